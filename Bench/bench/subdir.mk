@@ -0,0 +1,63 @@
+################################################################################
+# Automatically-generated file. Do not edit!
+################################################################################
+
+# Add inputs and outputs from these tool invocations to the build variables 
+C_SRCS += \
+../bench/bench-fanout.c \
+../bench/bench-glob.c \
+../bench/bench-index.c \
+../bench/bench-intern.c \
+../bench/bench-many.c \
+../bench/bench-numbers.c \
+../bench/bench-project.c \
+../bench/bench-query.c \
+../bench/bench-reduce.c \
+../bench/bench-serialize.c \
+../bench/bench-where.c \
+../bench/bench-writer.c \
+../bench/bench-writev.c \
+../bench/bench.c 
+
+OBJS += \
+./bench/bench-fanout.o \
+./bench/bench-glob.o \
+./bench/bench-index.o \
+./bench/bench-intern.o \
+./bench/bench-many.o \
+./bench/bench-numbers.o \
+./bench/bench-project.o \
+./bench/bench-query.o \
+./bench/bench-reduce.o \
+./bench/bench-serialize.o \
+./bench/bench-where.o \
+./bench/bench-writer.o \
+./bench/bench-writev.o \
+./bench/bench.o 
+
+C_DEPS += \
+./bench/bench-fanout.d \
+./bench/bench-glob.d \
+./bench/bench-index.d \
+./bench/bench-intern.d \
+./bench/bench-many.d \
+./bench/bench-numbers.d \
+./bench/bench-project.d \
+./bench/bench-query.d \
+./bench/bench-reduce.d \
+./bench/bench-serialize.d \
+./bench/bench-where.d \
+./bench/bench-writer.d \
+./bench/bench-writev.d \
+./bench/bench.d 
+
+
+# Each subdirectory must supply rules for building sources it contributes
+bench/%.o: ../bench/%.c bench/subdir.mk
+	@echo 'Building file: $<'
+	@echo 'Invoking: GCC C Compiler'
+	gcc -std=c11 -O3 -Wall -c -fmessage-length=0 -MMD -MP -MF"$(@:%.o=%.d)" -MT"$@" -o "$@" "$<"
+	@echo 'Finished building: $<'
+	@echo ' '
+
+
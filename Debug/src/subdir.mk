@@ -4,22 +4,49 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
+../src/columns.c \
+../src/dtoa.c \
+../src/filter.c \
 ../src/fnv.c \
+../src/index.c \
+../src/intern.c \
 ../src/json.c \
 ../src/nicson.c \
-../src/parse.c 
+../src/parse.c \
+../src/pool.c \
+../src/query.c \
+../src/reduce.c \
+../src/serialize.c 
 
 C_DEPS += \
+./src/columns.d \
+./src/dtoa.d \
+./src/filter.d \
 ./src/fnv.d \
+./src/index.d \
+./src/intern.d \
 ./src/json.d \
 ./src/nicson.d \
-./src/parse.d 
+./src/parse.d \
+./src/pool.d \
+./src/query.d \
+./src/reduce.d \
+./src/serialize.d 
 
 OBJS += \
+./src/columns.o \
+./src/dtoa.o \
+./src/filter.o \
 ./src/fnv.o \
+./src/index.o \
+./src/intern.o \
 ./src/json.o \
 ./src/nicson.o \
-./src/parse.o 
+./src/parse.o \
+./src/pool.o \
+./src/query.o \
+./src/reduce.o \
+./src/serialize.o 
 
 
 # Each subdirectory must supply rules for building sources it contributes
@@ -34,7 +61,7 @@ src/%.o: ../src/%.c src/subdir.mk
 clean: clean-src
 
 clean-src:
-	-$(RM) ./src/fnv.d ./src/fnv.o ./src/json.d ./src/json.o ./src/nicson.d ./src/nicson.o ./src/parse.d ./src/parse.o
+	-$(RM) ./src/columns.d ./src/columns.o ./src/dtoa.d ./src/dtoa.o ./src/filter.d ./src/filter.o ./src/fnv.d ./src/fnv.o ./src/index.d ./src/index.o ./src/intern.d ./src/intern.o ./src/json.d ./src/json.o ./src/nicson.d ./src/nicson.o ./src/parse.d ./src/parse.o ./src/pool.d ./src/pool.o ./src/query.d ./src/query.o ./src/reduce.d ./src/reduce.o ./src/serialize.d ./src/serialize.o
 
 .PHONY: clean-src
 
@@ -4,19 +4,46 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
+../src/columns.c \
+../src/dtoa.c \
+../src/filter.c \
 ../src/fnv.c \
+../src/index.c \
+../src/intern.c \
 ../src/json.c \
-../src/parse.c 
+../src/parse.c \
+../src/pool.c \
+../src/query.c \
+../src/reduce.c \
+../src/serialize.c 
 
 OBJS += \
+./src/columns.o \
+./src/dtoa.o \
+./src/filter.o \
 ./src/fnv.o \
+./src/index.o \
+./src/intern.o \
 ./src/json.o \
-./src/parse.o 
+./src/parse.o \
+./src/pool.o \
+./src/query.o \
+./src/reduce.o \
+./src/serialize.o 
 
 C_DEPS += \
+./src/columns.d \
+./src/dtoa.d \
+./src/filter.d \
 ./src/fnv.d \
+./src/index.d \
+./src/intern.d \
 ./src/json.d \
-./src/parse.d 
+./src/parse.d \
+./src/pool.d \
+./src/query.d \
+./src/reduce.d \
+./src/serialize.d 
 
 
 # Each subdirectory must supply rules for building sources it contributes
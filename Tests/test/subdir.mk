@@ -6,17 +6,20 @@
 CPP_SRCS += \
 ../test/all_tests.cpp \
 ../test/test-objects.cpp \
-../test/test-parser.cpp 
+../test/test-parser.cpp \
+../test/test-query.cpp 
 
 OBJS += \
 ./test/all_tests.o \
 ./test/test-objects.o \
-./test/test-parser.o 
+./test/test-parser.o \
+./test/test-query.o 
 
 CPP_DEPS += \
 ./test/all_tests.d \
 ./test/test-objects.d \
-./test/test-parser.d 
+./test/test-parser.d \
+./test/test-query.d 
 
 
 # Each subdirectory must supply rules for building sources it contributes
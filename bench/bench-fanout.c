@@ -0,0 +1,75 @@
+/*
+ * Wildcard queries over large-test.json replicated a hundred times,
+ * collected on one thread and fanned out over work stealing pools.
+ */
+
+#include "bench.h"
+
+#include <stdlib.h>
+
+#include "../src/json.h"
+#include "../src/query.h"
+
+#define DEFAULT_FILE "../test/large-test.json"
+#define COPIES       100
+#define ROUNDS       5
+
+static const char *queries[] = {
+  "*.dependencies.*.version",
+  "*.dependencies.*.requires.*",
+  "*.dependencies.*.re*",
+  "*.dependencies.*.version.=1.*",
+};
+
+static const unsigned int threadCounts[] = { 1, 2, 4, 8 };
+
+int benchFanout(int argc, char **argv) {
+  const char *file = argc > 0 ? argv[0] : DEFAULT_FILE;
+  size_t size = 0;
+  char *buf = benchSlurp(file, &size);
+  if (!buf) {
+    return 1;
+  }
+  JArray *copies = jsonNewArray();
+  for (int c = 0; c < COPIES; ++c) {
+    short type = 0;
+    JItemValue doc = jsonParseF(benchOpen(buf, size), &type);
+    if (type != VAL_OBJ) {
+      fprintf(stderr, "Error: Could not parse %s\n", file);
+      free(buf);
+      return 1;
+    }
+    jsonArrayPushObject(copies, doc.object_val);
+  }
+  free(buf);
+  JItemValue root = { .array_val = copies };
+  printf("%d copies of %s\n", COPIES, file);
+
+  int status = 0;
+  for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); ++q) {
+    JQuery *query = jsonQueryCompile(queries[q]);
+    unsigned expected = 0;
+    double start = benchNow();
+    for (int r = 0; r < ROUNDS; ++r) {
+      free(jsonQueryAll(query, root, copies->type, &expected));
+    }
+    double serial = (benchNow() - start) / ROUNDS;
+    printf("%-30s %8u matches %8.2f ms serial\n", queries[q], expected, serial * 1e3);
+
+    for (size_t t = 0; t < sizeof(threadCounts) / sizeof(threadCounts[0]); ++t) {
+      JPool *pool = jsonPoolNew(threadCounts[t]);
+      unsigned found = 0;
+      start = benchNow();
+      for (int r = 0; r < ROUNDS; ++r) {
+        free(jsonQueryAllParallel(query, root, copies->type, pool, &found));
+      }
+      double parallel = (benchNow() - start) / ROUNDS;
+      status |= found != expected;
+      printf("%30s %8u threads %8.2f ms %6.2fx\n", "", jsonPoolThreads(pool), parallel * 1e3, serial / parallel);
+      jsonPoolFree(pool);
+    }
+    jsonQueryFree(query);
+  }
+  jsonFree(root, copies->type);
+  return status;
+}
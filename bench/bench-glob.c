@@ -0,0 +1,102 @@
+/*
+ * Glob matching over every key and string value of large-test.json, the
+ * backtracking matcher against globs compiled with a literal prefilter.
+ */
+
+#include "bench.h"
+
+#include <stdlib.h>
+
+#include "../src/json.h"
+#include "../src/query.h"
+
+#define DEFAULT_FILE "../test/large-test.json"
+#define ROUNDS       200
+
+static const char *patterns[] = {
+  "version",
+  "re*",
+  "*-*",
+  "*integrity*",
+  "*sha512-*==",
+  "https://registry.npmjs.org/*/-/*.tgz",
+  "*?*?*?*?*?*?*?*?*?*?*?*?*?*?*?*?*",
+};
+
+typedef struct Strings {
+  const char** items;
+  unsigned int count;
+  unsigned int capacity;
+} Strings;
+
+static void add(Strings *all, const char *str) {
+  if (all->count == all->capacity) {
+    all->capacity = all->capacity ? all->capacity * 2 : 1024;
+    all->items = realloc(all->items, all->capacity * sizeof(const char*));
+  }
+  all->items[all->count++] = str;
+}
+
+static void collect(Strings *all, JItemValue value, short type) {
+  if (type == VAL_STRING && value.string_val) {
+    add(all, value.string_val);
+  } else if (type == VAL_OBJ) {
+    const char *name = NULL;
+    JItemValue child;
+    short childType = 0;
+    for (unsigned int i = 0; i < value.object_val->_used; ++i) {
+      if (jsonEntryAt(value.object_val, i, &name, &child, &childType)) {
+        add(all, name);
+        collect(all, child, childType);
+      }
+    }
+  } else if (type >= VAL_STRING_ARRAY && type <= VAL_MIXED_ARRAY) {
+    for (unsigned int i = 0; i < value.array_val->count; ++i) {
+      short childType = 0;
+      JItemValue child = jsonArrayGet(value.array_val, i, &childType);
+      collect(all, child, childType);
+    }
+  }
+}
+
+int benchGlob(int argc, char **argv) {
+  const char *file = argc > 0 ? argv[0] : DEFAULT_FILE;
+  short type = 0;
+  JItemValue doc = jsonParse(file, &type);
+  if (!doc.ptr_val) {
+    fprintf(stderr, "Error: Could not parse %s\n", file);
+    return 1;
+  }
+  Strings all = { NULL, 0, 0 };
+  collect(&all, doc, type);
+  printf("%u keys and strings, simd level %d\n", all.count, jsonSimdLevel());
+
+  int status = 0;
+  for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); ++p) {
+    unsigned int plain = 0;
+    double start = benchNow();
+    for (int r = 0; r < ROUNDS; ++r) {
+      for (unsigned int i = 0; i < all.count; ++i) {
+        plain += jsonGlobMatch(patterns[p], all.items[i]);
+      }
+    }
+    double backtracking = (benchNow() - start) / ROUNDS;
+
+    JGlob glob;
+    jsonGlobCompile(&glob, patterns[p]);
+    unsigned int compiled = 0;
+    start = benchNow();
+    for (int r = 0; r < ROUNDS; ++r) {
+      for (unsigned int i = 0; i < all.count; ++i) {
+        compiled += jsonGlobMatchCompiled(&glob, all.items[i]);
+      }
+    }
+    double prefiltered = (benchNow() - start) / ROUNDS;
+    status |= plain != compiled;
+    printf("%-40s %6u matches %8.1f us backtracking %8.1f us compiled\n",
+        patterns[p], compiled / ROUNDS, backtracking * 1e6, prefiltered * 1e6);
+  }
+  free(all.items);
+  jsonFree(doc, type);
+  return status;
+}
@@ -0,0 +1,60 @@
+/*
+ * Repeated equality lookups over an array of records, a predicate scan each
+ * time against one value index.
+ */
+
+#include "bench.h"
+
+#include <stdlib.h>
+
+#include "../src/json.h"
+#include "../src/query.h"
+
+#define DEFAULT_RECORDS 200000
+#define LOOKUPS         200
+
+int benchIndex(int argc, char **argv) {
+  unsigned int count = argc > 0 ? (unsigned int) atoi(argv[0]) : DEFAULT_RECORDS;
+  JArray *records = jsonArrayReserve(jsonNewArray(), count);
+  char name[32];
+  srand(42);
+  for (unsigned int i = 0; i < count; ++i) {
+    JObject *record = jsonNewObject();
+    jsonAddInt(record, "id", i);
+    sprintf(name, "user%d", rand() % 5000);
+    jsonAddString(record, "name", getOrCacheString(name));
+    jsonArrayPushObject(records, record);
+  }
+  printf("%u records, %u lookups\n", count, LOOKUPS);
+
+  unsigned int scanned = 0;
+  double start = benchNow();
+  for (unsigned int l = 0; l < LOOKUPS; ++l) {
+    sprintf(name, "user%u", l * 7);
+    JPredicate equals = jsonWhereEqualsString("name", name);
+    unsigned size = 0;
+    free(jsonArrayWhere(records, &equals, 1, &size));
+    scanned += size;
+  }
+  double scan = benchNow() - start;
+
+  start = benchNow();
+  JIndex *index = jsonBuildIndex((JItemValue) { records }, records->type, "*.name");
+  double build = benchNow() - start;
+  unsigned int looked = 0;
+  start = benchNow();
+  for (unsigned int l = 0; l < LOOKUPS; ++l) {
+    sprintf(name, "user%u", l * 7);
+    unsigned int size = 0;
+    jsonIndexLookupString(index, name, &size);
+    looked += size;
+  }
+  double lookup = benchNow() - start;
+  jsonIndexFree(index);
+
+  printf("%-16s %8.1f ms %8.1f us/lookup\n", "where scan", scan * 1e3, scan / LOOKUPS * 1e6);
+  printf("%-16s %8.1f ms\n", "index build", build * 1e3);
+  printf("%-16s %8.3f ms %8.3f us/lookup\n", "index lookup", lookup * 1e3, lookup / LOOKUPS * 1e6);
+  jsonFree((JItemValue) { records }, records->type);
+  return scanned != looked;
+}
@@ -0,0 +1,99 @@
+/*
+ * Contention benchmark for the string caches: every thread parses its own
+ * copies of one document, either with a private cache per thread or with
+ * all of them interning into one shared table.
+ */
+
+#include "bench.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "../src/json.h"
+
+#define DEFAULT_FILE    "../test/large-test.json"
+#define DEFAULT_PARSES  64
+#define MAX_THREADS     32
+
+typedef struct Worker {
+  pthread_t      thread;
+  const char*    buf;
+  size_t         size;
+  int            parses;
+  JSharedIntern* shared;
+  JInternStats   stats;
+  int            failed;
+} Worker;
+
+static void* parseCopies(void *arg) {
+  Worker *worker = arg;
+  JsonContext *ctx = jsonContextNew(NULL);
+  jsonContextSetSharedIntern(ctx, worker->shared);
+  for (int i = 0; i < worker->parses; ++i) {
+    short type = 0;
+    // the parser closes the stream
+    JItemValue val = jsonContextParseF(ctx, benchOpen(worker->buf, worker->size), &type);
+    if (!val.object_val) {
+      worker->failed = 1;
+      break;
+    }
+    jsonFree(val, type);
+  }
+  if (!worker->shared) {
+    jsonContextInternStats(ctx, &worker->stats);
+  }
+  jsonContextFree(ctx);
+  return 0;
+}
+
+static int run(const char *buf, size_t size, int threads, int parses, int shared) {
+  Worker workers[MAX_THREADS] = { { 0 } };
+  JSharedIntern *table = shared ? jsonSharedInternNew(NULL) : NULL;
+
+  double start = benchNow();
+  for (int t = 0; t < threads; ++t) {
+    workers[t] = (Worker) { 0, buf, size, parses / threads, table, { 0 }, 0 };
+    pthread_create(&workers[t].thread, NULL, parseCopies, &workers[t]);
+  }
+  int failed = 0;
+  size_t bytes = 0;
+  for (int t = 0; t < threads; ++t) {
+    pthread_join(workers[t].thread, NULL);
+    failed |= workers[t].failed;
+    bytes += workers[t].stats.slabBytes;
+  }
+  double elapsed = benchNow() - start;
+
+  if (table) {
+    JInternStats stats;
+    jsonSharedInternStats(table, &stats);
+    bytes = stats.slabBytes;
+    jsonSharedInternFree(table);
+  }
+
+  int done = (parses / threads) * threads;
+  printf("%-8s %3d threads %8.1f docs/s %8.1f MB/s %9zu cache bytes\n",
+      shared ? "shared" : "private", threads, done / elapsed,
+      done * (double) size / elapsed / (1024 * 1024), bytes);
+  return failed;
+}
+
+int benchIntern(int argc, char **argv) {
+  const char *filename = argc > 0 ? argv[0] : DEFAULT_FILE;
+  int parses = argc > 1 ? atoi(argv[1]) : DEFAULT_PARSES;
+
+  size_t size = 0;
+  char *buf = benchSlurp(filename, &size);
+  if (!buf) {
+    return 1;
+  }
+
+  int failed = 0;
+  for (int threads = 1; threads <= MAX_THREADS; threads *= 2) {
+    int count = parses < threads ? threads : parses;
+    failed |= run(buf, size, threads, count, 0);
+    failed |= run(buf, size, threads, count, 1);
+  }
+  free(buf);
+  return failed;
+}
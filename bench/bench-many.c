@@ -0,0 +1,69 @@
+/*
+ * Extracting a few dozen fields per record, one jsonGet each against one
+ * path set walk.
+ */
+
+#include "bench.h"
+
+#include <stdlib.h>
+
+#include "../src/json.h"
+
+#define DEFAULT_RECORDS 100000
+#define FIELDS          40
+#define GROUPS          8
+
+int benchMany(int argc, char **argv) {
+  unsigned int count = argc > 0 ? (unsigned int) atoi(argv[0]) : DEFAULT_RECORDS;
+  JArray *records = jsonArrayReserve(jsonNewArray(), count);
+  static char keys[FIELDS][32];
+  const char *paths[FIELDS];
+  for (unsigned int f = 0; f < FIELDS; ++f) {
+    sprintf(keys[f], "group%u.field%u", f % GROUPS, f);
+    paths[f] = keys[f];
+  }
+
+  char name[32];
+  for (unsigned int i = 0; i < count; ++i) {
+    JObject *record = jsonNewObject();
+    jsonAddInt(record, "id", i);
+    for (unsigned int g = 0; g < GROUPS; ++g) {
+      JObject *group = jsonNewObject();
+      for (unsigned int f = g; f < FIELDS; f += GROUPS) {
+        sprintf(name, "field%u", f);
+        jsonAddInt(group, name, i + f);
+      }
+      sprintf(name, "group%u", g);
+      jsonAddObj(record, name, group);
+    }
+    jsonArrayPushObject(records, record);
+  }
+  printf("%u records, %u fields each\n", count, FIELDS);
+
+  JArrayItem out[FIELDS];
+  long sum = 0;
+  double start = benchNow();
+  for (unsigned int i = 0; i < count; ++i) {
+    const JObject *record = records->_internal.mItems[i].value.object_val;
+    for (unsigned int f = 0; f < FIELDS; ++f) {
+      sum += jsonInt(record, paths[f]);
+    }
+  }
+  double each = benchNow() - start;
+
+  JPathSet *set = jsonPathSetCompile(paths, FIELDS);
+  start = benchNow();
+  for (unsigned int i = 0; i < count; ++i) {
+    jsonPathSetGet(records->_internal.mItems[i].value.object_val, set, out);
+    for (unsigned int f = 0; f < FIELDS; ++f) {
+      sum -= out[f].value.int_val;
+    }
+  }
+  double many = benchNow() - start;
+  jsonPathSetFree(set);
+
+  printf("%-16s %8.1f ms %8.1f ns/record\n", "jsonGet each", each * 1e3, each / count * 1e9);
+  printf("%-16s %8.1f ms %8.1f ns/record\n", "path set", many * 1e3, many / count * 1e9);
+  jsonFree((JItemValue) { records }, records->type);
+  return sum != 0;
+}
@@ -0,0 +1,83 @@
+/*
+ * Writing random doubles and floats with the shortest round trip formatter
+ * against snprintf, with the precision it needs to round trip and with the
+ * %e and %f the serializer used before.
+ */
+
+#include "bench.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/dtoa.h"
+
+#define DEFAULT_COUNT 1000000
+
+typedef int (*Format)(const void *number, char *out);
+
+static int shortestDouble(const void *number, char *out) {
+  return jsonFormatDouble(*(const double*) number, out);
+}
+
+static int shortestFloat(const void *number, char *out) {
+  return jsonFormatFloat(*(const float*) number, out);
+}
+
+static int printf17g(const void *number, char *out) {
+  return snprintf(out, JSON_NUMBER_CHARS, "%.17g", *(const double*) number);
+}
+
+static int printf9g(const void *number, char *out) {
+  return snprintf(out, JSON_NUMBER_CHARS, "%.9g", *(const float*) number);
+}
+
+static int printfE(const void *number, char *out) {
+  return snprintf(out, JSON_NUMBER_CHARS, "%e", *(const double*) number);
+}
+
+static int printfF(const void *number, char *out) {
+  char large[400];
+  return snprintf(large, sizeof(large), "%f", *(const float*) number);
+}
+
+static void run(const char *name, Format format, const char *numbers, size_t size, unsigned int count) {
+  char out[JSON_NUMBER_CHARS];
+  unsigned long bytes = 0;
+  double start = benchNow();
+  for (unsigned int i = 0; i < count; ++i) {
+    bytes += format(numbers + i * size, out);
+  }
+  double elapsed = benchNow() - start;
+  printf("%-18s %8.1f ns %6.1f chars\n", name, elapsed / count * 1e9, (double) bytes / count);
+}
+
+int benchNumbers(int argc, char **argv) {
+  unsigned int count = argc > 0 ? (unsigned int) atoi(argv[0]) : DEFAULT_COUNT;
+  double *doubles = malloc(count * sizeof(double));
+  float *floats = malloc(count * sizeof(float));
+  if (!doubles || !floats) {
+    free(doubles);
+    free(floats);
+    return 1;
+  }
+  // values the way documents hold them, a few digits at magnitudes around 1
+  uint64_t state = 88172645463325252ull;
+  for (unsigned int i = 0; i < count; ++i) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    doubles[i] = (double) (state % 1000000) / 1000 * ((state >> 32) % 2 ? 1 : -1e-3);
+    floats[i] = (float) doubles[i];
+  }
+
+  run("jsonFormatDouble", shortestDouble, (const char*) doubles, sizeof(double), count);
+  run("snprintf %.17g", printf17g, (const char*) doubles, sizeof(double), count);
+  run("snprintf %e", printfE, (const char*) doubles, sizeof(double), count);
+  run("jsonFormatFloat", shortestFloat, (const char*) floats, sizeof(float), count);
+  run("snprintf %.9g", printf9g, (const char*) floats, sizeof(float), count);
+  run("snprintf %f", printfF, (const char*) floats, sizeof(float), count);
+  free(doubles);
+  free(floats);
+  return 0;
+}
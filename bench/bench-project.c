@@ -0,0 +1,89 @@
+/*
+ * Full parses against projected ones keeping a few paths, with the bytes
+ * each leaves allocated.
+ */
+
+#include "bench.h"
+
+#include <stdlib.h>
+
+#include "../src/json.h"
+
+#define DEFAULT_FILE "../test/large-test.json"
+#define ROUNDS       20
+
+typedef struct Counted {
+  size_t live;
+} Counted;
+
+// every block carries its size in front so frees can be counted
+static void* countedMalloc(void *user, size_t size) {
+  size_t *block = malloc(size + sizeof(max_align_t));
+  if (!block) {
+    return 0;
+  }
+  *block = size;
+  ((Counted*) user)->live += size;
+  return (char*) block + sizeof(max_align_t);
+}
+
+static void* countedRealloc(void *user, void *ptr, size_t size) {
+  if (!ptr) {
+    return countedMalloc(user, size);
+  }
+  size_t *block = (size_t*) ((char*) ptr - sizeof(max_align_t));
+  size_t old = *block;
+  block = realloc(block, size + sizeof(max_align_t));
+  if (!block) {
+    return 0;
+  }
+  *block = size;
+  ((Counted*) user)->live += size - old;
+  return (char*) block + sizeof(max_align_t);
+}
+
+static void countedFree(void *user, void *ptr) {
+  if (ptr) {
+    size_t *block = (size_t*) ((char*) ptr - sizeof(max_align_t));
+    ((Counted*) user)->live -= *block;
+    free(block);
+  }
+}
+
+static void run(const char *name, const char *buf, size_t size, const char **keep, unsigned int count) {
+  Counted counted = { 0 };
+  JsonAllocator allocator = { countedMalloc, countedRealloc, countedFree, &counted };
+  double elapsed = 0;
+  size_t live = 0;
+  for (int r = 0; r < ROUNDS; ++r) {
+    JsonContext *ctx = jsonContextNew(&allocator);
+    short type = 0;
+    double start = benchNow();
+    JItemValue val = keep
+        ? jsonContextParseProjectedF(ctx, benchOpen(buf, size), keep, count, &type)
+        : jsonContextParseF(ctx, benchOpen(buf, size), &type);
+    elapsed += benchNow() - start;
+    live = counted.live;
+    jsonFree(val, type);
+    jsonContextFree(ctx);
+  }
+  printf("%-28s %8.2f ms %10zu bytes\n", name, elapsed / ROUNDS * 1e3, live);
+}
+
+int benchProject(int argc, char **argv) {
+  const char *file = argc > 0 ? argv[0] : DEFAULT_FILE;
+  size_t size = 0;
+  char *buf = benchSlurp(file, &size);
+  if (!buf) {
+    return 1;
+  }
+  const char *top[] = { "name" };
+  const char *versions[] = { "dependencies.*.version" };
+  const char *records[] = { "dependencies.*.version", "dependencies.*.requires" };
+  run("full", buf, size, NULL, 0);
+  run("name", buf, size, top, 1);
+  run("dependencies.*.version", buf, size, versions, 1);
+  run("version+requires", buf, size, records, 2);
+  free(buf);
+  return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * Query evaluation over a parsed document, wildcards fan out over every
+ * dependency of large-test.json.
+ */
+
+#include "bench.h"
+
+#include <stdlib.h>
+
+#include "../src/json.h"
+#include "../src/query.h"
+
+#define DEFAULT_FILE "../test/large-test.json"
+#define ROUNDS       200
+
+static const char *queries[] = {
+  "dependencies.*.version",
+  "dependencies.*.requires.*",
+  "dependencies.*.re*",
+  "dependencies.*.version.=1.*",
+  "*.*",
+};
+
+static int count(void *user, JItemValue value, short type) {
+  return 1;
+}
+
+int benchQuery(int argc, char **argv) {
+  const char *file = argc > 0 ? argv[0] : DEFAULT_FILE;
+  short type = 0;
+  JItemValue doc = jsonParse(file, &type);
+  if (!doc.ptr_val) {
+    fprintf(stderr, "Error: Could not parse %s\n", file);
+    return 1;
+  }
+
+  for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); ++q) {
+    JQuery *query = jsonQueryCompile(queries[q]);
+    unsigned found = 0;
+    double start = benchNow();
+    for (int r = 0; r < ROUNDS; ++r) {
+      found = jsonQueryRun(query, doc, type, count, NULL);
+    }
+    double elapsed = (benchNow() - start) / ROUNDS;
+    printf("%-30s %8u matches %8.3f ms %8.1f Mmatches/s\n",
+        queries[q], found, elapsed * 1e3, found / elapsed / 1e6);
+    jsonQueryFree(query);
+  }
+  jsonFree(doc, type);
+  return 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * Reduction kernels on every instruction set the cpu supports, over
+ * packed int, float and double arrays.
+ */
+
+#include "bench.h"
+
+#include <stdlib.h>
+
+#include "../src/json.h"
+
+#define DEFAULT_ITEMS  (1 << 22)
+#define ROUNDS         20
+
+static const char *levels[] = { "scalar", "sse2", "avx2" };
+
+static void run(const char *name, JArray *arr) {
+  int saved = jsonSimdLevel();
+  for (int level = JSON_SIMD_NONE; level <= saved; ++level) {
+    jsonSetSimdLevel(level);
+    double sink = 0;
+    double start = benchNow();
+    for (int r = 0; r < ROUNDS; ++r) {
+      sink += jsonArraySum(arr);
+    }
+    double sum = benchNow() - start;
+
+    start = benchNow();
+    for (int r = 0; r < ROUNDS; ++r) {
+      sink += jsonArrayCountIf(arr, JSON_CMP_GE, 0);
+    }
+    double count = benchNow() - start;
+
+    start = benchNow();
+    for (int r = 0; r < ROUNDS; ++r) {
+      double min, max;
+      jsonArrayMinMax(arr, &min, &max);
+      sink += max - min;
+    }
+    double minMax = benchNow() - start;
+
+    double items = (double) arr->count * ROUNDS / 1e6;
+    printf("%-7s %-7s sum %8.1f  countIf %8.1f  minMax %8.1f Mitems/s (%g)\n",
+        name, levels[level], items / sum, items / count, items / minMax, sink);
+  }
+  jsonSetSimdLevel(saved);
+}
+
+int benchReduce(int argc, char **argv) {
+  unsigned int items = argc > 0 ? (unsigned int) atoi(argv[0]) : DEFAULT_ITEMS;
+  JArray *ints = jsonArrayReserve(jsonNewArray(), items);
+  JArray *floats = jsonArrayReserve(jsonNewArray(), items);
+  JArray *doubles = jsonArrayReserve(jsonNewArray(), items);
+  srand(42);
+  for (unsigned int i = 0; i < items; ++i) {
+    int v = rand() % 2001 - 1000;
+    jsonArrayPushInt(ints, v);
+    jsonArrayPushFloat(floats, v / 8.0f);
+    jsonArrayPushDouble(doubles, v / 8.0);
+  }
+  run("int", ints);
+  run("float", floats);
+  run("double", doubles);
+  jsonFree((JItemValue) { ints }, ints->type);
+  jsonFree((JItemValue) { floats }, floats->type);
+  jsonFree((JItemValue) { doubles }, doubles->type);
+  return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * Pretty printing large-test.json into memory, to a descriptor and to a
+ * stdio stream, all through the buffered serializer, and compact into memory.
+ */
+
+#include "bench.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../src/json.h"
+#include "../src/serialize.h"
+
+#define DEFAULT_FILE "../test/large-test.json"
+#define ROUNDS       50
+
+int benchSerialize(int argc, char **argv) {
+  const char *file = argc > 0 ? argv[0] : DEFAULT_FILE;
+  short type = 0;
+  JItemValue doc = jsonParse(file, &type);
+  if (!doc.ptr_val) {
+    fprintf(stderr, "Error: Could not parse %s\n", file);
+    return 1;
+  }
+  int fd = open("/dev/null", O_WRONLY);
+  FILE *null = fdopen(dup(fd), "w");
+
+  size_t length = 0;
+  double start = benchNow();
+  for (int r = 0; r < ROUNDS; ++r) {
+    free(jsonSerialize(doc, type, &length));
+  }
+  double memory = (benchNow() - start) / ROUNDS;
+
+  size_t compactLength = 0;
+  start = benchNow();
+  for (int r = 0; r < ROUNDS; ++r) {
+    free(jsonSerializeCompact(doc, type, &compactLength));
+  }
+  double compact = (benchNow() - start) / ROUNDS;
+
+  int ok = 1;
+  start = benchNow();
+  for (int r = 0; r < ROUNDS; ++r) {
+    ok &= jsonSerializeFd(fd, doc, type);
+  }
+  double descriptor = (benchNow() - start) / ROUNDS;
+
+  start = benchNow();
+  for (int r = 0; r < ROUNDS; ++r) {
+    jsonPrintEntry(null, type, &doc);
+  }
+  double stream = (benchNow() - start) / ROUNDS;
+
+  printf("%lu bytes of output, %lu compact\n", (unsigned long) length, (unsigned long) compactLength);
+  printf("%-16s %8.3f ms %8.1f MB/s\n", "jsonSerialize", memory * 1e3, length / memory / 1e6);
+  printf("%-16s %8.3f ms %8.1f MB/s\n", "jsonSerializeFd", descriptor * 1e3, length / descriptor / 1e6);
+  printf("%-16s %8.3f ms %8.1f MB/s\n", "jsonPrintEntry", stream * 1e3, length / stream / 1e6);
+  printf("%-16s %8.3f ms %8.1f MB/s\n", "compact", compact * 1e3, compactLength / compact / 1e6);
+  fclose(null);
+  close(fd);
+  jsonFree(doc, type);
+  return !ok;
+}
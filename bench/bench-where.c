@@ -0,0 +1,56 @@
+/*
+ * Predicate filters over an array of records on the default pool.
+ */
+
+#include "bench.h"
+
+#include <stdlib.h>
+
+#include "../src/json.h"
+
+#define DEFAULT_RECORDS 1000000
+#define ROUNDS          5
+
+static void run(const char *name, JArray *records, const JPredicate *preds, unsigned int count) {
+  unsigned size = 0;
+  double start = benchNow();
+  for (int r = 0; r < ROUNDS; ++r) {
+    free(jsonArrayWhere(records, preds, count, &size));
+  }
+  double elapsed = (benchNow() - start) / ROUNDS;
+  printf("%-16s %8u matches %8.1f ms %8.1f Mrecords/s\n",
+      name, size, elapsed * 1e3, records->count / elapsed / 1e6);
+}
+
+int benchWhere(int argc, char **argv) {
+  unsigned int count = argc > 0 ? (unsigned int) atoi(argv[0]) : DEFAULT_RECORDS;
+  JArray *records = jsonArrayReserve(jsonNewArray(), count);
+  char name[32];
+  srand(42);
+  for (unsigned int i = 0; i < count; ++i) {
+    JObject *record = jsonNewObject();
+    jsonAddInt(record, "id", i);
+    sprintf(name, "%s%d", rand() % 4 ? "user" : "admin", rand() % 1000);
+    jsonAddString(record, "name", getOrCacheString(name));
+    if (i % 3) {
+      JObject *meta = jsonNewObject();
+      jsonAddVal(meta, "score", (JItemValue) { .double_val = rand() / (double) RAND_MAX }, VAL_DOUBLE);
+      jsonAddObj(record, "meta", meta);
+    }
+    jsonArrayPushObject(records, record);
+  }
+  printf("%u records, %u threads\n", count, jsonPoolThreads(jsonDefaultPool()));
+
+  JPredicate exists = jsonWhereExists("meta.score");
+  JPredicate equals = jsonWhereEqualsString("name", "admin7");
+  JPredicate range = jsonWhereRange("meta.score", 0.25, 0.5);
+  JPredicate prefix = jsonWherePrefix("name", "admin");
+  JPredicate all[] = { prefix, range, jsonWhereRange("id", 0, count / 2) };
+  run("exists", records, &exists, 1);
+  run("equals", records, &equals, 1);
+  run("range", records, &range, 1);
+  run("prefix", records, &prefix, 1);
+  run("prefix+ranges", records, all, 3);
+  jsonFree((JItemValue) { records }, records->type);
+  return 0;
+}
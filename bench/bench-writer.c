@@ -0,0 +1,76 @@
+/*
+ * Exporting records to /dev/null through the streaming writer, compact and
+ * pretty, against building an object per record and serializing it.
+ */
+
+#include "bench.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../src/json.h"
+#include "../src/serialize.h"
+
+#define DEFAULT_RECORDS 1000000
+
+static void writeRecord(JWriter *w, unsigned int i) {
+  jsonWriterBeginObject(w);
+  jsonWriterKey(w, "id");
+  jsonWriterInt(w, i);
+  jsonWriterKey(w, "name");
+  jsonWriterString(w, "record");
+  jsonWriterKey(w, "score");
+  jsonWriterDouble(w, i / 8.0);
+  jsonWriterKey(w, "tags");
+  jsonWriterBeginArray(w);
+  jsonWriterInt(w, i % 7);
+  jsonWriterInt(w, i % 11);
+  jsonWriterEndArray(w);
+  jsonWriterEndObject(w);
+}
+
+static double writer(int fd, unsigned int records, char compact) {
+  JWriter w;
+  double start = benchNow();
+  jsonWriterInitFd(&w, fd, compact);
+  for (unsigned int i = 0; i < records; ++i) {
+    writeRecord(&w, i);
+  }
+  jsonWriterFree(&w);
+  return benchNow() - start;
+}
+
+static double objects(int fd, unsigned int records) {
+  double start = benchNow();
+  for (unsigned int i = 0; i < records; ++i) {
+    JObject *obj = jsonNewObject();
+    jsonAddInt(obj, "id", i);
+    jsonAddString(obj, "name", "record");
+    jsonAddVal(obj, "score", (JItemValue) { .double_val = i / 8.0 }, VAL_DOUBLE);
+    JArray *tags = jsonNewArray();
+    jsonArrayPushInt(tags, i % 7);
+    jsonArrayPushInt(tags, i % 11);
+    jsonAddVal(obj, "tags", (JItemValue) { .array_val = tags }, VAL_OBJ_ARRAY);
+    jsonSerializeCompactFd(fd, (JItemValue) { .object_val = obj }, VAL_OBJ);
+    jsonFree((JItemValue) { .object_val = obj }, VAL_OBJ);
+  }
+  return benchNow() - start;
+}
+
+int benchWriter(int argc, char **argv) {
+  unsigned int records = argc > 0 ? (unsigned int) atoi(argv[0]) : DEFAULT_RECORDS;
+  int fd = open("/dev/null", O_WRONLY);
+  if (fd < 0) {
+    return 1;
+  }
+  double compact = writer(fd, records, 1);
+  double pretty = writer(fd, records, 0);
+  double built = objects(fd, records);
+  printf("%u records\n", records);
+  printf("%-24s %8.1f ns per record\n", "writer compact", compact / records * 1e9);
+  printf("%-24s %8.1f ns per record\n", "writer pretty", pretty / records * 1e9);
+  printf("%-24s %8.1f ns per record\n", "objects serialized", built / records * 1e9);
+  close(fd);
+  return 0;
+}
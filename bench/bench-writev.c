@@ -0,0 +1,69 @@
+/*
+ * Pretty and compact printing large-test.json replicated a hundred times
+ * to /dev/null, on one thread and split over pools of growing size.
+ */
+
+#include "bench.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../src/json.h"
+#include "../src/serialize.h"
+
+#define DEFAULT_FILE "../test/large-test.json"
+#define COPIES       100
+#define ROUNDS       5
+
+static const unsigned int threadCounts[] = { 1, 2, 4, 8 };
+
+int benchWritev(int argc, char **argv) {
+  const char *file = argc > 0 ? argv[0] : DEFAULT_FILE;
+  size_t size = 0;
+  char *buf = benchSlurp(file, &size);
+  if (!buf) {
+    return 1;
+  }
+  JArray *copies = jsonNewArray();
+  for (int c = 0; c < COPIES; ++c) {
+    short type = 0;
+    JItemValue doc = jsonParseF(benchOpen(buf, size), &type);
+    if (type != VAL_OBJ) {
+      fprintf(stderr, "Error: Could not parse %s\n", file);
+      free(buf);
+      return 1;
+    }
+    jsonArrayPushObject(copies, doc.object_val);
+  }
+  free(buf);
+  JItemValue root = { .array_val = copies };
+  int fd = open("/dev/null", O_WRONLY);
+  size_t length = 0;
+  free(jsonSerialize(root, copies->type, &length));
+  printf("%d copies of %s, %lu bytes pretty\n", COPIES, file, (unsigned long) length);
+
+  int ok = 1;
+  for (char compact = 0; compact < 2; ++compact) {
+    double start = benchNow();
+    for (int r = 0; r < ROUNDS; ++r) {
+      ok &= compact ? jsonSerializeCompactFd(fd, root, copies->type) : jsonSerializeFd(fd, root, copies->type);
+    }
+    double serial = (benchNow() - start) / ROUNDS;
+    printf("%-8s %8.2f ms serial\n", compact ? "compact" : "pretty", serial * 1e3);
+
+    for (size_t t = 0; t < sizeof(threadCounts) / sizeof(threadCounts[0]); ++t) {
+      JPool *pool = jsonPoolNew(threadCounts[t]);
+      start = benchNow();
+      for (int r = 0; r < ROUNDS; ++r) {
+        ok &= jsonSerializeParallelFd(fd, root, copies->type, compact, pool);
+      }
+      double parallel = (benchNow() - start) / ROUNDS;
+      printf("%8s %8u threads %8.2f ms %6.2fx\n", "", jsonPoolThreads(pool), parallel * 1e3, serial / parallel);
+      jsonPoolFree(pool);
+    }
+  }
+  close(fd);
+  jsonFree(root, copies->type);
+  return !ok;
+}
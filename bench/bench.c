@@ -0,0 +1,91 @@
+/*
+ * Benchmark driver, run a benchmark by name or all of them:
+ *
+ *   nicson-bench [name] [args...]
+ */
+
+#include "bench.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const Benchmark benchmarks[] = {
+  { "fanout", "wildcard queries over 100 copies of large-test.json per work stealing pool size", benchFanout },
+  { "glob", "backtracking and compiled glob matching over the keys and strings of large-test.json", benchGlob },
+  { "index", "equality lookups over records by predicate scan and by a value index", benchIndex },
+  { "intern", "threads parsing copies of a document with private and shared string caches", benchIntern },
+  { "many", "forty fields per record through jsonGet and through one path set", benchMany },
+  { "numbers", "shortest round trip formatting of doubles and floats against snprintf", benchNumbers },
+  { "project", "full parses against projected parses keeping a few paths of large-test.json", benchProject },
+  { "query", "wildcard, glob and value match queries over large-test.json", benchQuery },
+  { "reduce", "sum, countIf and minMax over packed numeric arrays per instruction set", benchReduce },
+  { "serialize", "pretty printing large-test.json into memory, a descriptor and a stream, then compact", benchSerialize },
+  { "where", "predicate filters over an array of a million records", benchWhere },
+  { "writer", "records streamed by the writer against objects built and serialized", benchWriter },
+  { "writev", "printing 100 copies of large-test.json serially and split over pools of 1 to 8 threads", benchWritev },
+};
+
+#define BENCH_COUNT (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+double benchNow() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+char* benchSlurp(const char *filename, size_t *size) {
+  FILE *file = fopen(filename, "rb");
+  if (!file) {
+    fprintf(stderr, "Error: Could not open %s\n", filename);
+    return 0;
+  }
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  char *buf = malloc(length + 1);
+  if (!buf || fread(buf, 1, length, file) != (size_t) length) {
+    fprintf(stderr, "Error: Could not read %s\n", filename);
+    free(buf);
+    fclose(file);
+    return 0;
+  }
+  buf[length] = '\0';
+  fclose(file);
+  *size = length;
+  return buf;
+}
+
+FILE* benchOpen(const char *buf, size_t size) {
+  return fmemopen((void*) buf, size, "r");
+}
+
+static void usage() {
+  fprintf(stderr, "usage: nicson-bench [name] [args...]\n");
+  for (size_t i = 0; i < BENCH_COUNT; ++i) {
+    fprintf(stderr, "  %-10s %s\n", benchmarks[i].name, benchmarks[i].description);
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)) {
+    usage();
+    return 0;
+  }
+
+  int status = 0;
+  int found = 0;
+  for (size_t i = 0; i < BENCH_COUNT; ++i) {
+    if (argc > 1 && strcmp(argv[1], benchmarks[i].name) != 0) {
+      continue;
+    }
+    found = 1;
+    printf("== %s\n", benchmarks[i].name);
+    status |= benchmarks[i].run(argc > 1 ? argc - 2 : 0, argc > 1 ? argv + 2 : argv + argc);
+  }
+  if (!found) {
+    usage();
+    return 1;
+  }
+  return status;
+}
@@ -0,0 +1,44 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * A benchmark gets the remaining command line, the first argument is the
+ * input file when there is one.
+ */
+typedef int (*BenchFn)(int argc, char **argv);
+
+typedef struct Benchmark {
+  const char* name;
+  const char* description;
+  BenchFn     run;
+} Benchmark;
+
+/** Monotonic clock in seconds */
+double benchNow();
+
+/** Reads a whole file, the caller frees the buffer */
+char*  benchSlurp(const char *filename, size_t *size);
+
+/** Opens a read only stream over a buffer so every parse sees a fresh copy */
+FILE*  benchOpen(const char *buf, size_t size);
+
+int benchFanout(int argc, char **argv);
+int benchGlob(int argc, char **argv);
+int benchIndex(int argc, char **argv);
+int benchIntern(int argc, char **argv);
+int benchMany(int argc, char **argv);
+int benchNumbers(int argc, char **argv);
+int benchProject(int argc, char **argv);
+int benchQuery(int argc, char **argv);
+int benchReduce(int argc, char **argv);
+int benchSerialize(int argc, char **argv);
+int benchWhere(int argc, char **argv);
+int benchWriter(int argc, char **argv);
+int benchWritev(int argc, char **argv);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+
+/**
+ * Allocator used for everything a context hands out: objects, arrays,
+ * interned strings and document string tables.
+ */
+typedef struct JsonAllocator {
+  void* (*malloc)(void *user, size_t size);
+  void* (*realloc)(void *user, void *ptr, size_t size);
+  void  (*free)(void *user, void *ptr);
+  void*  user;
+} JsonAllocator;
+
+extern const JsonAllocator jsonLibcAllocator;
+
+#define JMALLOC(a, size)       ((a)->malloc((a)->user, (size)))
+#define JREALLOC(a, ptr, size) ((a)->realloc((a)->user, (ptr), (size)))
+#define JFREE(a, ptr)          ((a)->free((a)->user, (ptr)))
+
+#endif
@@ -0,0 +1,258 @@
+#include "json.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DICTIONARY_MIN_CAPACITY 16
+
+#define SEEN(t)  (1u << (t))
+#define NUMBERS  (SEEN(VAL_INT) | SEEN(VAL_UINT) | SEEN(VAL_FLOAT) | SEEN(VAL_DOUBLE))
+
+/** Maps the strings of a column to their code while it is built */
+typedef struct Dictionary {
+  JArray*       strings;
+  unsigned int* slots;    // code + 1, 0 is empty
+  unsigned int  capacity; // always a power of two
+} Dictionary;
+
+static double numberOf(short type, JItemValue value) {
+  switch (type) {
+  case VAL_INT:   return value.int_val;
+  case VAL_UINT:  return (unsigned int) value.int_val;
+  case VAL_FLOAT: return value.float_val;
+  default:        return value.double_val;
+  }
+}
+
+/** Picks the narrowest layout holding every kind of value seen in a column */
+static unsigned char columnType(unsigned int seen) {
+  if (!seen) {
+    return VAL_NULL;
+  } else if (seen == SEEN(VAL_INT)) {
+    return VAL_INT_ARRAY;
+  } else if (seen == SEEN(VAL_FLOAT)) {
+    return VAL_FLOAT_ARRAY;
+  } else if (!(seen & ~NUMBERS)) {
+    return VAL_DOUBLE_ARRAY;
+  } else if (seen == SEEN(VAL_STRING)) {
+    return VAL_STRING_ARRAY;
+  } else if (seen == SEEN(VAL_BOOL)) {
+    return VAL_BOOL_ARRAY;
+  }
+  return VAL_MIXED_ARRAY;
+}
+
+static int growDictionary(Dictionary *dict, const JsonAllocator *allocator) {
+  unsigned int capacity = dict->capacity ? dict->capacity * 2 : DICTIONARY_MIN_CAPACITY;
+  unsigned int *slots = JMALLOC(allocator, capacity * sizeof(unsigned int));
+  if (!slots) {
+    return 0;
+  }
+  memset(slots, 0, capacity * sizeof(unsigned int));
+  for (unsigned int code = 0; code < dict->strings->count; ++code) {
+    unsigned int i = fnvstr(dict->strings->_internal.strings[code]) & (capacity - 1);
+    while (slots[i]) {
+      i = (i + 1) & (capacity - 1);
+    }
+    slots[i] = code + 1;
+  }
+  if (dict->slots) {
+    JFREE(allocator, dict->slots);
+  }
+  dict->slots = slots;
+  dict->capacity = capacity;
+  return 1;
+}
+
+/** Returns the code of a string, adding it to the dictionary the first time */
+static int dictionaryCode(Dictionary *dict, const JsonAllocator *allocator, const char *str) {
+  if (dict->strings->count * 2 >= dict->capacity && !growDictionary(dict, allocator)) {
+    return -1;
+  }
+  unsigned int mask = dict->capacity - 1;
+  unsigned int i = fnvstr(str) & mask;
+  while (dict->slots[i]) {
+    const char *known = dict->strings->_internal.strings[dict->slots[i] - 1];
+    if (known == str || strcmp(known, str) == 0) {
+      return dict->slots[i] - 1;
+    }
+    i = (i + 1) & mask;
+  }
+  int code = dict->strings->count;
+  if (!jsonArrayPushString(dict->strings, str)) {
+    return -1;
+  }
+  dict->slots[i] = code + 1;
+  return code;
+}
+
+static JArray* pushCell(JColumn *col, Dictionary *dict, const JsonAllocator *allocator, const JArrayItem *cell) {
+  char valid = cell->type != 0;
+  switch (col->type) {
+  case VAL_INT_ARRAY:
+    return jsonArrayPushInt(col->values, valid ? cell->value.int_val : 0);
+  case VAL_FLOAT_ARRAY:
+    return jsonArrayPushFloat(col->values, valid ? cell->value.float_val : 0);
+  case VAL_DOUBLE_ARRAY:
+    return jsonArrayPushDouble(col->values, valid ? numberOf(cell->type, cell->value) : 0);
+  case VAL_BOOL_ARRAY:
+    return jsonArrayPushBool(col->values, valid ? cell->value.char_val : 0);
+  case VAL_STRING_ARRAY: {
+    int code = valid ? dictionaryCode(dict, allocator, cell->value.string_val) : 0;
+    return code < 0 ? NULL : jsonArrayPushInt(col->values, code);
+  }
+  case VAL_MIXED_ARRAY: {
+    // written in place, a push would pack the first cells by their type and
+    // turn the ints before a float into floats
+    JArrayItem missing = { VAL_NULL, { 0 } };
+    col->values->_internal.mItems[col->values->count++] = valid ? *cell : missing;
+    return col->values;
+  }
+  default:
+    return jsonArrayPushInt(col->values, 0);
+  }
+}
+
+/** Resolves a key in every row into cells, then packs them into the column */
+static int buildColumn(const JArray *arr, const char *key, JArrayItem *cells, JColumn *col) {
+  JsonContext *ctx = arr->_ctx;
+  const JsonAllocator *allocator = &ctx->allocator;
+  JKeyPath path;
+  if (!jsonKeyPathInit(&path, key)) {
+    fprintf(stderr, "Error: Invalid column key '%s'\n", key ? key : "(null)");
+    return 0;
+  }
+
+  unsigned int seen = 0;
+  for (unsigned int i = 0; i < arr->count; ++i) {
+    short type = 0;
+    JItemValue row = jsonArrayGet(arr, i, &type);
+    JItemValue value = { 0 };
+    short valueType = 0;
+    if (type == VAL_OBJ) {
+      value = jsonKeyPathGet(row.object_val, &path, &valueType);
+    }
+    if (valueType == VAL_NULL || (valueType == VAL_STRING && !value.string_val)) {
+      valueType = 0;
+    }
+    cells[i].type = valueType;
+    cells[i].value = value;
+    seen |= valueType ? SEEN(valueType) : 0;
+  }
+  jsonKeyPathFree(&path);
+
+  col->key = key;
+  col->type = columnType(seen);
+  size_t validityBytes = (arr->count + 7) / 8;
+  col->validity = JMALLOC(allocator, validityBytes ? validityBytes : 1);
+  col->values = jsonContextNewArray(ctx);
+  if (!col->validity || !col->values) {
+    return 0;
+  }
+  memset(col->validity, 0, validityBytes ? validityBytes : 1);
+  // strings are stored as codes, columns without values as zeros
+  if (col->type != VAL_MIXED_ARRAY) {
+    col->values->type = col->type == VAL_STRING_ARRAY || col->type == VAL_NULL ? VAL_INT_ARRAY : col->type;
+  }
+  if (!jsonArrayReserve(col->values, arr->count)) {
+    return 0;
+  }
+
+  Dictionary dict = { NULL, NULL, 0 };
+  if (col->type == VAL_STRING_ARRAY) {
+    col->dictionary = dict.strings = jsonContextNewArray(ctx);
+    if (!dict.strings) {
+      return 0;
+    }
+  }
+
+  int ok = 1;
+  for (unsigned int i = 0; ok && i < arr->count; ++i) {
+    if (cells[i].type) {
+      col->validity[i >> 3] |= 1 << (i & 7);
+    } else {
+      ++col->nulls;
+    }
+    ok = pushCell(col, &dict, allocator, &cells[i]) != NULL;
+  }
+  if (dict.slots) {
+    JFREE(allocator, dict.slots);
+  }
+  if (col->type == VAL_MIXED_ARRAY && seen == SEEN(VAL_OBJ) && !col->nulls) {
+    col->type = col->values->type = VAL_OBJ_ARRAY; // object only columns keep the object layout
+  }
+  return ok;
+}
+
+JColumns* jsonArrayToColumns(const JArray *arr, const char **keys, unsigned int count) {
+  if (!arr || !keys) {
+    return 0;
+  }
+  const JsonAllocator *allocator = &arr->_ctx->allocator;
+  JColumns *cols = JMALLOC(allocator, sizeof(JColumns) + count * sizeof(JColumn));
+  JArrayItem *cells = JMALLOC(allocator, (arr->count ? arr->count : 1) * sizeof(JArrayItem));
+  if (!cols || !cells) {
+    fprintf(stderr, "Error: Could not allocate columns for %u rows\n", arr->count);
+    if (cols) {
+      JFREE(allocator, cols);
+    }
+    if (cells) {
+      JFREE(allocator, cells);
+    }
+    return 0;
+  }
+  memset(cols, 0, sizeof(JColumns) + count * sizeof(JColumn));
+  cols->rows = arr->count;
+  cols->_ctx = arr->_ctx;
+
+  for (unsigned int c = 0; c < count; ++c) {
+    ++cols->count; // counted first so a half built column is released too
+    if (!buildColumn(arr, keys[c], cells, &cols->columns[c])) {
+      JFREE(allocator, cells);
+      jsonColumnsFree(cols);
+      return 0;
+    }
+  }
+  JFREE(allocator, cells);
+  return cols;
+}
+
+JColumn* jsonColumn(JColumns *cols, const char *key) {
+  for (unsigned int c = 0; cols && key && c < cols->count; ++c) {
+    if (strcmp(cols->columns[c].key, key) == 0) {
+      return &cols->columns[c];
+    }
+  }
+  return 0;
+}
+
+const char* jsonColumnString(const JColumn *col, unsigned int row) {
+  if (!col || col->type != VAL_STRING_ARRAY || row >= col->values->count || !jsonColumnValid(col, row)) {
+    return 0;
+  }
+  return col->dictionary->_internal.strings[col->values->_internal.ints[row]];
+}
+
+void jsonColumnsFree(JColumns *cols) {
+  if (!cols) {
+    return;
+  }
+  const JsonAllocator *allocator = &cols->_ctx->allocator;
+  for (unsigned int c = 0; c < cols->count; ++c) {
+    JColumn *col = &cols->columns[c];
+    if (col->values) {
+      if (col->values->type == VAL_MIXED_ARRAY || col->values->type == VAL_OBJ_ARRAY) {
+        col->values->count = 0; // the items are borrowed from the rows
+      }
+      jsonFree((JItemValue) { col->values }, col->values->type);
+    }
+    if (col->dictionary) {
+      jsonFree((JItemValue) { col->dictionary }, col->dictionary->type);
+    }
+    if (col->validity) {
+      JFREE(allocator, col->validity);
+    }
+  }
+  JFREE(allocator, cols);
+}
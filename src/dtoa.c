@@ -0,0 +1,270 @@
+#include "dtoa.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/** A number f * 2^e with a 64 bit significand */
+typedef struct DiyFp {
+  uint64_t f;
+  int      e;
+} DiyFp;
+
+/** 10^k normalized, for k = -348 up to 340 in steps of 8 */
+static const uint64_t cachedSignificands[] = {
+  0xfa8fd5a0081c0288ull, 0xbaaee17fa23ebf76ull, 0x8b16fb203055ac76ull,
+  0xcf42894a5dce35eaull, 0x9a6bb0aa55653b2dull, 0xe61acf033d1a45dfull,
+  0xab70fe17c79ac6caull, 0xff77b1fcbebcdc4full, 0xbe5691ef416bd60cull,
+  0x8dd01fad907ffc3cull, 0xd3515c2831559a83ull, 0x9d71ac8fada6c9b5ull,
+  0xea9c227723ee8bcbull, 0xaecc49914078536dull, 0x823c12795db6ce57ull,
+  0xc21094364dfb5637ull, 0x9096ea6f3848984full, 0xd77485cb25823ac7ull,
+  0xa086cfcd97bf97f4ull, 0xef340a98172aace5ull, 0xb23867fb2a35b28eull,
+  0x84c8d4dfd2c63f3bull, 0xc5dd44271ad3cdbaull, 0x936b9fcebb25c996ull,
+  0xdbac6c247d62a584ull, 0xa3ab66580d5fdaf6ull, 0xf3e2f893dec3f126ull,
+  0xb5b5ada8aaff80b8ull, 0x87625f056c7c4a8bull, 0xc9bcff6034c13053ull,
+  0x964e858c91ba2655ull, 0xdff9772470297ebdull, 0xa6dfbd9fb8e5b88full,
+  0xf8a95fcf88747d94ull, 0xb94470938fa89bcfull, 0x8a08f0f8bf0f156bull,
+  0xcdb02555653131b6ull, 0x993fe2c6d07b7facull, 0xe45c10c42a2b3b06ull,
+  0xaa242499697392d3ull, 0xfd87b5f28300ca0eull, 0xbce5086492111aebull,
+  0x8cbccc096f5088ccull, 0xd1b71758e219652cull, 0x9c40000000000000ull,
+  0xe8d4a51000000000ull, 0xad78ebc5ac620000ull, 0x813f3978f8940984ull,
+  0xc097ce7bc90715b3ull, 0x8f7e32ce7bea5c70ull, 0xd5d238a4abe98068ull,
+  0x9f4f2726179a2245ull, 0xed63a231d4c4fb27ull, 0xb0de65388cc8ada8ull,
+  0x83c7088e1aab65dbull, 0xc45d1df942711d9aull, 0x924d692ca61be758ull,
+  0xda01ee641a708deaull, 0xa26da3999aef774aull, 0xf209787bb47d6b85ull,
+  0xb454e4a179dd1877ull, 0x865b86925b9bc5c2ull, 0xc83553c5c8965d3dull,
+  0x952ab45cfa97a0b3ull, 0xde469fbd99a05fe3ull, 0xa59bc234db398c25ull,
+  0xf6c69a72a3989f5cull, 0xb7dcbf5354e9beceull, 0x88fcf317f22241e2ull,
+  0xcc20ce9bd35c78a5ull, 0x98165af37b2153dfull, 0xe2a0b5dc971f303aull,
+  0xa8d9d1535ce3b396ull, 0xfb9b7cd9a4a7443cull, 0xbb764c4ca7a44410ull,
+  0x8bab8eefb6409c1aull, 0xd01fef10a657842cull, 0x9b10a4e5e9913129ull,
+  0xe7109bfba19c0c9dull, 0xac2820d9623bf429ull, 0x80444b5e7aa7cf85ull,
+  0xbf21e44003acdd2dull, 0x8e679c2f5e44ff8full, 0xd433179d9c8cb841ull,
+  0x9e19db92b4e31ba9ull, 0xeb96bf6ebadf77d9ull, 0xaf87023b9bf0ee6bull,
+};
+
+static const short cachedExponents[] = {
+  -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+  -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+  -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+  -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+  56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+  375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+  694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+  1013, 1039, 1066,
+};
+
+static const uint64_t powersOf10[] = {
+  1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull, 100000000ull,
+  1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull, 10000000000000ull,
+  100000000000000ull, 1000000000000000ull, 10000000000000000ull, 100000000000000000ull,
+  1000000000000000000ull, 10000000000000000000ull
+};
+
+static DiyFp normalize(DiyFp x) {
+  int shift = __builtin_clzll(x.f);
+  return (DiyFp) { x.f << shift, x.e - shift };
+}
+
+/** The upper 64 bits of the product, rounded */
+static DiyFp multiply(DiyFp x, DiyFp y) {
+  const uint64_t low = 0xFFFFFFFFu;
+  uint64_t a = x.f >> 32, b = x.f & low, c = y.f >> 32, d = y.f & low;
+  uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  uint64_t middle = (bd >> 32) + (ad & low) + (bc & low) + (1u << 31);
+  return (DiyFp) { ac + (ad >> 32) + (bc >> 32) + (middle >> 32), x.e + y.e + 64 };
+}
+
+/** A power 10^-k bringing a number of binary exponent e between 2^-60 and 2^-32 */
+static DiyFp cachedPower(int e, int *k) {
+  double dk = (-61 - e) * 0.30102999566398114 + 347; // log10(2), the table starts at 10^-348
+  int ik = (int) dk;
+  if (dk - ik > 0.0) {
+    ++ik;
+  }
+  unsigned int index = (ik >> 3) + 1;
+  *k = -(-348 + (int) index * 8);
+  return (DiyFp) { cachedSignificands[index], cachedExponents[index] };
+}
+
+/** Walks the last digit down towards the exact value while it stays within the bounds */
+static void roundWeed(char *digits, int length, uint64_t delta, uint64_t rest, uint64_t tenKappa, uint64_t distance) {
+  while (rest < distance && delta - rest >= tenKappa
+         && (rest + tenKappa < distance || distance - rest > rest + tenKappa - distance)) {
+    --digits[length - 1];
+    rest += tenKappa;
+  }
+}
+
+static int digitCount(uint32_t n) {
+  int count = 1;
+  while (count < 10 && n >= powersOf10[count]) {
+    ++count;
+  }
+  return count;
+}
+
+/** Generates the fewest digits of a number within delta below upper, *k is their decimal exponent */
+static int generateDigits(DiyFp w, DiyFp upper, uint64_t delta, char *digits, int *k) {
+  const DiyFp one = { (uint64_t) 1 << -upper.e, upper.e };
+  const uint64_t distance = upper.f - w.f;
+  uint32_t integral = (uint32_t) (upper.f >> -one.e);
+  uint64_t fraction = upper.f & (one.f - 1);
+  int kappa = digitCount(integral);
+  int length = 0;
+  while (kappa > 0) {
+    uint32_t digit = integral / powersOf10[kappa - 1];
+    integral %= powersOf10[kappa - 1];
+    if (digit || length) {
+      digits[length++] = '0' + digit;
+    }
+    --kappa;
+    uint64_t rest = ((uint64_t) integral << -one.e) + fraction;
+    if (rest <= delta) {
+      *k += kappa;
+      roundWeed(digits, length, delta, rest, powersOf10[kappa] << -one.e, distance);
+      return length;
+    }
+  }
+  for (;;) {
+    fraction *= 10;
+    delta *= 10;
+    char digit = (char) (fraction >> -one.e);
+    if (digit || length) {
+      digits[length++] = '0' + digit;
+    }
+    fraction &= one.f - 1;
+    --kappa;
+    if (fraction < delta) {
+      *k += kappa;
+      roundWeed(digits, length, delta, fraction, one.f, -kappa < 20 ? distance * powersOf10[-kappa] : 0);
+      return length;
+    }
+  }
+}
+
+/**
+ * Digits of the value f * 2^e, the halfway points to its neighbours bound
+ * them. The lower neighbour is closer when f is a power of two.
+ */
+static int grisu2(uint64_t f, int e, int lowerCloser, char *digits, int *k) {
+  DiyFp upper = normalize((DiyFp) { (f << 1) + 1, e - 1 });
+  DiyFp lower = lowerCloser ? (DiyFp) { (f << 2) - 1, e - 2 } : (DiyFp) { (f << 1) - 1, e - 1 };
+  lower.f <<= lower.e - upper.e;
+  lower.e = upper.e;
+
+  DiyFp power = cachedPower(upper.e, k);
+  DiyFp w = multiply(normalize((DiyFp) { f, e }), power);
+  upper = multiply(upper, power);
+  lower = multiply(lower, power);
+  // one unit in from both bounds covers the error of the products
+  ++lower.f;
+  --upper.f;
+  return generateDigits(w, upper, upper.f - lower.f, digits, k);
+}
+
+static int writeExponent(int exponent, char *out) {
+  char *at = out;
+  *at++ = 'e';
+  if (exponent < 0) {
+    *at++ = '-';
+    exponent = -exponent;
+  } else {
+    *at++ = '+';
+  }
+  if (exponent >= 100) {
+    *at++ = '0' + exponent / 100;
+    exponent %= 100;
+    *at++ = '0' + exponent / 10;
+  } else if (exponent >= 10) {
+    *at++ = '0' + exponent / 10;
+  }
+  *at++ = '0' + exponent % 10;
+  return at - out;
+}
+
+/** Lays out digits * 10^k in place the way JavaScript prints numbers */
+static int layout(char *digits, int length, int k) {
+  int point = length + k; // 10^(point - 1) <= value < 10^point
+  if (k >= 0 && point <= 21) {
+    // 1234e7 is 12340000000
+    memset(digits + length, '0', k);
+    return point;
+  }
+  if (point > 0 && point <= 21) {
+    // 1234e-2 is 12.34
+    memmove(digits + point + 1, digits + point, length - point);
+    digits[point] = '.';
+    return length + 1;
+  }
+  if (point > -6 && point <= 0) {
+    // 1234e-6 is 0.001234
+    int offset = 2 - point;
+    memmove(digits + offset, digits, length);
+    digits[0] = '0';
+    digits[1] = '.';
+    memset(digits + 2, '0', offset - 2);
+    return length + offset;
+  }
+  if (length == 1) {
+    // 1e30
+    return 1 + writeExponent(point - 1, digits + 1);
+  }
+  // 1234e30 is 1.234e+33
+  memmove(digits + 2, digits + 1, length - 1);
+  digits[1] = '.';
+  return length + 1 + writeExponent(point - 1, digits + length + 1);
+}
+
+/** Writes the sign and the special values, 0 when digits have to follow */
+static int special(int negative, int finite, int zero, char *out, int *length) {
+  if (!finite) {
+    memcpy(out, "null", 4);
+    *length = 4;
+    return 1;
+  }
+  *length = 0;
+  if (negative) {
+    out[(*length)++] = '-';
+  }
+  if (zero) {
+    out[(*length)++] = '0';
+    return 1;
+  }
+  return 0;
+}
+
+int jsonFormatDouble(double value, char *out) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  int biased = (int) (bits >> 52) & 0x7FF;
+  uint64_t f = bits & 0xFFFFFFFFFFFFFull;
+  int length;
+  if (special(bits >> 63, biased != 0x7FF, !biased && !f, out, &length)) {
+    return length;
+  }
+  int e = biased ? biased - 1075 : -1074;
+  if (biased) {
+    f |= (uint64_t) 1 << 52;
+  }
+  int k = 0;
+  int count = grisu2(f, e, biased > 1 && f == (uint64_t) 1 << 52, out + length, &k);
+  return length + layout(out + length, count, k);
+}
+
+int jsonFormatFloat(float value, char *out) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  int biased = (int) (bits >> 23) & 0xFF;
+  uint64_t f = bits & 0x7FFFFFu;
+  int length;
+  if (special(bits >> 31, biased != 0xFF, !biased && !f, out, &length)) {
+    return length;
+  }
+  int e = biased ? biased - 150 : -149;
+  if (biased) {
+    f |= 1u << 23;
+  }
+  int k = 0;
+  int count = grisu2(f, e, biased > 1 && f == 1u << 23, out + length, &k);
+  return length + layout(out + length, count, k);
+}
@@ -0,0 +1,17 @@
+#ifndef DTOA_H
+#define DTOA_H
+
+#define JSON_NUMBER_CHARS 32 // the longest text jsonFormatDouble writes, with room to spare
+
+/**
+ * Shortest decimal text of a number that reads back to the same value,
+ * written by Grisu2 without going through printf. Floats get the digits
+ * telling them apart from the floats around them, which are fewer than
+ * those of the double they widen to. Numbers from 1e-6 up to 1e21 are
+ * written out in full, others with an exponent, NaN and infinities as null.
+ * Both return the length of the text, which is not terminated.
+ */
+int jsonFormatDouble(double value, char *out);
+int jsonFormatFloat(float value, char *out);
+
+#endif
@@ -0,0 +1,198 @@
+#include "json.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WHERE_CHUNK
+#define WHERE_CHUNK 16384 // objects evaluated by one pool task
+#endif
+
+#define IS_NUMBER(t) ((t) == VAL_INT || (t) == VAL_UINT || (t) == VAL_FLOAT || (t) == VAL_DOUBLE)
+
+typedef struct Compiled {
+  const JPredicate* pred;
+  JKeyPath          path;
+  size_t            prefixLength;
+} Compiled;
+
+typedef struct WhereJob {
+  const JArrayItem* items;
+  unsigned int      count;
+  const Compiled*   preds;
+  unsigned int      npreds;
+  JObject**         found;      // every chunk packs its matches from its own offset
+  unsigned int*     chunkFound;
+} WhereJob;
+
+JPredicate jsonWhereExists(const char *path) {
+  return (JPredicate) { .path = path, .op = JSON_PRED_EXISTS };
+}
+
+JPredicate jsonWhereEquals(const char *path, short type, JItemValue value) {
+  return (JPredicate) { .path = path, .op = JSON_PRED_EQUALS, .type = type, .value = value };
+}
+
+JPredicate jsonWhereEqualsInt(const char *path, int value) {
+  return jsonWhereEquals(path, VAL_INT, (JItemValue) { .int_val = value });
+}
+
+JPredicate jsonWhereEqualsDouble(const char *path, double value) {
+  return jsonWhereEquals(path, VAL_DOUBLE, (JItemValue) { .double_val = value });
+}
+
+JPredicate jsonWhereEqualsString(const char *path, const char *value) {
+  return jsonWhereEquals(path, VAL_STRING, (JItemValue) { .string_val = (char*) value });
+}
+
+JPredicate jsonWhereRange(const char *path, double min, double max) {
+  return (JPredicate) { .path = path, .op = JSON_PRED_RANGE, .min = min, .max = max };
+}
+
+JPredicate jsonWherePrefix(const char *path, const char *prefix) {
+  return (JPredicate) { .path = path, .op = JSON_PRED_PREFIX, .value.string_val = (char*) prefix };
+}
+
+static double numberOf(short type, JItemValue value) {
+  switch (type) {
+  case VAL_INT:   return value.int_val;
+  case VAL_UINT:  return (unsigned int) value.int_val;
+  case VAL_FLOAT: return value.float_val;
+  default:        return value.double_val;
+  }
+}
+
+static int sameValue(short type, JItemValue value, short wantType, JItemValue want) {
+  if (IS_NUMBER(type) && IS_NUMBER(wantType)) {
+    return numberOf(type, value) == numberOf(wantType, want);
+  }
+  if (type != wantType) {
+    return 0;
+  }
+  switch (type) {
+  case VAL_STRING:
+    return value.string_val == want.string_val
+        || (value.string_val && want.string_val && strcmp(value.string_val, want.string_val) == 0);
+  case VAL_BOOL: return value.char_val == want.char_val;
+  case VAL_NULL: return 1;
+  default:       return value.ptr_val == want.ptr_val;
+  }
+}
+
+static int compilePredicate(const JPredicate *pred, Compiled *out) {
+  const char *path = pred->path;
+  if (pred->op < JSON_PRED_EXISTS || pred->op > JSON_PRED_PREFIX) {
+    fprintf(stderr, "Error: Invalid predicate on path '%s'\n", path ? path : "(null)");
+    return 0;
+  }
+  if (pred->op == JSON_PRED_PREFIX && !pred->value.string_val) {
+    fprintf(stderr, "Error: Prefix predicate on path '%s' has no prefix\n", path ? path : "(null)");
+    return 0;
+  }
+  out->pred = pred;
+  out->prefixLength = pred->op == JSON_PRED_PREFIX ? strlen(pred->value.string_val) : 0;
+  return jsonKeyPathInit(&out->path, path);
+}
+
+static int matches(const JObject *obj, const Compiled *c) {
+  short type = 0;
+  JItemValue value = jsonKeyPathGet(obj, &c->path, &type);
+  if (!type) {
+    return 0;
+  }
+
+  const JPredicate *pred = c->pred;
+  switch (pred->op) {
+  case JSON_PRED_EXISTS:
+    return 1;
+  case JSON_PRED_EQUALS:
+    return sameValue(type, value, pred->type, pred->value);
+  case JSON_PRED_RANGE:
+    if (!IS_NUMBER(type)) {
+      return 0;
+    }
+    double x = numberOf(type, value);
+    return x >= pred->min && x <= pred->max;
+  default:
+    return type == VAL_STRING && value.string_val
+        && strncmp(value.string_val, pred->value.string_val, c->prefixLength) == 0;
+  }
+}
+
+static void whereChunk(void *arg, unsigned int task) {
+  WhereJob *job = arg;
+  unsigned int begin = task * WHERE_CHUNK;
+  unsigned int end = job->count - begin < WHERE_CHUNK ? job->count : begin + WHERE_CHUNK;
+  JObject **out = job->found + begin;
+  unsigned int n = 0;
+  for (unsigned int i = begin; i < end; ++i) {
+    if (job->items[i].type != VAL_OBJ) {
+      continue;
+    }
+    JObject *obj = job->items[i].value.object_val;
+    unsigned int p = 0;
+    while (p < job->npreds && matches(obj, &job->preds[p])) {
+      ++p;
+    }
+    if (p == job->npreds) {
+      out[n++] = obj;
+    }
+  }
+  job->chunkFound[task] = n;
+}
+
+JObject **jsonArrayWhere(const JArray *array, const JPredicate *preds, unsigned int count, unsigned *size) {
+  *size = 0;
+  if (!array || (array->type != VAL_OBJ_ARRAY && array->type != VAL_MIXED_ARRAY) || !array->count) {
+    return NULL;
+  }
+
+  Compiled *compiled = malloc((count ? count : 1) * sizeof(Compiled));
+  unsigned int ready = 0;
+  while (compiled && ready < count && compilePredicate(&preds[ready], &compiled[ready])) {
+    ++ready;
+  }
+
+  unsigned int tasks = (array->count + WHERE_CHUNK - 1) / WHERE_CHUNK;
+  JObject **found = NULL;
+  unsigned int *chunkFound = NULL;
+  if (compiled && ready == count) {
+    found = malloc(array->count * sizeof(JObject*));
+    chunkFound = malloc(tasks * sizeof(unsigned int));
+  }
+
+  if (found && chunkFound) {
+    WhereJob job = { array->_internal.mItems, array->count, compiled, count, found, chunkFound };
+    // small arrays never start the default pool
+    jsonPoolRun(tasks > 1 ? jsonDefaultPool() : NULL, whereChunk, &job, tasks);
+
+    unsigned int total = 0;
+    for (unsigned int t = 0; t < tasks; ++t) {
+      memmove(found + total, found + t * WHERE_CHUNK, chunkFound[t] * sizeof(JObject*));
+      total += chunkFound[t];
+    }
+    if (total) {
+      JObject **shrunk = realloc(found, total * sizeof(JObject*));
+      found = shrunk ? shrunk : found;
+    } else {
+      free(found);
+      found = NULL;
+    }
+    *size = total;
+  } else {
+    free(found);
+    found = NULL;
+  }
+
+  for (unsigned int i = 0; i < ready; ++i) {
+    jsonKeyPathFree(&compiled[i].path);
+  }
+  free(compiled);
+  free(chunkFound);
+  return found;
+}
+
+JObject **jsonArrayKeyFilter(JArray* array, const char *key, unsigned *size) {
+  JPredicate exists = jsonWhereExists(key);
+  return jsonArrayWhere(array, &exists, 1, size);
+}
@@ -0,0 +1,378 @@
+#include "query.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IS_NUMBER(t)       ((t) == VAL_INT || (t) == VAL_UINT || (t) == VAL_FLOAT || (t) == VAL_DOUBLE)
+#define PAIRS_MIN_CAPACITY 64
+#define CONTEXTS_MIN       4
+#define NULL_HASH          0x9e3779b9u
+
+/** A value found at the pattern with the object holding it, while the index is built */
+typedef struct Pair {
+  Fnv32_t       hash;
+  unsigned char type;
+  JItemValue    value;
+  JObject*      holder;
+  unsigned int  seq; // keeps document order within a value
+} Pair;
+
+/** The contexts of the containers an index covers, usually the one of the root alone */
+typedef struct Contexts {
+  JsonContext** items;
+  unsigned int  count;
+  unsigned int  capacity;
+  char          failed;
+} Contexts;
+
+typedef struct Pairs {
+  const JIndex* index;
+  Contexts*     contexts;
+  Pair*         items;
+  unsigned int  count;
+  unsigned int  capacity;
+} Pairs;
+
+static double numberOf(short type, JItemValue value) {
+  switch (type) {
+  case VAL_INT:   return value.int_val;
+  case VAL_UINT:  return (unsigned int) value.int_val;
+  case VAL_FLOAT: return value.float_val;
+  default:        return value.double_val;
+  }
+}
+
+/** Brings a value to the form it is indexed by, returns 0 for values that are not indexed */
+static unsigned char indexed(short type, JItemValue value, JItemValue *out, Fnv32_t *hash) {
+  if (IS_NUMBER(type)) {
+    double x = numberOf(type, value);
+    out->double_val = x == 0 ? 0 : x; // -0 and 0 are one value
+    *hash = fnvbuf(&out->double_val, sizeof(double));
+    return VAL_DOUBLE;
+  }
+  switch (type) {
+  case VAL_STRING:
+    if (!value.string_val) {
+      return 0;
+    }
+    *out = value;
+    *hash = fnvstr(value.string_val);
+    return VAL_STRING;
+  case VAL_BOOL:
+    out->double_val = 0;
+    out->char_val = value.char_val != 0;
+    *hash = fnvbuf(&out->char_val, 1) ^ VAL_BOOL;
+    return VAL_BOOL;
+  case VAL_NULL:
+    out->ptr_val = NULL;
+    *hash = NULL_HASH;
+    return VAL_NULL;
+  }
+  return 0;
+}
+
+static int compareValues(unsigned char type, JItemValue a, JItemValue b) {
+  switch (type) {
+  case VAL_STRING:
+    return a.string_val == b.string_val ? 0 : strcmp(a.string_val, b.string_val);
+  case VAL_DOUBLE:
+    return (a.double_val > b.double_val) - (a.double_val < b.double_val);
+  case VAL_BOOL:
+    return a.char_val - b.char_val;
+  default:
+    return 0;
+  }
+}
+
+static int sameValue(const Pair *a, const Pair *b) {
+  return a->hash == b->hash && a->type == b->type && compareValues(a->type, a->value, b->value) == 0;
+}
+
+static int comparePairs(const void *left, const void *right) {
+  const Pair *a = left;
+  const Pair *b = right;
+  if (a->hash != b->hash) {
+    return a->hash < b->hash ? -1 : 1;
+  }
+  if (a->type != b->type) {
+    return a->type - b->type;
+  }
+  int order = compareValues(a->type, a->value, b->value);
+  if (order) {
+    return order;
+  }
+  return (a->seq > b->seq) - (a->seq < b->seq);
+}
+
+static JsonContext* contextOf(JItemValue value, short type) {
+  if (type == VAL_OBJ) {
+    return value.object_val ? value.object_val->_ctx : NULL;
+  }
+  if (type >= VAL_STRING_ARRAY && type <= VAL_MIXED_ARRAY) {
+    return value.array_val ? value.array_val->_ctx : NULL;
+  }
+  return NULL;
+}
+
+static int noteContext(Contexts *contexts, JsonContext *ctx) {
+  if (!ctx) {
+    return 1;
+  }
+  for (unsigned int i = contexts->count; i > 0; --i) {
+    if (contexts->items[i - 1] == ctx) {
+      return 1;
+    }
+  }
+  if (contexts->count == contexts->capacity) {
+    unsigned int capacity = contexts->capacity ? contexts->capacity * 2 : CONTEXTS_MIN;
+    JsonContext **items = realloc(contexts->items, capacity * sizeof(JsonContext*));
+    if (!items) {
+      fprintf(stderr, "Error: Could not grow the contexts of an index to %u\n", capacity);
+      contexts->failed = 1;
+      return 0;
+    }
+    contexts->items = items;
+    contexts->capacity = capacity;
+  }
+  contexts->items[contexts->count++] = ctx;
+  return 1;
+}
+
+static int addContext(void *user, JItemValue value, short type) {
+  return noteContext(user, contextOf(value, type));
+}
+
+static int addHolder(void *user, JItemValue value, short type) {
+  Pairs *pairs = user;
+  if (type != VAL_OBJ || !value.object_val) {
+    return 1;
+  }
+  if (!noteContext(pairs->contexts, value.object_val->_ctx)) {
+    return 0;
+  }
+  short keyType = 0;
+  JItemValue found = jsonGetKey(value.object_val, pairs->index->_key, &keyType);
+  Pair pair = { 0 };
+  if (!keyType || !(pair.type = indexed(keyType, found, &pair.value, &pair.hash))) {
+    return 1;
+  }
+  if (pairs->count == pairs->capacity) {
+    unsigned int capacity = pairs->capacity ? pairs->capacity * 2 : PAIRS_MIN_CAPACITY;
+    Pair *items = realloc(pairs->items, capacity * sizeof(Pair));
+    if (!items) {
+      fprintf(stderr, "Error: Could not grow the index to %u values\n", capacity);
+      return 0;
+    }
+    pairs->items = items;
+    pairs->capacity = capacity;
+  }
+  pair.holder = value.object_val;
+  pair.seq = pairs->count;
+  pairs->items[pairs->count++] = pair;
+  return 1;
+}
+
+static void releaseTables(JIndex *index) {
+  free(index->objects);
+  free(index->_groups);
+  free(index->_slots);
+  index->objects = NULL;
+  index->_groups = NULL;
+  index->_slots = NULL;
+  index->count = 0;
+  index->_groupCount = 0;
+}
+
+/** Stops mutations of the covered contexts from bumping their generation for this index */
+static void releaseContexts(JIndex *index) {
+  for (unsigned int i = 0; i < index->_contextCount; ++i) {
+    __atomic_fetch_sub(&index->_contexts[i]->_indexes, 1, __ATOMIC_RELAXED);
+  }
+  free(index->_contexts);
+  free(index->_generations);
+  index->_contexts = NULL;
+  index->_generations = NULL;
+  index->_contextCount = 0;
+}
+
+/** Registers the index with the contexts it covers now and notes their generations */
+static int coverContexts(JIndex *index, Contexts *contexts) {
+  releaseContexts(index);
+  unsigned long *generations = malloc((contexts->count ? contexts->count : 1) * sizeof(unsigned long));
+  if (!generations) {
+    free(contexts->items);
+    return 0;
+  }
+  for (unsigned int i = 0; i < contexts->count; ++i) {
+    __atomic_fetch_add(&contexts->items[i]->_indexes, 1, __ATOMIC_RELAXED);
+    generations[i] = __atomic_load_n(&contexts->items[i]->generation, __ATOMIC_RELAXED);
+  }
+  index->_contexts = contexts->items;
+  index->_generations = generations;
+  index->_contextCount = contexts->count;
+  return 1;
+}
+
+static int stale(const JIndex *index) {
+  for (unsigned int i = 0; i < index->_contextCount; ++i) {
+    if (index->_generations[i] != __atomic_load_n(&index->_contexts[i]->generation, __ATOMIC_RELAXED)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/** Collects the values, sorts them into groups and hashes the groups */
+static int buildTables(JIndex *index) {
+  releaseTables(index);
+
+  // every container on the way to the holders, a push into any of them changes the holders
+  Contexts contexts = { NULL, 0, 0, 0 };
+  noteContext(&contexts, contextOf(index->root, index->rootType));
+  for (unsigned int k = 1; index->_holders && k < index->_holders->count; ++k) {
+    JQuery prefix = *index->_holders;
+    prefix.count = k;
+    jsonQueryRun(&prefix, index->root, index->rootType, addContext, &contexts);
+  }
+
+  Pairs pairs = { index, &contexts, NULL, 0, 0 };
+  if (index->_holders) {
+    jsonQueryRun(index->_holders, index->root, index->rootType, addHolder, &pairs);
+  } else {
+    addHolder(&pairs, index->root, index->rootType);
+  }
+  if (contexts.failed || !coverContexts(index, &contexts)) {
+    if (contexts.failed) {
+      free(contexts.items);
+    }
+    free(pairs.items);
+    return 0;
+  }
+  if (pairs.count) {
+    qsort(pairs.items, pairs.count, sizeof(Pair), comparePairs); // items is NULL when nothing matched
+  }
+
+  unsigned int groups = 0;
+  for (unsigned int i = 0; i < pairs.count; ++i) {
+    groups += i == 0 || !sameValue(&pairs.items[i - 1], &pairs.items[i]);
+  }
+  unsigned int slots = 4;
+  while (slots < groups * 2) {
+    slots <<= 1;
+  }
+  index->objects = malloc((pairs.count ? pairs.count : 1) * sizeof(JObject*));
+  index->_groups = malloc((groups ? groups : 1) * sizeof(JIndexGroup));
+  index->_slots = calloc(slots, sizeof(unsigned int));
+  if (!index->objects || !index->_groups || !index->_slots) {
+    fprintf(stderr, "Error: Could not allocate an index of %u values\n", pairs.count);
+    free(pairs.items);
+    releaseTables(index);
+    return 0;
+  }
+  index->_slotMask = slots - 1;
+
+  for (unsigned int i = 0; i < pairs.count; ++i) {
+    const Pair *pair = &pairs.items[i];
+    if (i == 0 || !sameValue(&pairs.items[i - 1], pair)) {
+      index->_groups[index->_groupCount++] = (JIndexGroup) { pair->hash, pair->type, pair->value, i, 0 };
+      unsigned int slot = pair->hash & index->_slotMask;
+      while (index->_slots[slot]) {
+        slot = (slot + 1) & index->_slotMask;
+      }
+      index->_slots[slot] = index->_groupCount;
+    }
+    ++index->_groups[index->_groupCount - 1].count;
+    index->objects[i] = pair->holder;
+  }
+  index->count = pairs.count;
+  free(pairs.items);
+  return 1;
+}
+
+JIndex* jsonBuildIndex(JItemValue root, short type, const char *pattern) {
+  const char *last = pattern ? strrchr(pattern, '.') : NULL;
+  const char *key = last ? last + 1 : pattern;
+  if (!pattern || !*key || strpbrk(key, "*?[]") || key[0] == '=' || strstr(pattern, ".=") || pattern[0] == '=') {
+    fprintf(stderr, "Error: Index pattern '%s' has to end with a plain key\n", pattern ? pattern : "(null)");
+    return 0;
+  }
+  if (!root.ptr_val || (type != VAL_OBJ && (type < VAL_STRING_ARRAY || type > VAL_MIXED_ARRAY))) {
+    fprintf(stderr, "Error: Index over '%s' needs an object or array root\n", pattern);
+    return 0;
+  }
+
+  JIndex *index = malloc(sizeof(JIndex));
+  if (!index) {
+    return 0;
+  }
+  memset(index, 0, sizeof(JIndex));
+  index->root = root;
+  index->rootType = type;
+  index->_key = jsonInternKey(key, strlen(key));
+  if (last) {
+    size_t length = last - pattern;
+    char holders[length + 1];
+    memcpy(holders, pattern, length);
+    holders[length] = '\0';
+    index->_holders = jsonQueryCompile(holders);
+  }
+  if (!index->_key.str || (last && !index->_holders)) {
+    jsonQueryFree(index->_holders);
+    free(index);
+    return 0;
+  }
+
+  if (!buildTables(index)) {
+    jsonIndexFree(index);
+    return 0;
+  }
+  return index;
+}
+
+void jsonIndexFree(JIndex *index) {
+  if (!index) {
+    return;
+  }
+  releaseContexts(index);
+  releaseTables(index);
+  jsonQueryFree(index->_holders);
+  free(index);
+}
+
+JObject** jsonIndexLookup(JIndex *index, short type, JItemValue value, unsigned int *count) {
+  *count = 0;
+  if (!index) {
+    return 0;
+  }
+  if ((stale(index) || !index->_slots) && !buildTables(index)) {
+    return 0;
+  }
+
+  JItemValue want = { 0 };
+  Fnv32_t hash = 0;
+  unsigned char wantType = indexed(type, value, &want, &hash);
+  if (!wantType) {
+    return 0;
+  }
+  for (unsigned int slot = hash & index->_slotMask; index->_slots[slot]; slot = (slot + 1) & index->_slotMask) {
+    const JIndexGroup *group = &index->_groups[index->_slots[slot] - 1];
+    if (group->hash == hash && group->type == wantType && compareValues(wantType, group->value, want) == 0) {
+      *count = group->count;
+      return index->objects + group->start;
+    }
+  }
+  return 0;
+}
+
+JObject** jsonIndexLookupString(JIndex *index, const char *value, unsigned int *count) {
+  return jsonIndexLookup(index, VAL_STRING, (JItemValue) { .string_val = (char*) value }, count);
+}
+
+JObject** jsonIndexLookupDouble(JIndex *index, double value, unsigned int *count) {
+  return jsonIndexLookup(index, VAL_DOUBLE, (JItemValue) { .double_val = value }, count);
+}
+
+JObject** jsonIndexLookupBool(JIndex *index, char value, unsigned int *count) {
+  return jsonIndexLookup(index, VAL_BOOL, (JItemValue) { .char_val = value }, count);
+}
@@ -0,0 +1,401 @@
+#include "intern.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INTERN_MIN_CAPACITY 64
+
+JInternTable* jsonInternNew(const JsonAllocator *allocator) {
+  if (!allocator) {
+    allocator = &jsonLibcAllocator;
+  }
+  JInternTable *table = JMALLOC(allocator, sizeof(JInternTable));
+  if (!table) {
+    return 0;
+  }
+  memset(table, 0, sizeof(JInternTable));
+  table->allocator = allocator;
+  table->capacity = INTERN_MIN_CAPACITY;
+  table->slots = JMALLOC(allocator, table->capacity * sizeof(JInternSlot));
+  if (!table->slots) {
+    JFREE(allocator, table);
+    return 0;
+  }
+  memset(table->slots, 0, table->capacity * sizeof(JInternSlot));
+  return table;
+}
+
+void jsonInternFree(JInternTable *table) {
+  if (!table) {
+    return;
+  }
+  const JsonAllocator *allocator = table->allocator;
+  JInternSlab *slab = table->slab;
+  while (slab) {
+    JInternSlab *toDel = slab;
+    slab = slab->next;
+    JFREE(allocator, toDel);
+  }
+  JFREE(allocator, table->slots);
+  JFREE(allocator, table);
+}
+
+static int growSlots(JInternTable *table) {
+  unsigned int capacity = table->capacity << 1;
+  JInternSlot *slots = JMALLOC(table->allocator, capacity * sizeof(JInternSlot));
+  if (!slots) {
+    return 0;
+  }
+  memset(slots, 0, capacity * sizeof(JInternSlot));
+  unsigned int mask = capacity - 1;
+  for (unsigned int i = 0; i < table->capacity; ++i) {
+    JInternSlot *from = &table->slots[i];
+    if (from->str) {
+      unsigned int index = from->hash & mask;
+      while (slots[index].str) {
+        index = (index + 1) & mask;
+      }
+      slots[index] = *from;
+    }
+  }
+  JFREE(table->allocator, table->slots);
+  table->slots = slots;
+  table->capacity = capacity;
+  return 1;
+}
+
+static JInternStr* slabCarve(const JsonAllocator *allocator, JInternSlab **head,
+    size_t *slabBytes, unsigned int length) {
+  size_t need = sizeof(JInternStr) + length + 1;
+  need = (need + sizeof(Fnv32_t) - 1) & ~(sizeof(Fnv32_t) - 1);
+
+  JInternSlab *slab = *head;
+  if (!slab || slab->size - slab->used < need) {
+    // small documents get small slabs, doubling up to INTERN_SLAB_SIZE
+    size_t size = slab ? slab->size * 2 : INTERN_FIRST_SLAB_SIZE;
+    if (size > INTERN_SLAB_SIZE) {
+      size = INTERN_SLAB_SIZE;
+    }
+    if (need > size) {
+      size = need;
+    }
+    slab = JMALLOC(allocator, sizeof(JInternSlab) + size);
+    if (!slab) {
+      return 0;
+    }
+    slab->used = 0;
+    slab->size = size;
+    slab->next = *head;
+    *head = slab;
+    *slabBytes += size;
+  }
+
+  JInternStr *str = (JInternStr*)(slab->data + slab->used);
+  slab->used += need;
+  return str;
+}
+
+static JInternStr* slabAlloc(JInternTable *table, unsigned int length) {
+  JInternStr *str = slabCarve(table->allocator, &table->slab, &table->slabBytes, length);
+  if (str) {
+    table->bytes += sizeof(JInternStr) + length + 1;
+  }
+  return str;
+}
+
+static unsigned int findIndex(const JInternTable *table, const char *str,
+    unsigned int length, Fnv32_t hash) {
+  unsigned int mask = table->capacity - 1;
+  unsigned int index = hash & mask;
+  for (;;) {
+    const JInternSlot *slot = &table->slots[index];
+    if (!slot->str || (slot->hash == hash && slot->str->length == length
+        && memcmp(slot->str->bytes, str, length) == 0)) {
+      return index;
+    }
+    index = (index + 1) & mask;
+  }
+}
+
+JKey jsonInternFind(const JInternTable *table, const char *str,
+    unsigned int length, Fnv32_t hash) {
+  if (!table || !str) {
+    return (JKey) { 0 };
+  }
+  const JInternStr *found = table->slots[findIndex(table, str, length, hash)].str;
+  if (!found) {
+    return (JKey) { 0 };
+  }
+  return (JKey) { found->bytes, found->hash, found->length };
+}
+
+JKey jsonInternHashed(JInternTable *table, const char *str, unsigned int length,
+    Fnv32_t hash) {
+  if (!table || !str) {
+    return (JKey) { 0 };
+  }
+  ++table->lookups;
+  unsigned int index = findIndex(table, str, length, hash);
+  JInternStr *found = table->slots[index].str;
+  if (found) {
+    ++table->hits;
+    return (JKey) { found->bytes, found->hash, found->length };
+  }
+
+  // keep the load factor under 3/4
+  if ((table->count + 1) * 4 > table->capacity * 3) {
+    if (!growSlots(table)) {
+      fprintf(stderr, "Error: Could not grow string table\n");
+      return (JKey) { 0 };
+    }
+    index = findIndex(table, str, length, hash);
+  }
+
+  found = slabAlloc(table, length);
+  if (!found) {
+    fprintf(stderr, "Error: Could not allocate memory for string\n");
+    return (JKey) { 0 };
+  }
+  found->hash = hash;
+  found->length = length;
+  memcpy(found->bytes, str, length);
+  found->bytes[length] = '\0';
+
+  table->slots[index].str = found;
+  table->slots[index].hash = hash;
+  ++table->count;
+  return (JKey) { found->bytes, hash, length };
+}
+
+JKey jsonIntern(JInternTable *table, const char *str, unsigned int length) {
+  if (!str) {
+    return (JKey) { 0 };
+  }
+  return jsonInternHashed(table, str, length, fnvbuf(str, length));
+}
+
+void jsonInternTableStats(const JInternTable *table, JInternStats *stats) {
+  memset(stats, 0, sizeof(JInternStats));
+  if (!table) {
+    return;
+  }
+  stats->strings = table->count;
+  stats->capacity = table->capacity;
+  stats->bytes = table->bytes;
+  stats->slabBytes = table->slabBytes;
+  stats->lookups = table->lookups;
+  stats->hits = table->hits;
+}
+
+/**
+ * Buckets are published with a release store once a string is fully
+ * written, so readers can probe them without taking the shard lock. When a
+ * shard grows the old buckets stay alive on the retired list because a
+ * reader may still be probing them, they are released with the interner.
+ */
+typedef struct JSharedBuckets {
+  struct JSharedBuckets* retired;
+  unsigned int           capacity;
+  _Atomic(JInternStr*)   slots[];
+} JSharedBuckets;
+
+typedef struct JSharedShard {
+  _Alignas(64) _Atomic(JSharedBuckets*) buckets;
+  pthread_mutex_t lock;
+  unsigned int    count;
+  JInternSlab*    slab;
+  size_t          slabBytes;
+} JSharedShard;
+
+struct JSharedIntern {
+  const JsonAllocator* allocator;
+  atomic_size_t        bytes;
+  JSharedShard         shards[SHARED_INTERN_SHARDS];
+};
+
+#define SHARD_OF(hash) (((hash) >> 16) % SHARED_INTERN_SHARDS)
+
+static JSharedBuckets* newBuckets(const JsonAllocator *allocator, unsigned int capacity) {
+  size_t size = sizeof(JSharedBuckets) + capacity * sizeof(_Atomic(JInternStr*));
+  JSharedBuckets *buckets = JMALLOC(allocator, size);
+  if (!buckets) {
+    return 0;
+  }
+  buckets->retired = NULL;
+  buckets->capacity = capacity;
+  for (unsigned int i = 0; i < capacity; ++i) {
+    atomic_init(&buckets->slots[i], NULL);
+  }
+  return buckets;
+}
+
+JSharedIntern* jsonSharedInternNew(const JsonAllocator *allocator) {
+  if (!allocator) {
+    allocator = &jsonLibcAllocator;
+  }
+  JSharedIntern *shared = JMALLOC(allocator, sizeof(JSharedIntern));
+  if (!shared) {
+    return 0;
+  }
+  memset(shared, 0, sizeof(JSharedIntern));
+  shared->allocator = allocator;
+  atomic_init(&shared->bytes, 0);
+  for (int i = 0; i < SHARED_INTERN_SHARDS; ++i) {
+    JSharedShard *shard = &shared->shards[i];
+    pthread_mutex_init(&shard->lock, NULL);
+    atomic_init(&shard->buckets, newBuckets(allocator, INTERN_MIN_CAPACITY));
+    if (!atomic_load_explicit(&shard->buckets, memory_order_relaxed)) {
+      jsonSharedInternFree(shared);
+      return 0;
+    }
+  }
+  return shared;
+}
+
+void jsonSharedInternFree(JSharedIntern *shared) {
+  if (!shared) {
+    return;
+  }
+  const JsonAllocator *allocator = shared->allocator;
+  for (int i = 0; i < SHARED_INTERN_SHARDS; ++i) {
+    JSharedShard *shard = &shared->shards[i];
+    JSharedBuckets *buckets = atomic_load_explicit(&shard->buckets, memory_order_relaxed);
+    while (buckets) {
+      JSharedBuckets *toDel = buckets;
+      buckets = buckets->retired;
+      JFREE(allocator, toDel);
+    }
+    JInternSlab *slab = shard->slab;
+    while (slab) {
+      JInternSlab *toDel = slab;
+      slab = slab->next;
+      JFREE(allocator, toDel);
+    }
+    pthread_mutex_destroy(&shard->lock);
+  }
+  JFREE(allocator, shared);
+}
+
+static JInternStr* probeShared(JSharedBuckets *buckets, const char *str,
+    unsigned int length, Fnv32_t hash, unsigned int *empty) {
+  unsigned int mask = buckets->capacity - 1;
+  unsigned int index = hash & mask;
+  for (;;) {
+    JInternStr *found = atomic_load_explicit(&buckets->slots[index], memory_order_acquire);
+    if (!found) {
+      *empty = index;
+      return 0;
+    }
+    if (found->hash == hash && found->length == length
+        && memcmp(found->bytes, str, length) == 0) {
+      return found;
+    }
+    index = (index + 1) & mask;
+  }
+}
+
+static JSharedBuckets* growShared(JSharedIntern *shared, JSharedShard *shard,
+    JSharedBuckets *old) {
+  JSharedBuckets *buckets = newBuckets(shared->allocator, old->capacity << 1);
+  if (!buckets) {
+    return 0;
+  }
+  unsigned int mask = buckets->capacity - 1;
+  for (unsigned int i = 0; i < old->capacity; ++i) {
+    JInternStr *str = atomic_load_explicit(&old->slots[i], memory_order_relaxed);
+    if (str) {
+      unsigned int index = str->hash & mask;
+      while (atomic_load_explicit(&buckets->slots[index], memory_order_relaxed)) {
+        index = (index + 1) & mask;
+      }
+      atomic_store_explicit(&buckets->slots[index], str, memory_order_relaxed);
+    }
+  }
+  buckets->retired = old;
+  atomic_store_explicit(&shard->buckets, buckets, memory_order_release);
+  return buckets;
+}
+
+JKey jsonSharedInternFind(JSharedIntern *shared, const char *str,
+    unsigned int length, Fnv32_t hash) {
+  if (!shared || !str) {
+    return (JKey) { 0 };
+  }
+  JSharedShard *shard = &shared->shards[SHARD_OF(hash)];
+  JSharedBuckets *buckets = atomic_load_explicit(&shard->buckets, memory_order_acquire);
+  unsigned int empty = 0;
+  JInternStr *found = probeShared(buckets, str, length, hash, &empty);
+  if (!found) {
+    return (JKey) { 0 };
+  }
+  return (JKey) { found->bytes, found->hash, found->length };
+}
+
+JKey jsonSharedIntern(JSharedIntern *shared, const char *str, unsigned int length,
+    Fnv32_t hash) {
+  JKey key = jsonSharedInternFind(shared, str, length, hash);
+  if (key.str || !shared || !str) {
+    return key;
+  }
+
+  JSharedShard *shard = &shared->shards[SHARD_OF(hash)];
+  pthread_mutex_lock(&shard->lock);
+
+  // another thread may have won the race or grown the shard meanwhile
+  JSharedBuckets *buckets = atomic_load_explicit(&shard->buckets, memory_order_relaxed);
+  unsigned int index = 0;
+  JInternStr *found = probeShared(buckets, str, length, hash, &index);
+  if (!found) {
+    if ((shard->count + 1) * 2 > buckets->capacity) {
+      buckets = growShared(shared, shard, buckets);
+      if (buckets) {
+        probeShared(buckets, str, length, hash, &index);
+      }
+    }
+    if (buckets) {
+      found = slabCarve(shared->allocator, &shard->slab, &shard->slabBytes, length);
+    }
+    if (found) {
+      found->hash = hash;
+      found->length = length;
+      memcpy(found->bytes, str, length);
+      found->bytes[length] = '\0';
+      atomic_store_explicit(&buckets->slots[index], found, memory_order_release);
+      ++shard->count;
+      atomic_fetch_add_explicit(&shared->bytes, sizeof(JInternStr) + length + 1,
+          memory_order_relaxed);
+    } else {
+      fprintf(stderr, "Error: Could not allocate memory for string\n");
+    }
+  }
+  pthread_mutex_unlock(&shard->lock);
+
+  if (!found) {
+    return (JKey) { 0 };
+  }
+  return (JKey) { found->bytes, found->hash, found->length };
+}
+
+size_t jsonSharedInternBytes(JSharedIntern *shared) {
+  return shared ? atomic_load_explicit(&shared->bytes, memory_order_relaxed) : 0;
+}
+
+void jsonSharedInternStats(JSharedIntern *shared, JInternStats *stats) {
+  memset(stats, 0, sizeof(JInternStats));
+  if (!shared) {
+    return;
+  }
+  for (int i = 0; i < SHARED_INTERN_SHARDS; ++i) {
+    JSharedShard *shard = &shared->shards[i];
+    pthread_mutex_lock(&shard->lock);
+    JSharedBuckets *buckets = atomic_load_explicit(&shard->buckets, memory_order_relaxed);
+    stats->strings += shard->count;
+    stats->capacity += buckets->capacity;
+    stats->slabBytes += shard->slabBytes;
+    pthread_mutex_unlock(&shard->lock);
+  }
+  stats->bytes = jsonSharedInternBytes(shared);
+}
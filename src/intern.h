@@ -0,0 +1,98 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+
+#include "alloc.h"
+#include "fnv.h"
+
+#ifndef INTERN_SLAB_SIZE
+#define INTERN_SLAB_SIZE 65536
+#endif
+
+#ifndef INTERN_FIRST_SLAB_SIZE
+#define INTERN_FIRST_SLAB_SIZE 1024
+#endif
+
+/**
+ * An interned string lives in a slab right behind its hash and length so a
+ * handle never has to rehash or measure the bytes again.
+ */
+typedef struct JInternStr {
+  Fnv32_t      hash;
+  unsigned int length;
+  char         bytes[];
+} JInternStr;
+
+typedef struct JInternSlab {
+  struct JInternSlab* next;
+  size_t              used;
+  size_t              size;
+  char                data[];
+} JInternSlab;
+
+typedef struct JInternSlot {
+  JInternStr* str;
+  Fnv32_t     hash;
+} JInternSlot;
+
+typedef struct JInternTable {
+  const JsonAllocator* allocator;
+  JInternSlot*  slots;    // open addressed, linear probing
+  unsigned int  capacity; // always a power of two
+  unsigned int  count;
+  JInternSlab*  slab;     // newest slab first
+  size_t        bytes;    // bytes used by interned strings and headers
+  size_t        slabBytes;
+  unsigned long lookups;
+  unsigned long hits;
+} JInternTable;
+
+/**
+ * Handle to an interned string, str is NULL when nothing was interned.
+ */
+typedef struct JKey {
+  const char*  str;
+  Fnv32_t      hash;
+  unsigned int length;
+} JKey;
+
+typedef struct JInternStats {
+  unsigned int  strings;
+  unsigned int  capacity;
+  size_t        bytes;
+  size_t        slabBytes;
+  unsigned long lookups;
+  unsigned long hits;
+} JInternStats;
+
+/**
+ * A string table that many threads can intern into at once. It is split
+ * into shards by hash, lookups never lock and inserts only lock their
+ * shard.
+ */
+typedef struct JSharedIntern JSharedIntern;
+
+#ifndef SHARED_INTERN_SHARDS
+#define SHARED_INTERN_SHARDS 64
+#endif
+
+/** Returns the header in front of a string handed out by the table */
+#define jsonInternHeader(s) ((const JInternStr*)((s) - offsetof(JInternStr, bytes)))
+
+JInternTable* jsonInternNew(const JsonAllocator *allocator);
+void          jsonInternFree(JInternTable *table);
+
+JKey          jsonIntern(JInternTable *table, const char *str, unsigned int length);
+JKey          jsonInternHashed(JInternTable *table, const char *str, unsigned int length, Fnv32_t hash);
+JKey          jsonInternFind(const JInternTable *table, const char *str, unsigned int length, Fnv32_t hash);
+void          jsonInternTableStats(const JInternTable *table, JInternStats *stats);
+
+JSharedIntern* jsonSharedInternNew(const JsonAllocator *allocator);
+void           jsonSharedInternFree(JSharedIntern *shared);
+JKey           jsonSharedIntern(JSharedIntern *shared, const char *str, unsigned int length, Fnv32_t hash);
+JKey           jsonSharedInternFind(JSharedIntern *shared, const char *str, unsigned int length, Fnv32_t hash);
+size_t         jsonSharedInternBytes(JSharedIntern *shared);
+void           jsonSharedInternStats(JSharedIntern *shared, JInternStats *stats);
+
+#endif
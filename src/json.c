@@ -1,194 +1,533 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "json.h"
+#include "dtoa.h"
 
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define DEFAULT_HASH_SIZE   15
-#define DEFAULT_INC_AMOUNT  100
+#define MIN_INDEX_LOG2      3
+#define USABLE(slots)       (((slots) << 1) / 3)
+#define INDEX_EMPTY         (-1)
+#define INDEX_DUMMY         (-2)
+#define PERTURB_SHIFT       5
+#define SAMPLE_DECAY        (JSON_SAMPLE_SLOTS * 16)
+#define DEFAULT_POLICY      { JSON_INTERN_ALL, 64, 4, 0 }
+#define ARRAY_MIN_CAPACITY  4
+#define SHAPE_MAX_KEYS      64 // objects with more keys become dictionaries
+#define SHAPE_MAX_CHILDREN  64 // and so do objects branching off a shape this busy
+#define SHAPE_LINEAR_KEYS   8  // shapes up to this size are scanned instead of hashed
+#define SHAPE_MIN_SLOTS     4
+#define SHAPE_PENDING       (sizeof(((JShape*)0)->_pending) / sizeof(Fnv32_t))
+
+#define SLOT_VALUES(obj)    ((JItemValue*)(obj)->_index)
+#define KEY_STACK_BYTES     128 // longer keys in dotted lookups are copied to the heap
+#define SLOT_TYPES(obj)     ((unsigned char*)(SLOT_VALUES(obj) + (obj)->_usable))
+
+static void* libcMalloc(void *user, size_t size) {
+  return malloc(size);
+}
 
-JObject *stringCache = NULL;
+static void* libcRealloc(void *user, void *ptr, size_t size) {
+  return realloc(ptr, size);
+}
 
-int jsonGetEntryIndex(const JObject *obj, const char* keys);
-void jsonPrintObjectTabs(const FILE *io, const JObject* obj, unsigned int tabs, unsigned int tabInc);
+static void libcFree(void *user, void *ptr) {
+  free(ptr);
+}
 
-char *nextKey(const char *keys, int *last) {
-  if (!keys || !last) {
-    return 0;
+const JsonAllocator jsonLibcAllocator = { libcMalloc, libcRealloc, libcFree, NULL };
+
+static JsonContext defaultContext = {
+  { libcMalloc, libcRealloc, libcFree, NULL }, DEFAULT_POLICY, NULL, NULL, NULL, 0, { 0 }, 0, 0
+};
+
+
+static size_t indexBytes(unsigned char log2) {
+  size_t slots = (size_t)1 << log2;
+  size_t width = log2 < 8 ? 1 : (log2 < 16 ? 2 : 4);
+  // keep the entries that follow the index pointer aligned
+  return (slots * width + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+}
+
+static inline int getSlot(const JObject *obj, size_t i) {
+  if (obj->_indexLog2 < 8) {
+    return ((const int8_t*)obj->_index)[i];
+  } else if (obj->_indexLog2 < 16) {
+    return ((const int16_t*)obj->_index)[i];
   }
+  return ((const int32_t*)obj->_index)[i];
+}
 
-  int start = *last;
-  int begin = start;
-  for (; keys[start] != '.' && keys[start]; ++start) {
-    ;
+static inline void setSlot(JObject *obj, size_t i, int ix) {
+  if (obj->_indexLog2 < 8) {
+    ((int8_t*)obj->_index)[i] = (int8_t)ix;
+  } else if (obj->_indexLog2 < 16) {
+    ((int16_t*)obj->_index)[i] = (int16_t)ix;
+  } else {
+    ((int32_t*)obj->_index)[i] = (int32_t)ix;
   }
+}
 
-  int size = start - begin;
-  if (size <= 0) {
-    *last = -1;
+/**
+ * Finds the index slot for a key. Returns the slot holding the key or the
+ * first empty slot of its probe sequence, *found tells which one it is.
+ */
+static size_t findSlot(const JObject *obj, const char *key, Fnv32_t hash, char *found) {
+  size_t mask = ((size_t)1 << obj->_indexLog2) - 1;
+  size_t perturb = hash;
+  size_t i = hash & mask;
+  for (;;) {
+    int ix = getSlot(obj, i);
+    if (ix == INDEX_EMPTY) {
+      *found = 0;
+      return i;
+    }
+    if (ix >= 0) {
+      const JEntry *entry = &obj->entries[ix];
+      if (entry->hash == hash && (entry->name == key || strcmp(entry->name, key) == 0)) {
+        *found = 1;
+        return i;
+      }
+    }
+    perturb >>= PERTURB_SHIFT;
+    i = (i * 5 + perturb + 1) & mask;
+  }
+}
+
+static size_t findEmptySlot(const JObject *obj, Fnv32_t hash) {
+  size_t mask = ((size_t)1 << obj->_indexLog2) - 1;
+  size_t perturb = hash;
+  size_t i = hash & mask;
+  while (getSlot(obj, i) != INDEX_EMPTY) {
+    perturb >>= PERTURB_SHIFT;
+    i = (i * 5 + perturb + 1) & mask;
+  }
+  return i;
+}
+
+/**
+ * Allocates the index and entry storage for at least `minUsable` entries.
+ */
+static int allocKeys(JObject *obj, unsigned int minUsable) {
+  unsigned char log2 = MIN_INDEX_LOG2;
+  while (USABLE((size_t)1 << log2) < minUsable) {
+    ++log2;
+  }
+  size_t slots = (size_t)1 << log2;
+  size_t idxBytes = indexBytes(log2);
+  size_t usable = USABLE(slots);
+  char *block = JMALLOC(&obj->_ctx->allocator, idxBytes + sizeof(JEntry) * usable);
+  if (!block) {
     return 0;
   }
+  memset(block, 0xff, idxBytes); // every slot starts INDEX_EMPTY
+  obj->_index = block;
+  obj->entries = (JEntry*)(block + idxBytes);
+  obj->_indexLog2 = log2;
+  obj->_usable = usable;
+  obj->_used = 0;
+  return 1;
+}
 
-  char *newkey = malloc(size + 1);
-  memset(newkey, 0, size + 1);
+/**
+ * Grows the index and compacts away deleted entries, keeping insertion order.
+ */
+static int resizeObject(JObject *obj) {
+  void *oldBlock = obj->_index;
+  JEntry *oldEntries = obj->entries;
+  unsigned int oldUsed = obj->_used;
+  if (!allocKeys(obj, obj->size * 2 + 1)) {
+    obj->_index = oldBlock;
+    obj->entries = oldEntries;
+    return 0;
+  }
+  unsigned int n = 0;
+  for (unsigned int i = 0; i < oldUsed; ++i) {
+    if (oldEntries[i].name) {
+      obj->entries[n] = oldEntries[i];
+      setSlot(obj, findEmptySlot(obj, oldEntries[i].hash), n);
+      ++n;
+    }
+  }
+  obj->_used = n;
+  JFREE(&obj->_ctx->allocator, oldBlock);
+  return 1;
+}
 
-  int another = begin;
-  for (; begin <= start; ++begin) {
-    newkey[start - begin] = keys[another + (start - begin)];
+static JShape* newShape(JsonContext *ctx, JShape *parent, JKey key) {
+  unsigned int count = parent ? parent->count + 1 : 0;
+  unsigned int indexSize = 0;
+  if (count > SHAPE_LINEAR_KEYS) {
+    for (indexSize = 16; indexSize < count * 2; indexSize <<= 1) {
+      ;
+    }
+  }
+  JShape *shape = JMALLOC(&ctx->allocator, sizeof(JShape) + count * sizeof(JKey) + indexSize);
+  if (!shape) {
+    return 0;
+  }
+  memset(shape, 0, sizeof(JShape));
+  shape->parent = parent;
+  shape->count = count;
+  shape->keys = (JKey*)(shape + 1);
+  if (count) {
+    memcpy(shape->keys, parent->keys, (count - 1) * sizeof(JKey));
+    shape->keys[count - 1] = key;
+  }
+  if (indexSize) {
+    shape->_index = (unsigned char*)(shape->keys + count);
+    shape->_indexMask = indexSize - 1;
+    memset(shape->_index, 0, indexSize);
+    for (unsigned int i = 0; i < count; ++i) {
+      unsigned int j = shape->keys[i].hash & shape->_indexMask;
+      while (shape->_index[j]) {
+        j = (j + 1) & shape->_indexMask;
+      }
+      shape->_index[j] = i + 1;
+    }
   }
+  return shape;
+}
 
-  newkey[size] = '\0';
-  *last = start + 1;
+static void freeShapes(const JsonAllocator *allocator, JShape *shape) {
+  if (!shape) {
+    return;
+  }
+  for (unsigned int i = 0; i < shape->_childCount; ++i) {
+    freeShapes(allocator, shape->_children[i]);
+  }
+  if (shape->_children) {
+    JFREE(allocator, shape->_children);
+  }
+  JFREE(allocator, shape);
+}
 
-  if (keys[start] == '\0') {
-    *last = -1;
+static JShape* rootShape(JsonContext *ctx) {
+  if (!ctx->shapes) {
+    ctx->shapes = newShape(ctx, NULL, (JKey) { 0 });
   }
+  return ctx->shapes;
+}
 
-  return newkey;
+static inline int sameKey(const JKey *known, const char *key, Fnv32_t hash) {
+  return known->hash == hash && (known->str == key || strcmp(known->str, key) == 0);
 }
 
-JEntry* insertInto(JEntry *entry, JObject *obj) {
-  int index = (entry->hash + (entry->probes - 1)) % obj->_arraySize;
+/** Returns the slot of a key in a shape, -1 when the shape lacks it */
+static int shapeSlot(const JShape *shape, const char *key, Fnv32_t hash) {
+  if (!shape->_index) {
+    for (unsigned int i = 0; i < shape->count; ++i) {
+      if (sameKey(&shape->keys[i], key, hash)) {
+        return i;
+      }
+    }
+    return -1;
+  }
+  for (unsigned int j = hash & shape->_indexMask; shape->_index[j]; j = (j + 1) & shape->_indexMask) {
+    if (sameKey(&shape->keys[shape->_index[j] - 1], key, hash)) {
+      return shape->_index[j] - 1;
+    }
+  }
+  return -1;
+}
 
-  while (obj->entries[index] != 0) {
-    // steal the slot if the probed entrys' probes is less than mine
-    if (obj->entries[index]->probes < entry->probes) {
-      JEntry *tmp = obj->entries[index];
-      obj->entries[index] = entry;
-      entry = tmp; //swap
+/**
+ * Follows or creates the transition adding key to the shape of an object.
+ * Returns NULL when the object should become a dictionary instead.
+ */
+static JShape* shapeWith(JObject *obj, JKey key) {
+  JsonContext *ctx = obj->_ctx;
+  JShape *shape = obj->shape;
+  for (unsigned int i = 0; i < shape->_childCount; ++i) {
+    JShape *child = shape->_children[i];
+    if (sameKey(&child->keys[child->count - 1], key.str, key.hash)) {
+      obj->_extending = 0;
+      return child;
+    }
+  }
+  if (shape->count >= SHAPE_MAX_KEYS || shape->_childCount >= SHAPE_MAX_CHILDREN) {
+    return 0;
+  }
+  // a key sequence seen once is likely a map, not a record. Nested objects
+  // finish before their parent adds them, so a few recent keys are kept.
+  if (!obj->_extending) {
+    unsigned int i = 0;
+    while (i < SHAPE_PENDING && shape->_pending[i] != key.hash) {
+      ++i;
     }
+    if (i == SHAPE_PENDING) {
+      shape->_pending[shape->_nextPending++ % SHAPE_PENDING] = key.hash;
+      return 0;
+    }
+  }
+  if (shape->_childCount == shape->_childCapacity) {
+    unsigned int capacity = shape->_childCapacity ? shape->_childCapacity * 2 : 2;
+    JShape **children = JREALLOC(&ctx->allocator, shape->_children, capacity * sizeof(JShape*));
+    if (!children) {
+      return 0;
+    }
+    shape->_children = children;
+    shape->_childCapacity = capacity;
+  }
+  JShape *child = newShape(ctx, shape, key);
+  if (child) {
+    shape->_children[shape->_childCount++] = child;
+    obj->_extending = 1;
+  }
+  return child;
+}
 
-    ++entry->probes;
-    // adjust hash key and keep going
-    index = (entry->hash + (entry->probes - 1)) % obj->_arraySize;
+/**
+ * Grows the values of a shaped object. Objects built like earlier ones
+ * follow a single chain of transitions and get sized for all of it at once.
+ */
+static int growSlots(JObject *obj) {
+  const JShape *ahead = obj->shape;
+  while (ahead->_childCount == 1) {
+    ahead = ahead->_children[0];
+  }
+  unsigned int capacity = obj->_usable ? obj->_usable * 2 : SHAPE_MIN_SLOTS;
+  if (ahead->count > obj->size) {
+    capacity = ahead->count;
+  }
+  JItemValue *values = JMALLOC(&obj->_ctx->allocator, capacity * (sizeof(JItemValue) + 1));
+  if (!values) {
+    return 0;
+  }
+  if (obj->size) {
+    memcpy(values, SLOT_VALUES(obj), obj->size * sizeof(JItemValue));
+    memcpy(values + capacity, SLOT_TYPES(obj), obj->size);
+  }
+  if (obj->_index) {
+    JFREE(&obj->_ctx->allocator, obj->_index);
+  }
+  obj->_index = values;
+  obj->_usable = capacity;
+  return 1;
+}
 
-    if (entry->probes > obj->_maxProbes) {
-      obj->_maxProbes = entry->probes;
-    }
+/** Moves the values of a shaped object into entries of its own */
+static int toDictionary(JObject *obj) {
+  JShape *shape = obj->shape;
+  void *slots = obj->_index;
+  JItemValue *values = SLOT_VALUES(obj);
+  unsigned char *types = SLOT_TYPES(obj);
+  if (!allocKeys(obj, obj->size * 2 + 1)) {
+    return 0;
   }
-  obj->entries[index] = entry;
-  ++obj->size;
+  for (unsigned int i = 0; i < obj->size; ++i) {
+    JEntry *entry = &obj->entries[i];
+    entry->name = (char*) shape->keys[i].str;
+    entry->hash = shape->keys[i].hash;
+    entry->value = values[i];
+    entry->value_type = types[i];
+    setSlot(obj, findEmptySlot(obj, entry->hash), i);
+  }
+  obj->_used = obj->size;
+  obj->shape = NULL;
+  if (slots) {
+    JFREE(&obj->_ctx->allocator, slots);
+  }
+  return 1;
+}
+
+/** Position of a key among the entries or values of an object, -1 when missing */
+static int entryIndex(const JObject *obj, const char *key, Fnv32_t hash) {
+  if (obj->shape) {
+    return shapeSlot(obj->shape, key, hash);
+  }
+  char found = 0;
+  size_t slot = findSlot(obj, key, hash, &found);
+  return found ? getSlot(obj, slot) : -1;
+}
+
+/** Entries of both layouts by position, dictionaries leave NULL names behind deleted keys */
+static inline const char* entryName(const JObject *obj, unsigned int i) {
+  return obj->shape ? obj->shape->keys[i].str : obj->entries[i].name;
+}
+
+static inline JItemValue* entryValue(const JObject *obj, unsigned int i) {
+  return obj->shape ? &SLOT_VALUES(obj)[i] : &obj->entries[i].value;
+}
+
+/**
+ * Pushes change the layout of an array, an int array turns mixed on a
+ * string, without reaching the entries and items holding it. Their tag
+ * only says it is an array, the array's own type is the one to trust.
+ */
+static inline unsigned char liveType(unsigned char type, JItemValue value) {
+  return type >= VAL_STRING_ARRAY && type <= VAL_MIXED_ARRAY && value.array_val ? value.array_val->type : type;
+}
 
-  return 0;
+static inline unsigned char entryType(const JObject *obj, unsigned int i) {
+  return obj->shape ? liveType(SLOT_TYPES(obj)[i], SLOT_VALUES(obj)[i])
+      : liveType(obj->entries[i].value_type, obj->entries[i].value);
+}
+
+/** Tells the value indexes over the context that a document changed */
+static inline void touch(JsonContext *ctx) {
+  if (ctx && __atomic_load_n(&ctx->_indexes, __ATOMIC_RELAXED)) {
+    __atomic_fetch_add(&ctx->generation, 1, __ATOMIC_RELAXED);
+  }
 }
 
 JObject* jsonDeleteKey(JObject *obj, const char *key) {
-  int index = jsonGetEntryIndex(obj, key);
-  if(index > -1) {
-    JEntry *toDel = obj->entries[index];
-    obj->entries[index] = 0;
-    free(toDel->name);
-    jsonFree(toDel->value, toDel->value_type);
-    free(toDel);
-    return obj;
+  if (!obj || !key) {
+    return 0;
+  }
+  if (obj->shape && (shapeSlot(obj->shape, key, fnvstr(key)) < 0 || !toDictionary(obj))) {
+    return 0;
   }
-  obj->size--;
-  return 0;
+  char found = 0;
+  size_t slot = findSlot(obj, key, fnvstr(key), &found);
+  if (!found) {
+    return 0;
+  }
+  touch(obj->_ctx);
+  JEntry *toDel = &obj->entries[getSlot(obj, slot)];
+  setSlot(obj, slot, INDEX_DUMMY);
+  jsonFree(toDel->value, toDel->value_type);
+  toDel->name = NULL;
+  toDel->value_type = 0;
+  --obj->size;
+  return obj;
 }
 
 void signalHandler() {
-  if(!stringCache) {
-    return;
+  jsonInternFree(defaultContext.strings);
+  defaultContext.strings = 0;
+  freeShapes(&defaultContext.allocator, defaultContext.shapes);
+  defaultContext.shapes = 0;
+}
+
+JsonContext* jsonDefaultContext() {
+  return &defaultContext;
+}
+
+JsonContext* jsonContextNew(const JsonAllocator *allocator) {
+  if (!allocator) {
+    allocator = &jsonLibcAllocator;
   }
-  JObject *obj = stringCache;
-  JEntry *toDel = NULL;
-  JItemValue valToDel = { 0 };
-  for (int i = 0; i < obj->_arraySize; ++i) {
-    if (obj->entries[i] != NULL) {
-      toDel = obj->entries[i];
-      valToDel = toDel->value;
-      //free(valToDel.ptr_val);
-      free(toDel->name);
-      free(toDel);
-    }
+  JsonContext *ctx = JMALLOC(allocator, sizeof(JsonContext));
+  if (!ctx) {
+    return 0;
   }
-  free(obj->entries);
-  free(obj);
-  stringCache = 0;
+  memset(ctx, 0, sizeof(JsonContext));
+  ctx->allocator = *allocator;
+  ctx->policy = (JsonInternPolicy) DEFAULT_POLICY;
+  return ctx;
 }
 
-JObject *jsonAddVal(JObject *obj, const char *name, JItemValue value, short type) {
-  if (!obj) {
-    obj = jsonNewObject();
+void jsonContextFree(JsonContext *ctx) {
+  if (!ctx || ctx == &defaultContext) {
+    return;
   }
+  JsonAllocator allocator = ctx->allocator;
+  jsonInternFree(ctx->strings);
+  freeShapes(&allocator, ctx->shapes);
+  JFREE(&allocator, ctx);
+}
 
-  if(type == 0) {
-    fprintf(stderr, "WARNING: Adding entry with invalid type to object for key %s\n", name);
+static JInternTable* getStringCache(JsonContext *ctx) {
+  if(ctx->strings == NULL) {
+    ctx->strings = jsonInternNew(&ctx->allocator);
+    if(ctx == &defaultContext && atexit(signalHandler) != 0) {
+      fprintf(stderr, "WARNING: Could not register cleanup function!");
+    }
   }
+  return ctx->strings;
+}
 
+JObject *jsonAddVal(JObject *obj, const char *name, JItemValue value, short type) {
   if(name == 0) {
 	fprintf(stderr, "Error: Name was null cannot add value to object\n");
 	fflush(stderr);
-	jsonPrintObject(stderr, obj);
+	if(obj) {
+	  jsonPrintObject(stderr, obj);
+	}
 	return 0;
   }
 
-  if(stringCache == NULL && stringCache != obj) {
-    stringCache = jsonNewObject();
-    if(atexit(signalHandler) != 0) {
-      fprintf(stderr, "WARNING: Could not register cleanup function!");
-    }
-  }
-  char *cached = NULL;
-  if(stringCache != NULL && stringCache != obj) {
-    cached = jsonString(stringCache, name);
-    if(cached == NULL) {
-      cached = strdup(name);
-      if(!cached) {
-    	  fprintf(stderr, "Error: Could not allocate memory for string\n");
-    	  return 0;
-      }
-      jsonAddString(stringCache, cached, cached);
-    }
+  JKey key = jsonContextIntern(obj ? obj->_ctx : &defaultContext, name, strlen(name));
+  if(!key.str) {
+    return 0;
   }
-  JEntry *entry = malloc(sizeof(JEntry));
-  if(!entry) {
-	printf(stderr, "Error: Could not allocate memory for object\n");
-	jsonPrintObject(stderr, obj);
-	return 0;
+  return jsonAddValKey(obj, key, value, type);
+}
+
+JObject *jsonAddValKey(JObject *obj, JKey key, JItemValue value, short type) {
+  if (!obj) {
+    obj = jsonNewObject();
   }
 
-  if(cached) {
-    entry->name = cached;
-  }else{
-	const char* nameDup = strdup(name);
-	if(!nameDup || errno) {
-	  fprintf(stderr, "Error: Could not allocate memory for string %s\n", strerror(errno));
-	  return 0;
-	}
-	entry->name = nameDup;
+  if(type == 0) {
+    fprintf(stderr, "WARNING: Adding entry with invalid type to object for key %s\n", key.str);
   }
-  entry->value_type = type;
-  entry->value = value;
-  entry->probes = 1;
-  entry->hash = fnvstr(entry->name);
-  entry = insertInto(entry, obj);
-
-  if (entry || obj->size == obj->_arraySize) {
-    //now determine to expand the entry array
-    JEntry **oldEntries = obj->entries;
-    int oldCount = obj->_arraySize;
-    obj->_arraySize += obj->_incrementSize;
-    obj->_incrementSize += (int)(obj->_arraySize * 0.1f);
-    obj->size = 0;
-    obj->entries = malloc(sizeof(JEntry*) * obj->_arraySize);
-    memset(obj->entries, 0, sizeof(JEntry*) * obj->_arraySize);
-    for (int i = 0; i < oldCount; ++i) {
-      if (oldEntries[i]) {
-        oldEntries[i]->probes = 1;
-        if (insertInto(oldEntries[i], obj) != 0) {
-          printf("Our new size did not spread the keys enough\n");
-        }
+  type = liveType(type, value);
+  touch(obj->_ctx);
+
+  if (obj->shape) {
+    int i = shapeSlot(obj->shape, key.str, key.hash);
+    if (i >= 0) {
+      // a repeated key keeps its position and releases the value it replaces
+      if (SLOT_VALUES(obj)[i].ptr_val != value.ptr_val || entryType(obj, i) != type) {
+        jsonFree(SLOT_VALUES(obj)[i], SLOT_TYPES(obj)[i]);
+      }
+      SLOT_VALUES(obj)[i] = value;
+      SLOT_TYPES(obj)[i] = type;
+      return obj;
+    }
+    JShape *next = shapeWith(obj, key);
+    if (next) {
+      if (obj->size == obj->_usable && !growSlots(obj)) {
+        fprintf(stderr, "Error: Could not allocate memory for object\n");
+        return 0;
       }
+      SLOT_VALUES(obj)[obj->size] = value;
+      SLOT_TYPES(obj)[obj->size] = type;
+      obj->shape = next;
+      obj->_used = ++obj->size;
+      return obj;
     }
-    if (entry) {
-      entry->probes = 0;
-      insertInto(entry, obj);
+    if (!toDictionary(obj)) {
+      fprintf(stderr, "Error: Could not allocate memory for object\n");
+      return 0;
+    }
+  }
+
+  char found = 0;
+  size_t slot = findSlot(obj, key.str, key.hash, &found);
+  if (found) {
+    JEntry *entry = &obj->entries[getSlot(obj, slot)];
+    if (entry->value.ptr_val != value.ptr_val || entryType(obj, getSlot(obj, slot)) != type) {
+      jsonFree(entry->value, entry->value_type);
+    }
+    entry->value = value;
+    entry->value_type = type;
+    return obj;
+  }
+
+  if (obj->_used == obj->_usable) {
+    if (!resizeObject(obj)) {
+      fprintf(stderr, "Error: Could not allocate memory for object\n");
+      return 0;
     }
-    free(oldEntries);
+    slot = findEmptySlot(obj, key.hash);
   }
 
+  JEntry *entry = &obj->entries[obj->_used];
+  entry->name = (char*)key.str;
+  entry->value = value;
+  entry->hash = key.hash;
+  entry->value_type = type;
+  setSlot(obj, slot, obj->_used);
+  ++obj->_used;
+  ++obj->size;
+
   return obj;
 }
 
@@ -212,198 +551,679 @@ JObject *jsonAddBool(JObject *obj, const char *name, const char value) {
   return jsonAddVal(obj, name, (JItemValue) { value }, VAL_BOOL);
 }
 
-JItemValue _jsonGetObjVal(const JObject *obj, const char* keys, short *type) {
-  if(!keys) {
-    return (JItemValue){ 0 };
+JItemValue jsonGetKey(const JObject *obj, JKey key, short *type) {
+  *type = 0;
+  int index = obj && key.str ? entryIndex(obj, key.str, key.hash) : -1;
+  if (index < 0) {
+    return (JItemValue) { 0 };
   }
-  int keyhash = fnvstr(keys);
-  int index = keyhash % obj->_arraySize;
+  *type = entryType(obj, index);
+  return *entryValue(obj, index);
+}
 
-  int probes = -1;
-  do {
-    // not found, keep probing
-    ++probes;
-    index = (keyhash + probes) % obj->_arraySize;
-    if (obj->entries[index] != 0 && obj->entries[index]->hash == keyhash) {
-      *type = obj->entries[index]->value_type;
-      return obj->entries[index]->value;
+/**
+ * Copies one key of a path into out unescaped, returns the separator after
+ * it or the end of the path, NULL on a bad escape.
+ */
+static const char* pathKey(const char *keys, char pointer, char *out, unsigned int *length) {
+  const char separator = pointer ? '/' : '.';
+  unsigned int n = 0;
+  for (; *keys && *keys != separator; ++keys) {
+    char c = *keys;
+    if (pointer && c == '~') {
+      // JSON Pointer: ~0 is a tilde, ~1 a slash
+      if (keys[1] != '0' && keys[1] != '1') {
+        return 0;
+      }
+      c = *++keys == '0' ? '~' : '/';
+    } else if (!pointer && c == '\\') {
+      // dotted: \. is a dot, \\ a backslash
+      if (keys[1] != '.' && keys[1] != '\\') {
+        return 0;
+      }
+      c = *++keys;
     }
-  } while (probes < obj->_maxProbes);
+    out[n++] = c;
+  }
+  out[n] = '\0';
+  *length = n;
+  return keys;
+}
 
-  return (JItemValue){ 0 };
+int jsonKeyPathInit(JKeyPath *path, const char *keys) {
+  path->keys = NULL;
+  path->depth = 0;
+  if (!keys || !*keys) {
+    return 0;
+  }
+
+  const char pointer = keys[0] == '/';
+  const char *begin = keys + pointer;
+  size_t length = strlen(begin);
+  unsigned int depth = 1; // escaped dots make this an upper bound
+  for (size_t i = 0; i < length; ++i) {
+    depth += begin[i] == (pointer ? '/' : '.');
+  }
+  path->keys = malloc(depth * sizeof(JKey) + length + depth);
+  if (!path->keys) {
+    return 0;
+  }
+
+  char *key = (char*) (path->keys + depth);
+  const char *next = begin;
+  for (;;) {
+    unsigned int keyLength = 0;
+    const char *end = pathKey(next, pointer, key, &keyLength);
+    if (!end) {
+      fprintf(stderr, "Error: Bad escape in path '%s'\n", keys);
+      jsonKeyPathFree(path);
+      return 0;
+    }
+    // JSON Pointer may name the empty key, a dotted path can not
+    if (!keyLength && !pointer) {
+      fprintf(stderr, "Error: Empty key in path '%s'\n", keys);
+      jsonKeyPathFree(path);
+      return 0;
+    }
+    path->keys[path->depth++] = (JKey) { key, fnvbuf(key, keyLength), keyLength };
+    if (!*end) {
+      return 1;
+    }
+    key += keyLength + 1;
+    next = end + 1;
+  }
 }
 
-int jsonGetEntryIndex(const JObject *obj, const char* keys) {
-  int keyhash = fnvstr(keys);
-  int index = keyhash % obj->_arraySize;
+JKeyPath* jsonPathCompile(const char *keys) {
+  JKeyPath *path = malloc(sizeof(JKeyPath));
+  if (path && !jsonKeyPathInit(path, keys)) {
+    free(path);
+    return 0;
+  }
+  return path;
+}
+
+void jsonPathFree(JKeyPath *path) {
+  if (path) {
+    jsonKeyPathFree(path);
+    free(path);
+  }
+}
+
+void jsonKeyPathFree(JKeyPath *path) {
+  free(path->keys);
+  path->keys = NULL;
+  path->depth = 0;
+}
 
-  int probes = -1;
-  do {
-    // not found, keep probing
-    ++probes;
-    index = (keyhash + probes) % obj->_arraySize;
-    if (obj->entries[index] != 0 && obj->entries[index]->hash == keyhash) {
-      return index;
+JItemValue jsonGetPath(const JObject *obj, const JKeyPath *path, short *type) {
+  JItemValue value = { 0 };
+  *type = 0;
+  for (unsigned int d = 0; path && d < path->depth; ++d) {
+    if (!obj) {
+      *type = 0;
+      return (JItemValue) { 0 };
     }
-  } while (probes < obj->_maxProbes);
+    value = jsonGetKey(obj, path->keys[d], type);
+    obj = *type == VAL_OBJ ? value.object_val : NULL;
+  }
+  return value;
+}
 
-  return -1;
+JItemValue jsonKeyPathGet(const JObject *obj, const JKeyPath *path, short *type) {
+  return jsonGetPath(obj, path, type);
+}
+
+/** Starts loading the first place a lookup of the key will read */
+static inline void prefetchKey(const JObject *obj, Fnv32_t hash) {
+  if (obj->shape) {
+    const JShape *shape = obj->shape;
+    __builtin_prefetch(shape->_index ? (const void*) &shape->_index[hash & shape->_indexMask] : (const void*) shape->keys);
+  } else {
+    size_t i = hash & (((size_t)1 << obj->_indexLog2) - 1);
+    size_t width = obj->_indexLog2 < 8 ? 1 : (obj->_indexLog2 < 16 ? 2 : 4);
+    __builtin_prefetch((const char*) obj->_index + i * width);
+  }
+}
+
+/** Finds the child of a trie node with the key, adding it when there is none */
+static unsigned int pathChild(JPathNode *nodes, unsigned int *count, unsigned int parent, const JKey *key) {
+  unsigned int *link = &nodes[parent].firstChild;
+  for (; *link; link = &nodes[*link].nextSibling) {
+    const JKey *known = &nodes[*link].key;
+    if (known->hash == key->hash && known->length == key->length && memcmp(known->str, key->str, key->length) == 0) {
+      return *link;
+    }
+  }
+  unsigned int child = (*count)++;
+  memset(&nodes[child], 0, sizeof(JPathNode));
+  nodes[child].key = *key;
+  ++nodes[parent].childCount;
+  *link = child;
+  return child;
+}
+
+JPathSet* jsonPathSetCompile(const char **keys, unsigned int count) {
+  JPathSet *set = malloc(sizeof(JPathSet));
+  if (!set) {
+    return 0;
+  }
+  memset(set, 0, sizeof(JPathSet));
+  set->_paths = malloc((count ? count : 1) * sizeof(JKeyPath));
+  set->_ends = malloc((count ? count : 1) * sizeof(unsigned int));
+  unsigned int maxNodes = 1;
+  for (unsigned int i = 0; set->_paths && set->_ends && i < count; ++i) {
+    if (!jsonKeyPathInit(&set->_paths[i], keys[i])) {
+      fprintf(stderr, "Error: Invalid path '%s' in path set\n", keys[i] ? keys[i] : "(null)");
+      jsonPathSetFree(set);
+      return 0;
+    }
+    ++set->count;
+    maxNodes += set->_paths[i].depth;
+  }
+  set->nodes = malloc(maxNodes * sizeof(JPathNode));
+  if (!set->_paths || !set->_ends || !set->nodes) {
+    jsonPathSetFree(set);
+    return 0;
+  }
+
+  // shared prefixes become one branch of the trie
+  memset(&set->nodes[0], 0, sizeof(JPathNode));
+  set->nodeCount = 1;
+  for (unsigned int i = 0; i < count; ++i) {
+    unsigned int node = 0;
+    for (unsigned int d = 0; d < set->_paths[i].depth; ++d) {
+      node = pathChild(set->nodes, &set->nodeCount, node, &set->_paths[i].keys[d]);
+    }
+    set->_ends[i] = node;
+  }
+  return set;
+}
+
+void jsonPathSetFree(JPathSet *set) {
+  if (!set) {
+    return;
+  }
+  for (unsigned int i = 0; set->_paths && i < set->count; ++i) {
+    jsonKeyPathFree(&set->_paths[i]);
+  }
+  free(set->_paths);
+  free(set->_ends);
+  free(set->nodes);
+  free(set);
+}
+
+/**
+ * Resolves the children of a trie node in obj, every lookup of a level is
+ * prefetched before the first one runs and so is every object it descends to.
+ */
+static void getChildren(const JObject *obj, const JPathSet *set, const JPathNode *node, JArrayItem *values) {
+  unsigned int n = node->childCount;
+  if (!n) {
+    return;
+  }
+  unsigned int children[n];
+  unsigned int c = node->firstChild;
+  for (unsigned int i = 0; i < n; ++i, c = set->nodes[c].nextSibling) {
+    children[i] = c;
+    prefetchKey(obj, set->nodes[c].key.hash);
+  }
+  for (unsigned int i = 0; i < n; ++i) {
+    JArrayItem *value = &values[children[i]];
+    short type = 0;
+    value->value = jsonGetKey(obj, set->nodes[children[i]].key, &type);
+    value->type = type;
+    if (value->type == VAL_OBJ && set->nodes[children[i]].childCount) {
+      __builtin_prefetch(value->value.object_val);
+    }
+  }
+  for (unsigned int i = 0; i < n; ++i) {
+    const JArrayItem *value = &values[children[i]];
+    if (value->type == VAL_OBJ && value->value.object_val && set->nodes[children[i]].childCount) {
+      getChildren(value->value.object_val, set, &set->nodes[children[i]], values);
+    }
+  }
+}
+
+unsigned int jsonPathSetGet(const JObject *obj, const JPathSet *set, JArrayItem *out) {
+  if (!set) {
+    return 0;
+  }
+  JArrayItem values[set->nodeCount];
+  memset(values, 0, set->nodeCount * sizeof(JArrayItem));
+  if (obj) {
+    getChildren(obj, set, &set->nodes[0], values);
+  }
+  unsigned int found = 0;
+  for (unsigned int i = 0; i < set->count; ++i) {
+    out[i] = values[set->_ends[i]];
+    found += out[i].type != 0;
+  }
+  return found;
+}
+
+unsigned int jsonGetMany(const JObject *obj, const char **keys, unsigned int count, JArrayItem *out) {
+  memset(out, 0, count * sizeof(JArrayItem));
+  JPathSet *set = jsonPathSetCompile(keys, count);
+  unsigned int found = jsonPathSetGet(obj, set, out);
+  jsonPathSetFree(set);
+  return found;
 }
 
 JItemValue jsonGet(const JObject *obj, const char* keys, short *type) {
+  *type = 0;
   if (obj == 0 || keys == NULL) {
     return (JItemValue) { 0 };
   }
 
+  // each key is unescaped into a stack buffer, only keys this long use the heap
+  char stackKey[KEY_STACK_BYTES];
+  char *key = stackKey;
+  size_t length = strlen(keys);
+  if (length >= KEY_STACK_BYTES && !(key = malloc(length + 1))) {
+    return (JItemValue) { 0 };
+  }
+
+  // the same keys jsonKeyPathInit splits, read in place
+  const char pointer = keys[0] == '/';
   JItemValue jval = { 0 };
   const JObject *found = obj;
-  char *key = NULL;
-  int index = 0;
-  do {
-    key = nextKey(keys, &index);
-    jval = _jsonGetObjVal(found, key, type);
-    if (jval.ptr_val && *type == VAL_OBJ) {
-      found = jval.object_val;
-    } else if (key && index > -1) {
-      if (jval.ptr_val) {
-        printf("Err: Key %s was the wrong type.\n", keys);
-      } else {
-        printf("Err: Object did not contain a next object %s\n", keys);
-      }
-      if (key) {
-        free(key);
-      }
-      return (JItemValue) { 0 };
+  const char *next = keys + pointer;
+  for (;;) {
+    unsigned int keyLength = 0;
+    const char *end = pathKey(next, pointer, key, &keyLength);
+    int index = end ? entryIndex(found, key, fnvbuf(key, keyLength)) : -1;
+    if (index < 0) {
+      *type = 0;
+      jval = (JItemValue) { 0 };
+      break;
     }
-
-    if (key != NULL) {
-      free(key);
-      key = NULL;
+    *type = entryType(found, index);
+    jval = *entryValue(found, index);
+    if (!*end) {
+      break;
     }
-  } while (index > -1);
+    if (*type != VAL_OBJ || !jval.object_val) {
+      *type = 0;
+      jval = (JItemValue) { 0 };
+      break;
+    }
+    found = jval.object_val;
+    next = end + 1;
+  }
 
+  if (key != stackKey) {
+    free(key);
+  }
   return jval;
 }
 
-char *last(const char *keys) {
-  if (!keys) {
+char *getOrCacheString(const char* value) {
+  if(!value) {
     return 0;
   }
+  return (char*)jsonInternKey(value, strlen(value)).str;
+}
 
-  int len = strlen(keys);
-  const char *lastDot = keys + len;
-  const char* end = lastDot;
-  while (*lastDot != '.' && lastDot > keys) {
-    --lastDot;
-  }
-  if (keys == lastDot) {
-    return strdup(keys);
+JKey jsonInternKey(const char *value, unsigned int length) {
+  return jsonContextIntern(&defaultContext, value, length);
+}
+
+JKey jsonContextIntern(JsonContext *ctx, const char *value, unsigned int length) {
+  if (ctx->shared) {
+    return jsonSharedIntern(ctx->shared, value, length, fnvbuf(value, length));
   }
+  return jsonIntern(getStringCache(ctx), value, length);
+}
 
-  ++lastDot;
+void jsonInternStats(JInternStats *stats) {
+  jsonContextInternStats(&defaultContext, stats);
+}
 
-  if ((end - lastDot) <= 0) {
-    return 0;
+void jsonContextInternStats(const JsonContext *ctx, JInternStats *stats) {
+  if (ctx->shared) {
+    jsonSharedInternStats(ctx->shared, stats);
+    return;
   }
+  jsonInternTableStats(ctx->strings, stats);
+}
 
-  char *newkeys = malloc((end - lastDot) + 1);
-  memset(newkeys, 0, (end - lastDot) + 1);
-  strncpy(newkeys, lastDot, end - lastDot);
-  return newkeys;
+void jsonSetInternPolicy(const JsonInternPolicy *policy) {
+  jsonContextSetInternPolicy(&defaultContext, policy);
 }
 
-char *allButLast(const char *keys) {
-  if (!keys) {
-    return 0;
-  }
+void jsonGetInternPolicy(JsonInternPolicy *policy) {
+  *policy = defaultContext.policy;
+}
+
+void jsonContextSetInternPolicy(JsonContext *ctx, const JsonInternPolicy *policy) {
+  ctx->policy = *policy;
+  memset(ctx->sampleCounts, 0, sizeof(ctx->sampleCounts));
+  ctx->sampleSeen = 0;
+}
+
+void jsonContextSetSharedIntern(JsonContext *ctx, JSharedIntern *shared) {
+  ctx->shared = shared;
+}
 
-  int len = strlen(keys);
-  const char *last = keys + len;
-  while (*last != '.' && last > keys) {
-    --last;
+/**
+ * Counts a value in a small saturating sketch that is halved every so
+ * often, so only values that keep recurring reach the threshold.
+ */
+static int sampledEnough(JsonContext *ctx, Fnv32_t hash) {
+  if (++ctx->sampleSeen >= SAMPLE_DECAY) {
+    for (int i = 0; i < JSON_SAMPLE_SLOTS; ++i) {
+      ctx->sampleCounts[i] >>= 1;
+    }
+    ctx->sampleSeen = 0;
   }
+  unsigned char *count = &ctx->sampleCounts[hash & (JSON_SAMPLE_SLOTS - 1)];
+  if (*count < 255) {
+    ++*count;
+  }
+  return *count >= ctx->policy.sampleHits;
+}
 
-  if (keys == last) {
+static int shouldInternValue(JsonContext *ctx, unsigned int length, Fnv32_t hash) {
+  const JsonInternPolicy *policy = &ctx->policy;
+  if (policy->maxBytes) {
+    size_t bytes = ctx->shared ? jsonSharedInternBytes(ctx->shared)
+        : ctx->strings ? ctx->strings->bytes : 0;
+    if (bytes >= policy->maxBytes) {
+      return 0;
+    }
+  }
+  switch (policy->mode) {
+  case JSON_INTERN_ALL:
+    return 1;
+  case JSON_INTERN_SHORT:
+    return length <= policy->maxLength;
+  case JSON_INTERN_SAMPLED:
+    return sampledEnough(ctx, hash);
+  default:
     return 0;
   }
-
-  char *newkeys = malloc((last - keys) + 1);
-  memset(newkeys, 0, (last - keys) + 1);
-  strncpy(newkeys, keys, last - keys);
-  return newkeys;
 }
 
-char *getOrCacheString(const char* value) {
-  if(stringCache == NULL) {
-    stringCache = jsonNewObject();
-    if(atexit(signalHandler) != 0) {
-      fprintf(stderr, "WARNING: Could not register cleanup function!");
+char* jsonCacheValue(JsonContext *ctx, JInternTable **document, const char *value, unsigned int length) {
+  Fnv32_t hash = fnvbuf(value, length);
+  if (shouldInternValue(ctx, length, hash)) {
+    if (ctx->shared) {
+      return (char*)jsonSharedIntern(ctx->shared, value, length, hash).str;
     }
+    return (char*)jsonInternHashed(getStringCache(ctx), value, length, hash).str;
   }
-  short type;
-  if(stringCache != NULL) {
-    char* cached = NULL;
-    cached = _jsonGetObjVal(stringCache, value, &type).string_val;
-    if(cached == NULL) {
-      const char* duped = strdup(value);
-      if(!duped || errno) {
-    	  fprintf(stderr, "ERROR: Caches String copy failed for %s\n", value);
-    	  fprintf(stderr, "ERROR: %s", strerror(errno));
-    	  return 0;
-      }
-      cached = duped;
-      jsonAddVal(stringCache, cached, (JItemValue) { cached }, VAL_STRING);
-      return cached;
-    }else{
-      return cached;
+
+  // already shared with other documents, no need for another copy
+  JKey cached = ctx->shared ? jsonSharedInternFind(ctx->shared, value, length, hash)
+      : jsonInternFind(ctx->strings, value, length, hash);
+  if (cached.str) {
+    return (char*)cached.str;
+  }
+
+  if (!*document) {
+    *document = jsonInternNew(&ctx->allocator);
+    if (!*document) {
+      fprintf(stderr, "Error: Could not allocate document strings\n");
+      return 0;
     }
   }
-  return strdup(value);
+  return (char*)jsonInternHashed(*document, value, length, hash).str;
 }
 
 JObject *jsonNewObject() {
-  JObject *obj = malloc(sizeof(JObject));
-  obj->_incrementSize = DEFAULT_INC_AMOUNT;
-  obj->_arraySize = DEFAULT_HASH_SIZE;
-  obj->_maxProbes = obj->_arraySize / 5;
-  obj->size = 0;
-  obj->entries = malloc(sizeof(JEntry*) * obj->_arraySize);
-  memset(obj->entries, 0, sizeof(JEntry*) * obj->_arraySize);
+  return jsonContextNewObject(&defaultContext);
+}
+
+JObject *jsonContextNewObject(JsonContext *ctx) {
+  JObject *obj = JMALLOC(&ctx->allocator, sizeof(JObject));
+  if (!obj) {
+    return 0;
+  }
+  memset(obj, 0, sizeof(JObject));
+  obj->value_type = VAL_OBJ;
+  obj->_ctx = ctx;
+  obj->shape = rootShape(ctx);
+  if (!obj->shape && !allocKeys(obj, USABLE(1 << MIN_INDEX_LOG2))) {
+    JFREE(&ctx->allocator, obj);
+    return 0;
+  }
   return obj;
 }
 
 JArray* jsonNewArray() {
-  JArray *arr = malloc(sizeof(JArray));
+  return jsonContextNewArray(&defaultContext);
+}
+
+JArray* jsonContextNewArray(JsonContext *ctx) {
+  JArray *arr = JMALLOC(&ctx->allocator, sizeof(JArray));
+  if (!arr) {
+    return 0;
+  }
+  memset(arr, 0, sizeof(JArray));
   arr->type = VAL_MIXED_ARRAY;
   arr->count = 0;
-  arr->_internal.vItems = NULL;
+  arr->capacity = 0;
+  arr->_internal.mItems = NULL;
+  arr->_ctx = ctx;
   return arr;
 }
 
-JArray* jsonAddArrayItem(JArray *arr, JArrayItem *item) {
-  JArrayItem **items = malloc(sizeof(JArrayItem*)*(arr->count+1));
-  JArrayItem **fromArray = arr->_internal.vItems;
-  unsigned i = 0;
-  for(; i < arr->count; ++i) {
-    items[i] = fromArray[i];
+#define IS_TAGGED(t)  ((t) == VAL_MIXED_ARRAY || (t) == VAL_OBJ_ARRAY)
+#define IS_NUMERIC(t) ((t) == VAL_INT_ARRAY || (t) == VAL_FLOAT_ARRAY || (t) == VAL_DOUBLE_ARRAY)
+#define FLOAT_EXACT   16777216 // ints up to 2^24 survive a trip through float
+#define FITS_FLOAT(i) ((i) <= FLOAT_EXACT && (i) >= -FLOAT_EXACT)
+
+static unsigned char elementType(unsigned char arrayType) {
+  switch (arrayType) {
+  case VAL_STRING_ARRAY: return VAL_STRING;
+  case VAL_INT_ARRAY:    return VAL_INT;
+  case VAL_FLOAT_ARRAY:  return VAL_FLOAT;
+  case VAL_DOUBLE_ARRAY: return VAL_DOUBLE;
+  case VAL_BOOL_ARRAY:   return VAL_BOOL;
+  default:               return 0;
+  }
+}
+
+static unsigned char arrayTypeOf(unsigned char type) {
+  switch (type) {
+  case VAL_STRING: return VAL_STRING_ARRAY;
+  case VAL_INT:    return VAL_INT_ARRAY;
+  case VAL_FLOAT:  return VAL_FLOAT_ARRAY;
+  case VAL_DOUBLE: return VAL_DOUBLE_ARRAY;
+  case VAL_BOOL:   return VAL_BOOL_ARRAY;
+  case VAL_OBJ:    return VAL_OBJ_ARRAY;
+  default:         return VAL_MIXED_ARRAY;
+  }
+}
+
+static size_t itemSize(unsigned char arrayType) {
+  switch (arrayType) {
+  case VAL_STRING_ARRAY: return sizeof(char*);
+  case VAL_INT_ARRAY:    return sizeof(int);
+  case VAL_FLOAT_ARRAY:  return sizeof(float);
+  case VAL_DOUBLE_ARRAY: return sizeof(double);
+  case VAL_BOOL_ARRAY:   return sizeof(unsigned char);
+  default:               return sizeof(JArrayItem);
   }
-  items[i] = item;
-  if(arr->_internal.vItems) {
-    free(arr->_internal.vItems);
+}
+
+/** Reads an item of a packed array back as a value of its element type */
+static JItemValue packedGet(const JArray *arr, unsigned int i) {
+  switch (arr->type) {
+  case VAL_STRING_ARRAY: return (JItemValue) { .string_val = arr->_internal.strings[i] };
+  case VAL_INT_ARRAY:    return (JItemValue) { .int_val = arr->_internal.ints[i] };
+  case VAL_FLOAT_ARRAY:  return (JItemValue) { .float_val = arr->_internal.floats[i] };
+  case VAL_DOUBLE_ARRAY: return (JItemValue) { .double_val = arr->_internal.doubles[i] };
+  case VAL_BOOL_ARRAY:   return (JItemValue) { .char_val = arr->_internal.bools[i] };
+  default:               return arr->_internal.mItems[i].value;
   }
-  arr->_internal.vItems = items;
-  ++arr->count;
+}
+
+/**
+ * The double of the shortest text a float is written as, so 1.023f widens
+ * to 1.023 and not to 1.0230000019073486, digits the source never had
+ */
+static double widenFloat(float value) {
+  char text[JSON_NUMBER_CHARS + 1];
+  if (!(value - value == 0)) {
+    return value; // NaN and infinities are written as null
+  }
+  text[jsonFormatFloat(value, text)] = '\0';
+  return strtod(text, NULL);
+}
+
+static double numberOf(unsigned char type, JItemValue value) {
+  return type == VAL_INT ? value.int_val
+      : type == VAL_FLOAT ? widenFloat(value.float_val) : value.double_val;
+}
+
+static void packedSet(JArray *arr, unsigned int i, unsigned char type, JItemValue value) {
+  switch (arr->type) {
+  case VAL_STRING_ARRAY: arr->_internal.strings[i] = value.string_val; break;
+  case VAL_INT_ARRAY:    arr->_internal.ints[i] = value.int_val; break;
+  case VAL_FLOAT_ARRAY:  arr->_internal.floats[i] = type == VAL_FLOAT ? value.float_val : (float) numberOf(type, value); break;
+  case VAL_DOUBLE_ARRAY: arr->_internal.doubles[i] = numberOf(type, value); break;
+  case VAL_BOOL_ARRAY:   arr->_internal.bools[i] = value.char_val; break;
+  default:
+    arr->_internal.mItems[i].type = type;
+    arr->_internal.mItems[i].value = value;
+  }
+}
+
+JArray* jsonArrayReserve(JArray *arr, unsigned int capacity) {
+  if (!arr) {
+    return 0;
+  }
+  if (capacity <= arr->capacity) {
+    return arr;
+  }
+  void *items = JREALLOC(&arr->_ctx->allocator, arr->_internal.items,
+      (size_t) capacity * itemSize(arr->type));
+  if (!items) {
+    fprintf(stderr, "Error: Could not grow array to %u items\n", capacity);
+    return 0;
+  }
+  arr->_internal.items = items;
+  arr->capacity = capacity;
   return arr;
 }
 
-JArray* jsonAddArrayItemObject(JArray *arr, JObject *obj) {
-  JArrayItem *item = malloc(sizeof(JArrayItem));
-  item->type = VAL_OBJ;
-  item->value = (JItemValue) { obj };
-  jsonAddArrayItem(arr, item);
+/** Rewrites the items of a packed array with another layout */
+static JArray* convertArray(JArray *arr, unsigned char toType) {
+  const JsonAllocator *allocator = &arr->_ctx->allocator;
+  if (arr->count == 0) {
+    // nothing to convert, keep whatever was reserved
+    arr->capacity = arr->capacity * itemSize(arr->type) / itemSize(toType);
+    arr->type = toType;
+    return arr;
+  }
+
+  JArray to = *arr;
+  to.type = toType;
+  to._internal.items = JMALLOC(allocator, arr->capacity * itemSize(toType));
+  if (!to._internal.items) {
+    fprintf(stderr, "Error: Could not convert array\n");
+    return 0;
+  }
+  unsigned char type = elementType(arr->type);
+  for (unsigned int i = 0; i < arr->count; ++i) {
+    packedSet(&to, i, type, packedGet(arr, i));
+  }
+  JFREE(allocator, arr->_internal.items);
+  *arr = to;
+  return arr;
+}
+
+/** Picks the narrowest numeric layout holding both the array and value */
+static unsigned char widenNumeric(const JArray *arr, unsigned char type, JItemValue value) {
+  if (arr->type == VAL_DOUBLE_ARRAY || type == VAL_DOUBLE) {
+    return VAL_DOUBLE_ARRAY;
+  }
+  if (arr->type == VAL_FLOAT_ARRAY) {
+    return type == VAL_INT && !FITS_FLOAT(value.int_val) ? VAL_DOUBLE_ARRAY : VAL_FLOAT_ARRAY;
+  }
+  if (type == VAL_FLOAT) {
+    for (unsigned int i = 0; i < arr->count; ++i) {
+      if (!FITS_FLOAT(arr->_internal.ints[i])) {
+        return VAL_DOUBLE_ARRAY;
+      }
+    }
+    return VAL_FLOAT_ARRAY;
+  }
+  return arr->type;
+}
+
+static JArray* arrayPush(JArray *arr, unsigned char type, JItemValue value) {
+  if (!arr) {
+    return 0;
+  }
+  touch(arr->_ctx);
+  if (arr->count == 0) {
+    // an empty array takes the layout of its first item
+    if (arr->type != arrayTypeOf(type) && !convertArray(arr, arrayTypeOf(type))) {
+      return 0;
+    }
+  } else if (!IS_TAGGED(arr->type) && elementType(arr->type) != type) {
+    unsigned char toType = IS_NUMERIC(arr->type) && IS_NUMERIC(arrayTypeOf(type))
+        ? widenNumeric(arr, type, value) : VAL_MIXED_ARRAY;
+    if (toType != arr->type && !convertArray(arr, toType)) {
+      return 0;
+    }
+  }
+  if (arr->type == VAL_OBJ_ARRAY && type != VAL_OBJ) {
+    arr->type = VAL_MIXED_ARRAY;
+  }
+  if (arr->count == arr->capacity) {
+    unsigned int capacity = arr->capacity ? arr->capacity * 2 : ARRAY_MIN_CAPACITY;
+    if (capacity < arr->capacity || !jsonArrayReserve(arr, capacity)) {
+      return 0;
+    }
+  }
+  packedSet(arr, arr->count++, type, value);
   return arr;
 }
 
+JArray* jsonAddArrayItem(JArray *arr, const JArrayItem *item) {
+  return arrayPush(arr, item->type, item->value);
+}
+
+JArray* jsonAddArrayItemObject(JArray *arr, JObject *obj) {
+  return jsonArrayPushObject(arr, obj);
+}
+
+JArray* jsonArrayPushInt(JArray *arr, int value) {
+  return arrayPush(arr, VAL_INT, (JItemValue) { .int_val = value });
+}
+
+JArray* jsonArrayPushUInt(JArray *arr, unsigned int value) {
+  return arrayPush(arr, VAL_UINT, (JItemValue) { .int_val = (int) value });
+}
+
+JArray* jsonArrayPushFloat(JArray *arr, float value) {
+  return arrayPush(arr, VAL_FLOAT, (JItemValue) { .float_val = value });
+}
+
+JArray* jsonArrayPushDouble(JArray *arr, double value) {
+  return arrayPush(arr, VAL_DOUBLE, (JItemValue) { .double_val = value });
+}
+
+JArray* jsonArrayPushBool(JArray *arr, char value) {
+  return arrayPush(arr, VAL_BOOL, (JItemValue) { .char_val = value });
+}
+
+JArray* jsonArrayPushString(JArray *arr, const char *value) {
+  return arrayPush(arr, VAL_STRING, (JItemValue) { .string_val = (char*) value });
+}
+
+JArray* jsonArrayPushObject(JArray *arr, JObject *value) {
+  return arrayPush(arr, VAL_OBJ, (JItemValue) { .object_val = value });
+}
+
+JArray* jsonArrayPushArray(JArray *arr, JArray *value) {
+  return arrayPush(arr, value->type, (JItemValue) { .array_val = value });
+}
+
 int jsonInt(const JObject *obj, const char* keys) {
   short type = 0;
   JItemValue val = jsonGet(obj, keys, &type);
@@ -442,68 +1262,28 @@ double jsonDouble(const JObject *obj, const char* keys) {
 }
 
 char* jsonString(const JObject *obj, const char* keys) {
-  if (keys == NULL || obj == NULL) {
-    return NULL;
-  }
-  char *firstKeys = allButLast(keys);
-  const JObject *parentObj = obj;
-
-  if (firstKeys != NULL) {
-    parentObj = jsonObject(obj, firstKeys);
-    free(firstKeys);
-  }
-
-  if (parentObj != NULL) {
-    char *lastKey = last(keys);
-    if (lastKey != NULL) {
-      short type = 0;
-      JItemValue val = jsonGet(parentObj, lastKey, &type);
-      free(lastKey);
-      if (val.string_val && type == VAL_STRING) {
-        return val.string_val;
-      }
-    }
+  short type = 0;
+  JItemValue val = jsonGet(obj, keys, &type);
+  if (val.string_val && type == VAL_STRING) {
+    return val.string_val;
   }
-
   return NULL;
 }
 
 char jsonBool(const JObject* obj, const char* keys) {
-  if (keys == NULL) {
-    return -1;
-  }
-  char *firstKeys = allButLast(keys);
-  const JObject *parentObj = obj;
-
-  if (firstKeys != NULL) {
-    parentObj = jsonObject(obj, firstKeys);
-    free(firstKeys);
-  }
-
-  if (parentObj != NULL) {
-    char *lastKey = last(keys);
-    if (lastKey != NULL) {
-      short type = 0;
-      JItemValue val = jsonGet(parentObj, lastKey, &type);
-      free(lastKey);
-      if (type == VAL_BOOL) {
-        return val.char_val;
-      }
-    }
+  short type = 0;
+  JItemValue val = jsonGet(obj, keys, &type);
+  if (type == VAL_BOOL) {
+    return val.char_val;
   }
-
   return -1;
 }
 
 char* jsonBoolArray(const JObject *obj, const char* keys) {
-  short type = 0;
-  JArray *val = jsonGet(obj, keys, &type).array_val;
-  if (val && type == VAL_BOOL_ARRAY && val->count > 0) {
-    JItemValue *items = val->_internal.items;
+  JArray *val = jsonArray(obj, keys);
+  if (val && val->type == VAL_BOOL_ARRAY && val->count > 0) {
     char *ret = malloc(val->count);
-    for(int i = 0; i < val->count; ++i) {
-      ret[i] = (&items[i])->char_val;
-    }
+    memcpy(ret, val->_internal.bools, val->count);
     return ret;
   }
   return NULL;
@@ -512,227 +1292,94 @@ char* jsonBoolArray(const JObject *obj, const char* keys) {
 JArray* jsonArray(const JObject* obj, const char* keys) {
   short type;
   JItemValue value = jsonGet(obj, keys, &type);
-  char isArray = (type == VAL_MIXED_ARRAY || type == VAL_OBJ_ARRAY || type == VAL_INT_ARRAY || type == VAL_DOUBLE_ARRAY || type == VAL_FLOAT_ARRAY || type == VAL_BOOL_ARRAY);
+  char isArray = (type >= VAL_STRING_ARRAY && type <= VAL_MIXED_ARRAY);
   if(isArray) {
     return value.array_val;
   }
   return NULL;
 }
 
-int** jsonIntArray(const JObject* obj, const char* keys) {
-  return NULL;
+static void* packedArray(const JObject* obj, const char* keys, unsigned char arrayType, unsigned *count) {
+  JArray *arr = jsonArray(obj, keys);
+  if (!arr || arr->type != arrayType) {
+    if (count) {
+      *count = 0;
+    }
+    return NULL;
+  }
+  if (count) {
+    *count = arr->count;
+  }
+  return arr->_internal.items;
 }
 
-float** jsonFoatArray(const JObject* obj, const char* keys) {
-  return NULL;
+const int* jsonIntArray(const JObject* obj, const char* keys, unsigned *count) {
+  return packedArray(obj, keys, VAL_INT_ARRAY, count);
 }
 
-double** jsonDoubleArray(const JObject* obj, const char* keys) {
-  return NULL;
+const float* jsonFoatArray(const JObject* obj, const char* keys, unsigned *count) {
+  return packedArray(obj, keys, VAL_FLOAT_ARRAY, count);
 }
 
-char** jsonStringArray(const JObject* obj, const char* keys) {
-  return NULL;
+const double* jsonDoubleArray(const JObject* obj, const char* keys, unsigned *count) {
+  return packedArray(obj, keys, VAL_DOUBLE_ARRAY, count);
 }
 
-const char** jsonKeys(const JObject *obj, unsigned *size) {
-  const char** keys = malloc(sizeof(const char*)*obj->size);
-  size = obj->size;
-  unsigned left = obj->size;
-  for(unsigned e = 0; e < obj->_arraySize; ++e) {
-    keys[left--] = obj->entries[e]->name;
-  }
-
-  return keys;
+char* const* jsonStringArray(const JObject* obj, const char* keys, unsigned *count) {
+  return packedArray(obj, keys, VAL_STRING_ARRAY, count);
 }
 
-JArrayItem **jsonArrayItemList(JArray *array) {
-  return array->_internal.vItems;
-}
-
-JObject **jsonArrayKeyFilter(JArray* array, const char *key, unsigned *size) {
-  JArrayItem **items = jsonArrayItemList(array);
-  JObject** toRet = NULL;
-  JObject* found[256];
-  memset(&found, 0, sizeof(JObject*)*256);
-  int count = 0;
-  unsigned totalFound = 0;
-  for (int i = 0; i < array->count; ++i) {
-    JArrayItem *item = items[i];
-    if (item->type == VAL_OBJ) {
-      JObject *toEval = item->value.object_val;
-      if(jsonObject(toEval, key)) {
-        found[count] = toEval;
-        ++count;
-        if(count >= 256) {
-          if(!toRet) {
-            free(toRet);
-          }
-          toRet = (JObject**)malloc(sizeof(JObject*)*count);
-          memcpy(toRet, &found, sizeof(JObject*));
-          memset(&found, 0, sizeof(JObject*)*count);
-          totalFound += count;
-          count = 0;
-        }
-      }
+const char** jsonKeys(const JObject *obj, unsigned *size) {
+  if (!obj) {
+    return NULL;
+  }
+  const char** keys = malloc(sizeof(const char*) * (obj->size ? obj->size : 1));
+  unsigned count = 0;
+  for (unsigned e = 0; e < obj->_used; ++e) {
+    if (entryName(obj, e)) {
+      keys[count++] = entryName(obj, e);
     }
   }
-  if(!toRet) {
-    free(toRet);
+  if (size) {
+    *size = count;
   }
-  toRet = (JObject**)malloc(sizeof(JObject*)*count);
-  memcpy(toRet, &found, sizeof(JObject*));
-  memset(&found, 0, sizeof(JObject*)*count);
-  totalFound += count;
-  *size = count;
-  return toRet;
+  return keys;
 }
 
-JObject* jsonObject(const JObject* obj, const char* keys) {
-  if (obj == 0 || !keys) {
-    return 0;
-  }
-
-  int index = 0;
-  short type = 0;
-  char *key = nextKey(keys, &index);
-  JItemValue jval = jsonGet(obj, key, &type);
-  if (!jval.ptr_val || type != VAL_OBJ) {
-    free(key);
+int jsonEntryAt(const JObject *obj, unsigned int i, const char **name, JItemValue *value, short *type) {
+  if (!obj || i >= obj->_used || !entryName(obj, i)) {
     return 0;
   }
-
-  JObject *found = jval.object_val;
-  while (index > -1 && found != 0) {
-    free(key);
-    key = nextKey(keys, &index);
-    printf("Looking for key %s\n", key);
-    jval = jsonGet(found, key, &type);
-    if (jval.ptr_val && type == VAL_OBJ) {
-      found = jval.object_val;
-    } else if (key) {
-      if (jval.ptr_val) {
-        printf("Err: Key %s was the wrong type.\n", key);
-      } else {
-        printf("Err: Object did not contains a next object %s\n", key);
-      }
-      return 0;
-    }
-  }
-  free(key);
-  return found;
+  *name = entryName(obj, i);
+  *value = *entryValue(obj, i);
+  *type = entryType(obj, i);
+  return 1;
 }
 
-void jsonPrintEntryInc(const FILE *io, unsigned char type, JItemValue* value, unsigned int tabs, unsigned int tabInc) {
-  if (type == VAL_INT) {
-    fprintf(io, "%d", value->int_val);
-  } else if (type == VAL_FLOAT) {
-    fprintf(io, "%f", value->float_val);
-  } else if (type == VAL_DOUBLE) {
-    fprintf(io, "%e", value->double_val);
-  } else if (type == VAL_STRING) {
-    fprintf(io, "\"%s\"", value->string_val);
-  } else if (type == VAL_BOOL) {
-    if (value->char_val) {
-      fprintf(io, "%s", "true");
-    } else {
-      fprintf(io, "%s", "false");
-    }
-  } else if (type == VAL_BOOL_ARRAY) {
-    fprintf(io, "[");
-    JItemValue *bools = value->array_val->_internal.items;
-    for(int i = 0; i < value->array_val->count; ++i) {
-      JItemValue *boolVal = &bools[i];
-      jsonPrintEntryInc(io, VAL_BOOL, boolVal, tabs, tabInc);
-      if(i != value->array_val->count-1) {
-        fprintf(io, ",");
-      }
-    }
-    fprintf(io, "]");
-  } else if (type == VAL_INT_ARRAY) {
-    fprintf(io, "[");
-    JItemValue *ints = value->array_val->_internal.items;
-    for(int i = 0; i < value->array_val->count; ++i) {
-      JItemValue *intVal = &ints[i];
-      jsonPrintEntryInc(io, VAL_INT, intVal, tabs, tabInc);
-      if(i != value->array_val->count-1) {
-        fprintf(io, ",");
-      }
-    }
-    fprintf(io, "]");
-  } else if (type == VAL_FLOAT_ARRAY) {
-    fprintf(io, "[");
-    JItemValue *floats = value->array_val->_internal.items;
-    for(int i = 0; i < value->array_val->count; ++i) {
-      JItemValue *floatVal = &floats[i];
-      jsonPrintEntryInc(io, VAL_FLOAT, floatVal, tabs, tabInc);
-      if(i != value->array_val->count-1) {
-        fprintf(io, ",");
-      }
-    }
-    fprintf(io, "]");
-  } else if (type == VAL_DOUBLE_ARRAY) {
-    fprintf(io, "[");
-    JItemValue *doubles = value->array_val->_internal.items;
-    for(int i = 0; i < value->array_val->count; ++i) {
-      JItemValue *doubleVal = &doubles[i];
-      jsonPrintEntryInc(io, VAL_DOUBLE, doubleVal, tabs, tabInc);
-      if(i != value->array_val->count-1) {
-        fprintf(io, ",");
-      }
-    }
-    fprintf(io, "]");
-  } else if (type == VAL_MIXED_ARRAY) {
-    fprintf(io, "[");
-    JArrayItem **values = value->array_val->_internal.vItems;
-    for(int i = 0; i < value->array_val->count; ++i) {
-      JArrayItem *val = values[i];
-      jsonPrintEntryInc(io, val->type, &val->value, tabs, tabInc);
-      if(i != value->array_val->count-1) {
-        fprintf(io, ",");
-      }
-    }
-    fprintf(io, "]");
-  } else if (type == VAL_OBJ) {
-    jsonPrintObjectTabs(io, value->object_val, tabs, tabInc);
-  }
-}
-
-void jsonPrintEntry(const FILE *io, const unsigned short type, const JItemValue *value) {
-  jsonPrintEntryInc(io, type, value, 0, 2);
+JArrayItem *jsonArrayItemList(JArray *array) {
+  return array && IS_TAGGED(array->type) ? array->_internal.mItems : NULL;
 }
 
-void jsonPrintObjectTabs(const FILE *io, const JObject* obj, unsigned int tabs, unsigned int tabInc) {
-  tabs+=tabInc;
-  char strTabs[tabs+1];
-  memset(strTabs, ' ', tabs+1);
-  strTabs[tabs] = '\0';
-
-  fprintf(io, "{\n");
-  unsigned char type = -1;
-  JEntry* entry;
-
-  int count = 0;
-  for(int i = 0; i < obj->_arraySize; ++i) {
-    entry = obj->entries[i];
-    if(entry) {
-      ++count;
-      type = entry->value_type;
-      char *comma = ",";
-      if(count == obj->size) {
-        comma = ""; //last element
-      }
-      fprintf(io, "%s\"%s\": ", strTabs, entry->name);
-      jsonPrintEntryInc(io, entry->value_type, &entry->value, tabs, tabInc);
-      fprintf(io, "%s\n", comma);
-    }
+JItemValue jsonArrayGet(const JArray *array, unsigned int i, short *type) {
+  if (!array || i >= array->count) {
+    *type = 0;
+    return (JItemValue) { 0 };
+  }
+  if (IS_TAGGED(array->type)) {
+    *type = liveType(array->_internal.mItems[i].type, array->_internal.mItems[i].value);
+    return array->_internal.mItems[i].value;
   }
-  strTabs[tabs-tabInc] = '\0';
-  fprintf(io, "%s}", strTabs);
+  *type = elementType(array->type);
+  return packedGet(array, i);
 }
 
-void jsonPrintObject(const FILE *io, const JObject* obj) {
-  jsonPrintObjectTabs(io, obj, 0, 2);
+JObject* jsonObject(const JObject* obj, const char* keys) {
+  short type = 0;
+  JItemValue jval = jsonGet(obj, keys, &type);
+  if (!jval.ptr_val || type != VAL_OBJ) {
+    return 0;
+  }
+  return jval.object_val;
 }
 
 void jsonFree(JItemValue val, const short vtype) {
@@ -742,51 +1389,30 @@ void jsonFree(JItemValue val, const short vtype) {
 
   if (vtype == VAL_OBJ) {
     JObject *obj = val.object_val;
-    if(obj == stringCache) {
-      return;
-    }
-    JEntry *toDel = NULL;
-    JItemValue valToDel = { 0 };
-    for (int i = 0; i < obj->_arraySize; ++i) {
-      if (obj->entries[i] != NULL) {
-        toDel = obj->entries[i];
-        valToDel = toDel->value;
-
-        jsonFree(valToDel, toDel->value_type);
-        //free(toDel->name);
-        free(toDel);
+    const JsonAllocator *allocator = &obj->_ctx->allocator;
+    for (unsigned int i = 0; i < obj->_used; ++i) {
+      if (entryName(obj, i) != NULL) {
+        jsonFree(*entryValue(obj, i), entryType(obj, i));
       }
     }
-    free(obj->entries);
-  } else if (vtype == VAL_MIXED_ARRAY || vtype == VAL_OBJ_ARRAY) {
-    struct JArray *arr = val.array_val;
-    int count = arr->count;
-     for (int i = 0; i < count; ++i) {
-      JArrayItem *items = arr->_internal.vItems[i];
-
-      jsonFree(items->value, items->type);
-    }
-  } else if (vtype == VAL_INT_ARRAY || vtype == VAL_FLOAT_ARRAY
-      || vtype == VAL_BOOL_ARRAY || vtype == VAL_DOUBLE_ARRAY) {
-    JArray* arr = val.array_val;
-    free(arr->_internal.items);
-    free(arr);
-  } else if (vtype == VAL_STRING_ARRAY) {
+    if (obj->_index) {
+      JFREE(allocator, obj->_index);
+    }
+    jsonInternFree(obj->_strings);
+    JFREE(allocator, obj);
+  } else if (vtype >= VAL_STRING_ARRAY && vtype <= VAL_MIXED_ARRAY) {
     JArray *arr = val.array_val;
-    free(arr->_internal.items);
-  }
-
-  if(vtype != VAL_INT && vtype != VAL_NULL && vtype != VAL_BOOL
-      && vtype != VAL_DOUBLE && vtype != VAL_FLOAT && vtype != VAL_UINT &&
-      vtype != VAL_STRING) {
-    //printf("Could not free type\n");
-    //free(val);
-  }
-  if(vtype != 0 && vtype != VAL_FLOAT && vtype != VAL_DOUBLE && vtype != VAL_NULL &&
-      vtype != VAL_BOOL && vtype != VAL_INT && vtype != VAL_STRING &&
-      vtype != VAL_BOOL_ARRAY && vtype != VAL_DOUBLE_ARRAY &&
-      vtype != VAL_FLOAT_ARRAY && vtype != VAL_INT_ARRAY) {
-    free(val.ptr_val);
+    const JsonAllocator *allocator = &arr->_ctx->allocator;
+    if (IS_TAGGED(arr->type)) {
+      JArrayItem *items = arr->_internal.mItems;
+      for (unsigned int i = 0; i < arr->count; ++i) {
+        jsonFree(items[i].value, items[i].type);
+      }
+    }
+    if (arr->_internal.items) {
+      JFREE(allocator, arr->_internal.items);
+    }
+    jsonInternFree(arr->_strings);
+    JFREE(allocator, arr);
   }
 }
-
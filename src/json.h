@@ -3,6 +3,8 @@
 
 #include <stdio.h>
 #include "fnv.h"
+#include "intern.h"
+#include "pool.h"
 
 #define VAL_STRING        1
 #define VAL_INT           2
@@ -16,8 +18,8 @@
 #define VAL_FLOAT_ARRAY   10
 #define VAL_DOUBLE_ARRAY  11
 #define VAL_BOOL_ARRAY    12
-#define VAL_OBJ_ARRAY     13
-#define VAL_MIXED_ARRAY   14 /* JValue array */
+#define VAL_OBJ_ARRAY     13 /* JArrayItem array holding only objects */
+#define VAL_MIXED_ARRAY   14 /* JArrayItem array */
 #define VAL_NULL          15
 
 /** Structures */
@@ -32,46 +34,148 @@ typedef union Value {
   struct JObject* object_val;
 } JItemValue;
 
+/**
+ * Object and mixed arrays store these tagged items back to back, so walking
+ * one is a linear scan.
+ */
 typedef struct Item {
   unsigned char type :4;
   JItemValue    value;
 } JArrayItem;
 
 typedef union Items {
-  void*        items;
-  JArrayItem** vItems;
+  void*          items;
+  JArrayItem*    mItems;  // object and mixed arrays
+  int*           ints;    // homogeneous arrays are packed
+  float*         floats;
+  double*        doubles;
+  unsigned char* bools;
+  char**         strings;
 } JArrayItems;
 
 typedef struct JArray {
   unsigned int  count;
+  unsigned int  capacity;
   unsigned char type :4;
   JArrayItems _internal;
+  struct JInternTable* _strings; // strings owned by the document rooted here
+  struct JsonContext*  _ctx;
 } JArray;
 
 typedef struct JEntry {
-  char*          name;
+  char*          name; // NULL once the key has been deleted
   JItemValue     value;
-  int            hash;
-  unsigned short probes;
+  Fnv32_t        hash;
   unsigned char  value_type :4;
 } JEntry;
 
+/**
+ * Objects built with the same keys in the same order share a shape that
+ * maps each key to a slot of their flat value array. Shapes form a tree of
+ * one key transitions per context and live as long as the context. A
+ * transition is only added once a second object asks for it, the first
+ * one becomes a dictionary, so maps with unique keys do not grow the tree.
+ */
+typedef struct JShape {
+  struct JShape*  parent;
+  JKey*           keys;           // insertion ordered
+  unsigned char*  _index;         // slot + 1 by key hash, NULL for short shapes scanned linearly
+  struct JShape** _children;      // shapes with one more key
+  unsigned int    count;          // keys in the shape
+  unsigned int    _childCount;
+  unsigned int    _childCapacity;
+  unsigned int    _indexMask;
+  Fnv32_t         _pending[4];    // hashes of keys recently asked for without a transition
+  unsigned char   _nextPending;
+} JShape;
+
+/**
+ * A shaped object only stores its values, in the slot block at _index:
+ * _usable values followed by as many type bytes. Objects that delete a key
+ * or outgrow the shape limits turn into dictionaries that keep their
+ * entries densely packed in insertion order and hash into them through a
+ * small open addressed index whose slots are 1, 2 or 4 bytes wide
+ * depending on the index size. Both live in one allocation starting at
+ * _index.
+ */
 typedef struct JObject {
-  JEntry**       entries; // hashed arrangement by key.
-  unsigned int   size;
-  unsigned int   _incrementSize;
-  unsigned int   _arraySize;
-  unsigned short _maxProbes;
+  JEntry*        entries;    // dictionaries, insertion ordered
+  void*          _index;     // slots hold an entry offset, -1 empty, -2 deleted
+  JShape*        shape;      // NULL for dictionaries
+  unsigned int   size;       // live entries
+  unsigned int   _used;      // entries consumed including deleted ones
+  unsigned int   _usable;    // entries or values that fit before growing
+  unsigned char  _indexLog2; // index holds 1 << _indexLog2 slots
   unsigned char  value_type :4;
+  unsigned char  _extending :1; // the object created its shape and keeps adding to the chain
+  struct JInternTable* _strings; // strings owned by the document rooted here
+  struct JsonContext*  _ctx;
 } JObject;
 
-extern JObject *stringCache;
+/**
+ * String values policy. Keys are always interned in the process wide
+ * string cache, values that are not go into a table owned by the parsed
+ * document and are released with it.
+ */
+#define JSON_INTERN_ALL      0 // intern every string value
+#define JSON_INTERN_KEYS     1 // keep values in the document
+#define JSON_INTERN_SHORT    2 // intern values no longer than maxLength
+#define JSON_INTERN_SAMPLED  3 // intern values seen sampleHits times
+
+typedef struct JsonInternPolicy {
+  unsigned char mode;
+  unsigned int  maxLength;  // JSON_INTERN_SHORT
+  unsigned char sampleHits; // JSON_INTERN_SAMPLED
+  size_t        maxBytes;   // stop interning values once the cache is this big, 0 is unbounded
+} JsonInternPolicy;
+
+#define JSON_SAMPLE_SLOTS 4096
+
+/**
+ * A context owns the string cache, allocator and options used by the
+ * parses and objects created through it. Separate contexts share no state
+ * and can be used from separate threads, a single context must not be
+ * used from two threads at once. Contexts on different threads may intern
+ * into one JSharedIntern instead of their own cache, it has to outlive
+ * them. Documents must be freed before their context. The functions
+ * without a context use a process wide default.
+ */
+typedef struct JsonContext {
+  JsonAllocator    allocator;
+  JsonInternPolicy policy;
+  JInternTable*    strings;
+  JSharedIntern*   shared;
+  JShape*          shapes;     // root of the shape tree, the empty shape
+  unsigned int     sampleSeen;
+  unsigned char    sampleCounts[JSON_SAMPLE_SLOTS];
+  unsigned long    generation; // bumped by mutations while value indexes are live
+  unsigned int     _indexes;   // live value indexes over documents of the context
+} JsonContext;
+
+JsonContext* jsonContextNew(const JsonAllocator *allocator);
+void         jsonContextFree(JsonContext *ctx);
+JsonContext* jsonDefaultContext();
+
+void jsonContextSetInternPolicy(JsonContext *ctx, const JsonInternPolicy *policy);
+void jsonContextSetSharedIntern(JsonContext *ctx, JSharedIntern *shared);
+void jsonContextInternStats(const JsonContext *ctx, JInternStats *stats);
+JKey jsonContextIntern(JsonContext *ctx, const char *value, unsigned int length);
+
+JItemValue jsonContextParse(JsonContext *ctx, const char *filename, short *type);
+JItemValue jsonContextParseF(JsonContext *ctx, FILE *file, short *type);
+JObject*   jsonContextNewObject(JsonContext *ctx);
+JArray*    jsonContextNewArray(JsonContext *ctx);
+
+void jsonSetInternPolicy(const JsonInternPolicy *policy);
+void jsonGetInternPolicy(JsonInternPolicy *policy);
 
 /**
  * Building functions
  */
 JObject* jsonAddVal(JObject *obj, const char *name, JItemValue value,
     short type);
+/** Adds a value under a key handed out by the string cache, the key is not rehashed */
+JObject* jsonAddValKey(JObject *obj, JKey key, JItemValue value, short type);
 
 /** Manipulation methods */
 JObject* jsonAddObj(JObject *obj, const char *name, JObject *value);
@@ -80,9 +184,22 @@ JObject* jsonAddUInt(JObject *obj, const char *name, const unsigned int value);
 JObject* jsonAddString(JObject *obj, const char *name, const char *value);
 JObject* jsonDeleteKey(JObject *obj, const char *key);
 
-/** Array manipulation methods */
-JArray* jsonAddArrayItem(JArray *arr, JArrayItem *item);
+/**
+ * Array manipulation methods. Items are copied into the array, which grows
+ * geometrically. Pushing a value of another type to a typed array turns it
+ * into a mixed array.
+ */
+JArray* jsonArrayReserve(JArray *arr, unsigned int capacity);
+JArray* jsonAddArrayItem(JArray *arr, const JArrayItem *item);
 JArray* jsonAddArrayItemObject(JArray *arr, JObject *obj);
+JArray* jsonArrayPushInt(JArray *arr, int value);
+JArray* jsonArrayPushUInt(JArray *arr, unsigned int value);
+JArray* jsonArrayPushFloat(JArray *arr, float value);
+JArray* jsonArrayPushDouble(JArray *arr, double value);
+JArray* jsonArrayPushBool(JArray *arr, char value);
+JArray* jsonArrayPushString(JArray *arr, const char *value);
+JArray* jsonArrayPushObject(JArray *arr, JObject *value);
+JArray* jsonArrayPushArray(JArray *arr, JArray *value);
 
 
 #define NO_DUP 0
@@ -99,8 +216,82 @@ void        jsonPrintError();
 JObject* jsonNewObject();
 JArray*  jsonNewArray();
 
-/** Query & Extraction methods */
+/**
+ * Query & Extraction methods
+ *
+ * Keys are dotted paths, a dot or backslash inside a key is escaped with a
+ * backslash ("a\\.b" is the single key "a.b"). Paths starting with '/' are
+ * JSON Pointers, where ~1 is a slash and ~0 a tilde ("/a.b/c~1d"). *type
+ * is 0 when the path is missing, runs through a non-object or is malformed.
+ */
 JItemValue   jsonGet(const JObject *obj, const char *keys, short *type);
+/** Looks up a single key without rehashing it, *type is 0 when it is missing */
+JItemValue   jsonGetKey(const JObject *obj, JKey key, short *type);
+
+/**
+ * A key path split, unescaped and hashed once, for resolving the same path
+ * in many objects without allocating. Dotted paths with empty keys are rejected.
+ */
+typedef struct JKeyPath {
+  JKey*        keys; // the split copy of the path lives behind the keys
+  unsigned int depth;
+} JKeyPath;
+
+int          jsonKeyPathInit(JKeyPath *path, const char *keys);
+void         jsonKeyPathFree(JKeyPath *path);
+/** Same as jsonGetPath */
+JItemValue   jsonKeyPathGet(const JObject *obj, const JKeyPath *path, short *type);
+
+/**
+ * Many paths merged into a trie on their shared prefixes, resolving them
+ * all takes one walk down the object. Nodes are linked by index, 0 is the
+ * root and ends a sibling list.
+ */
+typedef struct JPathNode {
+  JKey         key;
+  unsigned int firstChild;
+  unsigned int nextSibling;
+  unsigned int childCount;
+} JPathNode;
+
+typedef struct JPathSet {
+  JPathNode*    nodes;
+  unsigned int  nodeCount;
+  unsigned int  count;  // paths in the set
+  unsigned int* _ends;  // the node each path ends at
+  JKeyPath*     _paths; // own the key strings of the nodes
+} JPathSet;
+
+JPathSet*    jsonPathSetCompile(const char **keys, unsigned int count);
+void         jsonPathSetFree(JPathSet *set);
+/** Fills out with a value per path, a type of 0 when missing, returns how many were found */
+unsigned int jsonPathSetGet(const JObject *obj, const JPathSet *set, JArrayItem *out);
+/** Same as the above compiling the paths for this one call */
+unsigned int jsonGetMany(const JObject *obj, const char **keys, unsigned int count, JArrayItem *out);
+
+/**
+ * Parses only the given paths of a document. Members on no path are
+ * skipped without allocating, a kept value brings its whole subtree, and
+ * reading stops once every path is found or known missing. A "*" key
+ * matches every member of an object and every item of an array, a key of
+ * digits such as "a.2.x" or "/a/2/x" the item at that index. Items no path
+ * reaches are kept as nulls up to the last kept item, so indices stay
+ * those of the source.
+ */
+JItemValue   jsonContextParseKeyPaths(JsonContext *ctx, const char *filename, const JKeyPath *paths, unsigned int count, short *type);
+JItemValue   jsonContextParseKeyPathsF(JsonContext *ctx, FILE *file, const JKeyPath *paths, unsigned int count, short *type);
+/** Same as the above for paths not compiled yet, such as "users.*.name" */
+JItemValue   jsonParseProjected(const char *filename, const char **keepPaths, unsigned int n, short *type);
+JItemValue   jsonParseProjectedF(FILE *file, const char **keepPaths, unsigned int n, short *type);
+JItemValue   jsonContextParseProjected(JsonContext *ctx, const char *filename, const char **keepPaths, unsigned int n, short *type);
+JItemValue   jsonContextParseProjectedF(JsonContext *ctx, FILE *file, const char **keepPaths, unsigned int n, short *type);
+
+/** Compiles a path into a heap handle, NULL and a message on stderr when it is invalid */
+JKeyPath*    jsonPathCompile(const char *keys);
+void         jsonPathFree(JKeyPath *path);
+/** Resolves a compiled path without printing anything, *type is 0 when it is missing */
+JItemValue   jsonGetPath(const JObject *obj, const JKeyPath *path, short *type);
+
 int          jsonInt(const JObject *obj, const char *keys);
 unsigned int jsonUInt(const JObject *obj, const char *keys);
 float        jsonFloat(const JObject *obj, const char *keys);
@@ -109,24 +300,140 @@ char*        jsonString(const JObject *obj, const char *keys);
 char         jsonBool(const JObject *obj, const char *keys);
 JArray*      jsonArray(const JObject *obj, const char *keys);
 char*        jsonBoolArray(const JObject *obj, const char *keys);
-int**        jsonIntArray(const JObject *obj, const char *keys);
-float**      jsonFoatArray(const JObject *obj, const char *keys);
-double**     jsonDoubleArray(const JObject *obj, const char *keys);
-char**       jsonStringArray(const JObject *obj, const char *keys);
+/**
+ * Point straight into the packed storage of an array, the caller must not
+ * free the result. They return NULL and a count of 0 unless the array
+ * holds exactly that type.
+ */
+const int*    jsonIntArray(const JObject *obj, const char *keys, unsigned *count);
+const float*  jsonFoatArray(const JObject *obj, const char *keys, unsigned *count);
+const double* jsonDoubleArray(const JObject *obj, const char *keys, unsigned *count);
+char* const*  jsonStringArray(const JObject *obj, const char *keys, unsigned *count);
 JObject*     jsonObject(const JObject *obj, const char *keys);
 const char** jsonKeys(const JObject *obj, unsigned *size);
+/**
+ * Reads the entry at a position below obj->_used, positions follow
+ * insertion order. Returns 0 for the holes deleted keys leave behind.
+ */
+int          jsonEntryAt(const JObject *obj, unsigned int i, const char **name, JItemValue *value, short *type);
+
+/** The tagged items of an object or mixed array, NULL for packed arrays */
+JArrayItem*  jsonArrayItemList(JArray *array);
+/** Reads item i of any array layout */
+JItemValue   jsonArrayGet(const JArray *array, unsigned int i, short *type);
+
+/**
+ * Predicates for jsonArrayWhere. The path is a dotted key path resolved in
+ * every object of the array. Numbers of any type compare by value, ranges
+ * include both bounds and prefixes only match strings.
+ */
+#define JSON_PRED_EXISTS 1
+#define JSON_PRED_EQUALS 2
+#define JSON_PRED_RANGE  3
+#define JSON_PRED_PREFIX 4
+
+typedef struct JPredicate {
+  const char*   path;
+  unsigned char op;
+  short         type;  // JSON_PRED_EQUALS, the type of value
+  JItemValue    value; // JSON_PRED_EQUALS, or the string of JSON_PRED_PREFIX
+  double        min;   // JSON_PRED_RANGE
+  double        max;
+} JPredicate;
+
+JPredicate jsonWhereExists(const char *path);
+JPredicate jsonWhereEquals(const char *path, short type, JItemValue value);
+JPredicate jsonWhereEqualsInt(const char *path, int value);
+JPredicate jsonWhereEqualsDouble(const char *path, double value);
+JPredicate jsonWhereEqualsString(const char *path, const char *value);
+JPredicate jsonWhereRange(const char *path, double min, double max);
+JPredicate jsonWherePrefix(const char *path, const char *prefix);
 
-JArrayItem** jsonArrayItemList(JArray *array);
+/**
+ * Returns the objects of an object or mixed array matching every one of
+ * the predicates, in array order. Large arrays are split into chunks
+ * evaluated on the default pool. The list is sized to the matches and
+ * the caller frees it, it is NULL when nothing matched.
+ */
+JObject**    jsonArrayWhere(const JArray *array, const JPredicate *preds, unsigned int count, unsigned *size);
+/** The objects of an array holding key, same as jsonArrayWhere with jsonWhereExists */
 JObject**    jsonArrayKeyFilter(JArray* array, const char* key, unsigned *size);
 
+/**
+ * Reductions over int, float and double arrays, other items of mixed
+ * arrays are skipped. Comparisons combine the JSON_CMP_ bits, so
+ * JSON_CMP_GE keeps items greater than or equal to the threshold.
+ * jsonArrayFilter returns a new array the caller frees.
+ */
+#define JSON_CMP_LT 1
+#define JSON_CMP_EQ 2
+#define JSON_CMP_GT 4
+#define JSON_CMP_LE (JSON_CMP_LT | JSON_CMP_EQ)
+#define JSON_CMP_GE (JSON_CMP_GT | JSON_CMP_EQ)
+#define JSON_CMP_NE (JSON_CMP_LT | JSON_CMP_GT)
+
+#define JSON_SIMD_NONE 0
+#define JSON_SIMD_SSE2 1
+#define JSON_SIMD_AVX2 2
+
+double       jsonArraySum(const JArray *arr);
+int          jsonArrayMinMax(const JArray *arr, double *min, double *max);
+unsigned int jsonArrayCountIf(const JArray *arr, int op, double threshold);
+JArray*      jsonArrayFilter(const JArray *arr, int op, double threshold);
+/** Highest instruction set the reductions use, capped to what the cpu has */
+int          jsonSimdLevel();
+void         jsonSetSimdLevel(int level);
+
+/**
+ * Columnar copy of an array of objects, one column per requested key path
+ * with one item per array item. Numbers, bools and strings are packed in
+ * values, strings as int codes into a dictionary of the distinct strings
+ * in first seen order. Keys holding several kinds of value get a mixed
+ * column whose cells keep their own types. Rows without a value, null
+ * included, hold 0 and have their validity bit clear, so reductions over
+ * values count them as 0. Strings and nested values are borrowed from the
+ * array, which has to outlive the columns.
+ */
+typedef struct JColumn {
+  const char*    key;
+  unsigned char  type;       // layout of the column, VAL_NULL when no row has a value
+  JArray*        values;
+  JArray*        dictionary; // VAL_STRING_ARRAY columns only
+  unsigned char* validity;   // bit (row & 7) of byte row >> 3
+  unsigned int   nulls;      // rows without a value
+} JColumn;
+
+typedef struct JColumns {
+  unsigned int        rows;
+  unsigned int        count;
+  struct JsonContext* _ctx;
+  JColumn             columns[];
+} JColumns;
+
+#define jsonColumnValid(col, row) (((col)->validity[(row) >> 3] >> ((row) & 7)) & 1)
+
+JColumns*   jsonArrayToColumns(const JArray *arr, const char **keys, unsigned int count);
+JColumn*    jsonColumn(JColumns *cols, const char *key);
+/** The string in a row of a dictionary column, NULL when it has none */
+const char* jsonColumnString(const JColumn *col, unsigned int row);
+void        jsonColumnsFree(JColumns *cols);
+
 void jsonPrintObject(const FILE *io, const JObject *obj);
 void jsonPrintEntryInc(const FILE *io, unsigned char type, JItemValue *value, unsigned int tabs, unsigned int tabInc);
 void jsonPrintEntry(const FILE *io, const unsigned short type, const JItemValue *value);
+/**
+ * Prints a value as one "key: value" hit, strings unquoted, and "key: not found"
+ * when type is 0, so the hits of several keys read back line up with the keys
+ */
+void jsonPrintHit(const FILE *io, const char *key, unsigned short type, const JItemValue *value);
 
 /** Memory methods */
 void jsonFree(JItemValue val, const short vtype);
 
 // miscellaneous
 char* getOrCacheString(const char *value);
+JKey  jsonInternKey(const char *value, unsigned int length);
+char* jsonCacheValue(JsonContext *ctx, JInternTable **document, const char *value, unsigned int length);
+void  jsonInternStats(JInternStats *stats);
 
 #endif
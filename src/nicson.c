@@ -10,54 +10,32 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "json.h"
+#include "query.h"
+#include "serialize.h"
 
-#define SEARCH_TYPE_ARRAY         0
-#define SEARCH_TYPE_ARRAY_RANGE   1
-#define SEARCH_TYPE_WILDCARD      2
-#define SEARCH_TYPE_MATCH         3
-#define SEARCH_TYPE_KEY_MATCH     4
-
-typedef enum SEARCH_TYPE {
-  ARRAY = 0,
-  ARRAY_RANGE,
-  WILDCARD,
-  MATCH,
-  KEY_MATCH
-} SEARCH_TYPE;
-
-/**
- * Defines a single search action within the json loaded by
- * nicson.
- *
- * Examples:
- *
- *  Array Range: key.[0-5].*.key.*.*match.hello*world.end*.[4,6,1234].*hello*world*
- *
- */
-typedef struct KeySearch {
-  SEARCH_TYPE searchType : 4; // up to 16 types
-  union meta {
-    // makes this 4-8 bytes on 32/64 depending
-    const char *matchStr;
-    const char *keyStr;
-    int arrayIndex;
-    struct range {
-      int32_t start;
-      int32_t end;
-    } range;
-  } meta;
-} KeySearch;
-
-JItemValue query(JObject *obj, const char *key, int *type);
+int query(JItemValue root, short type, const char *expr);
+void printValue(const char *key, JItemValue item, short type);
+int aggregate(const char *op, const JArray *arr, const char *cond);
 
 void printUsage(const char *execName) {
 	printf("Usage: %s <options> <filename> <key>\n", execName);
 	printf("Manipulate/Search JSON files\n");
 	printf("\nArguments:\n");
 	printf("\t -p         pretty prints the input json filename contents.\n");
-	printf("\t -e <value> find a value by the argument.\n");
+	printf("\t -c         prints the input json filename contents compact,\n");
+	printf("\t            without any whitespace.\n");
+	printf("\t -e <value> find a value by the argument, more keys may follow.\n");
+	printf("\t            A key without a value prints 'key: not found' and\n");
+	printf("\t            the exit status is nonzero.\n");
+	printf("\t -E <query> print every value matching a query, steps are\n");
+	printf("\t            key, [1,3], [0-5], *, key*glob and =value*glob.\n");
+	printf("\t -a <op>    aggregate the numeric array at key, op is one of\n");
+	printf("\t            sum, min, max, mean, count or filter. count and\n");
+	printf("\t            filter take a condition such as '>=10'.\n");
 	printf("\t -h         print this help message.\n");	
 	printf("\n");
 	printf("To report errors or request features please do so on ");
@@ -65,12 +43,18 @@ void printUsage(const char *execName) {
 	printf("\n");
 	printf("Examples:\n");
 	printf("\tnicson -p example.json\n");
+	printf("\tnicson -c example.json\n");
 	printf("\tnicson -e example.json key\n");
 	printf("\tnicson -e example.json key.key.key\n");
+	printf("\tnicson -e example.json key.one key.two other\n");
+	printf("\tnicson -E example.json 'key.[0-5].*.name'\n");
+	printf("\tnicson -a sum example.json key.values\n");
+	printf("\tnicson -a count example.json key.values '>0.5'\n");
 }
 
 int main(int count, const char* argv[]) {
-	printf("Nicson json parser cli tool %d\n", count);
+	// diagnostics go to stderr, stdout carries only the requested output
+	fprintf(stderr, "Nicson json parser cli tool %d\n", count);
 	if(count < 2) {
 		printUsage(argv[0]);
 		return 0;
@@ -78,17 +62,20 @@ int main(int count, const char* argv[]) {
 	short fileArgNum = 1;
 	short keyArgNum = 0;
 	char wholeFilePrint = 1;
+	char compactPrint = 0;
 	char useStandardIn = 1;
 	char findByArg = 0;
 	char printHelpAndExit = 0;
 	char interpKey = 0;
+	const char *aggregateOp = NULL;
 
   if(argv[1][0] == '-') {
     //we have options
-    if(argv[1][1] == 'p') {
-      //pretty print the whole file
+    if(argv[1][1] == 'p' || argv[1][1] == 'c') {
+      //pretty or compact print the whole file
       fileArgNum = 2;
       wholeFilePrint = 1;
+      compactPrint = argv[1][1] == 'c';
       useStandardIn = count <= fileArgNum ? 1 : 0;
     }else if(argv[1][1] == 'e') {
       //find by argument
@@ -104,6 +91,16 @@ int main(int count, const char* argv[]) {
       useStandardIn = 0;
       keyArgNum = 3;
       interpKey = 1;
+    }else if(argv[1][1] == 'a') {
+      if(count < 5) {
+        printUsage(argv[0]);
+        return 0;
+      }
+      aggregateOp = argv[2];
+      fileArgNum = 3;
+      wholeFilePrint = 0;
+      useStandardIn = 0;
+      keyArgNum = 4;
     }else if(argv[1][1] == 'h') {
       printHelpAndExit = 1;
     }
@@ -123,19 +120,26 @@ int main(int count, const char* argv[]) {
 
 	JItemValue val;
 	if(useStandardIn) {
-	  printf("Reading from standard-input\n");
+	  fprintf(stderr, "Reading from standard-input\n");
 	  val = jsonParseF(stdin, &type);
+	} else if(findByArg && !interpKey) {
+	  // only builds the objects on the way to the keys and stops reading there
+	  fprintf(stderr, "Loading JSON: %s\n", file);
+	  if(count <= keyArgNum) {
+	    fprintf(stderr, "Error: Missing key\n");
+	    exit(0);
+	  }
+	  val = jsonContextParseProjected(jsonDefaultContext(), file, &argv[keyArgNum], count - keyArgNum, &type);
 	} else {
-	  printf("Loading JSON: %s\n", file);
+	  fprintf(stderr, "Loading JSON: %s\n", file);
 	  val = jsonParse(file, &type);
 	}
 
 #ifdef DEBUG
-	if(stringCache) {
-	  printf("DEBUG: Strings cached used %d\n", stringCache->size);
-	}else{
-	  printf("DEBUG: String cache is null\n");
-	}
+	JInternStats stats;
+	jsonInternStats(&stats);
+	fprintf(stderr, "DEBUG: Strings cached %u using %lu bytes, %lu of %lu lookups hit\n",
+	    stats.strings, (unsigned long)stats.bytes, stats.hits, stats.lookups);
 #endif
 
 	if(!val.ptr_val) {
@@ -144,53 +148,152 @@ int main(int count, const char* argv[]) {
 	}
 
 	if(wholeFilePrint) {
-	  jsonPrintObject(stdout, val.object_val);
+	  fflush(stdout); // the document goes to the descriptor past stdio
+	  jsonSerializeParallelFd(STDOUT_FILENO, val, type, compactPrint, jsonDefaultPool());
+	}
+
+	if(aggregateOp) {
+	  const char *key = argv[keyArgNum];
+	  JArray *arr = type == VAL_OBJ ? jsonArray(val.object_val, key) : NULL;
+	  int status = EXIT_FAILURE;
+	  if(!arr) {
+	    fprintf(stderr, "Error: No array at key '%s'\n", key);
+	  }else{
+	    status = aggregate(aggregateOp, arr, count > 5 ? argv[5] : NULL);
+	  }
+	  jsonFree((JItemValue)val, type);
+	  return status;
 	}
 	
 	if(count >= 3 && (!wholeFilePrint || findByArg)) {
 	  const char *key = argv[keyArgNum];
-    JItemValue item;
-    short extractType = 0;
-
 	  if(interpKey) {
-	    item = query(val.object_val, key, &extractType);
-	  }else{
-	    item = jsonGet(val.object_val, key, &extractType);
+	    int status = query(val, type, key);
+	    jsonFree((JItemValue)val, type);
+	    return status;
 	  }
 
-	  if(extractType == VAL_INT) {
-	    printf("%s: %d\n", key, item.int_val);
-	  }else if(extractType == VAL_FLOAT) {
-	    printf("%s: %f\n", key, item.float_val);
-	  }else if(extractType == VAL_DOUBLE) {
-	    printf("%s: %f\n", key, item.double_val);
-	  }else if(extractType == VAL_STRING) {
-	    printf("%s: %s\n", key, item.string_val);
-	  }else if(extractType == VAL_OBJ) {
-	    jsonPrintObject(stdout, item.object_val);
-	  }else if(extractType == VAL_BOOL_ARRAY || extractType == VAL_DOUBLE_ARRAY || extractType == VAL_FLOAT_ARRAY ||
-	      extractType == VAL_INT_ARRAY || extractType == VAL_MIXED_ARRAY || extractType == VAL_STRING_ARRAY) {
-	    jsonPrintEntryInc(stdout, extractType, &item, 3, 0);
-	  }else{
-	    fprintf(stderr, "Error: Could not find key '%s'\n", key);
+	  // every key is resolved in one walk down the document
+	  const char **keys = &argv[keyArgNum];
+	  unsigned int nkeys = count - keyArgNum;
+	  JArrayItem found[nkeys];
+	  jsonGetMany(type == VAL_OBJ ? val.object_val : NULL, keys, nkeys, found);
+	  // one line per key, misses included, so the hits stay in the order of the keys
+	  int status = EXIT_SUCCESS;
+	  for(unsigned int i = 0; i < nkeys; ++i) {
+	    printValue(keys[i], found[i].value, found[i].type);
+	    if(!found[i].type) {
+	      status = EXIT_FAILURE;
+	    }
 	  }
+	  jsonFree((JItemValue)val, type);
+	  return status;
 	}
 	
 	jsonFree((JItemValue)val, type);
 	return EXIT_SUCCESS;
 }
 
-JItemValue query(JObject *obj, const char *key, int *type) {
-  JItemValue val;
-  memset(&val, 0, sizeof(JItemValue));
-  if(strlen(key) == 0) {
-    return val; //short-circuit
+void printValue(const char *key, JItemValue item, short type) {
+  jsonPrintHit(stdout, key, type, &item);
+}
+
+int query(JItemValue root, short type, const char *expr) {
+  JQuery *compiled = jsonQueryCompile(expr);
+  JCursor cursor;
+  if(!compiled || !jsonCursorQuery(&cursor, compiled, root, type)) {
+    jsonQueryFree(compiled);
+    return EXIT_FAILURE;
+  }
+  // matches are printed as the cursor finds them
+  unsigned found = 0;
+  JItemValue value;
+  short valueType = 0;
+  while(jsonCursorNext(&cursor, &value, &valueType)) {
+    printValue(expr, value, valueType);
+    ++found;
   }
+  jsonQueryFree(compiled);
+  if(!found) {
+    fprintf(stderr, "Error: Nothing matched '%s'\n", expr);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
 
-  if(key[0] == '[') {
+int parseCondition(const char *cond, int *op, double *threshold) {
+  if(!cond) {
+    return 0;
+  }
+  if(strncmp(cond, ">=", 2) == 0) {
+    *op = JSON_CMP_GE;
+    cond += 2;
+  }else if(strncmp(cond, "<=", 2) == 0) {
+    *op = JSON_CMP_LE;
+    cond += 2;
+  }else if(strncmp(cond, "==", 2) == 0) {
+    *op = JSON_CMP_EQ;
+    cond += 2;
+  }else if(strncmp(cond, "!=", 2) == 0) {
+    *op = JSON_CMP_NE;
+    cond += 2;
+  }else if(cond[0] == '>') {
+    *op = JSON_CMP_GT;
+    cond += 1;
+  }else if(cond[0] == '<') {
+    *op = JSON_CMP_LT;
+    cond += 1;
+  }else if(cond[0] == '=') {
+    *op = JSON_CMP_EQ;
+    cond += 1;
+  }else{
+    return 0;
+  }
+  char *end = NULL;
+  *threshold = strtod(cond, &end);
+  return end != cond && *end == '\0';
+}
 
-  } else if(key[0] == '*') {
-    return query(obj, &key[0], type);
+int aggregate(const char *op, const JArray *arr, const char *cond) {
+  double min = 0, max = 0;
+  if(strcmp(op, "sum") == 0) {
+    printf("%.17g\n", jsonArraySum(arr));
+  }else if(strcmp(op, "mean") == 0) {
+    unsigned int n = jsonArrayCountIf(arr, JSON_CMP_LT | JSON_CMP_EQ | JSON_CMP_GT, 0);
+    if(n == 0) {
+      fprintf(stderr, "Error: Array has no numbers\n");
+      return EXIT_FAILURE;
+    }
+    printf("%.17g\n", jsonArraySum(arr) / n);
+  }else if(strcmp(op, "min") == 0 || strcmp(op, "max") == 0) {
+    if(!jsonArrayMinMax(arr, &min, &max)) {
+      fprintf(stderr, "Error: Array has no numbers\n");
+      return EXIT_FAILURE;
+    }
+    printf("%.17g\n", op[1] == 'i' ? min : max);
+  }else if(strcmp(op, "count") == 0 || strcmp(op, "filter") == 0) {
+    int cmp = 0;
+    double threshold = 0;
+    if(!parseCondition(cond, &cmp, &threshold)) {
+      fprintf(stderr, "Error: Expected a condition like '>=10' but got '%s'\n", cond ? cond : "");
+      return EXIT_FAILURE;
+    }
+    if(op[0] == 'c') {
+      printf("%u\n", jsonArrayCountIf(arr, cmp, threshold));
+    }else{
+      JArray *filtered = jsonArrayFilter(arr, cmp, threshold);
+      if(!filtered) {
+        fprintf(stderr, "Error: Could not allocate the filtered array\n");
+        return EXIT_FAILURE;
+      }
+      JItemValue item = { .array_val = filtered };
+      jsonPrintEntryInc(stdout, filtered->type, &item, 3, 0);
+      printf("\n");
+      jsonFree(item, filtered->type);
+    }
+  }else{
+    fprintf(stderr, "Error: Unknown aggregate '%s'\n", op);
+    return EXIT_FAILURE;
   }
-  return val;
+  return EXIT_SUCCESS;
 }
@@ -5,6 +5,8 @@
  *      Author: nick
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "parse.h"
 
 #include <math.h>
@@ -22,6 +24,9 @@
   malloc((printf("Allocating %.0f bytes, in %s at %d\n", (float)p, __FILE__, __LINE__) * 0)+ p)
 #endif
 
+#define NUMBER_TEXT_BYTES    512 // digits of a number, enough for any double written out
+#define TEXT_STACK_BYTES     256 // keys and strings this long are read on the stack, longer ones on the heap
+
 #define NOT_IMPLEMENTED(p)   jsonSetParserError(p, 42, "parseArray: Not Implemented", __FILE__, __LINE__);
 #define UNEXPECTED_TOKEN(p)  jsonSetParserError(p, 43, "Unexpected Token", __FILE__, __LINE__);
 #define BAD_CHARACTER(p)     jsonSetParserError(p, 99, "Could not read first character", __FILE__, __LINE__);
@@ -185,12 +190,7 @@ int sizeOfType(const short type) {
     return sizeof(double);
   }else if(type == VAL_BOOL) {
     return sizeof(char);
-  }else if(type == VAL_BOOL_ARRAY ||
-      type == VAL_INT_ARRAY ||
-      type == VAL_DOUBLE_ARRAY ||
-      type == VAL_FLOAT_ARRAY ||
-      type == VAL_STRING_ARRAY ||
-      type == VAL_OBJ_ARRAY) {
+  }else if(type >= VAL_STRING_ARRAY && type <= VAL_MIXED_ARRAY) {
     return sizeof(JArray);
   }else{
     return 0;
@@ -209,7 +209,7 @@ int isTerm(Parser *p, const char *cterm) {
 
   if(p->cur->type == OTHER) {
 
-    int startPos = p->cur->seek;
+    long startPos = p->cur->seek;
     while(p->cur && p->cur->type == OTHER) {
       consume(p);
     }
@@ -239,7 +239,7 @@ int isTerm(Parser *p, const char *cterm) {
 int jsonParseQuotedString(Parser* p, char quote) {
   TokType quoteType = tokType(quote);
   consume(p);
-  int start = p->cur->seek;
+  long start = p->cur->seek;
   while(p->cur->type != quoteType) {
     if(p->cur->type == BACK_SLASH) {
       consume(p);
@@ -251,11 +251,30 @@ int jsonParseQuotedString(Parser* p, char quote) {
       break;
     }
   }
-  int size = (p->cur->seek-start);
+  int size = (int)(p->cur->seek-start);
   consume(p);
   return size;
 }
 
+/** Reads size bytes of the input from start into scratch, or the heap when they do not fit it */
+static char* readText(Parser *p, long start, int size, char *scratch) {
+  if(size < 0) {
+    return 0;
+  }
+  char *text = size < TEXT_STACK_BYTES ? scratch : malloc(size + 1);
+  if(text) {
+    jsonRead(text, p, start, size);
+    text[size] = '\0';
+  }
+  return text;
+}
+
+static void releaseText(char *text, const char *scratch) {
+  if(text != scratch) {
+    free(text);
+  }
+}
+
 JObject *jsonParseObject(Parser *p) {
 
   if(p->cur->type == OPEN_BRACE) {
@@ -264,7 +283,7 @@ JObject *jsonParseObject(Parser *p) {
     UNEXPECTED_TOKEN(p)
     return 0;
   }
-  JObject *obj = jsonNewObject();
+  JObject *obj = jsonContextNewObject(p->ctx);
   char haveComma = 0;
   do {
     if(haveComma) {
@@ -299,7 +318,7 @@ JObject *jsonParseObject(Parser *p) {
 }
 
 void jsonParseMembers(Parser *p, JObject *obj) {
-  int start = p->cur->seek+1;
+  long start = p->cur->seek+1;
   int size = -1;
   if(p->cur->type == SINGLE_QUOTE) {
     size = jsonParseQuotedString(p, '\'');
@@ -311,15 +330,383 @@ void jsonParseMembers(Parser *p, JObject *obj) {
     short type = 0;
     JItemValue val = jsonParseValue(p, &type);
     if(!p->error) {
-      char buf[size+1];
-      memset(buf, '\0', size+1);
-      jsonRead(buf, p, start, size);
-      jsonAddVal(obj, buf, val, type);
+      char scratch[TEXT_STACK_BYTES];
+      char *key = readText(p, start, size, scratch);
+      if(key) {
+        jsonAddValKey(obj, jsonContextIntern(p->ctx, key, size), val, type);
+        releaseText(key, scratch);
+      } else {
+        jsonFree(val, type);
+      }
+    }
+  } else {
+    jsonPrintError(p);
+  }
+
+}
+
+static int isWildcard(const JKey *key) {
+  return key->length == 1 && key->str[0] == '*';
+}
+
+/**
+ * Marks a path found or missing for good once its keys up to depth held
+ * no wildcard, which can match again further on. The parse is done with
+ * the last path.
+ */
+static void resolvePath(Parser *p, unsigned int path, int depth) {
+  for(int d = 0; d <= depth; ++d) {
+    if(isWildcard(&p->paths[path].keys[d])) {
+      return;
+    }
+  }
+  if(!p->resolved[path]) {
+    p->resolved[path] = 1;
+    if(--p->pending == 0) {
+      p->done = 1;
     }
+  }
+}
+
+static JArray* projectArray(Parser *p, const unsigned int *paths, unsigned int count, unsigned int depth, short *type);
+
+/** Projects the value at the cursor for paths matched up to depth, *type is 0 when it is skipped */
+static JItemValue projectValue(Parser *p, const unsigned int *paths, unsigned int count, unsigned int depth, short *type) {
+  JItemValue val = { 0 };
+  *type = 0;
+  if(p->cur->type == OPEN_BRACE) {
+    val.object_val = jsonProjectObject(p, paths, count, depth);
+    *type = VAL_OBJ;
+  } else if(p->cur->type == OPEN_BRACKET) {
+    val.array_val = projectArray(p, paths, count, depth, type);
   } else {
+    for(unsigned int i = 0; i < count; ++i) {
+      resolvePath(p, paths[i], depth - 1); // can not go through a scalar
+    }
+    jsonSkipValue(p);
+  }
+  return val;
+}
+
+/**
+ * Splits the paths matching a key at depth into the ones ending there and
+ * the ones going deeper, a NULL key matches only wildcards.
+ */
+static char matchPaths(Parser *p, const unsigned int *paths, unsigned int count, unsigned int depth,
+    const char *key, unsigned int length, unsigned int *deeper, unsigned int *ndeeper) {
+  Fnv32_t hash = key ? fnvbuf(key, length) : 0;
+  char keep = 0;
+  *ndeeper = 0;
+  for(unsigned int i = 0; i < count; ++i) {
+    const JKeyPath *path = &p->paths[paths[i]];
+    const JKey *want = &path->keys[depth];
+    if(p->resolved[paths[i]]) {
+      continue;
+    }
+    if(!isWildcard(want) && (!key || want->hash != hash || want->length != length
+        || memcmp(want->str, key, length) != 0)) {
+      continue;
+    }
+    if(depth + 1 == path->depth) {
+      keep = 1;
+      resolvePath(p, paths[i], depth);
+    } else {
+      deeper[(*ndeeper)++] = paths[i];
+    }
+  }
+  return keep;
+}
+
+static void projectMember(Parser *p, JObject *obj, const unsigned int *paths, unsigned int count, unsigned int depth) {
+  long start = p->cur->seek+1;
+  int size = -1;
+  if(p->cur->type == SINGLE_QUOTE) {
+    size = jsonParseQuotedString(p, '\'');
+  } else if(p->cur->type == DOUBLE_QUOTE) {
+    size = jsonParseQuotedString(p, '"');
+  }
+  if(size < 0) {
+    UNEXPECTED_TOKEN(p)
+    return;
+  }
+  jsonExpectPairSeparator(p);
+  if(p->error) {
     jsonPrintError(p);
+    return;
+  }
+
+  // the key stays in scratch until we know the member is kept
+  char scratch[TEXT_STACK_BYTES];
+  char *key = readText(p, start, size, scratch);
+  if(!key) {
+    jsonSkipValue(p);
+    return;
+  }
+
+  unsigned int deeper[count ? count : 1];
+  unsigned int ndeeper = 0;
+  char keep = matchPaths(p, paths, count, depth, key, size, deeper, &ndeeper);
+
+  short type = 0;
+  JItemValue val = { 0 };
+  if(keep) {
+    // a kept value brings its whole subtree, deeper paths included
+    val = jsonParseValue(p, &type);
+  } else if(ndeeper) {
+    val = projectValue(p, deeper, ndeeper, depth + 1, &type);
+  } else {
+    jsonSkipValue(p);
+  }
+  if(type && !p->error) {
+    jsonAddValKey(obj, jsonContextIntern(p->ctx, key, size), val, type);
+  }
+  releaseText(key, scratch);
+}
+
+JObject *jsonProjectObject(Parser *p, const unsigned int *paths, unsigned int count, unsigned int depth) {
+  if(p->cur->type == OPEN_BRACE) {
+    consume(p);
+  } else {
+    UNEXPECTED_TOKEN(p)
+    return 0;
+  }
+  JObject *obj = jsonContextNewObject(p->ctx);
+  char haveComma = 0;
+  do {
+    if(haveComma) {
+      consume(p);
+      haveComma = 0;
+    }
+    consumeWhitespace(p);
+    if(p->error || p->eof) {
+      break;
+    }
+    if(p->cur->type == CLOSE_BRACE) {
+      break;
+    }
+    projectMember(p, obj, paths, count, depth);
+    if(p->error || p->eof || p->done) {
+      break;
+    }
+    consumeWhitespace(p);
+    if(p->cur->type == COMMA) {
+      haveComma = 1;
+    }
+  } while(p->cur->type == COMMA);
+
+  if(p->error) {
+    jsonFree((JItemValue) { obj }, VAL_OBJ);
+    return 0;
+  }
+  if(p->done) {
+    return obj; // leaves the rest of the file unread
+  }
+
+  // paths leading into this object that it did not have are missing
+  for(unsigned int i = 0; i < count; ++i) {
+    resolvePath(p, paths[i], (int)depth - 1);
+  }
+  consume(p);
+  return obj;
+}
+
+/** The array index a key names, digits without a leading zero as in JSON Pointer, -1 for other keys */
+static long keyIndex(const JKey *key) {
+  if(!key->length || key->length > 9 || (key->length > 1 && key->str[0] == '0')) {
+    return -1;
+  }
+  long index = 0;
+  for(unsigned int i = 0; i < key->length; ++i) {
+    if(key->str[i] < '0' || key->str[i] > '9') {
+      return -1;
+    }
+    index = index * 10 + (key->str[i] - '0');
+  }
+  return index;
+}
+
+/**
+ * Arrays match wildcards and index keys. Items that none of the paths reach
+ * are held by nulls up to the last kept item, so indices stay those of the
+ * source.
+ */
+static JArray* projectArray(Parser *p, const unsigned int *paths, unsigned int count, unsigned int depth, short *type) {
+  unsigned int deeper[count ? count : 1];
+  unsigned int ndeeper = 0;
+  char indexed = 0;
+  for(unsigned int i = 0; i < count; ++i) {
+    const JKey *want = &p->paths[paths[i]].keys[depth];
+    if(isWildcard(want)) {
+      continue;
+    }
+    if(keyIndex(want) < 0) {
+      resolvePath(p, paths[i], (int)depth - 1); // other keys never match items
+    } else if(!p->resolved[paths[i]]) {
+      indexed = 1;
+    }
+  }
+  // without index keys every item matches the same paths
+  char keep = matchPaths(p, paths, count, depth, NULL, 0, deeper, &ndeeper);
+  if(!keep && !ndeeper && !indexed) {
+    jsonSkipValue(p);
+    *type = 0;
+    return 0;
+  }
+
+  JArray *arrayVal = jsonContextNewArray(p->ctx);
+  if(!arrayVal) {
+    return 0;
+  }
+  unsigned int index = 0;
+  unsigned int holes = 0;
+  do {
+    consume(p); //first time consume open bracket then commas
+    consumeWhitespace(p);
+    if(p->error || p->eof || p->cur->type == CLOSE_BRACKET) {
+      break;
+    }
+    if(indexed) {
+      char text[16];
+      int length = snprintf(text, sizeof(text), "%u", index);
+      keep = matchPaths(p, paths, count, depth, text, length, deeper, &ndeeper);
+    }
+    JArrayItem item = { 0 };
+    short valType = 0;
+    if(keep) {
+      item.value = jsonParseValue(p, &valType);
+    } else if(ndeeper) {
+      item.value = projectValue(p, deeper, ndeeper, depth + 1, &valType);
+    } else {
+      jsonSkipValue(p);
+    }
+    item.type = valType;
+    ++index;
+
+    if(p->error) {
+      jsonFree((JItemValue) { arrayVal }, VAL_MIXED_ARRAY);
+      return 0;
+    }
+    if(!valType) {
+      ++holes; // only pushed once an item after it is kept
+    } else {
+      const JArrayItem hole = { .type = VAL_NULL };
+      for(; holes && jsonAddArrayItem(arrayVal, &hole); --holes);
+      if(holes || !jsonAddArrayItem(arrayVal, &item)) {
+        jsonFree(item.value, valType);
+        jsonFree((JItemValue) { arrayVal }, VAL_MIXED_ARRAY);
+        return 0;
+      }
+    }
+    if(p->done) {
+      *type = arrayVal->type;
+      return arrayVal; // leaves the rest of the file unread
+    }
+    consumeWhitespace(p);
+  } while(p->cur && p->cur->type == COMMA);
+
+  if(!p->cur || p->cur->type != CLOSE_BRACKET) {
+    jsonFree((JItemValue) { arrayVal }, VAL_MIXED_ARRAY);
+    UNEXPECTED_TOKEN(p);
+    return 0;
+  }
+  for(unsigned int i = 0; i < count; ++i) {
+    resolvePath(p, paths[i], (int)depth - 1);
+  }
+  consume(p);
+
+  *type = arrayVal->type;
+  return arrayVal;
+}
+
+void jsonSkipValue(Parser *p) {
+  Tok *tok = p->cur;
+  long seek = tok->seek;
+  unsigned short line = tok->line;
+  unsigned short column = tok->column - tok->count;
+  unsigned int depth = 0;
+  char quote = 0;
+  char escaped = 0;
+  char c = 0;
+
+  // scans the read buffer directly, matching brackets outside of strings
+  for(;;) {
+    if(p->buf_seek < 0 || seek < p->buf_seek || seek >= p->buf_seek + TOK_BUF_SIZE) {
+      jsonRead(&c, p, seek, 1);
+    }
+    const char *at = p->buf + (seek - p->buf_seek);
+    const char *end = p->buf + TOK_BUF_SIZE;
+    for(; at < end; ++at, ++seek) {
+      c = *at;
+      if(c == '\0') {
+        jsonSetParserError(p, 43, "Unexpected end of file", __FILE__, __LINE__);
+        p->eof = 1;
+        return;
+      }
+      if(c == '\n') {
+        ++line;
+        column = 0;
+      } else {
+        ++column;
+      }
+
+      if(quote) {
+        if(escaped) {
+          escaped = 0;
+        } else if(c == '\\') {
+          escaped = 1;
+        } else if(c == quote) {
+          quote = 0;
+          if(depth == 0) {
+            ++seek;
+            goto found;
+          }
+        }
+        continue;
+      }
+      switch(c) {
+      case '"':
+      case '\'':
+        quote = c;
+        break;
+      case '{':
+      case '[':
+        ++depth;
+        break;
+      case '}':
+      case ']':
+        if(depth == 0) {
+          --column;
+          goto found; // closes the parent of a scalar
+        }
+        if(--depth == 0) {
+          ++seek;
+          goto found;
+        }
+        break;
+      case ',':
+      case ' ':
+      case '\t':
+      case '\r':
+      case '\n':
+        if(depth == 0) {
+          if(c == '\n') {
+            --line;
+          } else {
+            --column;
+          }
+          goto found;
+        }
+        break;
+      }
+    }
   }
 
+found:
+  tok->seek = seek;
+  tok->count = 0;
+  tok->line = line;
+  tok->column = column;
+  p->cur = next(p);
 }
 
 void jsonExpectPairSeparator(Parser *p) {
@@ -336,7 +723,7 @@ void jsonExpectPairSeparator(Parser *p) {
 }
 
 JItemValue jsonParseValue(Parser *p, short *type) {
-  int saved = p->cur->seek;
+  long saved = p->cur->seek;
 
   JItemValue val = { 0 };
   if(p->cur->type == SINGLE_QUOTE || p->cur->type == DOUBLE_QUOTE) {
@@ -408,7 +795,7 @@ JItemValue jsonParseValue(Parser *p, short *type) {
 
 char* jsonParseString(Parser *p) {
   Tok *cur = p->cur;
-  int start = p->cur->seek+1;
+  long start = p->cur->seek+1;
   int size = -1;
   if(cur->type == SINGLE_QUOTE) {
     size = jsonParseQuotedString(p, '\'');
@@ -417,10 +804,11 @@ char* jsonParseString(Parser *p) {
   }
 
   if(size != -1) {
-    char buf[size+1];
-    memset(buf, '\0', size+1);
-    jsonRead(buf, p, start, size);
-    return getOrCacheString(buf);
+    char scratch[TEXT_STACK_BYTES];
+    char *text = readText(p, start, size, scratch);
+    char *cached = text ? jsonCacheValue(p->ctx, &p->strings, text, size) : 0;
+    releaseText(text, scratch);
+    return cached;
   }
   return 0;
 }
@@ -443,89 +831,76 @@ char jsonParseBool(Parser *p, short *type) {
   return 0;
 }
 
+/** Appends the characters of the current token to the text of a number, 0 when it is too long */
+static int appendNumber(Parser *p, char *text, unsigned int *length) {
+  if(*length + p->cur->count >= NUMBER_TEXT_BYTES) {
+    jsonSetParserError(p, 43, "Number too long", __FILE__, __LINE__);
+    return 0;
+  }
+  jsonRead(text + *length, p, p->cur->seek, p->cur->count);
+  *length += p->cur->count;
+  consume(p);
+  return 1;
+}
+
 JItemValue jsonParseNumber(Parser *p, short *type) {
-  double value = 0.0L;
-  int signValue = 1;
-  if(p->cur->type == PLUS_MINUS) {
-    signValue = -1;
-    consume(p);
+  // the text is collected and converted once so every digit counts
+  char text[NUMBER_TEXT_BYTES];
+  unsigned int length = 0;
+  if(p->cur->type == PLUS_MINUS && !appendNumber(p, text, &length)) {
+    return (JItemValue){ 0 };
   }
   if(p->cur->type == DIGIT) {
-    value = signValue * (getCharAt(p, 0) - '0');
-    consume(p);
-
-    if(p->cur->type == DIGIT) {
-      do {
-        for(int i = 0; i < p->cur->count; ++i) {
-          value *= 10.0d;
-          value = value + signValue * (getCharAt(p, i) - '0');
-        }
-        consume(p);
-      } while(p->cur->type == DIGIT);
+    while(p->cur->type == DIGIT) {
+      if(!appendNumber(p, text, &length)) {
+        return (JItemValue){ 0 };
+      }
     }
 
     if(p->cur->type == DOT) {
-      consume(p);
-      double divisor = 10.0d;
-      if(p->cur->type == DIGIT) {
-        value += ((double)signValue * (double)(getCharAt(p, 0) - '0')) / divisor;
-        consume(p);
-        if(p->cur->type == DIGIT) {
-          do {
-            for(int i = 0; i < p->cur->count; ++i) {
-              divisor *= 10;
-              value = value + ((signValue * (getCharAt(p, i) - '0')) / divisor);
-            }
-            consume(p);
-          } while(p->cur->type == DIGIT);
-        }
-      } else {
+      if(!appendNumber(p, text, &length)) {
+        return (JItemValue){ 0 };
+      }
+      if(p->cur->type != DIGIT) {
         UNEXPECTED_TOKEN(p);
         return (JItemValue){ 0 };
       }
+      while(p->cur->type == DIGIT) {
+        if(!appendNumber(p, text, &length)) {
+          return (JItemValue){ 0 };
+        }
+      }
     }
 
     if(isTerm(p, "E") || isTerm(p, "e")) {
-      int sign = 1;
-      if(p->cur->type == PLUS_MINUS) {
-        sign = -1;
-        consume(p);
+      text[length++] = 'e';
+      if(p->cur->type == PLUS_MINUS && !appendNumber(p, text, &length)) {
+        return (JItemValue){ 0 };
       }
-
-      if(p->cur->type == DIGIT) {
-        double power = (double)(getCharAt(p, 0) - '0');
-        power *= (sign == '-' ? -1.0d : 1.0d);
-        consume(p);
-
-        if(p->cur->type == DIGIT) {
-          do {
-            for(int i = 0; i < p->cur->count; ++i) {
-              power *= 10.0d;
-              power += sign * (double)(getCharAt(p, i) - '0');
-            }
-            consume(p);
-          } while(p->cur->type == DIGIT);
-        }
-
-        value *= pow(10.0d, power);
-      } else {
+      if(p->cur->type != DIGIT) {
         UNEXPECTED_TOKEN(p);
         return (JItemValue) { 0 };
       }
+      while(p->cur->type == DIGIT) {
+        if(!appendNumber(p, text, &length)) {
+          return (JItemValue){ 0 };
+        }
+      }
     }
+    text[length] = '\0';
+    double value = strtod(text, NULL);
 
     //determine if we have a integer, float, or double
     JItemValue retVal = { 0 };
-    double absValue = signValue * value;
-    if(absValue <= FLT_MAX) {
+    if(fabs(value) <= FLT_MAX) {
       //we have a float, check for decimals
-      if(absValue <= INT_MAX && !(absValue - floor(absValue) > 0)) {
+      if(value >= INT_MIN && value <= INT_MAX && value == floor(value)) {
         //we have an integer
         *type = VAL_INT;
         retVal.int_val = (int)value;
       }else{
         *type = VAL_FLOAT;
-        retVal.float_val = (float)value;
+        retVal.float_val = strtof(text, NULL); // rounded once, straight from the text
       }
     }else{
 
@@ -541,7 +916,7 @@ JItemValue jsonParseNumber(Parser *p, short *type) {
   return (JItemValue) { 0 };
 }
 
-void jsonRewind(Parser *p, int saved) {
+void jsonRewind(Parser *p, long saved) {
   if(p->cur == NULL) {
     p->error = 45;
     return;
@@ -573,127 +948,47 @@ void jsonRewind(Parser *p, int saved) {
 }
 
 JArray* jsonParseArray(Parser *p, short *type) {
-  typedef struct ArrayVal {
-    JItemValue       val;
-    int              type : 4;
-    struct ArrayVal* next;
-  } ArrayVal;
-
-#define ARRAY_TYPE(t) \
-   (t == VAL_INT ? VAL_INT_ARRAY : \
-     (t == VAL_FLOAT ? VAL_FLOAT_ARRAY : \
-       (t == VAL_DOUBLE ? VAL_DOUBLE_ARRAY : \
-         (t == VAL_STRING ? VAL_STRING_ARRAY : \
-             (t == VAL_BOOL ? VAL_BOOL_ARRAY : VAL_MIXED_ARRAY)))))
-
   if(p->cur->type != OPEN_BRACKET) {
     UNEXPECTED_TOKEN(p);
     return 0;
   }
 
-  ArrayVal *curVal = malloc(sizeof(ArrayVal));
-  memset(curVal, 0, sizeof(ArrayVal));
-  ArrayVal *head = 0;
-  head = curVal;
-
-  int count = 0;
-  short singleValueType = -1;
-  ArrayVal *nextVal = 0;
+  // items go straight into the array, which packs them while they all
+  // share a type and only falls back to tagged items once they differ
+  JArray *arrayVal = jsonContextNewArray(p->ctx);
+  if(!arrayVal) {
+    return 0;
+  }
   do {
     consume(p); //first time consume open bracket then commas
     consumeWhitespace(p);
     if(p->cur->type == CLOSE_BRACKET) {
       break;
     }
+    JArrayItem item = { 0 };
     short valType = 0;
-    curVal->val = jsonParseValue(p, &valType);
-    curVal->type = valType;
-
-    if(curVal == NULL || p->error) {
-      while(head != 0) {
-        ArrayVal *deletable = head;
-        head = head->next;
-        free(deletable);
-      }
-      return 0;
+    if(p->cur->type == PLUS_MINUS || p->cur->type == DIGIT) {
+      item.value = jsonParseNumber(p, &valType);
+    } else {
+      item.value = jsonParseValue(p, &valType);
     }
+    item.type = valType;
 
-    // could make this a ternary but I won't
-    if(singleValueType == -1) {
-      singleValueType = ARRAY_TYPE(curVal->type);
-    }
-    if(singleValueType != ARRAY_TYPE(curVal->type)) {
-      // as soon as it's not the same it's mixed
-      singleValueType = VAL_MIXED_ARRAY;
+    if(p->error || !jsonAddArrayItem(arrayVal, &item)) {
+      jsonFree((JItemValue) { arrayVal }, VAL_MIXED_ARRAY);
+      return 0;
     }
-
-    nextVal = malloc(sizeof(ArrayVal));
-    memset(nextVal, 0, sizeof(ArrayVal));
-    curVal->next = nextVal;
-    curVal = nextVal;
-    ++count;
     consumeWhitespace(p);
   } while(p->cur->type == COMMA);
 
   if(p->cur->type != CLOSE_BRACKET) {
-    if(curVal) {
-      free(curVal);
-    }
+    jsonFree((JItemValue) { arrayVal }, VAL_MIXED_ARRAY);
     UNEXPECTED_TOKEN(p);
     return 0;
   }
   consume(p);
 
-  //Now we know how many we have lets allocate
-  JArray *arrayVal = malloc(sizeof(JArray));
-  memset(arrayVal, 0, sizeof(JArray));
-
-  if(count == 0) {
-    if(curVal) {
-      free(curVal);
-    }
-    arrayVal->count = 0;
-    arrayVal->_internal.vItems = 0;
-    *type = VAL_MIXED_ARRAY;
-    return arrayVal;
-  }
-
-  *type = singleValueType;
-  if(singleValueType == VAL_MIXED_ARRAY) {
-    arrayVal->type = singleValueType;
-    arrayVal->count = count;
-    arrayVal->_internal.vItems = (JArrayItem*)malloc(sizeof(JArrayItem)*count);
-
-    curVal = head;
-    int countDown = count;
-    JArrayItem *item = 0;
-    while(curVal && countDown > 0) {
-      item = &arrayVal->_internal.vItems[countDown-1];
-      item->type = curVal->type;
-      item->value = curVal->val;
-      ArrayVal *toDel = curVal;
-      curVal = curVal->next;
-      free(toDel);
-      countDown--;
-    }
-
-  }else if(singleValueType != VAL_MIXED_ARRAY) {
-    JItemValue *itemArray = malloc(sizeof(JItemValue) * count);
-    curVal = head;
-    int countDown = count;
-    while(curVal && countDown > 0) {
-      itemArray[count-countDown] = curVal->val;
-      ArrayVal *toDel = curVal;
-      curVal = curVal->next;
-      free(toDel);
-      countDown--;
-    }
-    arrayVal->_internal.items = itemArray;
-    arrayVal->type = *type;
-    arrayVal->count = count;
-  }
-
-
+  *type = arrayVal->type;
   return arrayVal;
 }
 
@@ -712,22 +1007,42 @@ void consume(Parser *p) {
 }
 
 JItemValue jsonParse(const char *filename, short *type) {
+  return jsonContextParse(jsonDefaultContext(), filename, type);
+}
+
+JItemValue jsonContextParse(JsonContext *ctx, const char *filename, short *type) {
   FILE *file = fopen(filename, "r");
   if(!file) {
 	  fprintf(stderr, "Could not open file %s\n", filename);
 	  return (JItemValue) { 0 };
   }
-  return jsonParseF(file, type);
+  return jsonContextParseF(ctx, file, type);
 }
 
 JItemValue jsonParseF(FILE *file, short *type) {
+  return jsonContextParseF(jsonDefaultContext(), file, type);
+}
+
+/** Parses a document, keeping only the given paths when there are any */
+static JItemValue parseFile(JsonContext *ctx, FILE *file, const JKeyPath *paths, unsigned int count, short *type) {
   if(!file) {
     return (JItemValue) { 0 };
   }
+  unsigned char resolved[count ? count : 1];
+  unsigned int all[count ? count : 1];
+  for(unsigned int i = 0; i < count; ++i) {
+    resolved[i] = 0;
+    all[i] = i;
+  }
+
   Parser p;
   memset(&p, 0, sizeof(p));
+  p.ctx = ctx;
   p.file = file;
   p.buf_seek = -1;
+  p.paths = paths;
+  p.resolved = resolved;
+  p.pending = count;
   p.error_message = strdup("Unknown Error");
   Tok *first = p.first = p.cur = ffirst(&p);
   if(p.cur) {
@@ -735,12 +1050,22 @@ JItemValue jsonParseF(FILE *file, short *type) {
     void *val = NULL;
     if(p.cur->type == OPEN_BRACE) {
       *type = VAL_OBJ;
-      val = jsonParseObject(&p);
+      val = paths ? jsonProjectObject(&p, all, count, 0) : jsonParseObject(&p);
     } else if(p.cur->type == OPEN_BRACKET) {
-      val = jsonParseArray(&p, type);
+      val = paths ? projectArray(&p, all, count, 0, type) : jsonParseArray(&p, type);
+      if(paths && !val && !p.error) {
+        val = jsonContextNewArray(ctx); // no path reached into the root
+        *type = VAL_MIXED_ARRAY;
+      }
     }
 
     if(val && !p.error) {
+      // the root owns the strings the document did not share
+      if(*type == VAL_OBJ) {
+        ((JObject*)val)->_strings = p.strings;
+      } else {
+        ((JArray*)val)->_strings = p.strings;
+      }
       free(p.error_message);
       free(first);
       fclose(file);
@@ -753,19 +1078,77 @@ JItemValue jsonParseF(FILE *file, short *type) {
 
   BAD_CHARACTER(&p)
   jsonPrintError(&p);
+  jsonInternFree(p.strings);
   free(p.error_message);
   free(first);
   fclose(file);
   return (JItemValue) { 0 };
 }
 
+JItemValue jsonContextParseF(JsonContext *ctx, FILE *file, short *type) {
+  return parseFile(ctx, file, NULL, 0, type);
+}
+
+JItemValue jsonContextParseKeyPathsF(JsonContext *ctx, FILE *file, const JKeyPath *paths, unsigned int count, short *type) {
+  return parseFile(ctx, file, paths, count, type);
+}
+
+JItemValue jsonContextParseKeyPaths(JsonContext *ctx, const char *filename, const JKeyPath *paths, unsigned int count, short *type) {
+  FILE *file = fopen(filename, "r");
+  if(!file) {
+    fprintf(stderr, "Could not open file %s\n", filename);
+    return (JItemValue) { 0 };
+  }
+  return parseFile(ctx, file, paths, count, type);
+}
+
+static JItemValue parseProjected(JsonContext *ctx, FILE *file, const char **keepPaths, unsigned int n, short *type) {
+  JKeyPath *paths = malloc((n ? n : 1) * sizeof(JKeyPath));
+  unsigned int ready = 0;
+  while(paths && ready < n && jsonKeyPathInit(&paths[ready], keepPaths[ready])) {
+    ++ready;
+  }
+  JItemValue val = { 0 };
+  if(paths && ready == n) {
+    val = parseFile(ctx, file, paths, n, type);
+  } else if(file) {
+    fclose(file);
+  }
+  for(unsigned int i = 0; i < ready; ++i) {
+    jsonKeyPathFree(&paths[i]);
+  }
+  free(paths);
+  return val;
+}
+
+JItemValue jsonParseProjected(const char *filename, const char **keepPaths, unsigned int n, short *type) {
+  return jsonContextParseProjected(jsonDefaultContext(), filename, keepPaths, n, type);
+}
+
+JItemValue jsonParseProjectedF(FILE *file, const char **keepPaths, unsigned int n, short *type) {
+  return parseProjected(jsonDefaultContext(), file, keepPaths, n, type);
+}
+
+JItemValue jsonContextParseProjectedF(JsonContext *ctx, FILE *file, const char **keepPaths, unsigned int n, short *type) {
+  return parseProjected(ctx, file, keepPaths, n, type);
+}
+
+JItemValue jsonContextParseProjected(JsonContext *ctx, const char *filename, const char **keepPaths, unsigned int n, short *type) {
+  FILE *file = fopen(filename, "r");
+  if(!file) {
+    fprintf(stderr, "Could not open file %s\n", filename);
+    return (JItemValue) { 0 };
+  }
+  return parseProjected(ctx, file, keepPaths, n, type);
+}
+
 char getCharAt(Parser *p, int index) {
   Tok *tok = p->cur;
   if(!tok) {
     return -1;
   }
   char buf;
-  int seekPos = tok->seek + index;
+  long seekPos = tok->seek + index;
   if(seekPos > tok->seek + tok->count) {
     seekPos = tok->seek + tok->count;
   }
@@ -781,7 +1164,14 @@ void jsonPrintParserInfo() {
   printf("Object struct size %d\n", (unsigned int) sizeof(JObject));
 }
 
-void jsonRead(char *buf, Parser *p, int seek, int count) {
+void jsonRead(char *buf, Parser *p, long seek, int count) {
+  if(count > TOK_BUF_SIZE) {
+    // more than the window holds, read it straight from the file
+    fseek(p->file, seek, SEEK_SET);
+    size_t n = fread(buf, sizeof(buf[0]), count, p->file);
+    memset(buf + n, 0, count - n);
+    return;
+  }
   if(seek + count > p->buf_seek + TOK_BUF_SIZE || p->buf_seek < 0) {
     if(p->buf_seek < 0) {
       p->buf_seek = 0;
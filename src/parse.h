@@ -28,7 +28,7 @@
 
 typedef unsigned char TokType;
 typedef struct Tok {
-  int   seek;
+  long  seek; // byte offset in the file, long so inputs past 2 GB stay addressable
   unsigned char  count;
   unsigned short line;
   unsigned short column;
@@ -47,11 +47,17 @@ typedef struct Parser {
     unsigned int error;
     Tok *error_tok;
     char* error_message;
+    JsonContext  *ctx;
+    JInternTable *strings; // document owned string values
     const char* error_in_file;
     int error_on_line;
-    int buf_seek;
+    long buf_seek;
+    const JKeyPath *paths;    // projected parse keeps only these, NULL keeps everything
+    unsigned char  *resolved; // per path, found or known to be missing
+    unsigned int    pending;  // paths not resolved yet, the parse stops at 0
     char buf[TOK_BUF_SIZE];
     char eof : 1;
+    char done : 1;            // every path is resolved, stop reading
 } Parser;
 
 TokType     tokType(const char c);
@@ -67,9 +73,9 @@ char        getCharAt(Parser *p, int index);
 const char* getStrBetween(Parser *p, Tok *start, Tok *end);
 const char* getnStrBetween(Parser *p, Tok *start, Tok *end, int count);
 
-void        jsonRewind(Parser *p, int saved);
+void        jsonRewind(Parser *p, long saved);
 void        jsonExpectPairSeparator(Parser *p);
-void        jsonRead(char *buf, Parser *p, int seek, int count);
+void        jsonRead(char *buf, Parser *p, long seek, int count);
 
 void*       expectPairSeparator(Tok *start);
 
@@ -77,6 +83,8 @@ void        jsonSetParserError(Parser *p, unsigned int, const char* err, const c
 
 JArray*     jsonParseArray(Parser *p, short *type);
 JObject*    jsonParseObject(Parser *p);
+JObject*    jsonProjectObject(Parser *p, const unsigned int *paths, unsigned int count, unsigned int depth);
+void        jsonSkipValue(Parser *p);
 void        jsonParseMembers(Parser *p, JObject *obj);
 int         jsonParseQuotedString(Parser* parser, char quote);
 char*       jsonParseString(Parser *p);
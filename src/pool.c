@@ -0,0 +1,276 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "pool.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define POOL_MAX_THREADS    64
+#define POOL_DEQUE_CAPACITY 1024
+
+typedef struct JPoolJob {
+  JPoolTask   fn;
+  void*       arg;
+  atomic_uint remaining; // tasks not finished yet, the job lives on the poster's stack until 0
+} JPoolJob;
+
+/** Tasks begin up to end of a job, halved every time it is taken */
+typedef struct JPoolRange {
+  JPoolJob*    job;
+  unsigned int begin;
+  unsigned int end;
+} JPoolRange;
+
+/**
+ * The owner pushes and pops the newest, smallest ranges at the tail, thieves
+ * take the oldest, largest ones at the head. Every deque has its own lock.
+ */
+typedef struct JPoolDeque {
+  pthread_mutex_t lock;
+  atomic_uint     size; // read without the lock to skip empty deques
+  unsigned int    head;
+  JPoolRange      items[POOL_DEQUE_CAPACITY];
+} JPoolDeque;
+
+typedef struct JPoolWorker {
+  struct JPool* pool;
+  unsigned int  index; // of its deque
+  pthread_t     thread;
+} JPoolWorker;
+
+struct JPool {
+  pthread_mutex_t submit;   // held by the outside thread whose job runs on the pool
+  pthread_mutex_t sleep;
+  pthread_cond_t  wake;     // idle workers wait here for work
+  atomic_uint     sleepers;
+  atomic_int      stop;
+  JPoolDeque*     deques;   // one per thread, the last one for the submitting thread
+  unsigned int    dequeCount;
+  unsigned int    workers;  // started
+  JPoolWorker     threads[];
+};
+
+/** The pool and deque of the calling thread while it works on a pool */
+typedef struct JPoolSlot {
+  JPool*       pool;
+  unsigned int deque;
+} JPoolSlot;
+
+static _Thread_local JPoolSlot current;
+
+static JPool          *defaultPool = NULL;
+static pthread_once_t  defaultPoolOnce = PTHREAD_ONCE_INIT;
+
+static int hasWork(JPool *pool) {
+  for (unsigned int i = 0; i < pool->dequeCount; ++i) {
+    if (atomic_load(&pool->deques[i].size)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void wakeOne(JPool *pool) {
+  if (atomic_load(&pool->sleepers)) {
+    pthread_mutex_lock(&pool->sleep);
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->sleep);
+  }
+}
+
+static int push(JPoolDeque *deque, JPoolRange range) {
+  pthread_mutex_lock(&deque->lock);
+  unsigned int size = atomic_load_explicit(&deque->size, memory_order_relaxed);
+  if (size == POOL_DEQUE_CAPACITY) {
+    pthread_mutex_unlock(&deque->lock);
+    return 0;
+  }
+  deque->items[(deque->head + size) % POOL_DEQUE_CAPACITY] = range;
+  atomic_store(&deque->size, size + 1);
+  pthread_mutex_unlock(&deque->lock);
+  return 1;
+}
+
+static int take(JPoolDeque *deque, JPoolRange *range, int oldest) {
+  if (!atomic_load_explicit(&deque->size, memory_order_relaxed)) {
+    return 0;
+  }
+  pthread_mutex_lock(&deque->lock);
+  unsigned int size = atomic_load_explicit(&deque->size, memory_order_relaxed);
+  if (size) {
+    if (oldest) {
+      *range = deque->items[deque->head];
+      deque->head = (deque->head + 1) % POOL_DEQUE_CAPACITY;
+    } else {
+      *range = deque->items[(deque->head + size - 1) % POOL_DEQUE_CAPACITY];
+    }
+    atomic_store_explicit(&deque->size, size - 1, memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return size != 0;
+}
+
+/** Pops the own deque first, then steals going round the others */
+static int findWork(JPool *pool, unsigned int self, JPoolRange *range) {
+  if (take(&pool->deques[self], range, 0)) {
+    return 1;
+  }
+  for (unsigned int k = 1; k < pool->dequeCount; ++k) {
+    if (take(&pool->deques[(self + k) % pool->dequeCount], range, 1)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/** Leaves the upper halves of a range to thieves and runs what remains */
+static void runRange(JPool *pool, unsigned int self, JPoolRange range) {
+  while (range.end - range.begin > 1) {
+    unsigned int mid = range.begin + (range.end - range.begin) / 2;
+    if (!push(&pool->deques[self], (JPoolRange) { range.job, mid, range.end })) {
+      break; // full, the rest runs here
+    }
+    wakeOne(pool);
+    range.end = mid;
+  }
+  JPoolJob *job = range.job;
+  for (unsigned int task = range.begin; task < range.end; ++task) {
+    job->fn(job->arg, task);
+  }
+  // the last touch of the job, its poster may return right after
+  atomic_fetch_sub_explicit(&job->remaining, range.end - range.begin, memory_order_release);
+}
+
+static void* poolWorker(void *arg) {
+  JPoolWorker *worker = arg;
+  JPool *pool = worker->pool;
+  current = (JPoolSlot) { pool, worker->index };
+  JPoolRange range;
+  while (!atomic_load(&pool->stop)) {
+    if (findWork(pool, worker->index, &range)) {
+      runRange(pool, worker->index, range);
+      continue;
+    }
+    pthread_mutex_lock(&pool->sleep);
+    atomic_fetch_add(&pool->sleepers, 1);
+    // pushers look at sleepers after publishing, so either they wake us or we see their work
+    if (!atomic_load(&pool->stop) && !hasWork(pool)) {
+      pthread_cond_wait(&pool->wake, &pool->sleep);
+    }
+    atomic_fetch_sub(&pool->sleepers, 1);
+    pthread_mutex_unlock(&pool->sleep);
+  }
+  return NULL;
+}
+
+JPool* jsonPoolNew(unsigned int threads) {
+  if (threads == 0) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = online > 0 ? (unsigned int) online : 1;
+  }
+  if (threads > POOL_MAX_THREADS) {
+    threads = POOL_MAX_THREADS;
+  }
+  unsigned int workers = threads - 1;
+  JPool *pool = malloc(sizeof(JPool) + workers * sizeof(JPoolWorker));
+  if (!pool) {
+    return 0;
+  }
+  memset(pool, 0, sizeof(JPool));
+  pool->deques = calloc(threads, sizeof(JPoolDeque));
+  if (!pool->deques) {
+    free(pool);
+    return 0;
+  }
+  // fixed before any worker starts, a worker that fails to start leaves its deque empty
+  pool->dequeCount = threads;
+  for (unsigned int i = 0; i < threads; ++i) {
+    pthread_mutex_init(&pool->deques[i].lock, NULL);
+  }
+  pthread_mutex_init(&pool->submit, NULL);
+  pthread_mutex_init(&pool->sleep, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  for (; pool->workers < workers; ++pool->workers) {
+    JPoolWorker *worker = &pool->threads[pool->workers];
+    worker->pool = pool;
+    worker->index = pool->workers;
+    if (pthread_create(&worker->thread, NULL, poolWorker, worker) != 0) {
+      fprintf(stderr, "Error: Could only start %u of %u pool threads\n", pool->workers, workers);
+      break;
+    }
+  }
+  return pool;
+}
+
+void jsonPoolFree(JPool *pool) {
+  if (!pool) {
+    return;
+  }
+  atomic_store(&pool->stop, 1);
+  pthread_mutex_lock(&pool->sleep);
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->sleep);
+  for (unsigned int i = 0; i < pool->workers; ++i) {
+    pthread_join(pool->threads[i].thread, NULL);
+  }
+  for (unsigned int i = 0; i < pool->dequeCount; ++i) {
+    pthread_mutex_destroy(&pool->deques[i].lock);
+  }
+  pthread_cond_destroy(&pool->wake);
+  pthread_mutex_destroy(&pool->sleep);
+  pthread_mutex_destroy(&pool->submit);
+  free(pool->deques);
+  free(pool);
+}
+
+void jsonPoolRun(JPool *pool, JPoolTask fn, void *arg, unsigned int tasks) {
+  JPoolJob job = { fn, arg };
+  atomic_init(&job.remaining, tasks);
+  JPoolSlot outer = current;
+  int outside = outer.pool != pool;
+  if (!pool || pool->workers == 0 || tasks < 2
+      || (outside && pthread_mutex_trylock(&pool->submit) != 0)) {
+    // no helpers, or another outside thread has its job on the pool
+    for (unsigned int task = 0; task < tasks; ++task) {
+      fn(arg, task);
+    }
+    return;
+  }
+  if (outside) {
+    current = (JPoolSlot) { pool, pool->dequeCount - 1 };
+  }
+
+  runRange(pool, current.deque, (JPoolRange) { &job, 0, tasks });
+  // help with whatever is queued until the stolen parts of the job are done
+  JPoolRange range;
+  while (atomic_load_explicit(&job.remaining, memory_order_acquire)) {
+    if (findWork(pool, current.deque, &range)) {
+      runRange(pool, current.deque, range);
+    } else {
+      sched_yield();
+    }
+  }
+
+  if (outside) {
+    current = outer;
+    pthread_mutex_unlock(&pool->submit);
+  }
+}
+
+unsigned int jsonPoolThreads(const JPool *pool) {
+  return pool ? pool->workers + 1 : 1;
+}
+
+static void createDefaultPool() {
+  defaultPool = jsonPoolNew(0);
+}
+
+JPool* jsonDefaultPool() {
+  pthread_once(&defaultPoolOnce, createDefaultPool);
+  return defaultPool;
+}
@@ -0,0 +1,28 @@
+#ifndef POOL_H
+#define POOL_H
+
+/**
+ * A fixed set of worker threads sharing the tasks of jobs by work stealing.
+ * Every thread owns a deque of task ranges, it halves the ranges it takes
+ * and leaves the upper halves for idle threads to steal. The calling
+ * thread works on the job too and jsonPoolRun only returns once every task
+ * finished, helping with queued work while it waits.
+ *
+ * Jobs posted from inside a task are nested: they go on the deque of the
+ * thread running the task, so recursive fan-out spreads over the pool.
+ * One outside thread at a time posts to a pool, a job posted from another
+ * one meanwhile runs on its calling thread alone.
+ */
+typedef struct JPool JPool;
+
+typedef void (*JPoolTask)(void *arg, unsigned int task);
+
+JPool*       jsonPoolNew(unsigned int threads);
+void         jsonPoolFree(JPool *pool);
+void         jsonPoolRun(JPool *pool, JPoolTask fn, void *arg, unsigned int tasks);
+/** Threads working on a job, counting the caller */
+unsigned int jsonPoolThreads(const JPool *pool);
+/** Process wide pool sized to the online cpus, created on first use */
+JPool*       jsonDefaultPool();
+
+#endif
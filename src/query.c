@@ -0,0 +1,565 @@
+#include "query.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define QUERY_X86
+#define AVX2 __attribute__((target("avx2")))
+#endif
+
+#define IS_ARRAY(t)          ((t) >= VAL_STRING_ARRAY && (t) <= VAL_MIXED_ARRAY)
+#define IS_WILD(c)           ((c) == '*' || (c) == '?')
+#define FAN_OUT_MIN          16 // children of a step worth splitting into tasks
+#define FAN_OUT_TASKS        64 // at most, per step
+#define COLLECT_MIN_CAPACITY 16
+
+typedef struct Collected {
+  JArrayItem*  items;
+  unsigned int count;
+  unsigned int capacity;
+  char         failed; // a match could not be stored, the list is incomplete
+} Collected;
+
+int jsonGlobMatch(const char *pattern, const char *str) {
+  const char *star = NULL;
+  const char *resume = NULL;
+  while (*str) {
+    if (*pattern == '?' || (*pattern == *str && *pattern != '*')) {
+      ++pattern;
+      ++str;
+    } else if (*pattern == '*') {
+      // remember the star, first try it matching nothing
+      star = pattern++;
+      resume = str;
+    } else if (star) {
+      pattern = star + 1;
+      str = ++resume;
+    } else {
+      return 0;
+    }
+  }
+  while (*pattern == '*') {
+    ++pattern;
+  }
+  return *pattern == '\0';
+}
+
+void jsonGlobCompile(JGlob *glob, const char *pattern) {
+  memset(glob, 0, sizeof(JGlob));
+  glob->pattern = pattern;
+  size_t length = strlen(pattern);
+  size_t first = strcspn(pattern, "*?");
+  glob->prefixLength = first;
+  glob->suffix = pattern + length;
+  glob->minLength = length;
+  if (first == length) {
+    glob->exact = 1;
+    return;
+  }
+  size_t last = length;
+  while (!IS_WILD(pattern[last - 1])) {
+    --last;
+  }
+  glob->suffix = pattern + last;
+  glob->suffixLength = length - last;
+
+  size_t run = first;
+  unsigned int runs = 0;
+  for (size_t i = first; i <= last; ++i) {
+    if (i == last || IS_WILD(pattern[i])) {
+      runs += i > run;
+      if (i - run > glob->literalLength) {
+        glob->literal = pattern + run;
+        glob->literalLength = i - run;
+      }
+      run = i + 1;
+      glob->minLength -= i < last && pattern[i] == '*';
+    }
+  }
+  glob->simple = runs <= 1 && !strchr(pattern, '?');
+}
+
+#ifdef QUERY_X86
+/** Candidates have the first and the last byte of the literal in place, 32 positions a step */
+AVX2 static const char* findAvx2(const char *str, size_t length, const char *literal, size_t literalLength, size_t *i) {
+  const __m256i first = _mm256_set1_epi8(literal[0]);
+  const __m256i last = _mm256_set1_epi8(literal[literalLength - 1]);
+  for (; *i + literalLength - 1 + 32 <= length; *i += 32) {
+    __m256i head = _mm256_loadu_si256((const __m256i*) (str + *i));
+    __m256i tail = _mm256_loadu_si256((const __m256i*) (str + *i + literalLength - 1));
+    unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(head, first), _mm256_cmpeq_epi8(tail, last)));
+    while (mask) {
+      const char *candidate = str + *i + __builtin_ctz(mask);
+      if (memcmp(candidate + 1, literal + 1, literalLength - 2) == 0) {
+        return candidate;
+      }
+      mask &= mask - 1;
+    }
+  }
+  return 0;
+}
+
+#ifdef __SSE2__
+static const char* findSse2(const char *str, size_t length, const char *literal, size_t literalLength, size_t *i) {
+  const __m128i first = _mm_set1_epi8(literal[0]);
+  const __m128i last = _mm_set1_epi8(literal[literalLength - 1]);
+  for (; *i + literalLength - 1 + 16 <= length; *i += 16) {
+    __m128i head = _mm_loadu_si128((const __m128i*) (str + *i));
+    __m128i tail = _mm_loadu_si128((const __m128i*) (str + *i + literalLength - 1));
+    unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+    while (mask) {
+      const char *candidate = str + *i + __builtin_ctz(mask);
+      if (memcmp(candidate + 1, literal + 1, literalLength - 2) == 0) {
+        return candidate;
+      }
+      mask &= mask - 1;
+    }
+  }
+  return 0;
+}
+#endif
+#endif
+
+/** Finds a literal of at least two characters in the first length characters of a string */
+static const char* findLiteral(const char *str, size_t length, const char *literal, size_t literalLength) {
+  size_t i = 0;
+  const char *found = NULL;
+#ifdef QUERY_X86
+  if (jsonSimdLevel() >= JSON_SIMD_AVX2) {
+    found = findAvx2(str, length, literal, literalLength, &i);
+  }
+#ifdef __SSE2__
+  if (!found && jsonSimdLevel() >= JSON_SIMD_SSE2) {
+    found = findSse2(str, length, literal, literalLength, &i);
+  }
+#endif
+#endif
+  for (; !found && i + literalLength <= length; ++i) {
+    if (str[i] == literal[0] && memcmp(str + i + 1, literal + 1, literalLength - 1) == 0) {
+      found = str + i;
+    }
+  }
+  return found;
+}
+
+int jsonGlobMatchCompiled(const JGlob *glob, const char *str) {
+  if (glob->prefixLength && *str != *glob->pattern) {
+    return 0;
+  }
+  if (glob->exact) {
+    return strcmp(str, glob->pattern) == 0;
+  }
+  if (strncmp(str, glob->pattern, glob->prefixLength) != 0) {
+    return 0;
+  }
+  const char *middle = str + glob->prefixLength;
+  if (glob->simple && !glob->suffixLength && glob->literalLength <= 1) {
+    // prefix* and prefix*c* need no length
+    return !glob->literalLength || strchr(middle, glob->literal[0]);
+  }
+  size_t length = strlen(middle);
+  if (glob->prefixLength + length < glob->minLength
+      || memcmp(middle + length - glob->suffixLength, glob->suffix, glob->suffixLength) != 0) {
+    return 0;
+  }
+  // the literal lies between the prefix and the suffix
+  length -= glob->suffixLength;
+  if (glob->literalLength == 1 && !memchr(middle, glob->literal[0], length)) {
+    return 0;
+  }
+  if (glob->literalLength > 1 && !findLiteral(middle, length, glob->literal, glob->literalLength)) {
+    return 0;
+  }
+  return glob->simple || jsonGlobMatch(glob->pattern + glob->prefixLength, middle);
+}
+
+static int parseIndex(const char *str, char **end, int32_t *index) {
+  long value = strtol(str, end, 10);
+  if (*end == str || value < 0 || value > INT32_MAX) {
+    return 0;
+  }
+  *index = (int32_t) value;
+  return 1;
+}
+
+/** Compiles the brackets of an array step, the closing bracket is already cut off */
+static int compileArray(JQuery *query, char *segment, KeySearch *step, unsigned int *used) {
+  if (strcmp(segment, "*") == 0) {
+    step->searchType = WILDCARD;
+    return 1;
+  }
+  char *end = NULL;
+  int32_t first = 0;
+  if (!parseIndex(segment, &end, &first)) {
+    return 0;
+  }
+  if (*end == '-') {
+    step->searchType = ARRAY_RANGE;
+    step->meta.range.start = first;
+    return parseIndex(end + 1, &end, &step->meta.range.end)
+        && *end == '\0' && step->meta.range.end >= first;
+  }
+
+  step->searchType = ARRAY;
+  step->meta.indices.items = query->_indices + *used;
+  step->meta.indices.count = 0;
+  for (;;) {
+    query->_indices[(*used)++] = first;
+    ++step->meta.indices.count;
+    if (*end == '\0') {
+      return 1;
+    }
+    if (*end != ',' || !parseIndex(end + 1, &end, &first)) {
+      return 0;
+    }
+  }
+}
+
+static int compileStep(JQuery *query, char *segment, KeySearch *step, unsigned int *used) {
+  size_t length = strlen(segment);
+  if (length == 0) {
+    return 0;
+  }
+  if (segment[0] == '[') {
+    if (length < 3 || segment[length - 1] != ']') {
+      return 0;
+    }
+    segment[length - 1] = '\0';
+    return compileArray(query, segment + 1, step, used);
+  }
+  if (strcmp(segment, "*") == 0) {
+    step->searchType = WILDCARD;
+  } else if (strpbrk(segment, "*?")) {
+    step->searchType = KEY_MATCH;
+    step->meta.matchStr = segment;
+    jsonGlobCompile(&step->glob, segment);
+  } else {
+    step->searchType = KEY;
+    step->meta.key = (JKey) { segment, fnvstr(segment), (unsigned int) length };
+  }
+  return 1;
+}
+
+JQuery* jsonQueryCompile(const char *expr) {
+  if (!expr || !*expr) {
+    fprintf(stderr, "Error: Empty query\n");
+    return 0;
+  }
+  size_t length = strlen(expr);
+  unsigned int steps = 1;
+  unsigned int indices = 1;
+  for (size_t i = 0; i < length; ++i) {
+    steps += expr[i] == '.';
+    indices += expr[i] == ',' || expr[i] == '[';
+  }
+
+  JQuery *query = malloc(sizeof(JQuery));
+  if (!query) {
+    return 0;
+  }
+  memset(query, 0, sizeof(JQuery));
+  query->_text = malloc(length + 1);
+  query->steps = malloc(steps * sizeof(KeySearch));
+  query->_indices = malloc(indices * sizeof(int32_t));
+  if (!query->_text || !query->steps || !query->_indices) {
+    fprintf(stderr, "Error: Could not allocate query '%s'\n", expr);
+    jsonQueryFree(query);
+    return 0;
+  }
+  memcpy(query->_text, expr, length + 1);
+  memset(query->steps, 0, steps * sizeof(KeySearch));
+
+  char *segment = query->_text;
+  unsigned int used = 0;
+  while (segment) {
+    KeySearch *step = &query->steps[query->count];
+    if (segment[0] == '=') {
+      // a value match is the last step and its glob may hold dots
+      step->searchType = MATCH;
+      step->meta.matchStr = segment + 1;
+      jsonGlobCompile(&step->glob, segment + 1);
+      ++query->count;
+      break;
+    }
+    char *end = strchr(segment, '.');
+    if (end) {
+      *end = '\0';
+    }
+    if (!compileStep(query, segment, step, &used)) {
+      fprintf(stderr, "Error: Invalid step '%s' in query '%s'\n", segment, expr);
+      jsonQueryFree(query);
+      return 0;
+    }
+    ++query->count;
+    segment = end ? end + 1 : NULL;
+  }
+  return query;
+}
+
+void jsonQueryFree(JQuery *query) {
+  if (!query) {
+    return;
+  }
+  free(query->_text);
+  free(query->steps);
+  free(query->_indices);
+  free(query);
+}
+
+static const KeySearch everyStep = { WILDCARD };
+static const JQuery everyValue = { (KeySearch*) &everyStep, 1, NULL, NULL };
+
+/** Selects the next value a frame's step leads to, 0 when there are no more */
+static int nextChild(JCursorFrame *f, const KeySearch *search, const char **key, JItemValue *child, short *childType) {
+  const JObject *obj = f->type == VAL_OBJ ? f->value.object_val : NULL;
+  const JArray *arr = IS_ARRAY(f->type) ? f->value.array_val : NULL;
+  *key = NULL;
+  switch (search->searchType) {
+  case KEY:
+    if (f->next++) {
+      return 0;
+    }
+    *key = search->meta.key.str;
+    *child = jsonGetKey(obj, search->meta.key, childType);
+    return *childType != 0;
+  case ARRAY:
+    while (arr && f->next < search->meta.indices.count) {
+      unsigned int i = search->meta.indices.items[f->next++];
+      if (i < arr->count) {
+        *child = jsonArrayGet(arr, i, childType);
+        return 1;
+      }
+    }
+    return 0;
+  case ARRAY_RANGE: {
+    unsigned int i = search->meta.range.start + f->next++;
+    if (!arr || i > (unsigned int) search->meta.range.end || i >= arr->count) {
+      return 0;
+    }
+    *child = jsonArrayGet(arr, i, childType);
+    return 1;
+  }
+  case WILDCARD:
+  case KEY_MATCH:
+    if (arr && search->searchType == WILDCARD) {
+      if (f->next >= arr->count) {
+        return 0;
+      }
+      *child = jsonArrayGet(arr, f->next++, childType);
+      return 1;
+    }
+    while (obj && f->next < obj->_used) {
+      if (jsonEntryAt(obj, f->next++, key, child, childType)
+          && (search->searchType == WILDCARD || jsonGlobMatchCompiled(&search->glob, *key))) {
+        return 1;
+      }
+    }
+    *key = NULL;
+    return 0;
+  case MATCH:
+    if (f->next++ || f->type != VAL_STRING || !f->value.string_val
+        || !jsonGlobMatchCompiled(&search->glob, f->value.string_val)) {
+      return 0;
+    }
+    *key = f->key;
+    *child = f->value;
+    *childType = f->type;
+    return 1;
+  }
+  return 0;
+}
+
+int jsonCursorQuery(JCursor *cursor, const JQuery *query, JItemValue root, short type) {
+  cursor->query = query;
+  cursor->key = NULL;
+  cursor->depth = 0;
+  if (!query || !query->count) {
+    return 0;
+  }
+  if (query->count > JSON_CURSOR_DEPTH) {
+    fprintf(stderr, "Error: Query of %u steps is deeper than a cursor's %d\n", query->count, JSON_CURSOR_DEPTH);
+    return 0;
+  }
+  cursor->frames[0] = (JCursorFrame) { root, NULL, 0, type, 0 };
+  cursor->depth = 1;
+  return 1;
+}
+
+void jsonCursorEntries(JCursor *cursor, const JObject *obj) {
+  jsonCursorQuery(cursor, &everyValue, (JItemValue) { .object_val = (JObject*) obj }, obj ? VAL_OBJ : 0);
+}
+
+void jsonCursorItems(JCursor *cursor, const JArray *arr) {
+  jsonCursorQuery(cursor, &everyValue, (JItemValue) { .array_val = (JArray*) arr }, arr ? arr->type : 0);
+}
+
+int jsonCursorNext(JCursor *cursor, JItemValue *value, short *type) {
+  while (cursor->depth) {
+    JCursorFrame *f = &cursor->frames[cursor->depth - 1];
+    const char *key = NULL;
+    JItemValue child;
+    short childType = 0;
+    if (!nextChild(f, &cursor->query->steps[f->step], &key, &child, &childType)) {
+      --cursor->depth;
+    } else if (f->step + 1u == cursor->query->count) {
+      cursor->key = key;
+      *value = child;
+      *type = childType;
+      return 1;
+    } else {
+      cursor->frames[cursor->depth++] = (JCursorFrame) { child, key, 0, childType, f->step + 1 };
+    }
+  }
+  cursor->key = NULL;
+  return 0;
+}
+
+unsigned jsonQueryRun(const JQuery *query, JItemValue root, short type, JQueryVisit visit, void *user) {
+  JCursor cursor;
+  if (!visit || !jsonCursorQuery(&cursor, query, root, type)) {
+    return 0;
+  }
+  unsigned found = 0;
+  JItemValue value;
+  short valueType = 0;
+  while (jsonCursorNext(&cursor, &value, &valueType)) {
+    ++found;
+    if (!visit(user, value, valueType)) {
+      break;
+    }
+  }
+  return found;
+}
+
+static int collect(void *user, JItemValue value, short type) {
+  Collected *all = user;
+  if (all->failed) {
+    return 0;
+  }
+  if (all->count == all->capacity) {
+    unsigned int capacity = all->capacity ? all->capacity * 2 : COLLECT_MIN_CAPACITY;
+    JArrayItem *items = realloc(all->items, capacity * sizeof(JArrayItem));
+    if (!items) {
+      fprintf(stderr, "Error: Could not grow query results to %u items\n", capacity);
+      all->failed = 1;
+      return 0;
+    }
+    all->items = items;
+    all->capacity = capacity;
+  }
+  all->items[all->count].type = type;
+  all->items[all->count].value = value;
+  ++all->count;
+  return 1;
+}
+
+/** Hands out the collected list, or frees it and returns NULL when a match was dropped */
+static JArrayItem* collected(Collected *all, unsigned *count) {
+  if (all->failed) {
+    free(all->items);
+    *count = 0;
+    return 0;
+  }
+  *count = all->count;
+  return all->items;
+}
+
+JArrayItem* jsonQueryAll(const JQuery *query, JItemValue root, short type, unsigned *count) {
+  Collected all = { NULL, 0, 0, 0 };
+  jsonQueryRun(query, root, type, collect, &all);
+  return collected(&all, count);
+}
+
+typedef struct FanOut {
+  const JQuery*       query;
+  JPool*              pool;
+  const JCursorFrame* frame;   // the value fanning out, next is where the children start
+  unsigned int        children;
+  unsigned int        tasks;
+  Collected*          results; // one per task, joined in order
+} FanOut;
+
+static void gather(const JQuery *query, JPool *pool, JCursorFrame frame, Collected *out);
+
+/** Positions a step walks over, for the steps that fan out */
+static unsigned int fanOutChildren(const KeySearch *search, const JCursorFrame *f) {
+  const JObject *obj = f->type == VAL_OBJ ? f->value.object_val : NULL;
+  const JArray *arr = IS_ARRAY(f->type) ? f->value.array_val : NULL;
+  switch (search->searchType) {
+  case WILDCARD:
+    return arr ? arr->count : obj ? obj->_used : 0;
+  case KEY_MATCH:
+    return obj ? obj->_used : 0;
+  case ARRAY_RANGE: {
+    unsigned int start = search->meta.range.start;
+    unsigned int end = (unsigned int) search->meta.range.end + 1;
+    return !arr || start >= arr->count ? 0 : (end < arr->count ? end : arr->count) - start;
+  }
+  default:
+    return 0;
+  }
+}
+
+/** Gathers the matches under the children one task covers */
+static void fanOutTask(void *arg, unsigned int task) {
+  FanOut *fan = arg;
+  JCursorFrame f = *fan->frame;
+  unsigned int end = (unsigned int) ((unsigned long) fan->children * (task + 1) / fan->tasks);
+  f.next = (unsigned int) ((unsigned long) fan->children * task / fan->tasks);
+  const KeySearch *search = &fan->query->steps[f.step];
+  const char *key = NULL;
+  JItemValue child;
+  short childType = 0;
+  // nextChild moves next past the child it selects, which has to lie before end
+  while (f.next < end && nextChild(&f, search, &key, &child, &childType) && f.next <= end) {
+    gather(fan->query, fan->pool, (JCursorFrame) { child, key, 0, childType, f.step + 1 }, &fan->results[task]);
+  }
+}
+
+/** Applies the step of a frame and gathers the matches below it, splitting wide steps into tasks */
+static void gather(const JQuery *query, JPool *pool, JCursorFrame frame, Collected *out) {
+  if (out->failed) {
+    return; // the list is dropped anyway
+  }
+  if (frame.step == query->count) {
+    collect(out, frame.value, frame.type);
+    return;
+  }
+  const KeySearch *search = &query->steps[frame.step];
+  unsigned int children = frame.step + 1 < query->count ? fanOutChildren(search, &frame) : 0;
+  if (children < FAN_OUT_MIN || jsonPoolThreads(pool) < 2) {
+    const char *key = NULL;
+    JItemValue child;
+    short childType = 0;
+    while (nextChild(&frame, search, &key, &child, &childType)) {
+      gather(query, pool, (JCursorFrame) { child, key, 0, childType, frame.step + 1 }, out);
+    }
+    return;
+  }
+
+  unsigned int tasks = children < FAN_OUT_TASKS ? children : FAN_OUT_TASKS;
+  Collected results[tasks];
+  memset(results, 0, sizeof(results));
+  FanOut fan = { query, pool, &frame, children, tasks, results };
+  jsonPoolRun(pool, fanOutTask, &fan, tasks);
+  for (unsigned int t = 0; t < tasks; ++t) {
+    out->failed |= results[t].failed;
+    for (unsigned int i = 0; i < results[t].count; ++i) {
+      if (!collect(out, results[t].items[i].value, results[t].items[i].type)) {
+        break;
+      }
+    }
+    free(results[t].items);
+  }
+}
+
+JArrayItem* jsonQueryAllParallel(const JQuery *query, JItemValue root, short type, JPool *pool, unsigned *count) {
+  Collected all = { NULL, 0, 0, 0 };
+  if (query && query->count) {
+    gather(query, pool, (JCursorFrame) { root, NULL, 0, type, 0 }, &all);
+  }
+  return collected(&all, count);
+}
@@ -0,0 +1,178 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <stdint.h>
+
+#include "json.h"
+
+#define SEARCH_TYPE_ARRAY         0
+#define SEARCH_TYPE_ARRAY_RANGE   1
+#define SEARCH_TYPE_WILDCARD      2
+#define SEARCH_TYPE_MATCH         3
+#define SEARCH_TYPE_KEY_MATCH     4
+#define SEARCH_TYPE_KEY           5
+
+typedef enum SEARCH_TYPE {
+  ARRAY = 0,
+  ARRAY_RANGE,
+  WILDCARD,
+  MATCH,
+  KEY_MATCH,
+  KEY
+} SEARCH_TYPE;
+
+/**
+ * Defines a single search action within the json loaded by
+ * nicson. A query is a dotted list of them:
+ *
+ *  key          the value of key in an object
+ *  [3] [4,6,12] items of an array
+ *  [0-5]        items 0 through 5 of an array
+ *  * or [*]     every value of an object or item of an array
+ *  hello*world  values of the object keys matching a glob, * and ?
+ *  =1.*         keeps the current value if it is a string matching a glob,
+ *               this is the last step so its glob may hold dots
+ *
+ * Examples:
+ *
+ *  Array Range: key.[0-5].*.key.*.*match.hello*world.end*.[4,6,1234].*hello*world*
+ *
+ */
+/**
+ * A glob compiled once per query. Strings are rejected on their length and
+ * on the literal runs before the first and after the last wildcard, then
+ * on the longest literal run in between, which is searched with SSE2 or
+ * AVX2. Only the strings passing these go through the backtracking match.
+ */
+typedef struct JGlob {
+  const char*  pattern;
+  unsigned int minLength;     // characters a match has at least, the pattern without its stars
+  unsigned int prefixLength;  // literal run starting the pattern
+  const char*  suffix;        // literal run ending the pattern, empty when it is all literal
+  unsigned int suffixLength;
+  const char*  literal;       // longest literal run between them, points into pattern
+  unsigned int literalLength;
+  char         exact;         // no wildcards, a plain comparison
+  char         simple;        // only stars and at most one literal run between the ends, the prefilter decides
+} JGlob;
+
+typedef struct KeySearch {
+  SEARCH_TYPE searchType : 4; // up to 16 types
+  union meta {
+    const char *matchStr; // MATCH and KEY_MATCH
+    JKey        key;      // KEY
+    struct indices {
+      const int32_t *items;
+      unsigned int   count;
+    } indices;            // ARRAY
+    struct range {
+      int32_t start;
+      int32_t end;
+    } range;              // ARRAY_RANGE, both ends included
+  } meta;
+  JGlob glob; // MATCH and KEY_MATCH, meta.matchStr compiled
+} KeySearch;
+
+typedef struct JQuery {
+  KeySearch*   steps;
+  unsigned int count;
+  char*        _text;    // the split expression the steps point into
+  int32_t*     _indices; // shared by the ARRAY steps
+} JQuery;
+
+/** Called for every match, returning 0 stops the search */
+typedef int (*JQueryVisit)(void *user, JItemValue value, short type);
+
+/** Compiles an expression, NULL and a message on stderr when it is invalid */
+JQuery*     jsonQueryCompile(const char *expr);
+void        jsonQueryFree(JQuery *query);
+/** Walks the document depth first in document order, returns the matches visited */
+unsigned    jsonQueryRun(const JQuery *query, JItemValue root, short type, JQueryVisit visit, void *user);
+/**
+ * Collects every match, the caller frees the list. It is NULL when nothing
+ * matched, or with a message on stderr when it could not hold every match.
+ */
+JArrayItem* jsonQueryAll(const JQuery *query, JItemValue root, short type, unsigned *count);
+/**
+ * Collects every match like jsonQueryAll, in document order too. Wildcard,
+ * glob and range steps with enough children fan out over the pool as
+ * nested jobs, so the branches of every level are stolen by idle threads.
+ */
+JArrayItem* jsonQueryAllParallel(const JQuery *query, JItemValue root, short type, JPool *pool, unsigned *count);
+int         jsonGlobMatch(const char *pattern, const char *str);
+void        jsonGlobCompile(JGlob *glob, const char *pattern);
+/** Same result as jsonGlobMatch on the pattern of the glob */
+int         jsonGlobMatchCompiled(const JGlob *glob, const char *str);
+
+#define JSON_CURSOR_DEPTH 32
+
+typedef struct JCursorFrame {
+  JItemValue    value;
+  const char*   key;   // the value was selected by, NULL for array items
+  unsigned int  next;  // position within the step, an index, an entry or 0 and 1
+  short         type;
+  unsigned char step;  // of the query applied to value
+} JCursorFrame;
+
+/**
+ * Pulls the matches of a query, the entries of an object or the items of
+ * an array one at a time. The state lives in the struct, one frame per
+ * query step, and nothing is allocated so it can sit on the stack. The
+ * document must not change while a cursor walks it.
+ */
+typedef struct JCursor {
+  const JQuery* query;
+  const char*   key;   // of the last match when it is an object entry, else NULL
+  unsigned int  depth;
+  JCursorFrame  frames[JSON_CURSOR_DEPTH];
+} JCursor;
+
+/** Starts a cursor over the matches of a query of at most JSON_CURSOR_DEPTH steps */
+int  jsonCursorQuery(JCursor *cursor, const JQuery *query, JItemValue root, short type);
+void jsonCursorEntries(JCursor *cursor, const JObject *obj);
+void jsonCursorItems(JCursor *cursor, const JArray *arr);
+/** Moves to the next match in document order, 0 when there are no more */
+int  jsonCursorNext(JCursor *cursor, JItemValue *value, short *type);
+
+/**
+ * Index from the values at a pattern back to the objects holding them. The
+ * pattern is a query whose last step is a plain key, so
+ * "dependencies.*.dev" maps every dev value to its dependency. Strings,
+ * bools, null and numbers are indexed, numbers of any type by value.
+ * Mutating any document of a context the indexed containers belong to,
+ * nested documents from other contexts included, marks the index stale
+ * and the next lookup rebuilds it.
+ */
+typedef struct JIndexGroup {
+  Fnv32_t       hash;
+  unsigned char type;  // VAL_DOUBLE for every number
+  JItemValue    value;
+  unsigned int  start; // into objects
+  unsigned int  count;
+} JIndexGroup;
+
+typedef struct JIndex {
+  JItemValue    root;
+  short         rootType;
+  JObject**     objects;     // grouped by value, document order within a value
+  unsigned int  count;
+  JIndexGroup*  _groups;
+  unsigned int  _groupCount;
+  unsigned int* _slots;      // group + 1 by hash, 0 is empty
+  unsigned int  _slotMask;
+  JQuery*       _holders;    // everything but the last step, NULL for the root
+  JKey          _key;        // the last step
+  struct JsonContext** _contexts; // of every container on the way to the holders, the root's first
+  unsigned long* _generations;    // of each context when the index was built
+  unsigned int  _contextCount;
+} JIndex;
+
+JIndex*    jsonBuildIndex(JItemValue root, short type, const char *pattern);
+void       jsonIndexFree(JIndex *index);
+/** The objects holding a value, *count of them, NULL when there are none */
+JObject**  jsonIndexLookup(JIndex *index, short type, JItemValue value, unsigned int *count);
+JObject**  jsonIndexLookupString(JIndex *index, const char *value, unsigned int *count);
+JObject**  jsonIndexLookupDouble(JIndex *index, double value, unsigned int *count);
+JObject**  jsonIndexLookupBool(JIndex *index, char value, unsigned int *count);
+
+#endif
@@ -0,0 +1,396 @@
+/*
+ * Reductions over numeric arrays. Packed int, float and double arrays are
+ * scanned with AVX2 or SSE2 when the cpu has them, lanes are widened to
+ * double so every type shares one set of kernels. Mixed arrays and the
+ * tails of packed arrays go through the scalar loops.
+ */
+#include "json.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define REDUCE_X86
+#endif
+
+#define IS_PACKED_NUMERIC(t) ((t) == VAL_INT_ARRAY || (t) == VAL_FLOAT_ARRAY || (t) == VAL_DOUBLE_ARRAY)
+
+static int simdLevel = -1;
+
+static int supportedSimd() {
+#ifdef REDUCE_X86
+  if (__builtin_cpu_supports("avx2")) {
+    return JSON_SIMD_AVX2;
+  }
+#ifdef __SSE2__
+  return JSON_SIMD_SSE2;
+#endif
+#endif
+  return JSON_SIMD_NONE;
+}
+
+int jsonSimdLevel() {
+  if (simdLevel < 0) {
+    simdLevel = supportedSimd();
+  }
+  return simdLevel;
+}
+
+void jsonSetSimdLevel(int level) {
+  int supported = supportedSimd();
+  simdLevel = level < supported ? level : supported;
+}
+
+/** Runs BODY with x set to every number from item i on, skipping non numbers */
+#define EACH_NUMBER(arr, i, x, BODY) \
+  switch ((arr)->type) { \
+  case VAL_INT_ARRAY: \
+    for (; i < (arr)->count; ++i) { double x = (arr)->_internal.ints[i]; BODY } \
+    break; \
+  case VAL_FLOAT_ARRAY: \
+    for (; i < (arr)->count; ++i) { double x = (arr)->_internal.floats[i]; BODY } \
+    break; \
+  case VAL_DOUBLE_ARRAY: \
+    for (; i < (arr)->count; ++i) { double x = (arr)->_internal.doubles[i]; BODY } \
+    break; \
+  case VAL_MIXED_ARRAY: \
+    for (; i < (arr)->count; ++i) { \
+      const JArrayItem *item_ = &(arr)->_internal.mItems[i]; \
+      if (item_->type != VAL_INT && item_->type != VAL_FLOAT && item_->type != VAL_DOUBLE) { \
+        continue; \
+      } \
+      double x = item_->type == VAL_INT ? item_->value.int_val \
+          : item_->type == VAL_FLOAT ? item_->value.float_val : item_->value.double_val; \
+      BODY \
+    } \
+    break; \
+  }
+
+/** The C operators, so NaN only passes JSON_CMP_NE */
+static inline int matches(double x, int op, double threshold) {
+  if (op == JSON_CMP_NE) {
+    return x != threshold;
+  }
+  return ((op & JSON_CMP_LT) && x < threshold) || ((op & JSON_CMP_EQ) && x == threshold)
+      || ((op & JSON_CMP_GT) && x > threshold);
+}
+
+/** Lane masks for each comparison bit of op, worked out once per scan */
+typedef struct LaneMasks {
+  int lt;
+  int eq;
+  int gt;
+  int ne;
+} LaneMasks;
+
+static inline LaneMasks laneMasks(int op, int full) {
+  if (op == JSON_CMP_NE) {
+    return (LaneMasks) { 0, 0, 0, full };
+  }
+  return (LaneMasks) { op & JSON_CMP_LT ? full : 0, op & JSON_CMP_EQ ? full : 0,
+      op & JSON_CMP_GT ? full : 0, 0 };
+}
+
+/** Set bits of a four lane mask, cheaper than a popcount call on plain x86-64 */
+static const unsigned char laneCount[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+/**
+ * Bits of the lanes that pass, built from ordered compares without
+ * branching. Lanes that are neither equal nor ordered hold NaN, and only
+ * not-equal takes them, as != does.
+ */
+#define LANE_MATCHES(lt, eq, gt, m) (((lt) & (m).lt) | ((eq) & (m).eq) | ((gt) & (m).gt) | (~(eq) & (m).ne))
+
+static inline void appendPacked(JArray *out, const JArray *arr, unsigned int i) {
+  switch (arr->type) {
+  case VAL_INT_ARRAY:    out->_internal.ints[out->count++] = arr->_internal.ints[i]; break;
+  case VAL_FLOAT_ARRAY:  out->_internal.floats[out->count++] = arr->_internal.floats[i]; break;
+  case VAL_DOUBLE_ARRAY: out->_internal.doubles[out->count++] = arr->_internal.doubles[i]; break;
+  }
+}
+
+static inline void appendLanes(JArray *out, const JArray *arr, unsigned int i, int bits) {
+  while (bits) {
+    appendPacked(out, arr, i + __builtin_ctz(bits));
+    bits &= bits - 1;
+  }
+}
+
+#ifdef REDUCE_X86
+
+#define AVX2 __attribute__((target("avx2")))
+
+/** Runs BODY over four items at a time widened to doubles in v */
+#define AVX2_LANES(arr, i, v, BODY) \
+  switch ((arr)->type) { \
+  case VAL_INT_ARRAY: \
+    for (; i + 4 <= (arr)->count; i += 4) { \
+      __m256d v = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*) ((arr)->_internal.ints + i))); \
+      BODY \
+    } \
+    break; \
+  case VAL_FLOAT_ARRAY: \
+    for (; i + 4 <= (arr)->count; i += 4) { \
+      __m256d v = _mm256_cvtps_pd(_mm_loadu_ps((arr)->_internal.floats + i)); \
+      BODY \
+    } \
+    break; \
+  case VAL_DOUBLE_ARRAY: \
+    for (; i + 4 <= (arr)->count; i += 4) { \
+      __m256d v = _mm256_loadu_pd((arr)->_internal.doubles + i); \
+      BODY \
+    } \
+    break; \
+  }
+
+static AVX2 unsigned int sumAvx2(const JArray *arr, double *sum) {
+  unsigned int i = 0;
+  __m256d acc = _mm256_setzero_pd();
+  AVX2_LANES(arr, i, v, acc = _mm256_add_pd(acc, v);)
+  double lanes[4];
+  _mm256_storeu_pd(lanes, acc);
+  *sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  return i;
+}
+
+static AVX2 unsigned int minMaxAvx2(const JArray *arr, double *min, double *max) {
+  unsigned int i = 0;
+  __m256d lo = _mm256_set1_pd(*min);
+  __m256d hi = _mm256_set1_pd(*max);
+  // min and max return their second operand on NaN, so NaN items keep the running value
+  AVX2_LANES(arr, i, v, lo = _mm256_min_pd(v, lo); hi = _mm256_max_pd(v, hi);)
+  double lows[4], highs[4];
+  _mm256_storeu_pd(lows, lo);
+  _mm256_storeu_pd(highs, hi);
+  for (int l = 0; l < 4; ++l) {
+    *min = lows[l] < *min ? lows[l] : *min;
+    *max = highs[l] > *max ? highs[l] : *max;
+  }
+  return i;
+}
+
+static AVX2 unsigned int countIfAvx2(const JArray *arr, int op, double threshold, unsigned int *count) {
+  unsigned int i = 0;
+  unsigned int n = 0;
+  __m256d t = _mm256_set1_pd(threshold);
+  LaneMasks m = laneMasks(op, 0xF);
+  AVX2_LANES(arr, i, v,
+    int lt = _mm256_movemask_pd(_mm256_cmp_pd(v, t, _CMP_LT_OQ));
+    int eq = _mm256_movemask_pd(_mm256_cmp_pd(v, t, _CMP_EQ_OQ));
+    int gt = _mm256_movemask_pd(_mm256_cmp_pd(v, t, _CMP_GT_OQ));
+    n += laneCount[LANE_MATCHES(lt, eq, gt, m)];)
+  *count = n;
+  return i;
+}
+
+static AVX2 unsigned int filterAvx2(const JArray *arr, int op, double threshold, JArray *out) {
+  unsigned int i = 0;
+  __m256d t = _mm256_set1_pd(threshold);
+  LaneMasks m = laneMasks(op, 0xF);
+  AVX2_LANES(arr, i, v,
+    int lt = _mm256_movemask_pd(_mm256_cmp_pd(v, t, _CMP_LT_OQ));
+    int eq = _mm256_movemask_pd(_mm256_cmp_pd(v, t, _CMP_EQ_OQ));
+    int gt = _mm256_movemask_pd(_mm256_cmp_pd(v, t, _CMP_GT_OQ));
+    appendLanes(out, arr, i, LANE_MATCHES(lt, eq, gt, m));)
+  return i;
+}
+
+#endif
+
+#if defined(REDUCE_X86) && defined(__SSE2__)
+
+/** Runs BODY over two items at a time widened to doubles in v */
+#define SSE2_LANES(arr, i, v, BODY) \
+  switch ((arr)->type) { \
+  case VAL_INT_ARRAY: \
+    for (; i + 2 <= (arr)->count; i += 2) { \
+      __m128d v = _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i*) ((arr)->_internal.ints + i))); \
+      BODY \
+    } \
+    break; \
+  case VAL_FLOAT_ARRAY: \
+    for (; i + 2 <= (arr)->count; i += 2) { \
+      __m128d v = _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*) ((arr)->_internal.floats + i)))); \
+      BODY \
+    } \
+    break; \
+  case VAL_DOUBLE_ARRAY: \
+    for (; i + 2 <= (arr)->count; i += 2) { \
+      __m128d v = _mm_loadu_pd((arr)->_internal.doubles + i); \
+      BODY \
+    } \
+    break; \
+  }
+
+static unsigned int sumSse2(const JArray *arr, double *sum) {
+  unsigned int i = 0;
+  __m128d acc = _mm_setzero_pd();
+  SSE2_LANES(arr, i, v, acc = _mm_add_pd(acc, v);)
+  double lanes[2];
+  _mm_storeu_pd(lanes, acc);
+  *sum = lanes[0] + lanes[1];
+  return i;
+}
+
+static unsigned int minMaxSse2(const JArray *arr, double *min, double *max) {
+  unsigned int i = 0;
+  __m128d lo = _mm_set1_pd(*min);
+  __m128d hi = _mm_set1_pd(*max);
+  // v first, NaN items are skipped as in the scalar loop
+  SSE2_LANES(arr, i, v, lo = _mm_min_pd(v, lo); hi = _mm_max_pd(v, hi);)
+  double lows[2], highs[2];
+  _mm_storeu_pd(lows, lo);
+  _mm_storeu_pd(highs, hi);
+  *min = lows[0] < lows[1] ? lows[0] : lows[1];
+  *max = highs[0] > highs[1] ? highs[0] : highs[1];
+  return i;
+}
+
+static unsigned int countIfSse2(const JArray *arr, int op, double threshold, unsigned int *count) {
+  unsigned int i = 0;
+  unsigned int n = 0;
+  __m128d t = _mm_set1_pd(threshold);
+  LaneMasks m = laneMasks(op, 0x3);
+  SSE2_LANES(arr, i, v,
+    int lt = _mm_movemask_pd(_mm_cmplt_pd(v, t));
+    int eq = _mm_movemask_pd(_mm_cmpeq_pd(v, t));
+    int gt = _mm_movemask_pd(_mm_cmpgt_pd(v, t));
+    n += laneCount[LANE_MATCHES(lt, eq, gt, m)];)
+  *count = n;
+  return i;
+}
+
+static unsigned int filterSse2(const JArray *arr, int op, double threshold, JArray *out) {
+  unsigned int i = 0;
+  __m128d t = _mm_set1_pd(threshold);
+  LaneMasks m = laneMasks(op, 0x3);
+  SSE2_LANES(arr, i, v,
+    int lt = _mm_movemask_pd(_mm_cmplt_pd(v, t));
+    int eq = _mm_movemask_pd(_mm_cmpeq_pd(v, t));
+    int gt = _mm_movemask_pd(_mm_cmpgt_pd(v, t));
+    appendLanes(out, arr, i, LANE_MATCHES(lt, eq, gt, m));)
+  return i;
+}
+
+#endif
+
+double jsonArraySum(const JArray *arr) {
+  if (!arr) {
+    return 0;
+  }
+  unsigned int i = 0;
+  double sum = 0;
+  if (IS_PACKED_NUMERIC(arr->type)) {
+#ifdef REDUCE_X86
+    if (jsonSimdLevel() >= JSON_SIMD_AVX2) {
+      i = sumAvx2(arr, &sum);
+    }
+#ifdef __SSE2__
+    else if (jsonSimdLevel() >= JSON_SIMD_SSE2) {
+      i = sumSse2(arr, &sum);
+    }
+#endif
+#endif
+  }
+  EACH_NUMBER(arr, i, x, sum += x;)
+  return sum;
+}
+
+int jsonArrayMinMax(const JArray *arr, double *min, double *max) {
+  if (!arr) {
+    return 0;
+  }
+  unsigned int i = 0;
+  int found = 0;
+  double lo = 0, hi = 0;
+  EACH_NUMBER(arr, i, x, lo = hi = x; found = 1; break;)
+  if (!found) {
+    return 0;
+  }
+  if (IS_PACKED_NUMERIC(arr->type)) {
+#ifdef REDUCE_X86
+    if (jsonSimdLevel() >= JSON_SIMD_AVX2) {
+      i = minMaxAvx2(arr, &lo, &hi);
+    }
+#ifdef __SSE2__
+    else if (jsonSimdLevel() >= JSON_SIMD_SSE2) {
+      i = minMaxSse2(arr, &lo, &hi);
+    }
+#endif
+#endif
+  }
+  EACH_NUMBER(arr, i, x, lo = x < lo ? x : lo; hi = x > hi ? x : hi;)
+  if (min) {
+    *min = lo;
+  }
+  if (max) {
+    *max = hi;
+  }
+  return 1;
+}
+
+unsigned int jsonArrayCountIf(const JArray *arr, int op, double threshold) {
+  if (!arr) {
+    return 0;
+  }
+  unsigned int i = 0;
+  unsigned int count = 0;
+  if (IS_PACKED_NUMERIC(arr->type)) {
+#ifdef REDUCE_X86
+    if (jsonSimdLevel() >= JSON_SIMD_AVX2) {
+      i = countIfAvx2(arr, op, threshold, &count);
+    }
+#ifdef __SSE2__
+    else if (jsonSimdLevel() >= JSON_SIMD_SSE2) {
+      i = countIfSse2(arr, op, threshold, &count);
+    }
+#endif
+#endif
+  }
+  EACH_NUMBER(arr, i, x, count += matches(x, op, threshold);)
+  return count;
+}
+
+JArray* jsonArrayFilter(const JArray *arr, int op, double threshold) {
+  if (!arr) {
+    return 0;
+  }
+  JArray *out = jsonContextNewArray(arr->_ctx);
+  if (!out) {
+    return 0;
+  }
+  unsigned int i = 0;
+  if (!IS_PACKED_NUMERIC(arr->type)) {
+    EACH_NUMBER(arr, i, x,
+      if (matches(x, op, threshold) && !jsonAddArrayItem(out, &arr->_internal.mItems[i])) {
+        jsonFree((JItemValue) { out }, out->type);
+        return 0;
+      })
+    return out;
+  }
+
+  // size the result exactly, then copy the matches straight into it
+  unsigned int count = jsonArrayCountIf(arr, op, threshold);
+  out->type = arr->type;
+  if (count && !jsonArrayReserve(out, count)) {
+    jsonFree((JItemValue) { out }, out->type);
+    return 0;
+  }
+#ifdef REDUCE_X86
+  if (jsonSimdLevel() >= JSON_SIMD_AVX2) {
+    i = filterAvx2(arr, op, threshold, out);
+  }
+#ifdef __SSE2__
+  else if (jsonSimdLevel() >= JSON_SIMD_SSE2) {
+    i = filterSse2(arr, op, threshold, out);
+  }
+#endif
+#endif
+  EACH_NUMBER(arr, i, x,
+    if (matches(x, op, threshold)) {
+      appendPacked(out, arr, i);
+    })
+  return out;
+}
@@ -0,0 +1,917 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "serialize.h"
+#include "dtoa.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define BUFFER_FLUSH_BYTES  (64 * 1024) // of bound buffers
+#define BUFFER_MIN_CAPACITY 4096
+#define SPACES_16           "                "
+#define INDENT_BYTES        128
+#define SPLIT_CHILDREN      1024 // a container below the root with as many is split over the pool
+#define CHUNK_CHILDREN      4096 // serialized by one task at most
+#define WINDOW_CHUNKS       8    // per thread held in memory before they are written
+#define SEGMENTS_MIN        64
+#ifndef IOV_MAX
+#define IOV_MAX             1024
+#endif
+
+static const char spaces[INDENT_BYTES + 1] =
+    SPACES_16 SPACES_16 SPACES_16 SPACES_16 SPACES_16 SPACES_16 SPACES_16 SPACES_16;
+
+/** Escape of a character in keys and strings given to a writer, 0 when it is written as it is */
+static const char escapes[256] = {
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+  0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,
+};
+
+static const char digitPairs[201] =
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+
+static void init(JBuffer *buf, int fd, FILE *file, size_t capacity) {
+  memset(buf, 0, sizeof(JBuffer));
+  buf->fd = fd;
+  buf->file = file;
+  buf->data = malloc(capacity);
+  buf->capacity = buf->data ? capacity : 0;
+  buf->failed = !buf->data;
+}
+
+void jsonBufferInit(JBuffer *buf) {
+  init(buf, -1, NULL, BUFFER_MIN_CAPACITY);
+}
+
+void jsonBufferInitFd(JBuffer *buf, int fd) {
+  init(buf, fd, NULL, BUFFER_FLUSH_BYTES);
+}
+
+void jsonBufferInitFile(JBuffer *buf, FILE *file) {
+  init(buf, -1, file, BUFFER_FLUSH_BYTES);
+}
+
+static int bound(const JBuffer *buf) {
+  return buf->fd >= 0 || buf->file;
+}
+
+static int writeOut(JBuffer *buf, const char *data, size_t length) {
+  if (buf->file) {
+    return fwrite(data, 1, length, buf->file) == length;
+  }
+  while (length) {
+    ssize_t written = write(buf->fd, data, length);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return 0;
+    }
+    data += written;
+    length -= written;
+  }
+  return 1;
+}
+
+int jsonBufferFlush(JBuffer *buf) {
+  if (bound(buf) && buf->length) {
+    if (!buf->failed && !writeOut(buf, buf->data, buf->length)) {
+      fprintf(stderr, "Error: Could not write %lu bytes of output\n", (unsigned long) buf->length);
+      buf->failed = 1;
+    }
+    buf->length = 0;
+  }
+  return !buf->failed;
+}
+
+/** Makes room for length more bytes, NULL when there is none */
+static char* reserve(JBuffer *buf, size_t length) {
+  if (buf->length + length <= buf->capacity) {
+    return buf->data + buf->length;
+  }
+  if (bound(buf)) {
+    jsonBufferFlush(buf);
+    if (length <= buf->capacity) {
+      return buf->data;
+    }
+  }
+  size_t capacity = buf->capacity ? buf->capacity : BUFFER_MIN_CAPACITY;
+  while (capacity < buf->length + length) {
+    capacity *= 2;
+  }
+  char *data = realloc(buf->data, capacity);
+  if (!data) {
+    if (!buf->failed) {
+      fprintf(stderr, "Error: Could not grow output to %lu bytes\n", (unsigned long) capacity);
+    }
+    buf->failed = 1;
+    return 0;
+  }
+  buf->data = data;
+  buf->capacity = capacity;
+  return buf->data + buf->length;
+}
+
+void jsonBufferWrite(JBuffer *buf, const char *str, size_t length) {
+  if (bound(buf) && length > buf->capacity) {
+    // larger than the buffer, goes out directly after what is buffered
+    if (jsonBufferFlush(buf) && !writeOut(buf, str, length)) {
+      buf->failed = 1;
+    }
+    return;
+  }
+  char *out = reserve(buf, length);
+  if (out) {
+    memcpy(out, str, length);
+    buf->length += length;
+  }
+}
+
+static inline void put(JBuffer *buf, char c) {
+  if (buf->length < buf->capacity) {
+    buf->data[buf->length++] = c;
+  } else {
+    jsonBufferWrite(buf, &c, 1);
+  }
+}
+
+static void indent(JBuffer *buf, unsigned int width) {
+  for (; width > INDENT_BYTES; width -= INDENT_BYTES) {
+    jsonBufferWrite(buf, spaces, INDENT_BYTES);
+  }
+  jsonBufferWrite(buf, spaces, width);
+}
+
+void jsonBufferUInt(JBuffer *buf, unsigned long value) {
+  char digits[24];
+  char *end = digits + sizeof(digits);
+  char *at = end;
+  while (value >= 100) {
+    unsigned int pair = (value % 100) * 2;
+    value /= 100;
+    *--at = digitPairs[pair + 1];
+    *--at = digitPairs[pair];
+  }
+  if (value >= 10) {
+    *--at = digitPairs[value * 2 + 1];
+    *--at = digitPairs[value * 2];
+  } else {
+    *--at = '0' + value;
+  }
+  jsonBufferWrite(buf, at, end - at);
+}
+
+void jsonBufferInt(JBuffer *buf, long value) {
+  if (value < 0) {
+    put(buf, '-');
+    jsonBufferUInt(buf, 0ul - (unsigned long) value);
+  } else {
+    jsonBufferUInt(buf, value);
+  }
+}
+
+void jsonBufferDouble(JBuffer *buf, double value) {
+  char text[JSON_NUMBER_CHARS];
+  jsonBufferWrite(buf, text, jsonFormatDouble(value, text));
+}
+
+void jsonBufferFloat(JBuffer *buf, float value) {
+  char text[JSON_NUMBER_CHARS];
+  jsonBufferWrite(buf, text, jsonFormatFloat(value, text));
+}
+
+/** Writes the live entries in the slots from up to to, after a separator unless they come first */
+static void writeEntries(JBuffer *buf, const JObject *obj, unsigned int from, unsigned int to, int first, unsigned int tabs, unsigned int tabInc) {
+  const char *name = NULL;
+  JItemValue value;
+  short type = 0;
+  for (unsigned int i = from; i < to; ++i) {
+    if (!jsonEntryAt(obj, i, &name, &value, &type)) {
+      continue;
+    }
+    if (!first) {
+      jsonBufferWrite(buf, ",\n", buf->compact ? 1 : 2);
+    }
+    first = 0;
+    if (!buf->compact) {
+      indent(buf, tabs);
+    }
+    put(buf, '"');
+    jsonBufferWrite(buf, name, strlen(name));
+    jsonBufferWrite(buf, "\": ", buf->compact ? 2 : 3);
+    jsonBufferValue(buf, type, &value, tabs, tabInc);
+  }
+}
+
+static void closeObject(JBuffer *buf, const JObject *obj, unsigned int tabs) {
+  if (!buf->compact) {
+    if (obj->size) {
+      put(buf, '\n');
+    }
+    indent(buf, tabs);
+  }
+  put(buf, '}');
+}
+
+static void writeItems(JBuffer *buf, const JArray *arr, unsigned int from, unsigned int to, unsigned int tabs, unsigned int tabInc) {
+  for (unsigned int i = from; i < to; ++i) {
+    short itemType = 0;
+    JItemValue item = jsonArrayGet(arr, i, &itemType);
+    if (i) {
+      put(buf, ',');
+    }
+    jsonBufferValue(buf, itemType, &item, tabs, tabInc);
+  }
+}
+
+void jsonBufferValue(JBuffer *buf, unsigned char type, const JItemValue *value, unsigned int tabs, unsigned int tabInc) {
+  if (type >= VAL_STRING_ARRAY && type <= VAL_MIXED_ARRAY && value->array_val) {
+    type = value->array_val->type; // pushes may have turned it into a mixed array
+  }
+  switch (type) {
+  case VAL_INT:
+    jsonBufferInt(buf, value->int_val);
+    break;
+  case VAL_UINT:
+    jsonBufferUInt(buf, (unsigned int) value->int_val);
+    break;
+  case VAL_FLOAT:
+    jsonBufferFloat(buf, value->float_val);
+    break;
+  case VAL_DOUBLE:
+    jsonBufferDouble(buf, value->double_val);
+    break;
+  case VAL_STRING:
+    put(buf, '"');
+    if (value->string_val) {
+      jsonBufferWrite(buf, value->string_val, strlen(value->string_val));
+    }
+    put(buf, '"');
+    break;
+  case VAL_BOOL:
+    if (value->char_val) {
+      jsonBufferWrite(buf, "true", 4);
+    } else {
+      jsonBufferWrite(buf, "false", 5);
+    }
+    break;
+  case VAL_NULL:
+    jsonBufferWrite(buf, "null", 4);
+    break;
+  case VAL_OBJ:
+    jsonBufferWrite(buf, "{\n", buf->compact ? 1 : 2);
+    writeEntries(buf, value->object_val, 0, value->object_val->_used, 1, tabs + tabInc, tabInc);
+    closeObject(buf, value->object_val, tabs);
+    break;
+  default:
+    if (type >= VAL_STRING_ARRAY && type <= VAL_MIXED_ARRAY) {
+      put(buf, '[');
+      writeItems(buf, value->array_val, 0, value->array_val->count, tabs, tabInc);
+      put(buf, ']');
+    }
+  }
+}
+
+int jsonBufferFree(JBuffer *buf) {
+  int ok = jsonBufferFlush(buf);
+  free(buf->data);
+  memset(buf, 0, sizeof(JBuffer));
+  buf->fd = -1;
+  return ok;
+}
+
+static char* serialize(JItemValue val, short type, char compact, size_t *length) {
+  JBuffer buf;
+  jsonBufferInit(&buf);
+  buf.compact = compact;
+  jsonBufferValue(&buf, type, &val, 0, 2);
+  put(&buf, '\0');
+  if (buf.failed) {
+    jsonBufferFree(&buf);
+    *length = 0;
+    return 0;
+  }
+  *length = buf.length - 1;
+  return buf.data;
+}
+
+static int serializeFd(int fd, JItemValue val, short type, char compact) {
+  JBuffer buf;
+  jsonBufferInitFd(&buf, fd);
+  buf.compact = compact;
+  jsonBufferValue(&buf, type, &val, 0, 2);
+  return jsonBufferFree(&buf);
+}
+
+char* jsonSerialize(JItemValue val, short type, size_t *length) {
+  return serialize(val, type, 0, length);
+}
+
+char* jsonSerializeCompact(JItemValue val, short type, size_t *length) {
+  return serialize(val, type, 1, length);
+}
+
+int jsonSerializeFd(int fd, JItemValue val, short type) {
+  return serializeFd(fd, val, type, 0);
+}
+
+int jsonSerializeCompactFd(int fd, JItemValue val, short type) {
+  return serializeFd(fd, val, type, 1);
+}
+
+enum SegmentKind { SEGMENT_TEXT, SEGMENT_ENTRIES, SEGMENT_ITEMS };
+
+/**
+ * A piece of the output of a parallel serialization. Text between the
+ * chunks is written while planning, the rest by a task into its buffer.
+ */
+typedef struct Segment {
+  JBuffer          buf;
+  enum SegmentKind kind;
+  JItemValue       value;  // the object or array the children are taken from
+  unsigned int     from;   // slots or items
+  unsigned int     to;
+  unsigned int     tabs;
+  unsigned int     tabInc;
+  char             first;  // no entry of the object comes before from
+} Segment;
+
+typedef struct Plan {
+  Segment*     segments;
+  unsigned int count;
+  unsigned int capacity;
+  unsigned int threads;
+  char         compact;
+  char         failed;
+} Plan;
+
+static Segment* addSegment(Plan *plan, enum SegmentKind kind) {
+  if (plan->failed) {
+    return 0;
+  }
+  if (plan->count == plan->capacity) {
+    unsigned int capacity = plan->capacity ? plan->capacity * 2 : SEGMENTS_MIN;
+    Segment *segments = realloc(plan->segments, capacity * sizeof(Segment));
+    if (!segments) {
+      fprintf(stderr, "Error: Could not grow the serialization plan to %u segments\n", capacity);
+      plan->failed = 1;
+      return 0;
+    }
+    plan->segments = segments;
+    plan->capacity = capacity;
+  }
+  Segment *segment = &plan->segments[plan->count++];
+  memset(segment, 0, sizeof(Segment));
+  segment->kind = kind;
+  segment->buf.fd = -1;
+  return segment;
+}
+
+/** The buffer of the text segment at the end of the plan */
+static JBuffer* text(Plan *plan) {
+  if (plan->count && plan->segments[plan->count - 1].kind == SEGMENT_TEXT) {
+    return &plan->segments[plan->count - 1].buf;
+  }
+  Segment *segment = addSegment(plan, SEGMENT_TEXT);
+  if (!segment) {
+    return 0;
+  }
+  jsonBufferInit(&segment->buf);
+  segment->buf.compact = plan->compact;
+  plan->failed |= segment->buf.failed;
+  return &segment->buf;
+}
+
+static unsigned char resolved(short type, JItemValue value) {
+  if (type >= VAL_STRING_ARRAY && type <= VAL_MIXED_ARRAY && value.array_val) {
+    return value.array_val->type;
+  }
+  return type;
+}
+
+static int splits(short type, JItemValue value, unsigned int least) {
+  type = resolved(type, value);
+  if (type == VAL_OBJ) {
+    return value.object_val && value.object_val->size >= least;
+  }
+  return type >= VAL_STRING_ARRAY && type <= VAL_MIXED_ARRAY && value.array_val->count >= least;
+}
+
+/** Children per chunk, enough chunks to fill a few windows yet no more than CHUNK_CHILDREN each */
+static unsigned int chunkOf(const Plan *plan, unsigned int children) {
+  unsigned int chunk = children / (plan->threads * WINDOW_CHUNKS) + 1;
+  return chunk < CHUNK_CHILDREN ? chunk : CHUNK_CHILDREN;
+}
+
+static void planValue(Plan *plan, short type, JItemValue value, unsigned int tabs, unsigned int tabInc);
+
+static void addRun(Plan *plan, enum SegmentKind kind, JItemValue container, unsigned int from, unsigned int to,
+    int first, unsigned int tabs, unsigned int tabInc) {
+  Segment *segment = addSegment(plan, kind);
+  if (segment) {
+    segment->value = container;
+    segment->from = from;
+    segment->to = to;
+    segment->first = first;
+    segment->tabs = tabs;
+    segment->tabInc = tabInc;
+  }
+}
+
+/** Chunks the entries of an object, large values among them are planned on their own */
+static void planObject(Plan *plan, const JObject *obj, unsigned int tabs, unsigned int tabInc) {
+  JItemValue container = { .object_val = (JObject*) obj };
+  JBuffer *buf = text(plan);
+  if (!buf) {
+    return;
+  }
+  jsonBufferWrite(buf, "{\n", plan->compact ? 1 : 2);
+  tabs += tabInc;
+  unsigned int chunk = chunkOf(plan, obj->size);
+  unsigned int from = 0;
+  unsigned int entries = 0; // in the run starting at from
+  unsigned int before = 0;  // entries before from
+  const char *name = NULL;
+  JItemValue value;
+  short type = 0;
+  for (unsigned int i = 0; i < obj->_used; ++i) {
+    if (!jsonEntryAt(obj, i, &name, &value, &type)) {
+      continue;
+    }
+    if (splits(type, value, SPLIT_CHILDREN)) {
+      if (entries) {
+        addRun(plan, SEGMENT_ENTRIES, container, from, i, !before, tabs, tabInc);
+      }
+      before += entries;
+      if (!(buf = text(plan))) {
+        return;
+      }
+      // what writeEntries puts before the value
+      if (before) {
+        jsonBufferWrite(buf, ",\n", plan->compact ? 1 : 2);
+      }
+      if (!plan->compact) {
+        indent(buf, tabs);
+      }
+      put(buf, '"');
+      jsonBufferWrite(buf, name, strlen(name));
+      jsonBufferWrite(buf, "\": ", plan->compact ? 2 : 3);
+      planValue(plan, type, value, tabs, tabInc);
+      ++before;
+      from = i + 1;
+      entries = 0;
+    } else if (entries == chunk) {
+      addRun(plan, SEGMENT_ENTRIES, container, from, i, !before, tabs, tabInc);
+      before += entries;
+      from = i;
+      entries = 1;
+    } else {
+      ++entries;
+    }
+  }
+  if (entries) {
+    addRun(plan, SEGMENT_ENTRIES, container, from, obj->_used, !before, tabs, tabInc);
+  }
+  if ((buf = text(plan))) {
+    closeObject(buf, obj, tabs - tabInc);
+  }
+}
+
+static void planArray(Plan *plan, const JArray *arr, unsigned int tabs, unsigned int tabInc) {
+  JItemValue container = { .array_val = (JArray*) arr };
+  JBuffer *buf = text(plan);
+  if (!buf) {
+    return;
+  }
+  put(buf, '[');
+  unsigned int chunk = chunkOf(plan, arr->count);
+  unsigned int from = 0;
+  for (unsigned int i = 0; i < arr->count; ++i) {
+    short type = 0;
+    JItemValue item = jsonArrayGet(arr, i, &type);
+    if (splits(type, item, SPLIT_CHILDREN)) {
+      if (from < i) {
+        addRun(plan, SEGMENT_ITEMS, container, from, i, 0, tabs, tabInc);
+      }
+      if (!(buf = text(plan))) {
+        return;
+      }
+      if (i) {
+        put(buf, ',');
+      }
+      planValue(plan, type, item, tabs, tabInc);
+      from = i + 1;
+    } else if (i - from == chunk) {
+      addRun(plan, SEGMENT_ITEMS, container, from, i, 0, tabs, tabInc);
+      from = i;
+    }
+  }
+  if (from < arr->count) {
+    addRun(plan, SEGMENT_ITEMS, container, from, arr->count, 0, tabs, tabInc);
+  }
+  if ((buf = text(plan))) {
+    put(buf, ']');
+  }
+}
+
+/** Plans a value that splits */
+static void planValue(Plan *plan, short type, JItemValue value, unsigned int tabs, unsigned int tabInc) {
+  if (resolved(type, value) == VAL_OBJ) {
+    planObject(plan, value.object_val, tabs, tabInc);
+  } else {
+    planArray(plan, value.array_val, tabs, tabInc);
+  }
+}
+
+typedef struct Window {
+  Segment** chunks;  // the segments tasks fill
+  JBuffer*  buffers; // one per task, they keep their capacity from window to window
+} Window;
+
+static void serializeChunk(void *arg, unsigned int task) {
+  Window *window = arg;
+  Segment *segment = window->chunks[task];
+  segment->buf = window->buffers[task];
+  switch (segment->kind) {
+  case SEGMENT_ENTRIES:
+    writeEntries(&segment->buf, segment->value.object_val, segment->from, segment->to, segment->first,
+        segment->tabs, segment->tabInc);
+    break;
+  case SEGMENT_ITEMS:
+    writeItems(&segment->buf, segment->value.array_val, segment->from, segment->to, segment->tabs, segment->tabInc);
+    break;
+  default:
+    break;
+  }
+}
+
+static int writeAll(int fd, struct iovec *iov, int count) {
+  while (count) {
+    ssize_t written = writev(fd, iov, count);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return 0;
+    }
+    for (; count && (size_t) written >= iov->iov_len; ++iov, --count) {
+      written -= iov->iov_len;
+    }
+    if (count) {
+      iov->iov_base = (char*) iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+  return 1;
+}
+
+/** Writes the buffers of segments in order, IOV_MAX at a time, 0 when a write failed */
+static int writeSegments(int fd, Segment *segments, unsigned int count) {
+  struct iovec iov[IOV_MAX];
+  int n = 0;
+  for (unsigned int i = 0; i < count; ++i) {
+    if (!segments[i].buf.length) {
+      continue;
+    }
+    iov[n++] = (struct iovec) { segments[i].buf.data, segments[i].buf.length };
+    if (n == IOV_MAX) {
+      if (!writeAll(fd, iov, n)) {
+        return 0;
+      }
+      n = 0;
+    }
+  }
+  return writeAll(fd, iov, n);
+}
+
+int jsonSerializeParallelFd(int fd, JItemValue val, short type, char compact, JPool *pool) {
+  unsigned int threads = jsonPoolThreads(pool);
+  if (threads < 2 || !splits(type, val, 2)) {
+    return serializeFd(fd, val, type, compact);
+  }
+  Plan plan = { NULL, 0, 0, threads, compact, 0 };
+  planValue(&plan, type, val, 0, 2);
+
+  unsigned int window = threads * WINDOW_CHUNKS;
+  Segment *chunks[window];
+  JBuffer buffers[window];
+  for (unsigned int t = 0; t < window; ++t) {
+    buffers[t] = (JBuffer) { .fd = -1, .compact = compact };
+  }
+  int ok = !plan.failed;
+  unsigned int start = 0;
+  while (ok && start < plan.count) {
+    // the segments up to the one holding the window's last chunk
+    unsigned int tasks = 0;
+    unsigned int end = start;
+    for (; end < plan.count && (tasks < window || plan.segments[end].kind == SEGMENT_TEXT); ++end) {
+      if (plan.segments[end].kind != SEGMENT_TEXT) {
+        chunks[tasks++] = &plan.segments[end];
+      }
+    }
+    jsonPoolRun(pool, serializeChunk, &(Window) { chunks, buffers }, tasks);
+    for (unsigned int i = start; i < end; ++i) {
+      if (plan.segments[i].buf.failed) {
+        ok = 0;
+      }
+    }
+    if (ok && !writeSegments(fd, plan.segments + start, end - start)) {
+      fprintf(stderr, "Error: Could not write the serialized output\n");
+      ok = 0;
+    }
+    for (unsigned int t = 0; t < tasks; ++t) {
+      buffers[t] = chunks[t]->buf;
+      buffers[t].length = 0;
+      chunks[t]->buf.data = NULL;
+    }
+    for (unsigned int i = start; i < end; ++i) {
+      free(plan.segments[i].buf.data);
+      plan.segments[i].buf.data = NULL;
+    }
+    start = end;
+  }
+  for (unsigned int i = start; i < plan.count; ++i) {
+    free(plan.segments[i].buf.data);
+  }
+  for (unsigned int t = 0; t < window; ++t) {
+    free(buffers[t].data);
+  }
+  free(plan.segments);
+  return ok;
+}
+
+void jsonPrintEntryInc(const FILE *io, unsigned char type, JItemValue *value, unsigned int tabs, unsigned int tabInc) {
+  JBuffer buf;
+  jsonBufferInitFile(&buf, (FILE*) io);
+  jsonBufferValue(&buf, type, value, tabs, tabInc);
+  jsonBufferFree(&buf);
+}
+
+void jsonPrintEntry(const FILE *io, const unsigned short type, const JItemValue *value) {
+  jsonPrintEntryInc(io, type, (JItemValue*) value, 0, 2);
+}
+
+void jsonPrintObject(const FILE *io, const JObject *obj) {
+  jsonPrintEntryInc(io, VAL_OBJ, &(JItemValue) { .object_val = (JObject*) obj }, 0, 2);
+}
+
+void jsonPrintHit(const FILE *io, const char *key, unsigned short type, const JItemValue *value) {
+  FILE *out = (FILE*) io;
+  if (!type) {
+    fprintf(out, "%s: not found\n", key);
+    return;
+  }
+  fprintf(out, "%s: ", key);
+  if (type == VAL_STRING) {
+    fputs(value->string_val, out);
+  } else {
+    jsonPrintEntry(io, type, value);
+  }
+  fputc('\n', out);
+}
+
+static void initWriter(JWriter *w, char compact) {
+  w->buf.compact = compact;
+  w->depth = 0;
+  w->objects = 0;
+  w->roots = 0;
+  w->empty = 0;
+  w->keyed = 0;
+  w->misused = 0;
+}
+
+void jsonWriterInit(JWriter *w, char compact) {
+  jsonBufferInit(&w->buf);
+  initWriter(w, compact);
+}
+
+void jsonWriterInitFd(JWriter *w, int fd, char compact) {
+  jsonBufferInitFd(&w->buf, fd);
+  initWriter(w, compact);
+}
+
+static void misuse(JWriter *w, const char *message) {
+  if (!w->misused) {
+    fprintf(stderr, "Error: JSON writer %s\n", message);
+  }
+  w->misused = 1;
+}
+
+static char inside(const JWriter *w) {
+  return w->depth ? w->open[w->depth - 1] : 0;
+}
+
+/** Separates a value from the one before it, 0 when there may be no value here */
+static int beforeValue(JWriter *w) {
+  switch (inside(w)) {
+  case 0:
+    if (w->roots++) {
+      put(&w->buf, '\n');
+    }
+    return 1;
+  case '{':
+    if (!w->keyed) {
+      misuse(w, "got a value in an object without its key");
+      return 0;
+    }
+    w->keyed = 0;
+    return 1;
+  default:
+    if (!w->empty) {
+      put(&w->buf, ',');
+    }
+    w->empty = 0;
+    return 1;
+  }
+}
+
+static void escaped(JBuffer *buf, const char *str, size_t length) {
+  put(buf, '"');
+  size_t run = 0;
+  for (size_t i = 0; i < length; ++i) {
+    char escape = escapes[(unsigned char) str[i]];
+    if (!escape) {
+      continue;
+    }
+    jsonBufferWrite(buf, str + run, i - run);
+    run = i + 1;
+    if (escape == 'u') {
+      char code[6] = { '\\', 'u', '0', '0', "0123456789abcdef"[str[i] >> 4], "0123456789abcdef"[str[i] & 15] };
+      jsonBufferWrite(buf, code, 6);
+    } else {
+      char code[2] = { '\\', escape };
+      jsonBufferWrite(buf, code, 2);
+    }
+  }
+  jsonBufferWrite(buf, str + run, length - run);
+  put(buf, '"');
+}
+
+static void begin(JWriter *w, char open) {
+  if (!beforeValue(w)) {
+    return;
+  }
+  if (w->depth == JSON_WRITER_DEPTH) {
+    misuse(w, "nested deeper than JSON_WRITER_DEPTH");
+    return;
+  }
+  w->open[w->depth++] = open;
+  w->empty = 1;
+  if (open == '{') {
+    ++w->objects;
+    jsonBufferWrite(&w->buf, "{\n", w->buf.compact ? 1 : 2);
+  } else {
+    put(&w->buf, '[');
+  }
+}
+
+static void end(JWriter *w, char open) {
+  if (inside(w) != open || w->keyed) {
+    misuse(w, open == '{' ? "ended an object that is not open or lacks a value" : "ended an array that is not open");
+    return;
+  }
+  --w->depth;
+  if (open == '{') {
+    --w->objects;
+    if (!w->buf.compact) {
+      if (!w->empty) {
+        put(&w->buf, '\n');
+      }
+      indent(&w->buf, w->objects * 2);
+    }
+    put(&w->buf, '}');
+  } else {
+    put(&w->buf, ']');
+  }
+  w->empty = 0; // the container was a value of the outer one
+}
+
+void jsonWriterBeginObject(JWriter *w) {
+  begin(w, '{');
+}
+
+void jsonWriterEndObject(JWriter *w) {
+  end(w, '{');
+}
+
+void jsonWriterBeginArray(JWriter *w) {
+  begin(w, '[');
+}
+
+void jsonWriterEndArray(JWriter *w) {
+  end(w, '[');
+}
+
+void jsonWriterKey(JWriter *w, const char *key) {
+  if (inside(w) != '{' || w->keyed) {
+    misuse(w, "got a key outside of an object or without a value");
+    return;
+  }
+  if (!w->empty) {
+    put(&w->buf, ',');
+  }
+  if (!w->buf.compact) {
+    if (!w->empty) {
+      put(&w->buf, '\n');
+    }
+    indent(&w->buf, w->objects * 2);
+  }
+  w->empty = 0;
+  w->keyed = 1;
+  escaped(&w->buf, key, strlen(key));
+  jsonBufferWrite(&w->buf, ": ", w->buf.compact ? 1 : 2);
+}
+
+void jsonWriterString(JWriter *w, const char *str) {
+  if (!str) {
+    jsonWriterNull(w);
+  } else if (beforeValue(w)) {
+    escaped(&w->buf, str, strlen(str));
+  }
+}
+
+void jsonWriterStringLength(JWriter *w, const char *str, size_t length) {
+  if (beforeValue(w)) {
+    escaped(&w->buf, str, length);
+  }
+}
+
+void jsonWriterInt(JWriter *w, long value) {
+  if (beforeValue(w)) {
+    jsonBufferInt(&w->buf, value);
+  }
+}
+
+void jsonWriterUInt(JWriter *w, unsigned long value) {
+  if (beforeValue(w)) {
+    jsonBufferUInt(&w->buf, value);
+  }
+}
+
+void jsonWriterDouble(JWriter *w, double value) {
+  if (beforeValue(w)) {
+    jsonBufferDouble(&w->buf, value);
+  }
+}
+
+void jsonWriterFloat(JWriter *w, float value) {
+  if (beforeValue(w)) {
+    jsonBufferFloat(&w->buf, value);
+  }
+}
+
+void jsonWriterBool(JWriter *w, char value) {
+  if (beforeValue(w)) {
+    jsonBufferWrite(&w->buf, value ? "true" : "false", value ? 4 : 5);
+  }
+}
+
+void jsonWriterNull(JWriter *w) {
+  if (beforeValue(w)) {
+    jsonBufferWrite(&w->buf, "null", 4);
+  }
+}
+
+void jsonWriterValue(JWriter *w, short type, JItemValue value) {
+  if (beforeValue(w)) {
+    jsonBufferValue(&w->buf, type, &value, w->objects * 2, 2);
+  }
+}
+
+static int finished(JWriter *w) {
+  if (w->depth) {
+    misuse(w, "was finished with a container open");
+  }
+  return !w->misused && !w->buf.failed;
+}
+
+char* jsonWriterText(JWriter *w, size_t *length) {
+  if (bound(&w->buf)) {
+    misuse(w, "writes to a descriptor and has no text");
+  } else {
+    put(&w->buf, '\0');
+  }
+  if (!finished(w)) {
+    jsonBufferFree(&w->buf);
+    *length = 0;
+    return 0;
+  }
+  *length = w->buf.length - 1;
+  return w->buf.data;
+}
+
+int jsonWriterFree(JWriter *w) {
+  int ok = finished(w);
+  return jsonBufferFree(&w->buf) && ok;
+}
@@ -0,0 +1,114 @@
+#ifndef SERIALIZE_H
+#define SERIALIZE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "json.h"
+
+/**
+ * Output buffer of the serializer. Bound to a file descriptor or a stream
+ * it is flushed whenever it fills up, unbound it grows to hold the whole
+ * text.
+ */
+typedef struct JBuffer {
+  char*  data;
+  size_t length;
+  size_t capacity;
+  int    fd;     // -1 when not writing to a descriptor
+  FILE*  file;   // NULL when not writing to a stream
+  char   failed;  // a write or an allocation failed, the output is incomplete
+  char   compact; // values go without newlines, indents or spaces
+} JBuffer;
+
+void  jsonBufferInit(JBuffer *buf);
+void  jsonBufferInitFd(JBuffer *buf, int fd);
+void  jsonBufferInitFile(JBuffer *buf, FILE *file);
+void  jsonBufferWrite(JBuffer *buf, const char *str, size_t length);
+void  jsonBufferInt(JBuffer *buf, long value);
+void  jsonBufferUInt(JBuffer *buf, unsigned long value);
+/** The shortest text reading back to the value, see jsonFormatDouble */
+void  jsonBufferDouble(JBuffer *buf, double value);
+void  jsonBufferFloat(JBuffer *buf, float value);
+/** Writes what a bound buffer holds, 0 when the write failed */
+int   jsonBufferFlush(JBuffer *buf);
+/** Flushes a bound buffer and releases it, 0 when any write failed */
+int   jsonBufferFree(JBuffer *buf);
+
+/**
+ * Writes a value in the layout of jsonPrintEntryInc: objects put every
+ * key on its own line indented by tabs + tabInc, arrays stay on one line.
+ * A compact buffer leaves out every newline, indent and space instead.
+ * Strings are written as they are held, with the escapes of the source.
+ */
+void  jsonBufferValue(JBuffer *buf, unsigned char type, const JItemValue *value, unsigned int tabs, unsigned int tabInc);
+
+/** The pretty printed text of a value, the caller frees it, NULL when out of memory */
+char* jsonSerialize(JItemValue val, short type, size_t *length);
+/** The text of a value without any whitespace, the caller frees it, NULL when out of memory */
+char* jsonSerializeCompact(JItemValue val, short type, size_t *length);
+/** Pretty prints a value to a file descriptor, 0 when a write failed */
+int   jsonSerializeFd(int fd, JItemValue val, short type);
+int   jsonSerializeCompactFd(int fd, JItemValue val, short type);
+/**
+ * Writes the same bytes as jsonSerializeFd, or jsonSerializeCompactFd, with
+ * the threads of a pool. The children of the root are cut into chunks, and
+ * so are those of objects and arrays below it with 1024 or more. A window
+ * of chunks at a time is serialized into buffers of their own on the pool
+ * and the buffers go out in order with writev. Scalars and pools of one
+ * thread take the single threaded path. 0 when a write failed.
+ */
+int   jsonSerializeParallelFd(int fd, JItemValue val, short type, char compact, JPool *pool);
+
+#define JSON_WRITER_DEPTH 128
+
+/**
+ * Writes JSON as it is generated, without building the objects first.
+ * Containers are opened and closed around their values and every value
+ * in an object follows its key:
+ *
+ *   jsonWriterBeginObject(&w);
+ *   jsonWriterKey(&w, "id");
+ *   jsonWriterInt(&w, 7);
+ *   jsonWriterEndObject(&w);
+ *
+ * The layout is the one of jsonSerialize, or of jsonSerializeCompact for
+ * a compact writer. Values at the top level go on lines of their own, so
+ * a writer streams one record per line. Keys and strings are escaped,
+ * values from a parsed document go through jsonWriterValue as they are.
+ * Misuse, like a value without its key, is reported on stderr once and
+ * fails the writer.
+ */
+typedef struct JWriter {
+  JBuffer       buf;
+  unsigned int  depth;
+  unsigned int  objects; // open, the indent of pretty output
+  unsigned long roots;   // values written at the top level
+  char          empty;   // nothing written in the innermost container yet
+  char          keyed;   // a key was written, its value comes next
+  char          misused;
+  char          open[JSON_WRITER_DEPTH]; // '{' or '[' per depth
+} JWriter;
+
+void  jsonWriterInit(JWriter *w, char compact);
+void  jsonWriterInitFd(JWriter *w, int fd, char compact);
+void  jsonWriterBeginObject(JWriter *w);
+void  jsonWriterEndObject(JWriter *w);
+void  jsonWriterBeginArray(JWriter *w);
+void  jsonWriterEndArray(JWriter *w);
+void  jsonWriterKey(JWriter *w, const char *key);
+void  jsonWriterString(JWriter *w, const char *str);
+void  jsonWriterStringLength(JWriter *w, const char *str, size_t length);
+void  jsonWriterInt(JWriter *w, long value);
+void  jsonWriterUInt(JWriter *w, unsigned long value);
+void  jsonWriterDouble(JWriter *w, double value);
+void  jsonWriterFloat(JWriter *w, float value);
+void  jsonWriterBool(JWriter *w, char value);
+void  jsonWriterNull(JWriter *w);
+void  jsonWriterValue(JWriter *w, short type, JItemValue value);
+/** The text of an unbound writer, which is released, the caller frees it, NULL when it failed */
+char* jsonWriterText(JWriter *w, size_t *length);
+/** Flushes and releases a writer, 0 when it failed or a container is still open */
+int   jsonWriterFree(JWriter *w);
+
+#endif
@@ -1,12 +1,22 @@
 #include "gtest/gtest.h"
+#include <atomic>
+#include <cmath>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
 
 extern "C" {
+  #include "../src/dtoa.h"
   #include "../src/json.h"
   #include "../src/parse.h"
+  #include "../src/serialize.h"
 };
 
 #define NO_DUP 0
 
+FILE *inlineJson(const char *jstr, char **deleteThis);
+
 TEST(JsonObjectManipulation, shouldBuildAnewObjectAndAddAKey) {
     JObject *obj = jsonNewObject();
     EXPECT_TRUE(obj != NULL);
@@ -81,6 +91,119 @@ TEST(JsonObjectManipulation, shouldGetObjectValueOutOfNestedKeys) {
   jsonFree( (JItemValue) { obj }, VAL_OBJ);
 }
 
+TEST(JsonObjectManipulation, shouldResolveCompiledAndEscapedPaths) {
+  JObject *obj = jsonNewObject();
+  JObject *inner = jsonNewObject();
+  jsonAddInt(inner, "a.b", 1);
+  jsonAddInt(inner, "c/d", 2);
+  jsonAddInt(inner, "e~f", 3);
+  jsonAddString(inner, "g", "deep");
+  jsonAddObj(obj, "outer", inner);
+  jsonAddVal(obj, "flag", (JItemValue) { .char_val = 1 }, VAL_BOOL);
+
+  short type = 0;
+  EXPECT_EQ(jsonGet(obj, "outer.a\\.b", &type).int_val, 1);
+  EXPECT_EQ(type, VAL_INT);
+  EXPECT_STREQ(jsonString(obj, "outer.g"), "deep");
+  EXPECT_EQ(jsonBool(obj, "flag"), 1);
+  jsonGet(obj, "outer.missing", &type);
+  EXPECT_EQ(type, 0);
+  EXPECT_EQ(jsonGet(obj, "/outer/a.b", &type).int_val, 1);
+  EXPECT_EQ(jsonGet(obj, "/outer/c~1d", &type).int_val, 2);
+  EXPECT_EQ(jsonGet(obj, "/outer/e~0f", &type).int_val, 3);
+  EXPECT_EQ(type, VAL_INT);
+  jsonGet(obj, "/outer/~2", &type);
+  EXPECT_EQ(type, 0);
+  jsonGet(obj, "outer.g.deeper", &type);
+  EXPECT_EQ(type, 0);
+
+  JKeyPath *dotted = jsonPathCompile("outer.a\\.b");
+  JKeyPath *pointer = jsonPathCompile("/outer/c~1d");
+  JKeyPath *tilde = jsonPathCompile("/outer/e~0f");
+  JKeyPath *missing = jsonPathCompile("outer.g.deeper");
+  ASSERT_TRUE(dotted && pointer && tilde && missing);
+  EXPECT_EQ(dotted->depth, 2u);
+  EXPECT_STREQ(dotted->keys[1].str, "a.b");
+  EXPECT_EQ(jsonGetPath(obj, dotted, &type).int_val, 1);
+  EXPECT_EQ(jsonGetPath(obj, pointer, &type).int_val, 2);
+  EXPECT_EQ(jsonGetPath(obj, tilde, &type).int_val, 3);
+  jsonGetPath(obj, missing, &type);
+  EXPECT_EQ(type, 0);
+  jsonPathFree(dotted);
+  jsonPathFree(pointer);
+  jsonPathFree(tilde);
+  jsonPathFree(missing);
+
+  EXPECT_TRUE(jsonPathCompile("outer..g") == NULL);
+  EXPECT_TRUE(jsonPathCompile("outer.\\g") == NULL);
+  EXPECT_TRUE(jsonPathCompile("/outer/~2") == NULL);
+  jsonFree( (JItemValue) { obj }, VAL_OBJ);
+}
+
+TEST(JsonObjectManipulation, shouldResolveManyPathsThroughOneTrie) {
+  JObject *obj = jsonNewObject();
+  JObject *a = jsonNewObject();
+  JObject *b = jsonNewObject();
+  jsonAddInt(b, "x", 1);
+  jsonAddString(b, "y", "why");
+  jsonAddObj(a, "b", b);
+  jsonAddInt(a, "c", 2);
+  jsonAddObj(obj, "a", a);
+  jsonAddInt(obj, "d", 3);
+
+  const char *keys[] = { "a.b.x", "a.b.y", "a.c", "d", "a.b.missing", "a.c.deeper", "a.b.x", "a.b" };
+  JPathSet *set = jsonPathSetCompile(keys, 8);
+  ASSERT_TRUE(set != NULL);
+  // root, a, b, x, y, c, d, missing, deeper
+  EXPECT_EQ(set->nodeCount, 9u);
+
+  JArrayItem out[8];
+  EXPECT_EQ(jsonPathSetGet(obj, set, out), 6u);
+  EXPECT_EQ(out[0].type, VAL_INT);
+  EXPECT_EQ(out[0].value.int_val, 1);
+  EXPECT_STREQ(out[1].value.string_val, "why");
+  EXPECT_EQ(out[2].value.int_val, 2);
+  EXPECT_EQ(out[3].value.int_val, 3);
+  EXPECT_EQ(out[4].type, 0);
+  EXPECT_EQ(out[5].type, 0);
+  EXPECT_EQ(out[6].value.int_val, 1);
+  EXPECT_EQ(out[7].type, VAL_OBJ);
+  EXPECT_EQ(out[7].value.object_val, b);
+  jsonPathSetFree(set);
+
+  const char *one[] = { "a.b.y" };
+  EXPECT_EQ(jsonGetMany(obj, one, 1, out), 1u);
+  EXPECT_STREQ(out[0].value.string_val, "why");
+  const char *bad[] = { "a..b" };
+  EXPECT_EQ(jsonGetMany(obj, bad, 1, out), 0u);
+  EXPECT_EQ(out[0].type, 0);
+  jsonFree( (JItemValue) { obj }, VAL_OBJ);
+}
+
+TEST(JsonObjectManipulation, shouldPrintOneHitPerKeyInKeyOrder) {
+  JObject *obj = jsonNewObject();
+  JObject *o = jsonNewObject();
+  jsonAddInt(o, "a", 1);
+  jsonAddObj(obj, "o", o);
+  jsonAddVal(obj, "n", (JItemValue) { .double_val = 3.5 }, VAL_DOUBLE);
+  jsonAddString(obj, "s", "text");
+
+  // what nicson -e prints for several keys
+  const char *keys[] = { "o", "n", "missing", "s" };
+  JArrayItem found[4];
+  EXPECT_EQ(jsonGetMany(obj, keys, 4, found), 3u);
+  char *out = NULL;
+  size_t len = 0;
+  FILE *io = open_memstream(&out, &len);
+  for (unsigned int i = 0; i < 4; ++i) {
+    jsonPrintHit(io, keys[i], found[i].type, &found[i].value);
+  }
+  fclose(io);
+  EXPECT_STREQ(out, "o: {\n  \"a\": 1\n}\nn: 3.5\nmissing: not found\ns: text\n");
+  free(out);
+  jsonFree( (JItemValue) { obj }, VAL_OBJ);
+}
+
 TEST(JsonObjectManipulation, shouldExpandObjectIfMaxProbesReached) {
   char buf[80];
   
@@ -121,3 +244,958 @@ TEST(JsonObjectManipulation, shouldGetStringsFromCacheNoKeyInterpretation) {
 }
 
 
+TEST(JsonObjectManipulation, shouldKeepKeysInInsertionOrder) {
+  char buf[80];
+  JObject *obj = jsonNewObject();
+  for(int i = 0; i < 300; ++i) {
+    sprintf(buf, "Key %d", 299 - i);
+    jsonAddInt(obj, buf, i);
+  }
+
+  unsigned size = 0;
+  const char **keys = jsonKeys(obj, &size);
+  ASSERT_EQ(size, 300u);
+  for(unsigned i = 0; i < size; ++i) {
+    sprintf(buf, "Key %d", 299 - i);
+    EXPECT_STREQ(keys[i], buf);
+  }
+  free(keys);
+  jsonFree( (JItemValue) { obj }, VAL_OBJ);
+}
+
+TEST(JsonObjectManipulation, shouldDeleteAndReplaceKeys) {
+  JObject *obj = jsonNewObject();
+  jsonAddInt(obj, "first", 1);
+  jsonAddInt(obj, "second", 2);
+  jsonAddInt(obj, "third", 3);
+
+  EXPECT_EQ(jsonDeleteKey(obj, "second"), obj);
+  EXPECT_EQ(jsonDeleteKey(obj, "second"), (JObject*)NULL);
+  EXPECT_EQ(obj->size, 2u);
+  jsonAddInt(obj, "first", 10);
+  EXPECT_EQ(obj->size, 2u);
+  jsonAddInt(obj, "second", 20);
+
+  unsigned size = 0;
+  const char **keys = jsonKeys(obj, &size);
+  ASSERT_EQ(size, 3u);
+  EXPECT_STREQ(keys[0], "first");
+  EXPECT_STREQ(keys[1], "third");
+  EXPECT_STREQ(keys[2], "second");
+  EXPECT_EQ(jsonInt(obj, "first"), 10);
+  EXPECT_EQ(jsonInt(obj, "second"), 20);
+  free(keys);
+  jsonFree( (JItemValue) { obj }, VAL_OBJ);
+}
+
+TEST(JsonObjectManipulation, shouldPrintKeysInInsertionOrder) {
+  JObject *obj = jsonNewObject();
+  jsonAddInt(obj, "zebra", 1);
+  jsonAddInt(obj, "apple", 2);
+  jsonAddInt(obj, "mango", 3);
+
+  char *out = NULL;
+  size_t len = 0;
+  FILE *io = open_memstream(&out, &len);
+  jsonPrintObject(io, obj);
+  fclose(io);
+  EXPECT_STREQ(out, "{\n  \"zebra\": 1,\n  \"apple\": 2,\n  \"mango\": 3\n}");
+  free(out);
+  jsonFree( (JItemValue) { obj }, VAL_OBJ);
+}
+
+TEST(JsonSerialize, shouldWriteWhatThePrinterPrints) {
+  char *deleteMe = NULL;
+  short type = 0;
+  JItemValue val = jsonParseF(inlineJson("{\"a\": [1, -20, 2147483647, \"x\\\"y\", true, null, {\"b\": {}}],"
+      " \"c\": -2147483647, \"d\": {\"e\": [[], [false]]}}", &deleteMe), &type);
+  ASSERT_TRUE(val.object_val != NULL);
+  JObject *deep = val.object_val;
+  for(int i = 0; i < 80; ++i) {
+    JObject *next = jsonNewObject();
+    jsonAddObj(deep, "deeper", next);
+    deep = next;
+  }
+  jsonAddUInt(deep, "u", 4000000000u);
+  jsonAddInt(val.object_val, "m", INT32_MIN);
+
+  char *printed = NULL;
+  size_t printedLength = 0;
+  FILE *io = open_memstream(&printed, &printedLength);
+  jsonPrintObject(io, val.object_val);
+  fclose(io);
+
+  size_t length = 0;
+  char *text = jsonSerialize(val, type, &length);
+  ASSERT_TRUE(text != NULL);
+  EXPECT_EQ(length, strlen(text));
+  EXPECT_STREQ(text, printed);
+  EXPECT_EQ(std::string(text).find("{\n  \"a\": [1,-20,2147483647,\"x\\\"y\",true,null,{\n    \"b\": {\n"), 0u);
+  EXPECT_NE(std::string(text).find("\"c\": -2147483647,\n"), std::string::npos);
+  EXPECT_NE(std::string(text).find("\"m\": -2147483648\n}"), std::string::npos);
+  EXPECT_NE(std::string(text).find(std::string(162, ' ') + "\"u\": 4000000000\n"), std::string::npos);
+
+  FILE *out = tmpfile();
+  ASSERT_TRUE(jsonSerializeFd(fileno(out), val, type));
+  EXPECT_EQ((size_t) ftell(out), length);
+  rewind(out);
+  std::string written(length, '\0');
+  EXPECT_EQ(fread(&written[0], 1, length, out), length);
+  EXPECT_EQ(written, text);
+  fclose(out);
+
+  free(text);
+  free(printed);
+  jsonFree(val, type);
+  free(deleteMe);
+}
+
+TEST(JsonObjectShapes, shouldShareOneShapeBetweenObjectsWithTheSameKeys) {
+  JsonContext *ctx = jsonContextNew(NULL);
+  JObject *records[3];
+  const char *keys[] = { "version", "resolved", "integrity", "dev", "optional" };
+  for(int r = 0; r < 3; ++r) {
+    records[r] = jsonContextNewObject(ctx);
+    for(int k = 0; k < 5; ++k) {
+      jsonAddInt(records[r], keys[k], k * (r + 1));
+    }
+  }
+  JObject *other = jsonContextNewObject(ctx);
+  jsonAddInt(other, "resolved", 1);
+  jsonAddInt(other, "version", 2);
+
+  // the first object of a key sequence stays a dictionary, the next ones share a shape
+  EXPECT_EQ(records[0]->shape, (JShape*)NULL);
+  EXPECT_EQ(records[1]->shape, records[2]->shape);
+  EXPECT_EQ(records[1]->shape->count, 5u);
+  EXPECT_EQ(records[1]->entries, (JEntry*)NULL);
+  EXPECT_EQ(other->shape, (JShape*)NULL);
+  // the third object follows the transitions of the second and is sized once
+  EXPECT_EQ(records[2]->_usable, 5u);
+  EXPECT_EQ(jsonInt(records[0], "integrity"), 2);
+  EXPECT_EQ(jsonInt(records[2], "integrity"), 6);
+  EXPECT_EQ(jsonInt(other, "version"), 2);
+
+  jsonAddInt(records[2], "dev", 7);
+  EXPECT_EQ(records[1]->shape, records[2]->shape);
+  EXPECT_EQ(jsonInt(records[2], "dev"), 7);
+
+  // deleting a key leaves the shape for a dictionary of its own
+  EXPECT_TRUE(jsonDeleteKey(records[2], "resolved") != NULL);
+  EXPECT_EQ(records[2]->shape, (JShape*)NULL);
+  EXPECT_EQ(records[2]->size, 4u);
+  EXPECT_EQ(jsonInt(records[2], "optional"), 12);
+  unsigned size = 0;
+  const char **names = jsonKeys(records[2], &size);
+  ASSERT_EQ(size, 4u);
+  EXPECT_STREQ(names[0], "version");
+  EXPECT_STREQ(names[1], "integrity");
+  free(names);
+  EXPECT_TRUE(jsonDeleteKey(records[1], "missing") == NULL);
+  EXPECT_TRUE(records[1]->shape != NULL);
+
+  for(int r = 0; r < 3; ++r) {
+    jsonFree( (JItemValue) { records[r] }, VAL_OBJ);
+  }
+  jsonFree( (JItemValue) { other }, VAL_OBJ);
+  jsonContextFree(ctx);
+}
+
+TEST(JsonObjectShapes, shouldHashLongShapesAndFallBackPastTheKeyLimit) {
+  JsonContext *ctx = jsonContextNew(NULL);
+  JObject *objs[2];
+  char name[16];
+  for(int o = 0; o < 2; ++o) {
+    objs[o] = jsonContextNewObject(ctx);
+    for(int i = 0; i < 100; ++i) {
+      sprintf(name, "key%d", i);
+      jsonAddInt(objs[o], name, i);
+      if(o == 1 && i == 20) {
+        EXPECT_TRUE(objs[o]->shape != NULL);
+        EXPECT_TRUE(objs[o]->shape->_index != NULL);
+        EXPECT_EQ(jsonInt(objs[o], "key13"), 13);
+      }
+    }
+  }
+  EXPECT_EQ(objs[1]->shape, (JShape*)NULL);
+  EXPECT_EQ(objs[1]->size, 100u);
+  for(int i = 0; i < 100; ++i) {
+    sprintf(name, "key%d", i);
+    ASSERT_EQ(jsonInt(objs[1], name), i);
+  }
+  jsonFree( (JItemValue) { objs[0] }, VAL_OBJ);
+  jsonFree( (JItemValue) { objs[1] }, VAL_OBJ);
+  jsonContextFree(ctx);
+}
+
+TEST(JsonArrayManipulation, shouldPushItemsInlineWithGeometricGrowth) {
+  JArray *arr = jsonNewArray();
+  unsigned int grows = 0;
+  unsigned int capacity = 0;
+  for(int i = 0; i < 100000; ++i) {
+    jsonArrayPushObject(arr, jsonAddInt(jsonNewObject(), "id", i));
+    if(arr->capacity != capacity) {
+      capacity = arr->capacity;
+      ++grows;
+    }
+  }
+  EXPECT_EQ(arr->count, 100000u);
+  EXPECT_LT(grows, 20u);
+  EXPECT_EQ(arr->_internal.mItems[0].type, VAL_OBJ);
+  EXPECT_EQ(jsonInt(arr->_internal.mItems[99999].value.object_val, "id"), 99999);
+  jsonFree( (JItemValue) { arr }, VAL_MIXED_ARRAY);
+}
+
+TEST(JsonArrayManipulation, shouldReserveAndKeepItemsInPlace) {
+  JArray *arr = jsonArrayReserve(jsonNewArray(), 1000);
+  ASSERT_TRUE(arr != NULL);
+  EXPECT_EQ(arr->capacity, 1000u);
+  jsonArrayPushInt(arr, 1);
+  ASSERT_EQ(arr->type, VAL_INT_ARRAY);
+  EXPECT_GE(arr->capacity, 1000u);
+  int *first = &arr->_internal.ints[0];
+  for(int i = 1; i < 1000; ++i) {
+    jsonArrayPushInt(arr, i + 1);
+  }
+  EXPECT_EQ(first, &arr->_internal.ints[0]);
+  EXPECT_EQ(arr->_internal.ints[999], 1000);
+  jsonFree( (JItemValue) { arr }, VAL_MIXED_ARRAY);
+}
+
+TEST(JsonArrayManipulation, shouldTurnTypedArraysMixedOnAnotherType) {
+  char *deleteMe = NULL;
+  short type = 0;
+  JItemValue val = jsonParseF(inlineJson("{\"ints\": [1, 2, 3]}", &deleteMe), &type);
+  ASSERT_TRUE(val.object_val != NULL);
+  JArray *ints = jsonArray(val.object_val, "ints");
+  ASSERT_EQ(ints->type, VAL_INT_ARRAY);
+  jsonArrayPushInt(ints, 4);
+  EXPECT_EQ(ints->type, VAL_INT_ARRAY);
+  jsonArrayPushString(ints, "five");
+  jsonArrayPushBool(ints, 1);
+  ASSERT_EQ(ints->type, VAL_MIXED_ARRAY);
+  EXPECT_EQ(ints->count, 6u);
+  EXPECT_EQ(ints->_internal.mItems[3].type, VAL_INT);
+  EXPECT_EQ(ints->_internal.mItems[3].value.int_val, 4);
+  EXPECT_STREQ(ints->_internal.mItems[4].value.string_val, "five");
+
+  char *out = NULL;
+  size_t size = 0;
+  FILE *io = open_memstream(&out, &size);
+  jsonPrintObject(io, val.object_val);
+  fclose(io);
+  EXPECT_STREQ(out, "{\n  \"ints\": [1,2,3,4,\"five\",true]\n}");
+  free(out);
+  jsonFree(val, type);
+  free(deleteMe);
+}
+
+TEST(JsonArrayManipulation, shouldReadTheNewTypeThroughHoldersAfterAMixedPush) {
+  char *deleteMe = NULL;
+  short type = 0;
+  // the first object is a dictionary, the second shares a shape
+  JItemValue val = jsonParseF(inlineJson("[{\"ints\": [1, 2], \"n\": [[3]]}, {\"ints\": [1, 2], \"n\": [[3]]}]",
+      &deleteMe), &type);
+  ASSERT_TRUE(val.array_val != NULL);
+  for(unsigned int o = 0; o < 2; ++o) {
+    short itemType = 0;
+    JObject *obj = jsonArrayGet(val.array_val, o, &itemType).object_val;
+    ASSERT_EQ(itemType, VAL_OBJ);
+    JArray *ints = jsonArray(obj, "ints");
+    ASSERT_EQ(ints->type, VAL_INT_ARRAY);
+    jsonArrayPushString(ints, "three");
+
+    short entryType = 0;
+    EXPECT_EQ(jsonGet(obj, "ints", &entryType).array_val, ints);
+    EXPECT_EQ(entryType, VAL_MIXED_ARRAY);
+    const char *name = NULL;
+    JItemValue value;
+    ASSERT_TRUE(jsonEntryAt(obj, 0, &name, &value, &entryType));
+    EXPECT_EQ(entryType, VAL_MIXED_ARRAY);
+    EXPECT_EQ(jsonArrayGet(ints, 1, &itemType).int_val, 2);
+    EXPECT_EQ(itemType, VAL_INT);
+    EXPECT_STREQ(jsonArrayGet(ints, 2, &itemType).string_val, "three");
+    EXPECT_EQ(itemType, VAL_STRING);
+
+    // an array inside a mixed array reads its new type the same way
+    JArray *outer = jsonArray(obj, "n");
+    JArray *inner = jsonArrayGet(outer, 0, &itemType).array_val;
+    ASSERT_EQ(itemType, VAL_INT_ARRAY);
+    jsonArrayPushBool(inner, 1);
+    jsonArrayGet(outer, 0, &itemType);
+    EXPECT_EQ(itemType, VAL_MIXED_ARRAY);
+
+    // setting the same array again under its old type keeps it alive
+    jsonAddVal(obj, "ints", (JItemValue) { .array_val = ints }, VAL_INT_ARRAY);
+    EXPECT_EQ(jsonArray(obj, "ints")->count, 3u);
+  }
+  size_t length = 0;
+  char *text = jsonSerializeCompact(val, type, &length);
+  EXPECT_STREQ(text, "[{\"ints\":[1,2,\"three\"],\"n\":[[3,true]]},{\"ints\":[1,2,\"three\"],\"n\":[[3,true]]}]");
+  free(text);
+  jsonFree(val, type);
+  free(deleteMe);
+}
+
+TEST(JsonStringInterning, shouldReturnTheSameHandleWithItsHash) {
+  JInternTable *table = jsonInternNew(NULL);
+  char buf[80];
+  for(int i = 0; i < 1000; ++i) {
+    sprintf(buf, "interned %d", i);
+    jsonIntern(table, buf, strlen(buf));
+  }
+
+  JKey first = jsonIntern(table, "interned 42", 11);
+  JKey second = jsonIntern(table, "interned 42 and more", 11);
+  EXPECT_EQ(first.str, second.str);
+  EXPECT_EQ(first.hash, fnvstr("interned 42"));
+  EXPECT_EQ(first.length, 11u);
+  EXPECT_EQ(jsonInternHeader(first.str)->hash, first.hash);
+  EXPECT_EQ(jsonInternFind(table, "missing", 7, fnvstr("missing")).str, (const char*)NULL);
+
+  JInternStats stats;
+  jsonInternTableStats(table, &stats);
+  EXPECT_EQ(stats.strings, 1000u);
+  EXPECT_EQ(stats.hits, 2ul);
+  jsonInternFree(table);
+}
+
+TEST(JsonStringInterning, shouldShareKeyNamesBetweenObjects) {
+  JObject *first = jsonNewObject();
+  JObject *second = jsonNewObject();
+  jsonDeleteKey(jsonAddInt(first, "other_key", 1), "other_key"); // keeps first a dictionary
+  jsonAddInt(first, "shared_key", 1);
+  jsonAddInt(second, "shared_key", 2);
+  unsigned size = 0;
+  const char **names = jsonKeys(second, &size);
+  ASSERT_EQ(size, 1u);
+  EXPECT_EQ(first->entries[1].name, names[0]);
+  EXPECT_EQ(first->entries[1].hash, fnvstr("shared_key"));
+  free(names);
+  jsonFree( (JItemValue) { first }, VAL_OBJ);
+  jsonFree( (JItemValue) { second }, VAL_OBJ);
+}
+
+TEST(JsonStringInterning, shouldHandOutOneCopyFromConcurrentThreads) {
+  JSharedIntern *shared = jsonSharedInternNew(NULL);
+  std::vector<std::thread> workers;
+  const char *seen[8][2000];
+  for(int t = 0; t < 8; ++t) {
+    workers.push_back(std::thread([t, shared, &seen]() {
+      char buf[80];
+      for(int i = 0; i < 2000; ++i) {
+        int n = (i * 7 + t * 131) % 2000;
+        sprintf(buf, "shared %d", n);
+        seen[t][n] = jsonSharedIntern(shared, buf, strlen(buf), fnvstr(buf)).str;
+      }
+    }));
+  }
+  for(auto &worker : workers) {
+    worker.join();
+  }
+  for(int t = 1; t < 8; ++t) {
+    for(int i = 0; i < 2000; ++i) {
+      ASSERT_EQ(seen[t][i], seen[0][i]);
+    }
+  }
+  EXPECT_STREQ(seen[0][1234], "shared 1234");
+  EXPECT_EQ(jsonSharedInternFind(shared, "shared 99", 9, fnvstr("shared 99")).str, seen[0][99]);
+
+  JInternStats stats;
+  jsonSharedInternStats(shared, &stats);
+  EXPECT_EQ(stats.strings, 2000u);
+  jsonSharedInternFree(shared);
+}
+
+TEST(JsonStringInterning, shouldShareKeysBetweenContextsThroughTheSharedTable) {
+  JSharedIntern *shared = jsonSharedInternNew(NULL);
+  JsonContext *first = jsonContextNew(NULL);
+  JsonContext *second = jsonContextNew(NULL);
+  jsonContextSetSharedIntern(first, shared);
+  jsonContextSetSharedIntern(second, shared);
+
+  JObject *a = jsonContextNewObject(first);
+  JObject *b = jsonContextNewObject(second);
+  jsonAddString(a, "shared_key", "value");
+  jsonAddString(b, "shared_key", "value");
+  unsigned size = 0;
+  const char **aKeys = jsonKeys(a, &size);
+  const char **bKeys = jsonKeys(b, &size);
+  EXPECT_EQ(aKeys[0], bKeys[0]);
+  free(aKeys);
+  free(bKeys);
+  EXPECT_EQ(first->strings, (JInternTable*)NULL);
+
+  jsonFree( (JItemValue) { a }, VAL_OBJ);
+  jsonFree( (JItemValue) { b }, VAL_OBJ);
+  jsonContextFree(first);
+  jsonContextFree(second);
+  jsonSharedInternFree(shared);
+}
+
+TEST(JsonArrayReduction, shouldAgreeWithPlainLoopsOnEverySimdLevel) {
+  int saved = jsonSimdLevel();
+  for(int level = JSON_SIMD_NONE; level <= saved; ++level) {
+    jsonSetSimdLevel(level);
+    for(unsigned n = 1; n < 40; ++n) {
+      JArray *ints = jsonNewArray();
+      JArray *doubles = jsonNewArray();
+      long sum = 0;
+      unsigned above = 0;
+      int lowest = 1000, highest = -1000;
+      for(unsigned i = 0; i < n; ++i) {
+        int v = (int)((i * 37) % 23) - 11;
+        jsonArrayPushInt(ints, v);
+        jsonArrayPushDouble(doubles, v * 1.5e200);
+        sum += v;
+        above += v >= 3;
+        lowest = v < lowest ? v : lowest;
+        highest = v > highest ? v : highest;
+      }
+      ASSERT_EQ(ints->type, VAL_INT_ARRAY);
+      ASSERT_EQ(doubles->type, VAL_DOUBLE_ARRAY);
+      EXPECT_EQ(jsonArraySum(ints), (double)sum);
+      EXPECT_EQ(jsonArrayCountIf(ints, JSON_CMP_GE, 3), above);
+      EXPECT_EQ(jsonArrayCountIf(doubles, JSON_CMP_GE, 3 * 1.5e200), above);
+      EXPECT_EQ(jsonArrayCountIf(ints, JSON_CMP_NE, 3) + jsonArrayCountIf(ints, JSON_CMP_EQ, 3), n);
+
+      double min = 0, max = 0;
+      ASSERT_TRUE(jsonArrayMinMax(doubles, &min, &max));
+      EXPECT_EQ(min, lowest * 1.5e200);
+      EXPECT_EQ(max, highest * 1.5e200);
+
+      JArray *filtered = jsonArrayFilter(ints, JSON_CMP_GE, 3);
+      ASSERT_EQ(filtered->count, above);
+      for(unsigned i = 0, k = 0; i < n; ++i) {
+        if(ints->_internal.ints[i] >= 3) {
+          EXPECT_EQ(filtered->_internal.ints[k++], ints->_internal.ints[i]);
+        }
+      }
+      jsonFree( (JItemValue) { filtered }, filtered->type);
+      jsonFree( (JItemValue) { ints }, ints->type);
+      jsonFree( (JItemValue) { doubles }, doubles->type);
+    }
+
+    // NaN is only unequal, as with the C operators
+    JArray *withNan = jsonNewArray();
+    for(unsigned i = 0; i < 13; ++i) {
+      jsonArrayPushDouble(withNan, i % 3 == 0 ? NAN : i - 6.0);
+    }
+    const int ops[] = { JSON_CMP_LT, JSON_CMP_LE, JSON_CMP_EQ, JSON_CMP_GE, JSON_CMP_GT, JSON_CMP_NE };
+    for(int op : ops) {
+      unsigned expected = 0;
+      for(unsigned i = 0; i < withNan->count; ++i) {
+        double x = withNan->_internal.doubles[i];
+        expected += op == JSON_CMP_LT ? x < 0 : op == JSON_CMP_LE ? x <= 0 : op == JSON_CMP_EQ ? x == 0
+            : op == JSON_CMP_GE ? x >= 0 : op == JSON_CMP_GT ? x > 0 : x != 0;
+      }
+      EXPECT_EQ(jsonArrayCountIf(withNan, op, 0), expected) << "level " << level << " op " << op;
+      JArray *filtered = jsonArrayFilter(withNan, op, 0);
+      EXPECT_EQ(filtered->count, expected) << "level " << level << " op " << op;
+      jsonFree( (JItemValue) { filtered }, filtered->type);
+    }
+    jsonFree( (JItemValue) { withNan }, withNan->type);
+
+    // min and max skip NaN items like the scalar loop, wherever they fall in the lanes
+    const double spread[] = { 10, 2, 10, 10, 10, NAN, 10, 10, 10, 5, 10, 10, NAN, -1, 11, 10, 10 };
+    for(unsigned n = 1; n <= sizeof(spread) / sizeof(spread[0]); ++n) {
+      JArray *doubles = jsonNewArray();
+      double lowest = spread[0], highest = spread[0];
+      for(unsigned i = 0; i < n; ++i) {
+        jsonArrayPushDouble(doubles, spread[i]);
+        lowest = spread[i] < lowest ? spread[i] : lowest;
+        highest = spread[i] > highest ? spread[i] : highest;
+      }
+      double min = 0, max = 0;
+      ASSERT_TRUE(jsonArrayMinMax(doubles, &min, &max));
+      EXPECT_EQ(min, lowest) << "level " << level << " n " << n;
+      EXPECT_EQ(max, highest) << "level " << level << " n " << n;
+      jsonFree( (JItemValue) { doubles }, doubles->type);
+    }
+  }
+  jsonSetSimdLevel(saved);
+}
+
+TEST(JsonArrayReduction, shouldSkipNonNumbersInMixedArrays) {
+  char *deleteMe = NULL;
+  short type = 0;
+  JItemValue val = jsonParseF(inlineJson("{\"mixed\": [1, \"two\", 3.5, null, 10]}", &deleteMe), &type);
+  ASSERT_TRUE(val.object_val != NULL);
+  JArray *mixed = jsonArray(val.object_val, "mixed");
+  EXPECT_DOUBLE_EQ(jsonArraySum(mixed), 14.5);
+  EXPECT_EQ(jsonArrayCountIf(mixed, JSON_CMP_GT, 2), 2u);
+  double min = 0, max = 0;
+  EXPECT_TRUE(jsonArrayMinMax(mixed, &min, &max));
+  EXPECT_EQ(min, 1);
+  EXPECT_EQ(max, 10);
+
+  JArray *filtered = jsonArrayFilter(mixed, JSON_CMP_GT, 2);
+  EXPECT_EQ(filtered->count, 2u);
+  EXPECT_EQ(filtered->type, VAL_FLOAT_ARRAY);
+  jsonFree( (JItemValue) { filtered }, filtered->type);
+  EXPECT_FALSE(jsonArrayMinMax(jsonArray(val.object_val, "missing"), &min, &max));
+  jsonFree(val, type);
+  free(deleteMe);
+}
+
+TEST(JsonArrayWhere, shouldMatchPlainLoopsAcrossChunks) {
+  JArray *records = jsonNewArray();
+  char name[32];
+  for(int i = 0; i < 100000; ++i) {
+    JObject *record = jsonNewObject();
+    jsonAddInt(record, "id", i);
+    sprintf(name, "%s-%d", i % 3 ? "user" : "admin", i);
+    jsonAddString(record, "name", getOrCacheString(name));
+    if(i % 2 == 0) {
+      JObject *meta = jsonNewObject();
+      jsonAddVal(meta, "score", (JItemValue) { .double_val = i / 100.0 }, VAL_DOUBLE);
+      jsonAddObj(record, "meta", meta);
+    }
+    jsonArrayPushObject(records, record);
+  }
+
+  unsigned size = 0;
+  JPredicate scored[] = { jsonWhereExists("meta.score"), jsonWhereRange("meta.score", 10, 20) };
+  JObject **found = jsonArrayWhere(records, scored, 2, &size);
+  ASSERT_EQ(size, 501u);
+  for(unsigned i = 0; i < size; ++i) {
+    ASSERT_EQ(jsonInt(found[i], "id"), 1000 + (int) i * 2);
+  }
+  free(found);
+
+  JPredicate admins[] = { jsonWherePrefix("name", "admin-"), jsonWhereRange("id", 0, 50000) };
+  found = jsonArrayWhere(records, admins, 2, &size);
+  EXPECT_EQ(size, 16667u);
+  free(found);
+
+  JPredicate one = jsonWhereEqualsString("name", "admin-99999");
+  found = jsonArrayWhere(records, &one, 1, &size);
+  ASSERT_EQ(size, 1u);
+  EXPECT_EQ(jsonInt(found[0], "id"), 99999);
+  free(found);
+
+  one = jsonWhereEqualsDouble("id", 42);
+  found = jsonArrayWhere(records, &one, 1, &size);
+  ASSERT_EQ(size, 1u);
+  free(found);
+
+  found = jsonArrayKeyFilter(records, "meta", &size);
+  EXPECT_EQ(size, 50000u);
+  free(found);
+
+  one = jsonWhereEqualsInt("missing", 1);
+  EXPECT_TRUE(jsonArrayWhere(records, &one, 1, &size) == NULL);
+  EXPECT_EQ(size, 0u);
+  one = jsonWhereExists("meta..score");
+  EXPECT_TRUE(jsonArrayWhere(records, &one, 1, &size) == NULL);
+  jsonFree((JItemValue) { records }, VAL_OBJ_ARRAY);
+}
+
+TEST(JsonArrayWhere, shouldSkipNonObjectsInMixedArrays) {
+  char *deleteMe = NULL;
+  short type = 0;
+  JItemValue val = jsonParseF(inlineJson("{\"list\": [{\"a\": true}, 1, {\"b\": 2}, \"a\", {\"a\": false}]}", &deleteMe), &type);
+  ASSERT_TRUE(val.object_val != NULL);
+  unsigned size = 0;
+  JObject **found = jsonArrayKeyFilter(jsonArray(val.object_val, "list"), "a", &size);
+  ASSERT_EQ(size, 2u);
+  EXPECT_EQ(jsonBool(found[0], "a"), 1);
+  EXPECT_EQ(jsonBool(found[1], "a"), 0);
+  free(found);
+  jsonFree(val, type);
+  free(deleteMe);
+}
+
+static void countTask(void *arg, unsigned int task) {
+  std::atomic<int> *counts = (std::atomic<int>*) arg;
+  counts[task]++;
+  // a job posted from inside a task of another pool finishes before the task
+  jsonPoolRun(jsonDefaultPool(), [](void *arg, unsigned int task) {
+    ((std::atomic<int>*) arg)[1000 + task]++;
+  }, arg, 2);
+}
+
+TEST(JsonPool, shouldRunEveryTaskOnce) {
+  JPool *pool = jsonPoolNew(4);
+  EXPECT_EQ(jsonPoolThreads(pool), 4u);
+  static std::atomic<int> counts[1002];
+  for(int round = 0; round < 20; ++round) {
+    jsonPoolRun(pool, countTask, counts, 1000);
+  }
+  for(int i = 0; i < 1000; ++i) {
+    ASSERT_EQ(counts[i].load(), 20);
+  }
+  EXPECT_EQ(counts[1000].load(), 20000);
+  jsonPoolFree(pool);
+}
+
+static JPool *nestedPool = NULL;
+
+static void nestedTask(void *arg, unsigned int task) {
+  std::atomic<int> *counts = (std::atomic<int>*) arg;
+  counts[task]++;
+  // nested jobs on the same pool are spread over its threads
+  jsonPoolRun(nestedPool, [](void *arg, unsigned int task) {
+    ((std::atomic<int>*) arg)[100 + task]++;
+  }, arg, 50);
+}
+
+TEST(JsonPool, shouldRunNestedJobsOfTheSamePool) {
+  static std::atomic<int> counts[150];
+  nestedPool = jsonPoolNew(4);
+  for(int round = 0; round < 20; ++round) {
+    jsonPoolRun(nestedPool, nestedTask, counts, 100);
+  }
+  jsonPoolFree(nestedPool);
+  for(int i = 0; i < 100; ++i) {
+    ASSERT_EQ(counts[i].load(), 20);
+  }
+  for(int i = 100; i < 150; ++i) {
+    ASSERT_EQ(counts[i].load(), 2000);
+  }
+}
+
+TEST(JsonArrayColumns, shouldSplitRecordsIntoTypedColumns) {
+  char *deleteMe = NULL;
+  short type = 0;
+  JItemValue val = jsonParseF(inlineJson("{\"records\": ["
+      "{\"name\": \"a\", \"size\": 10, \"ok\": true, \"weight\": 1, \"score\": 1.5},"
+      "{\"name\": \"b\", \"size\": 20, \"ok\": false, \"weight\": 2.5, \"score\": 2},"
+      "{\"name\": \"a\", \"size\": 30, \"meta\": {\"x\": 7}, \"score\": null},"
+      "{\"name\": \"c\", \"ok\": true, \"score\": \"high\"},"
+      "5]}", &deleteMe), &type);
+  ASSERT_TRUE(val.object_val != NULL);
+  const char *keys[] = { "name", "size", "ok", "weight", "score", "meta.x", "missing" };
+  JColumns *cols = jsonArrayToColumns(jsonArray(val.object_val, "records"), keys, 7);
+  ASSERT_TRUE(cols != NULL);
+  EXPECT_EQ(cols->rows, 5u);
+
+  JColumn *name = jsonColumn(cols, "name");
+  EXPECT_EQ(name->type, VAL_STRING_ARRAY);
+  EXPECT_EQ(name->dictionary->count, 3u);
+  EXPECT_EQ(name->nulls, 1u);
+  EXPECT_EQ(name->values->_internal.ints[2], 0);
+  EXPECT_EQ(name->values->_internal.ints[3], 2);
+  EXPECT_STREQ(jsonColumnString(name, 1), "b");
+  EXPECT_TRUE(jsonColumnString(name, 4) == NULL);
+
+  JColumn *size = jsonColumn(cols, "size");
+  EXPECT_EQ(size->type, VAL_INT_ARRAY);
+  EXPECT_EQ(size->values->type, VAL_INT_ARRAY);
+  EXPECT_EQ(jsonArraySum(size->values), 60);
+  EXPECT_TRUE(jsonColumnValid(size, 2));
+  EXPECT_FALSE(jsonColumnValid(size, 3));
+  EXPECT_EQ(size->nulls, 2u);
+
+  EXPECT_EQ(jsonColumn(cols, "ok")->type, VAL_BOOL_ARRAY);
+  EXPECT_EQ(jsonColumn(cols, "weight")->type, VAL_DOUBLE_ARRAY);
+  EXPECT_EQ(jsonColumn(cols, "weight")->values->_internal.doubles[1], 2.5);
+
+  JColumn *score = jsonColumn(cols, "score");
+  EXPECT_EQ(score->type, VAL_MIXED_ARRAY);
+  EXPECT_EQ(score->values->count, 5u);
+  EXPECT_EQ(score->nulls, 2u);
+  // every cell keeps its own type, 2 stays an int next to the float before it
+  EXPECT_EQ(score->values->_internal.mItems[0].type, VAL_FLOAT);
+  EXPECT_EQ(score->values->_internal.mItems[1].type, VAL_INT);
+  EXPECT_EQ(score->values->_internal.mItems[1].value.int_val, 2);
+  size_t length = 0;
+  char *text = jsonSerializeCompact((JItemValue) { .array_val = score->values }, score->values->type, &length);
+  EXPECT_STREQ(text, "[1.5,2,null,\"high\",null]");
+  free(text);
+
+  JColumn *x = jsonColumn(cols, "meta.x");
+  EXPECT_EQ(x->values->_internal.ints[2], 7);
+  EXPECT_EQ(x->nulls, 4u);
+  EXPECT_EQ(jsonColumn(cols, "missing")->type, VAL_NULL);
+  EXPECT_EQ(jsonColumn(cols, "missing")->nulls, 5u);
+  EXPECT_TRUE(jsonColumn(cols, "other") == NULL);
+
+  jsonColumnsFree(cols);
+  jsonFree(val, type);
+  free(deleteMe);
+
+  // object only columns keep the object layout, an int among them stays an int
+  const char *objects[] = { "o" };
+  const char *docs[] = { "[{\"o\": {\"x\": 1}}, {\"o\": {}}]", "[{\"o\": {}}, {\"o\": 2}]" };
+  for(int d = 0; d < 2; ++d) {
+    val = jsonParseF(inlineJson(docs[d], &deleteMe), &type);
+    ASSERT_TRUE(val.array_val != NULL);
+    cols = jsonArrayToColumns(val.array_val, objects, 1);
+    ASSERT_TRUE(cols != NULL);
+    EXPECT_EQ(cols->columns[0].type, d ? VAL_MIXED_ARRAY : VAL_OBJ_ARRAY);
+    EXPECT_EQ(cols->columns[0].values->_internal.mItems[1].type, d ? VAL_INT : VAL_OBJ);
+    jsonColumnsFree(cols);
+    jsonFree(val, type);
+    free(deleteMe);
+  }
+}
+
+static std::string formatDouble(double value) {
+  char text[JSON_NUMBER_CHARS];
+  return std::string(text, jsonFormatDouble(value, text));
+}
+
+static std::string formatFloat(float value) {
+  char text[JSON_NUMBER_CHARS];
+  return std::string(text, jsonFormatFloat(value, text));
+}
+
+TEST(JsonSerialize, shouldWriteTheShortestNumbersThatReadBack) {
+  EXPECT_EQ(formatFloat(0.1f), "0.1");
+  EXPECT_EQ(formatFloat(1.0f / 3), "0.33333334");
+  EXPECT_EQ(formatFloat(1e10f), "10000000000");
+  EXPECT_EQ(formatFloat(3.4028235e38f), "3.4028235e+38");
+  EXPECT_EQ(formatFloat(1e-45f), "1e-45");
+  EXPECT_EQ(formatDouble(0.1), "0.1");
+  EXPECT_EQ(formatDouble(-0.0), "-0");
+  EXPECT_EQ(formatDouble(2.5e-5), "0.000025");
+  EXPECT_EQ(formatDouble(1e-7), "1e-7");
+  EXPECT_EQ(formatDouble(1e21), "1e+21");
+  EXPECT_EQ(formatDouble(5e-324), "5e-324");
+  EXPECT_EQ(formatDouble(1.7976931348623157e308), "1.7976931348623157e+308");
+  EXPECT_EQ(formatDouble(1.0 / 0.0), "null");
+
+  std::mt19937_64 random(48);
+  for(int i = 0; i < 100000; ++i) {
+    uint64_t bits = random();
+    double d;
+    float f;
+    memcpy(&d, &bits, sizeof(d));
+    memcpy(&f, &bits, sizeof(f));
+    if(d == d && d - d == 0) {
+      double back = strtod(formatDouble(d).c_str(), NULL);
+      ASSERT_EQ(memcmp(&back, &d, sizeof(d)), 0) << formatDouble(d);
+    }
+    if(f == f && f - f == 0) {
+      float back = strtof(formatFloat(f).c_str(), NULL);
+      ASSERT_EQ(memcmp(&back, &f, sizeof(f)), 0) << formatFloat(f);
+    }
+  }
+
+  char *deleteMe = NULL;
+  short type = 0;
+  JItemValue val = jsonParseF(inlineJson("{\"f\": [0.1, -1.5e-5, 1E+3, 3.4e38, 2.5, 1e10], \"d\": 1.5e300, \"i\": -2147483648}", &deleteMe), &type);
+  ASSERT_TRUE(val.object_val != NULL);
+  size_t length = 0;
+  char *text = jsonSerialize(val, type, &length);
+  EXPECT_STREQ(text, "{\n  \"f\": [0.1,-0.000015,1000,3.4e+38,2.5,10000000000],\n  \"d\": 1.5e+300,\n  \"i\": -2147483648\n}");
+  free(text);
+  jsonFree(val, type);
+  free(deleteMe);
+}
+
+TEST(JsonSerialize, shouldKeepTheDigitsOfFloatsWidenedToDoubles) {
+  // 0.123E+10 is an int beyond what floats hold exactly, the array widens to doubles
+  char *deleteMe = NULL;
+  short type = 0;
+  JItemValue val = jsonParseF(inlineJson("{\"f\": [1.023, 2.34  ,  3.012,\t405.123, 0.123E+10], \"s\": 1.023}", &deleteMe), &type);
+  ASSERT_TRUE(val.object_val != NULL);
+  JArray *f = jsonArray(val.object_val, "f");
+  ASSERT_TRUE(f != NULL);
+  EXPECT_EQ(f->type, VAL_DOUBLE_ARRAY);
+  jsonArrayPushFloat(f, 0.1f);
+  size_t length = 0;
+  char *text = jsonSerializeCompact(val, type, &length);
+  EXPECT_STREQ(text, "{\"f\":[1.023,2.34,3.012,405.123,1230000000,0.1],\"s\":1.023}");
+  free(text);
+  jsonFree(val, type);
+  free(deleteMe);
+}
+
+static void writeRecord(JWriter *w, JItemValue tags, short tagsType) {
+  jsonWriterBeginObject(w);
+  jsonWriterKey(w, "id");
+  jsonWriterInt(w, -7);
+  jsonWriterKey(w, "name");
+  jsonWriterString(w, "x\"y");
+  jsonWriterKey(w, "scores");
+  jsonWriterBeginArray(w);
+  jsonWriterUInt(w, 4000000000u);
+  jsonWriterFloat(w, 0.5f);
+  jsonWriterBool(w, 1);
+  jsonWriterNull(w);
+  jsonWriterBeginObject(w);
+  jsonWriterKey(w, "empty");
+  jsonWriterBeginObject(w);
+  jsonWriterEndObject(w);
+  jsonWriterEndObject(w);
+  jsonWriterEndArray(w);
+  jsonWriterKey(w, "tags");
+  jsonWriterValue(w, tagsType, tags);
+  jsonWriterEndObject(w);
+}
+
+TEST(JsonWriter, shouldWriteWhatTheSerializerWrites) {
+  const char *json = "{\"id\": -7, \"name\": \"x\\\"y\", \"scores\": [4000000000, 0.5, true, null, {\"empty\": {}}],"
+      " \"tags\": {\"a\": [\"b\"], \"c\": {}}}";
+  char *deleteMe = NULL;
+  short type = 0;
+  JItemValue val = jsonParseF(inlineJson(json, &deleteMe), &type);
+  ASSERT_TRUE(val.object_val != NULL);
+  short tagsType = 0;
+  JItemValue tags = jsonGet(val.object_val, "tags", &tagsType);
+
+  for(char compact = 0; compact < 2; ++compact) {
+    JWriter w;
+    jsonWriterInit(&w, compact);
+    writeRecord(&w, tags, tagsType);
+    size_t length = 0;
+    char *written = jsonWriterText(&w, &length);
+    ASSERT_TRUE(written != NULL);
+    EXPECT_EQ(length, strlen(written));
+
+    char *deleteBack = NULL;
+    JItemValue back = jsonParseF(inlineJson(written, &deleteBack), &type);
+    ASSERT_TRUE(back.object_val != NULL);
+    size_t expectedLength = 0;
+    char *expected = compact ? jsonSerializeCompact(back, type, &expectedLength) : jsonSerialize(back, type, &expectedLength);
+    EXPECT_STREQ(written, expected);
+    free(expected);
+    jsonFree(back, type);
+    free(deleteBack);
+    free(written);
+  }
+
+  JWriter w;
+  jsonWriterInit(&w, 1);
+  writeRecord(&w, tags, tagsType);
+  size_t length = 0;
+  char *written = jsonWriterText(&w, &length);
+  EXPECT_STREQ(written, "{\"id\":-7,\"name\":\"x\\\"y\",\"scores\":[4000000000,0.5,true,null,{\"empty\":{}}],"
+      "\"tags\":{\"a\":[\"b\"],\"c\":{}}}");
+  free(written);
+  char *compact = jsonSerializeCompact(val, VAL_OBJ, &length);
+  EXPECT_STREQ(compact, "{\"id\":-7,\"name\":\"x\\\"y\",\"scores\":[4000000000,0.5,true,null,{\"empty\":{}}],"
+      "\"tags\":{\"a\":[\"b\"],\"c\":{}}}");
+  free(compact);
+  jsonFree(val, type);
+  free(deleteMe);
+}
+
+TEST(JsonWriter, shouldEscapeStreamRecordsAndRejectMisuse) {
+  JWriter w;
+  jsonWriterInit(&w, 1);
+  jsonWriterString(&w, "tab\there \"quoted\" back\\slash\x01 \xc3\xa9");
+  jsonWriterBeginArray(&w);
+  jsonWriterStringLength(&w, "new\nline", 8);
+  jsonWriterDouble(&w, 1.0 / 0.0);
+  jsonWriterEndArray(&w);
+  size_t length = 0;
+  char *written = jsonWriterText(&w, &length);
+  EXPECT_STREQ(written, "\"tab\\there \\\"quoted\\\" back\\\\slash\\u0001 \xc3\xa9\"\n[\"new\\nline\",null]");
+  free(written);
+
+  FILE *out = tmpfile();
+  jsonWriterInitFd(&w, fileno(out), 1);
+  for(int i = 0; i < 100000; ++i) {
+    jsonWriterBeginObject(&w);
+    jsonWriterKey(&w, "i");
+    jsonWriterInt(&w, i);
+    jsonWriterEndObject(&w);
+  }
+  EXPECT_TRUE(jsonWriterFree(&w));
+  rewind(out);
+  char line[32];
+  int records = 0;
+  while(fgets(line, sizeof(line), out)) {
+    char expected[32];
+    snprintf(expected, sizeof(expected), records < 99999 ? "{\"i\":%d}\n" : "{\"i\":%d}", records);
+    ASSERT_STREQ(line, expected);
+    ++records;
+  }
+  EXPECT_EQ(records, 100000);
+  fclose(out);
+
+  jsonWriterInit(&w, 0);
+  jsonWriterBeginObject(&w);
+  jsonWriterInt(&w, 1);
+  jsonWriterEndObject(&w);
+  EXPECT_TRUE(jsonWriterText(&w, &length) == NULL);
+
+  jsonWriterInit(&w, 0);
+  jsonWriterKey(&w, "outside");
+  EXPECT_FALSE(jsonWriterFree(&w));
+
+  jsonWriterInit(&w, 0);
+  jsonWriterBeginArray(&w);
+  EXPECT_FALSE(jsonWriterFree(&w));
+
+  jsonWriterInit(&w, 0);
+  jsonWriterBeginArray(&w);
+  jsonWriterEndObject(&w);
+  jsonWriterEndArray(&w);
+  EXPECT_FALSE(jsonWriterFree(&w));
+}
+
+static std::string serializedTo(FILE *out) {
+  std::string written(ftell(out), '\0');
+  rewind(out);
+  EXPECT_EQ(fread(&written[0], 1, written.size(), out), written.size());
+  return written;
+}
+
+TEST(JsonSerialize, shouldWriteTheSameBytesInParallel) {
+  // split children first and last, chunk edges, deleted entries and nesting both ways
+  JObject *root = jsonNewObject();
+  JArray *first = jsonNewArray();
+  for(int i = 0; i < 7000; ++i) {
+    JObject *item = jsonNewObject();
+    jsonAddInt(item, "i", i);
+    if(i % 1000 == 0) {
+      JArray *inner = jsonNewArray();
+      for(int k = 0; k < 1500; ++k) {
+        jsonArrayPushFloat(inner, k / 4.0f);
+      }
+      jsonAddVal(item, "inner", (JItemValue){ .array_val = inner }, VAL_OBJ_ARRAY);
+    }
+    if(i == 1500) {
+      for(int k = 0; k < 1100; ++k) {
+        char wide[16];
+        snprintf(wide, sizeof(wide), "w%d", k);
+        jsonAddInt(item, wide, k);
+      }
+    }
+    jsonAddArrayItemObject(first, item);
+  }
+  JArray *nested = jsonNewArray();
+  for(int k = 0; k < 1200; ++k) {
+    jsonArrayPushInt(nested, k);
+  }
+  JArrayItem nestedItem;
+  nestedItem.type = VAL_INT_ARRAY;
+  nestedItem.value.array_val = nested;
+  jsonAddArrayItem(first, &nestedItem);
+  jsonAddVal(root, "first", (JItemValue){ .array_val = first }, VAL_OBJ_ARRAY);
+  char key[32];
+  for(int i = 0; i < 9000; ++i) {
+    snprintf(key, sizeof(key), "k%d", i);
+    jsonAddString(root, key, "v");
+  }
+  for(int i = 0; i < 9000; i += 7) {
+    snprintf(key, sizeof(key), "k%d", i);
+    jsonDeleteKey(root, key);
+  }
+  JObject *last = jsonNewObject();
+  for(int i = 0; i < 2000; ++i) {
+    snprintf(key, sizeof(key), "n%d", i);
+    jsonAddObj(last, key, jsonNewObject());
+  }
+  jsonAddObj(root, "last", last);
+  JItemValue val = { .object_val = root };
+
+  JPool *pool = jsonPoolNew(4);
+  for(char compact = 0; compact < 2; ++compact) {
+    FILE *serial = tmpfile();
+    FILE *parallel = tmpfile();
+    ASSERT_TRUE(compact ? jsonSerializeCompactFd(fileno(serial), val, VAL_OBJ) : jsonSerializeFd(fileno(serial), val, VAL_OBJ));
+    ASSERT_TRUE(jsonSerializeParallelFd(fileno(parallel), val, VAL_OBJ, compact, pool));
+    std::string expected = serializedTo(serial);
+    EXPECT_GT(expected.size(), 100000u);
+    EXPECT_TRUE(serializedTo(parallel) == expected);
+    fclose(serial);
+    fclose(parallel);
+  }
+  jsonPoolFree(pool);
+  jsonFree(val, VAL_OBJ);
+}
@@ -1,5 +1,9 @@
 #include "gtest/gtest.h"
 
+#include <string>
+#include <thread>
+#include <vector>
+
 extern "C" {
   #include "../src/json.h"
   #include "../src/parse.h"
@@ -302,6 +306,40 @@ TEST (JsonParserWorks, shouldParseArrayOfIntegers) {
   free(deleteMe);
 }
 
+TEST (JsonParserWorks, shouldPackHomogeneousArrays) {
+  char *deleteMe = NULL;
+  FILE* file = inlineJson("{\"ints\": [1,-2,3], \"floats\": [1, 2.5], \"wide\": [16777217, 0.5], \"names\": [\"a\", \"b\"]}", &deleteMe);
+  short type = 0;
+  JItemValue val = jsonParseF(file, &type);
+  ASSERT_TRUE(val.object_val != NULL);
+
+  unsigned count = 0;
+  const int *ints = jsonIntArray(val.object_val, "ints", &count);
+  ASSERT_TRUE(ints != NULL);
+  EXPECT_EQ(count, 3u);
+  EXPECT_EQ(ints[1], -2);
+  EXPECT_EQ(ints, jsonArray(val.object_val, "ints")->_internal.ints);
+
+  const float *floats = jsonFoatArray(val.object_val, "floats", &count);
+  ASSERT_TRUE(floats != NULL);
+  EXPECT_EQ(count, 2u);
+  EXPECT_FLOAT_EQ(floats[0], 1.0f);
+  EXPECT_FLOAT_EQ(floats[1], 2.5f);
+
+  const double *doubles = jsonDoubleArray(val.object_val, "wide", &count);
+  ASSERT_TRUE(doubles != NULL);
+  EXPECT_DOUBLE_EQ(doubles[0], 16777217.0);
+
+  char* const* names = jsonStringArray(val.object_val, "names", &count);
+  ASSERT_TRUE(names != NULL);
+  EXPECT_STREQ(names[1], "b");
+
+  EXPECT_TRUE(jsonIntArray(val.object_val, "floats", &count) == NULL);
+  EXPECT_EQ(count, 0u);
+  jsonFree(val, type);
+  free(deleteMe);
+}
+
 TEST (JsonParserWorks, shouldParseArrayOfFloats) {
   char *deleteMe = NULL;
   FILE *file = inlineJson("[-4.54E37, 1.1, 0.123E7, 3.345, 5.43, +8.9, -0.0004, +0.03]", &deleteMe);
@@ -371,3 +409,264 @@ TEST(JsonParserWorks, shouldFreeMixedArraysInsideNestedObjects) {
   free(deleteMe);
 }
 
+
+TEST(JsonParserWorks, shouldStoreMixedArrayItemsContiguouslyInOrder) {
+  char *deleteMe = NULL;
+  FILE *file = inlineJson("{\"objs\":[{\"a\":1},{\"a\":2}], \"mixed\":[{\"a\":1},\"two\",3,null,[4]]}", &deleteMe);
+  short type = 0;
+  JItemValue val = jsonParseF(file, &type);
+  ASSERT_TRUE(val.object_val != NULL);
+
+  JArray *objs = jsonArray(val.object_val, "objs");
+  ASSERT_EQ(objs->type, VAL_OBJ_ARRAY);
+  JArrayItem *items = jsonArrayItemList(objs);
+  EXPECT_EQ(jsonInt(items[1].value.object_val, "a"), 2);
+
+  JArray *mixed = jsonArray(val.object_val, "mixed");
+  ASSERT_EQ(mixed->type, VAL_MIXED_ARRAY);
+  items = jsonArrayItemList(mixed);
+  EXPECT_EQ(items[0].type, VAL_OBJ);
+  EXPECT_EQ(items[1].type, VAL_STRING);
+  EXPECT_STREQ(items[1].value.string_val, "two");
+  EXPECT_EQ(items[2].value.int_val, 3);
+  EXPECT_EQ(items[3].type, VAL_NULL);
+  EXPECT_EQ(items[4].type, VAL_INT_ARRAY);
+
+  short itemType = 0;
+  JItemValue nested = jsonArrayGet(items[4].value.array_val, 0, &itemType);
+  EXPECT_EQ(itemType, VAL_INT);
+  EXPECT_EQ(nested.int_val, 4);
+  EXPECT_TRUE(jsonArrayItemList(items[4].value.array_val) == NULL);
+  jsonFree(val, type);
+  free(deleteMe);
+}
+
+TEST(JsonParserWorks, shouldKeepUninternedValuesWithTheDocument) {
+  JsonInternPolicy saved;
+  jsonGetInternPolicy(&saved);
+  JsonInternPolicy keysOnly = { JSON_INTERN_KEYS, 0, 0, 0 };
+  jsonSetInternPolicy(&keysOnly);
+
+  char *deleteMe = NULL;
+  FILE *file = inlineJson("{\"a\":\"sha512-document-only\", \"b\":\"sha512-document-only\"}", &deleteMe);
+  short type = 0;
+  JItemValue val = jsonParseF(file, &type);
+  ASSERT_TRUE(val.object_val != NULL);
+  const char *a = jsonString(val.object_val, "a");
+  EXPECT_STREQ(a, "sha512-document-only");
+  EXPECT_EQ(a, jsonString(val.object_val, "b"));
+  EXPECT_TRUE(val.object_val->_strings != NULL);
+  EXPECT_EQ(jsonInternFind(jsonDefaultContext()->strings, a, strlen(a), fnvstr(a)).str, (const char*)NULL);
+  jsonFree(val, type);
+  free(deleteMe);
+
+  jsonSetInternPolicy(&saved);
+}
+
+TEST(JsonParserWorks, shouldInternOnlyShortValues) {
+  JsonInternPolicy saved;
+  jsonGetInternPolicy(&saved);
+  JsonInternPolicy shortOnly = { JSON_INTERN_SHORT, 4, 0, 0 };
+  jsonSetInternPolicy(&shortOnly);
+
+  char *deleteMe = NULL;
+  FILE *file = inlineJson("{\"dev\":\"yes\", \"resolved\":\"https://registry.example/unique.tgz\"}", &deleteMe);
+  short type = 0;
+  JItemValue val = jsonParseF(file, &type);
+  ASSERT_TRUE(val.object_val != NULL);
+  const char *dev = jsonString(val.object_val, "dev");
+  const char *resolved = jsonString(val.object_val, "resolved");
+  EXPECT_EQ(jsonInternFind(jsonDefaultContext()->strings, dev, strlen(dev), fnvstr(dev)).str, dev);
+  EXPECT_EQ(jsonInternFind(jsonDefaultContext()->strings, resolved, strlen(resolved), fnvstr(resolved)).str, (const char*)NULL);
+  jsonFree(val, type);
+  free(deleteMe);
+
+  jsonSetInternPolicy(&saved);
+}
+
+TEST(JsonParserWorks, shouldParseIndependentlyWithSeparateContexts) {
+  const char *json = "{\"name\":\"worker\", \"dependencies\": {\"a\": {\"version\": \"1.0.0\", \"dev\": true}}}";
+  std::vector<std::thread> workers;
+  int ok[8] = { 0 };
+  for(int t = 0; t < 8; ++t) {
+    workers.push_back(std::thread([t, json, &ok]() {
+      JsonContext *ctx = jsonContextNew(NULL);
+      for(int i = 0; i < 200; ++i) {
+        char *deleteMe = NULL;
+        short type = 0;
+        JItemValue val = jsonContextParseF(ctx, inlineJson(json, &deleteMe), &type);
+        if(val.object_val && val.object_val->_ctx == ctx
+            && strcmp(jsonString(val.object_val, "dependencies.a.version"), "1.0.0") == 0) {
+          ++ok[t];
+        }
+        jsonFree(val, type);
+        free(deleteMe);
+      }
+      jsonContextFree(ctx);
+    }));
+  }
+  for(auto &worker : workers) {
+    worker.join();
+  }
+  for(int t = 0; t < 8; ++t) {
+    EXPECT_EQ(ok[t], 200);
+  }
+}
+
+TEST(JsonParserWorks, shouldShareShapesBetweenParsedRecords) {
+  char *deleteMe = NULL;
+  short type = 0;
+  JsonContext *ctx = jsonContextNew(NULL);
+  JItemValue val = jsonContextParseF(ctx, inlineJson("{\"dependencies\": {"
+      "\"a\": {\"version\": \"1.0.0\", \"resolved\": \"r1\", \"dev\": true},"
+      "\"b\": {\"version\": \"2.0.0\", \"resolved\": \"r2\", \"dev\": false},"
+      "\"c\": {\"version\": \"3.0.0\", \"resolved\": \"r3\"}}}", &deleteMe), &type);
+  ASSERT_TRUE(val.object_val != NULL);
+  JObject *a = jsonObject(val.object_val, "dependencies.a");
+  JObject *b = jsonObject(val.object_val, "dependencies.b");
+  JObject *c = jsonObject(val.object_val, "dependencies.c");
+  ASSERT_TRUE(a && b && c);
+  // the first record is a dictionary, the ones after it share its key sequence
+  EXPECT_EQ(a->shape, (JShape*)NULL);
+  EXPECT_EQ(b->shape->count, 3u);
+  EXPECT_EQ(c->shape, b->shape->parent);
+  EXPECT_STREQ(jsonString(a, "resolved"), "r1");
+  EXPECT_STREQ(jsonString(b, "resolved"), "r2");
+  EXPECT_EQ(jsonBool(b, "dev"), 0);
+  jsonFree(val, type);
+  jsonContextFree(ctx);
+  free(deleteMe);
+}
+
+TEST(JsonParserWorks, shouldKeepOnlyProjectedPathsAndStopReading) {
+  char *deleteMe = NULL;
+  short type = 0;
+  JKeyPath paths[3];
+  ASSERT_TRUE(jsonKeyPathInit(&paths[0], "a.b"));
+  ASSERT_TRUE(jsonKeyPathInit(&paths[1], "c"));
+  ASSERT_TRUE(jsonKeyPathInit(&paths[2], "a.missing"));
+  // the garbage after c would fail a full parse, it is never read
+  JItemValue val = jsonContextParseKeyPathsF(jsonDefaultContext(), inlineJson("{"
+      "\"skip\": {\"x\": [1, \"}]\\\"\", {\"y\": null}], \"z\": 'q'},"
+      "\"a\": {\"n\": 1.5, \"b\": {\"deep\": [true, false]}, \"s\": \"str\"},"
+      "\"after\": -12e3,"
+      "\"c\": \"kept\", \"later\": {{{ not json", &deleteMe), paths, 3, &type);
+  ASSERT_TRUE(val.object_val != NULL);
+  ASSERT_EQ(type, VAL_OBJ);
+  EXPECT_EQ(val.object_val->size, 2);
+  EXPECT_EQ(jsonObject(val.object_val, "a")->size, 1);
+  EXPECT_STREQ(jsonString(val.object_val, "c"), "kept");
+  JArray *deep = jsonArray(val.object_val, "a.b.deep");
+  ASSERT_TRUE(deep != NULL);
+  EXPECT_EQ(deep->count, 2u);
+  short missing = 0;
+  jsonGet(val.object_val, "skip", &missing);
+  EXPECT_EQ(missing, 0);
+  jsonGet(val.object_val, "after", &missing);
+  EXPECT_EQ(missing, 0);
+  jsonFree(val, type);
+  free(deleteMe);
+  for(int i = 0; i < 3; ++i) {
+    jsonKeyPathFree(&paths[i]);
+  }
+}
+
+TEST(JsonParserWorks, shouldProjectWildcardsThroughObjectsAndArrays) {
+  char *deleteMe = NULL;
+  short type = 0;
+  const char *keep[] = { "users.*.name", "meta.*", "users.*.tags.*" };
+  JItemValue val = jsonParseProjectedF(inlineJson("{"
+      "\"users\": [{\"name\": \"ann\", \"age\": 30, \"tags\": [\"a\", \"b\"]},"
+      "  7, {\"age\": 40}, {\"name\": \"bob\", \"tags\": \"none\"}],"
+      "\"other\": [1, 2, 3],"
+      "\"meta\": {\"x\": 1, \"y\": {\"z\": [2]}}}", &deleteMe), keep, 3, &type);
+  ASSERT_TRUE(val.object_val != NULL);
+  EXPECT_EQ(val.object_val->size, 2);
+  JArray *users = jsonArray(val.object_val, "users");
+  ASSERT_TRUE(users != NULL);
+  // the scalar item is held by a null, the object without the keys stays empty
+  ASSERT_EQ(users->count, 4u);
+  short itemType = 0;
+  JObject *ann = jsonArrayGet(users, 0, &itemType).object_val;
+  ASSERT_EQ(itemType, VAL_OBJ);
+  EXPECT_EQ(ann->size, 2);
+  EXPECT_STREQ(jsonString(ann, "name"), "ann");
+  EXPECT_EQ(jsonArray(ann, "tags")->count, 2u);
+  jsonArrayGet(users, 1, &itemType);
+  EXPECT_EQ(itemType, VAL_NULL);
+  EXPECT_EQ(jsonArrayGet(users, 2, &itemType).object_val->size, 0);
+  JObject *bob = jsonArrayGet(users, 3, &itemType).object_val;
+  EXPECT_EQ(bob->size, 1);
+  EXPECT_STREQ(jsonString(bob, "name"), "bob");
+  EXPECT_EQ(jsonInt(val.object_val, "meta.x"), 1);
+  EXPECT_EQ(jsonArray(val.object_val, "meta.y.z")->count, 1u);
+  jsonFree(val, type);
+  free(deleteMe);
+
+  const char *names[] = { "*.id" };
+  val = jsonParseProjectedF(inlineJson("[{\"id\": 1, \"x\": 2}, {\"id\": 2}]", &deleteMe), names, 1, &type);
+  ASSERT_TRUE(val.array_val != NULL);
+  ASSERT_EQ(val.array_val->count, 2u);
+  EXPECT_EQ(jsonInt(jsonArrayGet(val.array_val, 1, &itemType).object_val, "id"), 2);
+  EXPECT_EQ(jsonArrayGet(val.array_val, 0, &itemType).object_val->size, 1);
+  jsonFree(val, type);
+  free(deleteMe);
+}
+
+TEST(JsonParserWorks, shouldReadKeysAndStringsLongerThanTheReadWindow) {
+  // both are past the stack scratch and the file window, and read from the heap
+  std::string key, text;
+  while(key.size() < 3 * TOK_BUF_SIZE) {
+    key += "key-";
+  }
+  while(text.size() < 2 * TOK_BUF_SIZE + 7) {
+    text += "text ";
+  }
+  std::string json = "{\"" + key + "\": \"" + text + "\", \"n\": 1}";
+  char *deleteMe = NULL;
+  short type = 0;
+  JItemValue val = jsonParseF(inlineJson(json.c_str(), &deleteMe), &type);
+  ASSERT_TRUE(val.object_val != NULL);
+  EXPECT_EQ(jsonString(val.object_val, key.c_str()), text);
+  EXPECT_EQ(jsonInt(val.object_val, "n"), 1);
+  jsonFree(val, type);
+  free(deleteMe);
+
+  const char *keep[] = { key.c_str() };
+  val = jsonParseProjectedF(inlineJson(json.c_str(), &deleteMe), keep, 1, &type);
+  ASSERT_TRUE(val.object_val != NULL);
+  EXPECT_EQ(val.object_val->size, 1);
+  EXPECT_EQ(jsonString(val.object_val, key.c_str()), text);
+  jsonFree(val, type);
+  free(deleteMe);
+}
+
+TEST(JsonParserWorks, shouldKeepArrayIndicesOfProjectedItems) {
+  char *deleteMe = NULL;
+  short type = 0;
+  const char *keep[] = { "a.2.x", "/b/1" };
+  // reading stops after b[1], the garbage behind it is never read
+  JItemValue val = jsonParseProjectedF(inlineJson("{"
+      "\"a\": [{\"x\": 0}, [1, 2], {\"x\": 3, \"y\": 4}, {\"x\": 5}],"
+      "\"b\": [\"zero\", \"one\", {{{ not json", &deleteMe), keep, 2, &type);
+  ASSERT_TRUE(val.object_val != NULL);
+  JArray *a = jsonArray(val.object_val, "a");
+  ASSERT_TRUE(a != NULL);
+  // a[0] and a[1] are skipped but hold their places, a[3] is left off the end
+  ASSERT_EQ(a->count, 3u);
+  short itemType = 0;
+  jsonArrayGet(a, 0, &itemType);
+  EXPECT_EQ(itemType, VAL_NULL);
+  jsonArrayGet(a, 1, &itemType);
+  EXPECT_EQ(itemType, VAL_NULL);
+  JObject *item = jsonArrayGet(a, 2, &itemType).object_val;
+  ASSERT_EQ(itemType, VAL_OBJ);
+  EXPECT_EQ(item->size, 1);
+  EXPECT_EQ(jsonInt(item, "x"), 3);
+  JArray *b = jsonArray(val.object_val, "b");
+  ASSERT_TRUE(b != NULL);
+  ASSERT_EQ(b->count, 2u);
+  EXPECT_STREQ(jsonArrayGet(b, 1, &itemType).string_val, "one");
+  jsonFree(val, type);
+  free(deleteMe);
+}
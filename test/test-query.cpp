@@ -0,0 +1,386 @@
+#include "gtest/gtest.h"
+#include <string>
+#include <vector>
+
+extern "C" {
+  #include "../src/json.h"
+  #include "../src/query.h"
+};
+
+FILE *inlineJson(const char *jstr, char **deleteThis);
+
+static const char *QUERY_DOC =
+    "{\"users\": ["
+    "  {\"name\": \"ann\", \"role\": \"admin\", \"tags\": [\"a\", \"b\"]},"
+    "  {\"name\": \"bob\", \"role\": \"user\", \"tags\": [\"c\"]},"
+    "  {\"name\": \"cat\", \"role\": \"user\"},"
+    "  {\"name\": \"dan\", \"role\": \"guest\", \"tags\": []}"
+    "], \"version\": \"1.2.3\", \"vendor\": \"nicson\", \"count\": 4}";
+
+/** Runs a query over the document and returns the string matches in order */
+static std::vector<std::string> strings(JItemValue root, short type, const char *expr) {
+  std::vector<std::string> out;
+  JQuery *query = jsonQueryCompile(expr);
+  EXPECT_TRUE(query != NULL) << expr;
+  unsigned count = 0;
+  JArrayItem *items = jsonQueryAll(query, root, type, &count);
+  for (unsigned i = 0; i < count; ++i) {
+    out.push_back(items[i].type == VAL_STRING ? items[i].value.string_val : "?");
+  }
+  free(items);
+  jsonQueryFree(query);
+  return out;
+}
+
+static int stopAfterTwo(void *user, JItemValue value, short type) {
+  return ++*(int*) user < 2;
+}
+
+TEST(JsonGlob, shouldMatchStarsAndSingleCharacters) {
+  EXPECT_TRUE(jsonGlobMatch("hello*world", "helloworld"));
+  EXPECT_TRUE(jsonGlobMatch("hello*world", "hello big world"));
+  EXPECT_TRUE(jsonGlobMatch("*", ""));
+  EXPECT_TRUE(jsonGlobMatch("a?c", "abc"));
+  EXPECT_TRUE(jsonGlobMatch("*a*b*", "xxaxxbxx"));
+  EXPECT_TRUE(jsonGlobMatch("1.*", "1.0.9"));
+  EXPECT_FALSE(jsonGlobMatch("a?c", "ac"));
+  EXPECT_FALSE(jsonGlobMatch("hello*world", "hello worlds"));
+  EXPECT_FALSE(jsonGlobMatch("abc", "ab"));
+  EXPECT_FALSE(jsonGlobMatch("", "a"));
+}
+
+TEST(JsonGlob, shouldMatchCompiledGlobsLikeTheBacktrackingMatcher) {
+  std::string longText = std::string(70, 'x') + "hello" + std::string(40, 'y') + "world" + std::string(33, 'z');
+  const char *patterns[] = {
+    "hello*world", "*", "", "abc", "a?c", "*a*b*", "1.*", "*.9", "*hello*", "x*hello*world*z",
+    "*yyyyhello*", "*hello?yy*worl?z*", "*xy?ello*", "*lo*wor*", "?*", "*zz", "*zzz*zzzz*", "x*q*",
+  };
+  const char *strs[] = {
+    "", "a", "abc", "ac", "helloworld", "hello big world", "hello worlds", "1.0.9", "xxaxxbxx",
+    "hhello", "world", longText.c_str(), "xhelloworldz", "zz", "zzzzzzz", "yyyyhello",
+  };
+  for (const char *pattern : patterns) {
+    JGlob glob;
+    jsonGlobCompile(&glob, pattern);
+    for (const char *str : strs) {
+      EXPECT_EQ(jsonGlobMatchCompiled(&glob, str), jsonGlobMatch(pattern, str)) << pattern << " " << str;
+    }
+  }
+
+  JGlob glob;
+  jsonGlobCompile(&glob, "ab*cdef?g*hi");
+  EXPECT_EQ(glob.prefixLength, 2u);
+  EXPECT_EQ(glob.suffixLength, 2u);
+  EXPECT_EQ(glob.minLength, 10u);
+  EXPECT_EQ(std::string(glob.literal, glob.literalLength), "cdef");
+  EXPECT_TRUE(jsonGlobMatchCompiled(&glob, (std::string("ab") + std::string(100, '-') + "cdefXg" + std::string(50, '-') + "hi").c_str()));
+  EXPECT_FALSE(jsonGlobMatchCompiled(&glob, (std::string("ab") + std::string(100, '-') + "cdeXg" + std::string(50, '-') + "hi").c_str()));
+}
+
+TEST(JsonQuery, shouldRejectInvalidExpressions) {
+  EXPECT_TRUE(jsonQueryCompile("") == NULL);
+  EXPECT_TRUE(jsonQueryCompile("a..b") == NULL);
+  EXPECT_TRUE(jsonQueryCompile("a.[]") == NULL);
+  EXPECT_TRUE(jsonQueryCompile("a.[1") == NULL);
+  EXPECT_TRUE(jsonQueryCompile("a.[x]") == NULL);
+  EXPECT_TRUE(jsonQueryCompile("a.[5-2]") == NULL);
+  EXPECT_TRUE(jsonQueryCompile("a.[1,]") == NULL);
+
+  JQuery *query = jsonQueryCompile("users.[0-5].*.na*e.[4,6,12].=1.*");
+  ASSERT_TRUE(query != NULL);
+  ASSERT_EQ(query->count, 6u);
+  EXPECT_EQ(query->steps[0].searchType, KEY);
+  EXPECT_EQ(query->steps[1].searchType, ARRAY_RANGE);
+  EXPECT_EQ(query->steps[1].meta.range.end, 5);
+  EXPECT_EQ(query->steps[2].searchType, WILDCARD);
+  EXPECT_EQ(query->steps[3].searchType, KEY_MATCH);
+  EXPECT_EQ(query->steps[4].searchType, ARRAY);
+  ASSERT_EQ(query->steps[4].meta.indices.count, 3u);
+  EXPECT_EQ(query->steps[4].meta.indices.items[2], 12);
+  EXPECT_EQ(query->steps[5].searchType, MATCH);
+  EXPECT_STREQ(query->steps[5].meta.matchStr, "1.*");
+  jsonQueryFree(query);
+}
+
+TEST(JsonQuery, shouldEvaluateEveryStepTypeInDocumentOrder) {
+  char *deleteMe = NULL;
+  short type = 0;
+  JItemValue doc = jsonParseF(inlineJson(QUERY_DOC, &deleteMe), &type);
+  ASSERT_TRUE(doc.object_val != NULL);
+
+  typedef std::vector<std::string> S;
+  EXPECT_EQ(strings(doc, type, "version"), S({ "1.2.3" }));
+  EXPECT_EQ(strings(doc, type, "users.[1].name"), S({ "bob" }));
+  EXPECT_EQ(strings(doc, type, "users.[3,0,9].name"), S({ "dan", "ann" }));
+  EXPECT_EQ(strings(doc, type, "users.[1-2].name"), S({ "bob", "cat" }));
+  EXPECT_EQ(strings(doc, type, "users.[2-100].name"), S({ "cat", "dan" }));
+  EXPECT_EQ(strings(doc, type, "users.*.tags.*"), S({ "a", "b", "c" }));
+  EXPECT_EQ(strings(doc, type, "users.[*].tags.[0]"), S({ "a", "c" }));
+  EXPECT_EQ(strings(doc, type, "v*"), S({ "1.2.3", "nicson" }));
+  EXPECT_EQ(strings(doc, type, "users.[0].?ame"), S({ "ann" }));
+  EXPECT_EQ(strings(doc, type, "users.*.role.=*user*"), S({ "user", "user" }));
+  EXPECT_EQ(strings(doc, type, "version.=1.2.*"), S({ "1.2.3" }));
+  EXPECT_TRUE(strings(doc, type, "version.=2.*").empty());
+  EXPECT_TRUE(strings(doc, type, "missing.*").empty());
+  EXPECT_TRUE(strings(doc, type, "count.[0]").empty());
+
+  JQuery *query = jsonQueryCompile("*");
+  unsigned count = 0;
+  JArrayItem *items = jsonQueryAll(query, doc, type, &count);
+  ASSERT_EQ(count, 4u);
+  EXPECT_EQ(items[0].type, VAL_OBJ_ARRAY);
+  EXPECT_EQ(items[3].type, VAL_INT);
+  EXPECT_EQ(items[3].value.int_val, 4);
+  free(items);
+  jsonQueryFree(query);
+
+  jsonFree(doc, type);
+  free(deleteMe);
+}
+
+TEST(JsonQuery, shouldStopWhenTheVisitorSaysSo) {
+  char *deleteMe = NULL;
+  short type = 0;
+  JItemValue doc = jsonParseF(inlineJson(QUERY_DOC, &deleteMe), &type);
+  ASSERT_TRUE(doc.object_val != NULL);
+
+  JQuery *query = jsonQueryCompile("users.*.name");
+  int seen = 0;
+  EXPECT_EQ(jsonQueryRun(query, doc, type, stopAfterTwo, &seen), 2u);
+  EXPECT_EQ(seen, 2);
+  jsonQueryFree(query);
+
+  jsonFree(doc, type);
+  free(deleteMe);
+}
+
+static const char *INDEX_DOC =
+    "{\"dependencies\": {"
+    "  \"a\": {\"dev\": true, \"resolved\": \"r1\", \"size\": 2},"
+    "  \"b\": {\"dev\": false, \"resolved\": \"r2\", \"size\": 2.0},"
+    "  \"c\": {\"dev\": true, \"resolved\": \"r1\", \"size\": 7, \"note\": null}"
+    "}}";
+
+TEST(JsonIndex, shouldLookUpHoldersByValueAndRebuildAfterMutation) {
+  char *deleteMe = NULL;
+  short type = 0;
+  JItemValue doc = jsonParseF(inlineJson(INDEX_DOC, &deleteMe), &type);
+  ASSERT_TRUE(doc.object_val != NULL);
+  JObject *deps = jsonObject(doc.object_val, "dependencies");
+  JObject *a = jsonObject(deps, "a");
+  JObject *b = jsonObject(deps, "b");
+  JObject *c = jsonObject(deps, "c");
+
+  EXPECT_TRUE(jsonBuildIndex(doc, type, "dependencies.*") == NULL);
+  EXPECT_TRUE(jsonBuildIndex(doc, type, "dependencies.*.=r*") == NULL);
+  EXPECT_TRUE(jsonBuildIndex(doc, type, "dependencies.*.d?v") == NULL);
+
+  JIndex *dev = jsonBuildIndex(doc, type, "dependencies.*.dev");
+  ASSERT_TRUE(dev != NULL);
+  EXPECT_EQ(dev->count, 3u);
+  unsigned int count = 0;
+  JObject **found = jsonIndexLookupBool(dev, 1, &count);
+  ASSERT_EQ(count, 2u);
+  EXPECT_EQ(found[0], a);
+  EXPECT_EQ(found[1], c);
+  found = jsonIndexLookupBool(dev, 0, &count);
+  ASSERT_EQ(count, 1u);
+  EXPECT_EQ(found[0], b);
+  EXPECT_TRUE(jsonIndexLookupString(dev, "true", &count) == NULL);
+  EXPECT_EQ(count, 0u);
+
+  JIndex *resolved = jsonBuildIndex(doc, type, "dependencies.*.resolved");
+  found = jsonIndexLookupString(resolved, "r1", &count);
+  ASSERT_EQ(count, 2u);
+  EXPECT_EQ(found[1], c);
+  EXPECT_TRUE(jsonIndexLookupString(resolved, "r3", &count) == NULL);
+
+  // ints and doubles of the same value are one value
+  JIndex *size = jsonBuildIndex(doc, type, "dependencies.*.size");
+  found = jsonIndexLookupDouble(size, 2, &count);
+  ASSERT_EQ(count, 2u);
+  EXPECT_EQ(found[0], a);
+  EXPECT_EQ(found[1], b);
+  found = jsonIndexLookup(size, VAL_INT, (JItemValue) { .int_val = 7 }, &count);
+  ASSERT_EQ(count, 1u);
+  EXPECT_EQ(found[0], c);
+
+  JIndex *note = jsonBuildIndex((JItemValue) { .object_val = c }, VAL_OBJ, "note");
+  found = jsonIndexLookup(note, VAL_NULL, (JItemValue) { 0 }, &count);
+  ASSERT_EQ(count, 1u);
+  EXPECT_EQ(found[0], c);
+  // a pattern nothing matches builds an empty index
+  JIndex *none = jsonBuildIndex(doc, type, "dependencies.*.missing");
+  ASSERT_TRUE(none != NULL);
+  EXPECT_EQ(none->count, 0u);
+  EXPECT_TRUE(jsonIndexLookupBool(none, 1, &count) == NULL);
+  EXPECT_EQ(count, 0u);
+  jsonIndexFree(none);
+  EXPECT_EQ(doc.object_val->_ctx->_indexes, 4u);
+
+  // mutations mark every live index stale, the next lookup rebuilds it
+  jsonAddVal(b, "dev", (JItemValue) { .char_val = 1 }, VAL_BOOL);
+  jsonDeleteKey(a, "dev");
+  found = jsonIndexLookupBool(dev, 1, &count);
+  ASSERT_EQ(count, 2u);
+  EXPECT_EQ(found[0], b);
+  EXPECT_EQ(found[1], c);
+  EXPECT_TRUE(jsonIndexLookupBool(dev, 0, &count) == NULL);
+  EXPECT_EQ(dev->count, 2u);
+
+  jsonIndexFree(dev);
+  jsonIndexFree(resolved);
+  jsonIndexFree(size);
+  jsonIndexFree(note);
+  EXPECT_EQ(doc.object_val->_ctx->_indexes, 0u);
+  jsonFree(doc, type);
+  free(deleteMe);
+}
+
+TEST(JsonIndex, shouldGoStaleWhenDocumentsOfOtherContextsChange) {
+  JsonContext *other = jsonContextNew(NULL);
+  JObject *root = jsonNewObject();
+  JObject *deps = jsonNewObject();
+  jsonAddObj(root, "dependencies", deps);
+  JObject *foreign = jsonContextNewObject(other);
+  jsonAddVal(foreign, "dev", (JItemValue) { .char_val = 1 }, VAL_BOOL);
+  jsonAddObj(deps, "x", foreign);
+  JArray *list = jsonContextNewArray(other);
+  jsonAddVal(root, "list", (JItemValue) { .array_val = list }, VAL_OBJ_ARRAY);
+  JItemValue doc = { .object_val = root };
+
+  JIndex *dev = jsonBuildIndex(doc, VAL_OBJ, "dependencies.*.dev");
+  JIndex *listed = jsonBuildIndex(doc, VAL_OBJ, "list.*.dev");
+  ASSERT_TRUE(dev != NULL && listed != NULL);
+  unsigned int count = 0;
+  JObject **found = jsonIndexLookupBool(dev, 1, &count);
+  ASSERT_EQ(count, 1u);
+  EXPECT_EQ(found[0], foreign);
+  EXPECT_TRUE(jsonIndexLookupBool(listed, 1, &count) == NULL);
+  EXPECT_EQ(other->_indexes, 2u);
+
+  // the holder and the array live in the other context, the root does not see them change
+  jsonAddVal(foreign, "dev", (JItemValue) { .char_val = 0 }, VAL_BOOL);
+  JObject *item = jsonContextNewObject(other);
+  jsonAddVal(item, "dev", (JItemValue) { .char_val = 1 }, VAL_BOOL);
+  jsonAddArrayItemObject(list, item);
+  EXPECT_TRUE(jsonIndexLookupBool(dev, 1, &count) == NULL);
+  found = jsonIndexLookupBool(dev, 0, &count);
+  ASSERT_EQ(count, 1u);
+  EXPECT_EQ(found[0], foreign);
+  found = jsonIndexLookupBool(listed, 1, &count);
+  ASSERT_EQ(count, 1u);
+  EXPECT_EQ(found[0], item);
+
+  jsonIndexFree(dev);
+  jsonIndexFree(listed);
+  EXPECT_EQ(other->_indexes, 0u);
+  EXPECT_EQ(root->_ctx->_indexes, 0u);
+  jsonFree(doc, VAL_OBJ);
+  jsonContextFree(other);
+}
+
+TEST(JsonCursor, shouldStreamMatchesEntriesAndItems) {
+  char *deleteMe = NULL;
+  short type = 0;
+  JItemValue doc = jsonParseF(inlineJson(QUERY_DOC, &deleteMe), &type);
+  ASSERT_TRUE(doc.object_val != NULL);
+  JCursor cursor;
+  JItemValue value;
+  short valueType = 0;
+
+  std::vector<std::string> keys;
+  jsonCursorEntries(&cursor, doc.object_val);
+  while (jsonCursorNext(&cursor, &value, &valueType)) {
+    keys.push_back(cursor.key);
+  }
+  EXPECT_EQ(keys, std::vector<std::string>({ "users", "version", "vendor", "count" }));
+  EXPECT_TRUE(cursor.key == NULL);
+  EXPECT_FALSE(jsonCursorNext(&cursor, &value, &valueType));
+
+  JArray *users = jsonArray(doc.object_val, "users");
+  jsonCursorItems(&cursor, users);
+  unsigned int items = 0;
+  while (jsonCursorNext(&cursor, &value, &valueType)) {
+    EXPECT_EQ(valueType, VAL_OBJ);
+    EXPECT_TRUE(cursor.key == NULL);
+    ++items;
+  }
+  EXPECT_EQ(items, 4u);
+
+  // every step type, the key of a match is the entry it came from
+  JQuery *query = jsonQueryCompile("users.[0-2].t*.[1,0].=?");
+  ASSERT_TRUE(jsonCursorQuery(&cursor, query, doc, type));
+  std::vector<std::string> found;
+  while (jsonCursorNext(&cursor, &value, &valueType)) {
+    ASSERT_EQ(valueType, VAL_STRING);
+    found.push_back(value.string_val);
+  }
+  EXPECT_EQ(found, std::vector<std::string>({ "b", "a", "c" }));
+  jsonQueryFree(query);
+
+  query = jsonQueryCompile("v*.=*");
+  ASSERT_TRUE(jsonCursorQuery(&cursor, query, doc, type));
+  ASSERT_TRUE(jsonCursorNext(&cursor, &value, &valueType));
+  EXPECT_STREQ(cursor.key, "version");
+  ASSERT_TRUE(jsonCursorNext(&cursor, &value, &valueType));
+  EXPECT_STREQ(cursor.key, "vendor");
+  EXPECT_STREQ(value.string_val, "nicson");
+  EXPECT_FALSE(jsonCursorNext(&cursor, &value, &valueType));
+  jsonQueryFree(query);
+
+  std::string deep = "a";
+  for (int i = 0; i < JSON_CURSOR_DEPTH; ++i) {
+    deep += ".a";
+  }
+  query = jsonQueryCompile(deep.c_str());
+  EXPECT_FALSE(jsonCursorQuery(&cursor, query, doc, type));
+  EXPECT_FALSE(jsonCursorNext(&cursor, &value, &valueType));
+  jsonQueryFree(query);
+
+  jsonFree(doc, type);
+  free(deleteMe);
+}
+
+TEST(JsonQuery, shouldCollectTheSameMatchesInParallel) {
+  JObject *doc = jsonNewObject();
+  char name[32];
+  for (int k = 0; k < 200; ++k) {
+    JArray *items = jsonNewArray();
+    for (int i = 0; i < 40; ++i) {
+      JObject *item = jsonNewObject();
+      jsonAddInt(item, "v", k * 100 + i);
+      jsonArrayPushObject(items, item);
+    }
+    JObject *entry = jsonNewObject();
+    jsonAddVal(entry, "items", (JItemValue) { .array_val = items }, VAL_OBJ_ARRAY);
+    sprintf(name, "k%d", k);
+    jsonAddObj(doc, getOrCacheString(name), entry);
+  }
+  JItemValue root = { .object_val = doc };
+  JPool *pool = jsonPoolNew(4);
+
+  const char *exprs[] = { "*.items.*.v", "k1*.items.[3-30].v", "*.items.[38-90].*", "k7.items.[1,2].v", "*.missing.*" };
+  for (const char *expr : exprs) {
+    JQuery *query = jsonQueryCompile(expr);
+    unsigned expected = 0, found = 0;
+    JArrayItem *serial = jsonQueryAll(query, root, VAL_OBJ, &expected);
+    JArrayItem *parallel = jsonQueryAllParallel(query, root, VAL_OBJ, pool, &found);
+    ASSERT_EQ(found, expected) << expr;
+    for (unsigned i = 0; i < found; ++i) {
+      ASSERT_EQ(parallel[i].type, serial[i].type) << expr;
+      ASSERT_EQ(parallel[i].value.int_val, serial[i].value.int_val) << expr << " " << i;
+    }
+    free(serial);
+    free(parallel);
+    jsonQueryFree(query);
+  }
+  unsigned found = 0;
+  JQuery *query = jsonQueryCompile("*.items.*.v");
+  free(jsonQueryAllParallel(query, root, VAL_OBJ, pool, &found));
+  EXPECT_EQ(found, 8000u);
+  jsonQueryFree(query);
+
+  jsonPoolFree(pool);
+  jsonFree(root, VAL_OBJ);
+}